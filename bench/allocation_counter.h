@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+namespace bench {
+
+// Number of global operator new calls made by this process so far.
+std::size_t allocation_count();
+
+}  // namespace bench
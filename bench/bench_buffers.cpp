@@ -0,0 +1,41 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "allocation_counter.h"
+#include "block_pool.h"
+
+namespace {
+// The life of a downloaded block: received into a pooled buffer, shared
+// with the hasher and the disk cache, and given back once written. A window
+// of blocks is in flight at once, as across the pieces being downloaded.
+void BM_block_pool(benchmark::State& state) {
+    constexpr std::size_t window = 1024;
+    auto pool = buffers::block_pool{64 << 20, 1};
+    auto in_flight = std::array<buffers::block_ref, window>{};
+    for (auto& block : in_flight) {
+        block = pool.allocate();
+    }
+
+    const auto before = bench::allocation_count();
+    std::size_t next = 0;
+    for (auto _ : state) {
+        auto block = pool.allocate();
+        std::memcpy(block.data(), &next, sizeof(next));
+        auto hashing = block;
+        in_flight[next++ % window] = std::move(block);
+        benchmark::DoNotOptimize(hashing.data());
+    }
+    state.counters["allocs_per_block"] = benchmark::Counter(
+        static_cast<double>(bench::allocation_count() - before),
+        benchmark::Counter::kAvgIterations);
+    state.counters["high_water"] =
+        static_cast<double>(pool.stats().high_water);
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+}  // namespace
+
+BENCHMARK(BM_block_pool);
@@ -0,0 +1,98 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "generator.h"
+#include "metadata_cache.h"
+#include "torrent.h"
+
+namespace {
+const auto cache_directory =
+    std::filesystem::temp_directory_path() / "rush_bench_cache";
+
+bench::torrent_spec library_spec() {
+    auto spec = bench::torrent_spec{};
+    spec.piece_count = 256;
+    spec.file_count = 8;
+    spec.path_depth = 2;
+    spec.announce_tiers = 2;
+    spec.trackers_per_tier = 2;
+    return spec;
+}
+
+// A cache of count copies of one torrent under distinct paths, as left
+// behind by a previous run over a library of that size.
+std::filesystem::path write_library_cache(std::size_t count) {
+    const auto path =
+        cache_directory / fmt::format("library-{}.cache", count);
+    if (std::filesystem::exists(path)) {
+        return path;
+    }
+
+    const auto t = torrent::from_bytes(bench::generate_torrent(library_spec()));
+    auto writer = cache::cache_writer{};
+    for (std::size_t i = 0; i < count; i++) {
+        writer.add({fmt::format("/library/{:06}.torrent", i), 0, 0, {}},
+                   t.value());
+    }
+    std::filesystem::create_directories(cache_directory);
+    writer.write(path);
+    return path;
+}
+
+// Opens the cache and reads the summary of every entry, which is what a
+// start-up listing needs.
+void BM_cache_startup(benchmark::State& state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    const auto path = write_library_cache(count);
+    for (auto _ : state) {
+        const auto cache = cache::metadata_cache::open(path);
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < cache->size(); i++) {
+            const auto entry = (*cache)[i];
+            total += entry.total_size() + entry.name().size();
+            benchmark::DoNotOptimize(entry.info_hash());
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * count));
+}
+
+// A refresh where nothing changed: one stat per file, no reads.
+void BM_cache_refresh(benchmark::State& state) {
+    const auto count = static_cast<std::size_t>(state.range(0));
+    const auto directory = cache_directory / fmt::format("files-{}", count);
+    std::filesystem::create_directories(directory);
+
+    auto torrents = std::vector<std::filesystem::path>{};
+    for (std::size_t i = 0; i < count; i++) {
+        auto spec = library_spec();
+        spec.seed = i + 1;
+        torrents.push_back(bench::write_torrent(spec, directory));
+    }
+
+    const auto path = directory / "meta.cache";
+    cache::refresh(path, torrents);
+    for (auto _ : state) {
+        auto stats = cache::refresh(path, torrents);
+        benchmark::DoNotOptimize(stats);
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * count));
+}
+}  // namespace
+
+BENCHMARK(BM_cache_startup)
+    ->ArgName("torrents")
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_cache_refresh)
+    ->ArgName("torrents")
+    ->Arg(1000)
+    ->Unit(benchmark::kMillisecond);
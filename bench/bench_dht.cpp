@@ -0,0 +1,82 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "node.h"
+#include "node_id.h"
+
+namespace {
+using boost::asio::ip::udp;
+
+constexpr std::size_t swarm_size = 1000;
+
+void run(boost::asio::io_context& ctx, boost::asio::awaitable<void> body) {
+    ctx.restart();
+    boost::asio::co_spawn(ctx, std::move(body),
+                          [&](std::exception_ptr) { ctx.stop(); });
+    ctx.run();
+}
+
+// A thousand nodes on loopback, each bootstrapped from the first, built once
+// for every run.
+struct swarm {
+    swarm() {
+        const auto localhost = boost::asio::ip::make_address_v4("127.0.0.1");
+        auto random = std::mt19937_64{11};
+        for (std::size_t i = 0; i < swarm_size; i++) {
+            nodes.push_back(std::make_unique<dht::node>(
+                ctx.get_executor(), udp::endpoint{localhost, 0},
+                dht::random_id(random),
+                dht::node_options{.rate_limit = 0}));
+        }
+        run(ctx, [this]() -> boost::asio::awaitable<void> {
+            const auto first = std::array{nodes[0]->local_endpoint()};
+            for (std::size_t i = 1; i < nodes.size(); i++) {
+                co_await nodes[i]->bootstrap(first);
+            }
+        }());
+    }
+
+    boost::asio::io_context ctx;
+    std::vector<std::unique_ptr<dht::node>> nodes;
+};
+
+// get_peers lookups for random info-hashes from random nodes of a settled
+// swarm. Reports the hops and packets a lookup takes, which is what bounds
+// its latency on a real network.
+void BM_dht_lookup(benchmark::State& state) {
+    static auto s = swarm{};
+    auto random = std::mt19937_64{state.range(0)};
+    std::size_t hops = 0;
+    std::size_t queries = 0;
+    auto peers = std::vector<boost::asio::ip::tcp::endpoint>{};
+    for (auto _ : state) {
+        auto& from = *s.nodes[random() % s.nodes.size()];
+        const auto info_hash = dht::random_id(random);
+        run(s.ctx, [&]() -> boost::asio::awaitable<void> {
+            const auto result = co_await from.get_peers(info_hash, peers);
+            hops += result.hops;
+            queries += result.queries;
+        }());
+    }
+    state.counters["hops"] = benchmark::Counter(
+        static_cast<double>(hops), benchmark::Counter::kAvgIterations);
+    state.counters["packets"] = benchmark::Counter(
+        static_cast<double>(2 * queries), benchmark::Counter::kAvgIterations);
+}
+}  // namespace
+
+BENCHMARK(BM_dht_lookup)->Arg(1)->Unit(benchmark::kMicrosecond);
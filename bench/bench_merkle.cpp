@@ -0,0 +1,192 @@
+#include <benchmark/benchmark.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "merkle.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace {
+constexpr std::size_t block_size = torrent::merkle_block_size;
+constexpr std::size_t piece_count = 16;
+
+// A file of piece_count pieces with everything needed to check it both
+// ways: SHA-1 piece hashes, and the v2 piece layer and block hashes.
+struct sample {
+    explicit sample(std::size_t piece_length)
+        : piece_length{piece_length},
+          content(piece_count * piece_length, '\0') {
+        for (std::size_t i = 0; i < content.size(); i++) {
+            content[i] = static_cast<char>(i * 31 + i / 4099);
+        }
+        const auto blocks = piece_length / block_size;
+        auto layer = std::string{};
+        for (std::size_t p = 0; p < piece_count; p++) {
+            v1.push_back(crypto::sha1(piece(p)));
+            for (std::size_t b = 0; b < blocks; b++) {
+                leaves.push_back(crypto::sha256(block(p, b)));
+            }
+            const auto hash = torrent::merkle_root(
+                std::span{leaves}.subspan(p * blocks, blocks), blocks);
+            layer.append(reinterpret_cast<const char*>(hash.data()),
+                         hash.size());
+            pieces.push_back(hash);
+        }
+        file.length = static_cast<bencode::integer>(content.size());
+        file.pieces_root =
+            torrent::merkle_root(pieces, std::bit_ceil(piece_count),
+                                 static_cast<std::size_t>(
+                                     std::countr_zero(blocks)));
+        piece_layer = layer;
+    }
+
+    std::string_view piece(std::size_t p) const {
+        return std::string_view{content}.substr(p * piece_length,
+                                                piece_length);
+    }
+    std::string_view block(std::size_t p, std::size_t b) const {
+        return piece(p).substr(b * block_size, block_size);
+    }
+    std::span<const crypto::sha256_digest> block_hashes(std::size_t p) const {
+        const auto blocks = piece_length / block_size;
+        return std::span{leaves}.subspan(p * blocks, blocks);
+    }
+    torrent::merkle_verifier verifier() const {
+        return torrent::merkle_verifier::build(
+                   file, static_cast<bencode::integer>(piece_length),
+                   piece_layer)
+            .value();
+    }
+
+    std::size_t piece_length;
+    std::string content;
+    std::vector<crypto::sha1_digest> v1;
+    std::vector<crypto::sha256_digest> leaves;
+    std::vector<crypto::sha256_digest> pieces;
+    torrent::v2::file file;
+    std::string piece_layer;
+};
+
+// v1: the blocks of a piece are hashed into one SHA-1 as they come, and the
+// piece is checked at the end.
+bool feed_v1(const sample& s, crypto::sha1_hasher& hasher, std::size_t p,
+             std::string_view corrupt_block, std::size_t corrupt) {
+    for (std::size_t b = 0; b < s.piece_length / block_size; b++) {
+        hasher.update(b == corrupt ? corrupt_block : s.block(p, b));
+    }
+    return hasher.finish() == s.v1[p];
+}
+
+void BM_verify_v1(benchmark::State& state) {
+    const auto s = sample{static_cast<std::size_t>(state.range(0))};
+    auto hasher = crypto::sha1_hasher{};
+    std::size_t p = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(feed_v1(s, hasher, p, {}, SIZE_MAX));
+        p = (p + 1) % piece_count;
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * s.piece_length));
+}
+
+// v2: every block is hashed on arrival and the piece's subtree is built
+// over them when the last one is in. With block hashes from a peer, each
+// block is compared on its own instead.
+void BM_verify_v2(benchmark::State& state) {
+    const auto s = sample{static_cast<std::size_t>(state.range(0))};
+    const bool with_hashes = state.range(1) != 0;
+    auto verifier = s.verifier();
+    std::size_t p = 0;
+    for (auto _ : state) {
+        if (with_hashes) {
+            verifier.set_block_hashes(p, s.block_hashes(p));
+        }
+        for (std::size_t b = 0; b < s.piece_length / block_size; b++) {
+            benchmark::DoNotOptimize(verifier.add_block(p, b, s.block(p, b)));
+        }
+        p = (p + 1) % piece_count;
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * s.piece_length));
+}
+
+// One block of every piece arrives corrupt. wasted counts the bytes that
+// have to be fetched again before the piece passes: the whole piece for v1
+// and for v2 without block hashes, only the block for v2 with them.
+void BM_corrupt_v1(benchmark::State& state) {
+    const auto s = sample{static_cast<std::size_t>(state.range(0))};
+    auto corrupt = std::string{s.block(0, 0)};
+    corrupt[0] ^= 1;
+    auto hasher = crypto::sha1_hasher{};
+    std::uint64_t wasted = 0;
+    std::size_t p = 0;
+    for (auto _ : state) {
+        if (!feed_v1(s, hasher, p, corrupt, 0)) {
+            wasted += s.piece_length;
+            benchmark::DoNotOptimize(feed_v1(s, hasher, p, {}, SIZE_MAX));
+        }
+        p = (p + 1) % piece_count;
+    }
+    state.counters["wasted"] = benchmark::Counter(
+        static_cast<double>(wasted), benchmark::Counter::kAvgIterations);
+}
+
+void BM_corrupt_v2(benchmark::State& state) {
+    using verdict = torrent::merkle_verifier::verdict;
+    const auto s = sample{static_cast<std::size_t>(state.range(0))};
+    const bool with_hashes = state.range(1) != 0;
+    const auto blocks = s.piece_length / block_size;
+    auto verifier = s.verifier();
+    std::uint64_t wasted = 0;
+    std::size_t p = 0;
+    for (auto _ : state) {
+        if (with_hashes) {
+            verifier.set_block_hashes(p, s.block_hashes(p));
+        }
+        auto corrupt = std::string{s.block(p, 0)};
+        corrupt[0] ^= 1;
+        auto result = verifier.add_block(p, 0, corrupt);
+        for (std::size_t b = 1; b < blocks; b++) {
+            result = verifier.add_block(p, b, s.block(p, b));
+        }
+        if (result == verdict::piece_failed) {
+            for (std::size_t b = 0; b < blocks; b++) {
+                verifier.add_block(p, b, s.block(p, b));
+            }
+            wasted += s.piece_length;
+        } else {
+            // The corrupt block failed on arrival.
+            verifier.add_block(p, 0, s.block(p, 0));
+            wasted += block_size;
+        }
+        p = (p + 1) % piece_count;
+    }
+    state.counters["wasted"] = benchmark::Counter(
+        static_cast<double>(wasted), benchmark::Counter::kAvgIterations);
+}
+}  // namespace
+
+BENCHMARK(BM_verify_v1)
+    ->ArgName("piece")
+    ->Arg(256 << 10)
+    ->Arg(4 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_verify_v2)
+    ->ArgNames({"piece", "hashes"})
+    ->ArgsProduct({{256 << 10, 4 << 20}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_corrupt_v1)
+    ->ArgName("piece")
+    ->Arg(256 << 10)
+    ->Arg(4 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_corrupt_v2)
+    ->ArgNames({"piece", "hashes"})
+    ->ArgsProduct({{256 << 10, 4 << 20}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,98 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder.h"
+#include "engine.h"
+#include "exchange.h"
+#include "extension.h"
+#include "fetcher.h"
+#include "message.h"
+#include "sha.h"
+
+namespace {
+using boost::asio::ip::tcp;
+
+// About a megabyte of info dictionary: 64 metadata pieces.
+constexpr std::size_t files = 20000;
+
+std::string make_info() {
+    auto info = std::string{};
+    auto e = bencode::encoder{std::back_inserter(info)};
+    e.begin_dict().string("files").begin_list();
+    for (std::size_t i = 0; i < files; i++) {
+        e.begin_dict()
+            .string("length")
+            .integer(static_cast<bencode::integer>(1 << 20))
+            .string("path")
+            .begin_list()
+            .string("directory")
+            .string("file" + std::to_string(i) + ".dat")
+            .end()
+            .end();
+    }
+    e.end();
+    e.string("name").string("content");
+    e.string("piece length").integer(1 << 20);
+    e.string("pieces").string(std::string(20 * files, 'x'));
+    e.end();
+    return info;
+}
+
+// Time to metadata from a magnet link's point of view: connect to the
+// seeders on loopback, exchange extension handshakes and pull every piece
+// of the info dictionary, spread over however many seeders there are.
+void BM_metadata_fetch(benchmark::State& state) {
+    static const auto info = std::make_shared<const std::string>(make_info());
+    const auto seeders = static_cast<std::size_t>(state.range(0));
+
+    auto local = wire::handshake{};
+    local.info_hash = crypto::sha1(*info);
+    metadata::enable_extensions(local);
+
+    auto server = session::engine{{.threads = 2}};
+    auto endpoints = std::vector<tcp::endpoint>{};
+    for (std::size_t i = 0; i < seeders; i++) {
+        endpoints.push_back(
+            server.listen({boost::asio::ip::make_address("127.0.0.1"), 0},
+                          metadata::serve(info, local)));
+    }
+    auto client = session::engine{{.threads = 2}};
+
+    for (auto _ : state) {
+        auto done = std::atomic<bool>{false};
+        const auto f = std::make_shared<metadata::fetcher>(
+            local.info_hash, [&] {
+                done = true;
+                done.notify_one();
+            });
+        const auto handler = metadata::fetch(f, local);
+        for (const auto& endpoint : endpoints) {
+            client.connect(endpoint, local, handler);
+        }
+        done.wait(false);
+        // Let the connections wind down before the next fetch begins.
+        while (client.connections() > 0) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * info->size()));
+}
+}  // namespace
+
+BENCHMARK(BM_metadata_fetch)
+    ->ArgName("seeders")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
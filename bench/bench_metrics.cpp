@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "generator.h"
+#include "metrics.h"
+#include "tape.h"
+
+namespace {
+void BM_counter_add(benchmark::State& state) {
+    static auto counter = metrics::counter{};
+    for (auto _ : state) {
+        counter.add();
+    }
+    benchmark::DoNotOptimize(counter.value());
+}
+BENCHMARK(BM_counter_add)->ThreadRange(1, 16)->UseRealTime();
+
+void BM_histogram_record(benchmark::State& state) {
+    static auto histogram = metrics::histogram{};
+    std::uint64_t value = 1;
+    for (auto _ : state) {
+        histogram.record(value);
+        value = value * 7 % 1000003;
+    }
+}
+BENCHMARK(BM_histogram_record)->ThreadRange(1, 16)->UseRealTime();
+
+void BM_scoped_timer(benchmark::State& state) {
+    static auto histogram = metrics::histogram{};
+    for (auto _ : state) {
+        const auto timer = metrics::scoped_timer{histogram};
+    }
+}
+BENCHMARK(BM_scoped_timer);
+
+// Parsing a small torrent, where a per-document cost shows the most, with
+// parse timing on (1) and off (0).
+void BM_parse_tape_metrics(benchmark::State& state) {
+    auto spec = bench::torrent_spec{};
+    spec.piece_count = 64;
+    const auto input = bench::generate_torrent(spec);
+
+    metrics::set_enabled(state.range(0) != 0);
+    for (auto _ : state) {
+        auto tape = bencode::parse_tape(input);
+        benchmark::DoNotOptimize(tape);
+    }
+    metrics::set_enabled(true);
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * input.size()));
+}
+BENCHMARK(BM_parse_tape_metrics)->Arg(0)->Arg(1);
+}  // namespace
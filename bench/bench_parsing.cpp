@@ -0,0 +1,204 @@
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <variant>
+
+#include "allocation_counter.h"
+#include "bencode.h"
+#include "decoder.h"
+#include "document.h"
+#include "generator.h"
+#include "json.h"
+#include "layout.h"
+#include "tape.h"
+#include "torrent.h"
+
+namespace {
+const auto corpus_directory =
+    std::filesystem::temp_directory_path() / "rush_bench";
+
+bench::torrent_spec spec_from(const benchmark::State& state) {
+    auto spec = bench::torrent_spec{};
+    spec.piece_count = static_cast<std::size_t>(state.range(0));
+    spec.file_count = static_cast<std::size_t>(state.range(1));
+    spec.path_depth = 3;
+    spec.announce_tiers = 4;
+    spec.trackers_per_tier = 2;
+    return spec;
+}
+
+std::string read_file(const std::filesystem::path& path) {
+    auto file = std::ifstream{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file},
+            std::istreambuf_iterator<char>{}};
+}
+
+// Reports input throughput and the number of allocations each iteration
+// made on average.
+class document_counters {
+   public:
+    document_counters(benchmark::State& state, std::size_t bytes)
+        : state_{state}, bytes_{bytes}, before_{bench::allocation_count()} {}
+
+    ~document_counters() {
+        const auto allocations = bench::allocation_count() - before_;
+        state_.SetBytesProcessed(
+            static_cast<std::int64_t>(state_.iterations() * bytes_));
+        state_.counters["allocs_per_doc"] = benchmark::Counter(
+            static_cast<double>(allocations),
+            benchmark::Counter::kAvgIterations);
+    }
+
+   private:
+    benchmark::State& state_;
+    std::size_t bytes_;
+    std::size_t before_;
+};
+
+void corpus(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"pieces", "files"});
+    b->Args({1 << 10, 1});
+    b->Args({1 << 14, 1});
+    b->Args({1 << 17, 1});
+    b->Args({1 << 20, 1});
+    b->Args({1 << 10, 1000});
+    b->Args({1 << 12, 100000});
+    b->Unit(benchmark::kMicrosecond);
+}
+
+template <bencode::backend Backend>
+void BM_parse(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto counters =
+        document_counters{state, std::filesystem::file_size(path)};
+    for (auto _ : state) {
+        auto result = bencode::parse(path, Backend);
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+template <bencode::backend Backend>
+void BM_parse_literal(benchmark::State& state) {
+    const auto input = bench::generate_torrent(spec_from(state));
+    const auto counters = document_counters{state, input.size()};
+    for (auto _ : state) {
+        auto result = bencode::parse_literal(input, Backend);
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+void BM_load_document(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto counters =
+        document_counters{state, std::filesystem::file_size(path)};
+    for (auto _ : state) {
+        auto result = bencode::load_document(path);
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+void BM_load_tape(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto counters =
+        document_counters{state, std::filesystem::file_size(path)};
+    for (auto _ : state) {
+        auto result = bencode::load_tape(path);
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+// A decoder stepping over the whole document: the floor for decoding a
+// torrent in one pass, before anything is kept.
+void BM_decoder_skip(benchmark::State& state) {
+    const auto input = bench::generate_torrent(spec_from(state));
+    const auto counters = document_counters{state, input.size()};
+    for (auto _ : state) {
+        auto d = bencode::decoder{input};
+        benchmark::DoNotOptimize(d.skip());
+    }
+}
+
+void BM_from_file(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto counters =
+        document_counters{state, std::filesystem::file_size(path)};
+    for (auto _ : state) {
+        auto result = torrent::from_file(path);
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+void BM_build_layout(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto parsed = torrent::from_file(path).value();
+    const auto& info = std::get<torrent::multi_file_info>(parsed.info);
+    for (auto _ : state) {
+        auto layout = torrent::file_layout::build(info);
+        benchmark::DoNotOptimize(layout);
+    }
+    state.counters["files"] = static_cast<double>(info.files.size());
+}
+
+// Output iterator that only counts the bytes written through it.
+struct counting_iterator {
+    using iterator_category = std::output_iterator_tag;
+    using value_type = void;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = void;
+
+    counting_iterator& operator*() { return *this; }
+    counting_iterator& operator=(char) {
+        ++*count;
+        return *this;
+    }
+    counting_iterator& operator++() { return *this; }
+    counting_iterator operator++(int) { return *this; }
+
+    std::size_t* count;
+};
+
+void BM_write_json(benchmark::State& state) {
+    const auto path = bench::write_torrent(spec_from(state), corpus_directory);
+    const auto counters =
+        document_counters{state, std::filesystem::file_size(path)};
+    std::size_t written = 0;
+    for (auto _ : state) {
+        auto file = std::ifstream{path, std::ios::binary};
+        auto result = bencode::write_json(file, counting_iterator{&written});
+        benchmark::DoNotOptimize(result);
+    }
+}
+
+void BM_format(benchmark::State& state) {
+    const auto input = bench::generate_torrent(spec_from(state));
+    const auto value =
+        bencode::parse_literal(input, bencode::backend::fast).value();
+    const auto counters = document_counters{state, input.size()};
+    for (auto _ : state) {
+        auto result = fmt::format("{}", value);
+        benchmark::DoNotOptimize(result);
+    }
+}
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_parse, bencode::backend::lexy)->Apply(corpus);
+BENCHMARK_TEMPLATE(BM_parse, bencode::backend::fast)->Apply(corpus);
+BENCHMARK_TEMPLATE(BM_parse_literal, bencode::backend::lexy)->Apply(corpus);
+BENCHMARK_TEMPLATE(BM_parse_literal, bencode::backend::fast)->Apply(corpus);
+BENCHMARK(BM_load_document)->Apply(corpus);
+BENCHMARK(BM_load_tape)->Apply(corpus);
+BENCHMARK(BM_decoder_skip)->Apply(corpus);
+BENCHMARK(BM_from_file)->Apply(corpus);
+BENCHMARK(BM_build_layout)
+    ->ArgNames({"pieces", "files"})
+    ->Args({1 << 12, 1000})
+    ->Args({1 << 14, 200000})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_write_json)->Apply(corpus);
+BENCHMARK(BM_format)->Apply(corpus);
@@ -0,0 +1,116 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "piece_picker.h"
+#include "piece_set.h"
+
+namespace {
+constexpr std::size_t pieces = 1 << 20;
+constexpr std::size_t peer_count = 500;
+constexpr std::uint32_t blocks_per_piece = 16;
+
+// A swarm of seeds and leechers holding about a quarter, half or three
+// quarters of the torrent each.
+const std::vector<picker::piece_set>& swarm() {
+    static const auto peers = [] {
+        auto random = std::mt19937_64{7};
+        auto result = std::vector<picker::piece_set>{};
+        for (std::size_t i = 0; i < peer_count; i++) {
+            auto peer = picker::piece_set{pieces};
+            if (i % 5 == 0) {
+                peer.fill();
+            } else {
+                for (std::size_t p = 0; p < pieces; p += 64) {
+                    auto word = random();
+                    if (i % 5 == 1) {
+                        word &= random();
+                    } else if (i % 5 == 2) {
+                        word |= random();
+                    }
+                    for (std::size_t bit = 0; bit < 64; bit++) {
+                        if ((word >> bit & 1) != 0) {
+                            peer.set(p + bit);
+                        }
+                    }
+                }
+            }
+            result.push_back(std::move(peer));
+        }
+        return result;
+    }();
+    return peers;
+}
+
+picker::piece_picker make_picker() {
+    auto p = picker::piece_picker{pieces, blocks_per_piece, blocks_per_piece};
+    for (const auto& peer : swarm()) {
+        p.add_peer(peer);
+    }
+    return p;
+}
+
+// Latency of one pick of a piece's worth of blocks, peers taking turns.
+// Blocks are downloaded and the piece passed between picks, outside the
+// timing, so the picker moves through the whole torrent.
+void BM_pick(benchmark::State& state) {
+    const auto& peers = swarm();
+    const auto initial = make_picker();
+    auto p = initial;
+    auto out = std::array<picker::block, blocks_per_piece>{};
+    std::size_t turn = 0;
+
+    for (auto _ : state) {
+        const auto& peer = peers[turn++ % peers.size()];
+        const auto start = std::chrono::steady_clock::now();
+        const auto n = p.pick(peer, out);
+        const auto stop = std::chrono::steady_clock::now();
+        state.SetIterationTime(
+            std::chrono::duration<double>(stop - start).count());
+
+        for (std::size_t i = 0; i < n; i++) {
+            if (p.finished(out[i])) {
+                p.passed(out[i].piece);
+            }
+        }
+        if (p.complete()) {
+            p = initial;
+        }
+    }
+}
+
+// A peer joining with its bitfield and then leaving.
+void BM_bitfield(benchmark::State& state) {
+    const auto& peers = swarm();
+    auto p = make_picker();
+    std::size_t turn = 0;
+    for (auto _ : state) {
+        const auto& peer = peers[1 + turn++ % 4];
+        p.add_peer(peer);
+        p.remove_peer(peer);
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * pieces));
+}
+
+// Deciding whether to be interested in a peer that has nothing new.
+void BM_interesting(benchmark::State& state) {
+    auto have = picker::piece_set{pieces};
+    have.fill();
+    const auto& peer = swarm()[1];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(picker::any_missing(peer, have));
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * pieces / 8));
+}
+}  // namespace
+
+BENCHMARK(BM_pick)->UseManualTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_bitfield)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_interesting)->Unit(benchmark::kMicrosecond);
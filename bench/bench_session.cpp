@@ -0,0 +1,108 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "engine.h"
+#include "message.h"
+#include "peer_connection.h"
+
+namespace {
+constexpr std::uint32_t block_size = 16384;
+constexpr std::uint32_t piece_blocks = 64;
+// Moved per iteration, however many connections it is spread over.
+constexpr std::size_t total_blocks = 16384;
+
+wire::handshake make_handshake() {
+    auto h = wire::handshake{};
+    h.info_hash.fill(std::byte{1});
+    return h;
+}
+
+session::peer_handler seeder(std::string_view content) {
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [](session::peer_connection&,
+                              const wire::handshake& remote) {
+        return std::optional{remote};
+    };
+    handler.on_message = [content](session::peer_connection& peer,
+                                   const wire::message& m) {
+        if (const auto* r = std::get_if<wire::request>(&m)) {
+            peer.send(wire::piece{
+                r->index, r->begin,
+                content.substr(r->index * block_size, r->length)});
+        }
+    };
+    return handler;
+}
+
+session::peer_handler leecher(std::uint32_t blocks,
+                              std::atomic<std::size_t>& closed) {
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [blocks](session::peer_connection& peer,
+                                    const wire::handshake& remote) {
+        peer.send(wire::interested{});
+        for (std::uint32_t b = 0; b < blocks; b++) {
+            peer.send(wire::request{b % piece_blocks, 0, block_size});
+        }
+        return std::optional{remote};
+    };
+    handler.on_message = [blocks, received = std::uint32_t{0}](
+                             session::peer_connection& peer,
+                             const wire::message& m) mutable {
+        if (std::holds_alternative<wire::piece>(m) && ++received == blocks) {
+            peer.close();
+        }
+    };
+    handler.on_close = [&closed](session::peer_connection&) {
+        closed.fetch_add(1);
+        closed.notify_one();
+    };
+    return handler;
+}
+
+// Both ends in one process over loopback, each engine with the same number
+// of threads. Every iteration opens the connections, downloads the blocks
+// through them and closes them again.
+void BM_loopback(benchmark::State& state) {
+    static const auto content =
+        std::string(std::size_t{piece_blocks} * block_size, 'x');
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    const auto peers = static_cast<std::size_t>(state.range(1));
+    const auto blocks = static_cast<std::uint32_t>(
+        std::max<std::size_t>(total_blocks / peers, 1));
+
+    const auto options = session::engine_options{
+        .threads = threads, .max_connections = 2 * peers + 64};
+    auto server = session::engine{options};
+    auto client = session::engine{options};
+    const auto endpoint = server.listen(
+        {boost::asio::ip::make_address("127.0.0.1"), 0}, seeder(content));
+
+    for (auto _ : state) {
+        auto closed = std::atomic<std::size_t>{0};
+        for (std::size_t i = 0; i < peers; i++) {
+            client.connect(endpoint, make_handshake(), leecher(blocks, closed));
+        }
+        for (auto n = closed.load(); n < peers; n = closed.load()) {
+            closed.wait(n);
+        }
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(
+        state.iterations() * peers * blocks * block_size));
+}
+}  // namespace
+
+BENCHMARK(BM_loopback)
+    ->ArgNames({"threads", "peers"})
+    ->ArgsProduct({{1, 2, 4, 8}, {64, 5000}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,398 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "block_pool.h"
+#include "create.h"
+#include "disk_io.h"
+#include "engine.h"
+#include "layout.h"
+#include "message.h"
+#include "peer_connection.h"
+#include "resume.h"
+#include "sha.h"
+#include "thread_pool.h"
+#include "torrent.h"
+#include "verify.h"
+
+namespace {
+constexpr std::size_t content_size = 256 << 20;
+constexpr std::size_t piece_length = 256 << 10;
+constexpr std::size_t file_count = 16;
+
+// 256 MiB split over 16 files whose sizes do not line up with the pieces.
+torrent::multi_file_info make_content(const std::filesystem::path& root) {
+    auto info = torrent::multi_file_info{};
+    info.piece_length = piece_length;
+    info.name = "content";
+
+    auto data = std::string(content_size, '\0');
+    auto state = std::uint64_t{0x9e3779b97f4a7c15};
+    for (auto& c : data) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        c = static_cast<char>(state);
+    }
+
+    for (std::size_t i = 0; i < data.size(); i += piece_length) {
+        const auto digest = crypto::sha1(
+            std::string_view{data}.substr(i, piece_length));
+        info.pieces.append(reinterpret_cast<const char*>(digest.data()),
+                           digest.size());
+    }
+
+    std::filesystem::create_directories(root / info.name);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < file_count; i++) {
+        const auto length = i + 1 == file_count
+                                ? content_size - offset
+                                : content_size / file_count + 12345;
+        const auto name = "file" + std::to_string(i);
+        auto file = std::ofstream{root / info.name / name, std::ios::binary};
+        file.write(data.data() + offset, static_cast<std::streamsize>(length));
+        info.files.push_back(
+            {static_cast<bencode::integer>(length), "", name, ""});
+        offset += length;
+    }
+    return info;
+}
+
+void BM_verify(benchmark::State& state) {
+    static const auto root =
+        std::filesystem::temp_directory_path() / "rush_bench_verify";
+    static const auto info = make_content(root);
+
+    auto pool = concurrency::thread_pool{
+        static_cast<std::size_t>(state.range(0))};
+    for (auto _ : state) {
+        auto result = storage::verify(info, root, pool);
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * content_size));
+}
+
+// Blocks of the same content arriving in random order, as from a swarm,
+// with the writer backing off whenever the cache is full. Reports the
+// sustained write rate with and without io_uring.
+void BM_disk_write(benchmark::State& state) {
+    static const auto source =
+        std::filesystem::temp_directory_path() / "rush_bench_verify";
+    static const auto info = make_content(source);
+    static const auto layout = *torrent::file_layout::build(info);
+    const auto data = [] {
+        auto result = std::string{};
+        for (const auto& file : info.files) {
+            auto in = std::ifstream{source / info.name / file.path,
+                                    std::ios::binary};
+            result.append(std::istreambuf_iterator<char>{in}, {});
+        }
+        return result;
+    }();
+
+    auto blocks = std::vector<std::pair<std::uint32_t, std::uint32_t>>{};
+    for (std::uint32_t p = 0; p < layout.piece_count(); p++) {
+        for (std::uint32_t b = 0; b < layout.piece_size(p);
+             b += storage::block_size) {
+            blocks.emplace_back(p, b);
+        }
+    }
+    std::shuffle(blocks.begin(), blocks.end(), std::mt19937{1});
+
+    const auto root =
+        std::filesystem::temp_directory_path() / "rush_bench_disk_io";
+    auto options = storage::disk_options{};
+    options.io_uring = state.range(0) != 0;
+    options.cache_size = 32 << 20;
+
+    // Room for the cache and the blocks being written.
+    auto pool = buffers::block_pool{2 * options.cache_size};
+    auto mutex = std::mutex{};
+    auto drained = std::condition_variable{};
+    const auto before = bench::allocation_count();
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::filesystem::remove_all(root);
+        state.ResumeTiming();
+
+        auto disk = storage::disk_io{
+            layout, storage::content_paths(info, root), pool, options,
+            {[&] {
+                 const auto lock = std::lock_guard{mutex};
+                 drained.notify_all();
+             },
+             {}}};
+        for (const auto& [piece, begin] : blocks) {
+            const auto length = std::min<std::uint64_t>(
+                storage::block_size, layout.piece_size(piece) - begin);
+            const auto offset = layout.piece_offset(piece) + begin;
+            auto block = pool.allocate();
+            std::memcpy(block.data(), data.data() + offset, length);
+            if (!disk.write(piece, begin, std::move(block),
+                            static_cast<std::uint32_t>(length))) {
+                auto lock = std::unique_lock{mutex};
+                drained.wait(lock, [&] { return !disk.congested(); });
+            }
+        }
+        disk.flush();
+    }
+    state.counters["allocs_per_block"] =
+        static_cast<double>(bench::allocation_count() - before) /
+        static_cast<double>(state.iterations() * blocks.size());
+    std::filesystem::remove_all(root);
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * content_size));
+}
+// Creating a torrent for the same content, v1 (0) or hybrid (1), by thread
+// count. The content is in the page cache, so this is the hashing rate the
+// reader has to keep up with.
+void BM_create_torrent(benchmark::State& state) {
+    static const auto root =
+        std::filesystem::temp_directory_path() / "rush_bench_verify";
+    static const auto info = make_content(root);
+
+    auto options = storage::create_options{};
+    options.piece_length = piece_length;
+    options.hybrid = state.range(1) != 0;
+    auto pool = concurrency::thread_pool{
+        static_cast<std::size_t>(state.range(0))};
+    for (auto _ : state) {
+        auto result = storage::create_torrent(root / info.name, options, pool);
+        benchmark::DoNotOptimize(result);
+    }
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * content_size));
+}
+
+// Answers requests through disk_io::upload, from the read cache or with
+// sendfile, back on the connection's core.
+session::peer_handler uploader(session::engine& server,
+                               storage::disk_io& disk) {
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [](session::peer_connection&,
+                              const wire::handshake& remote) {
+        return std::optional{remote};
+    };
+    handler.on_message = [&server, &disk](session::peer_connection& peer,
+                                          const wire::message& m) {
+        const auto* r = std::get_if<wire::request>(&m);
+        if (r == nullptr) {
+            return;
+        }
+        disk.upload(
+            r->index, r->begin, r->length,
+            [&server, peer = peer.shared_from_this(),
+             header = wire::piece_header{r->index, r->begin, r->length}](
+                storage::upload_data data, std::error_code ec) {
+                server.post(peer->core(), [peer, header, ec,
+                                           data = std::move(data)]() mutable {
+                    if (ec) {
+                        peer->close();
+                    } else if (data.ranges.empty()) {
+                        peer->send(
+                            wire::piece{header.index, header.begin,
+                                        {data.bytes.data(), data.bytes.size()}},
+                            std::move(data.block));
+                    } else {
+                        auto slices = std::vector<session::file_slice>{};
+                        for (const auto& range : data.ranges) {
+                            slices.push_back(
+                                {range.file->fd(), range.offset, range.length});
+                        }
+                        peer->send(header, std::move(slices),
+                                   std::make_shared<std::vector<
+                                       storage::file_range>>(
+                                       std::move(data.ranges)));
+                    }
+                });
+            });
+    };
+    return handler;
+}
+
+// Requests every block of the first pieces in order, as peers downloading
+// the same popular content do.
+session::peer_handler downloader(const torrent::file_layout& layout,
+                                 std::uint32_t pieces,
+                                 std::atomic<std::size_t>& closed) {
+    auto blocks = std::uint32_t{0};
+    for (std::uint32_t p = 0; p < pieces; p++) {
+        blocks += static_cast<std::uint32_t>(
+            (layout.piece_size(p) + storage::block_size - 1) /
+            storage::block_size);
+    }
+
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [&layout, pieces](session::peer_connection& peer,
+                                             const wire::handshake& remote) {
+        peer.send(wire::interested{});
+        for (std::uint32_t p = 0; p < pieces; p++) {
+            for (std::uint32_t b = 0; b < layout.piece_size(p);
+                 b += storage::block_size) {
+                peer.send(wire::request{
+                    p, b,
+                    static_cast<std::uint32_t>(std::min<std::uint64_t>(
+                        storage::block_size, layout.piece_size(p) - b))});
+            }
+        }
+        return std::optional{remote};
+    };
+    handler.on_message = [blocks, received = std::uint32_t{0}](
+                             session::peer_connection& peer,
+                             const wire::message& m) mutable {
+        if (std::holds_alternative<wire::piece>(m) && ++received == blocks) {
+            peer.close();
+        }
+    };
+    handler.on_close = [&closed](session::peer_connection&) {
+        closed.fetch_add(1);
+        closed.notify_one();
+    };
+    return handler;
+}
+
+// Seeding the first 32 MiB of the content to a number of local peers at
+// once over loopback, with the read cache off (0) or on (1). Without it
+// every block is sent from its file; with it each piece is read once and
+// served to the other peers from memory. Reports the upload rate and the
+// read cache hit rate.
+void BM_seed(benchmark::State& state) {
+    static const auto root =
+        std::filesystem::temp_directory_path() / "rush_bench_verify";
+    static const auto info = make_content(root);
+    static const auto layout = *torrent::file_layout::build(info);
+    constexpr auto pieces = std::uint32_t{(32 << 20) / piece_length};
+    const auto peers = static_cast<std::size_t>(state.range(1));
+
+    auto options = storage::disk_options{};
+    options.read_cache_size = state.range(0) != 0 ? 64 << 20 : 0;
+    auto pool = buffers::block_pool{2 * options.read_cache_size + (8 << 20)};
+    const auto engine_options = session::engine_options{
+        .threads = 2, .max_connections = 2 * peers + 64};
+    auto server = session::engine{engine_options};
+    auto client = session::engine{engine_options};
+    // Destroyed first, so that its last handlers still find the engine.
+    auto disk = storage::disk_io{layout, storage::content_paths(info, root),
+                                 pool, options};
+    const auto endpoint =
+        server.listen({boost::asio::ip::make_address("127.0.0.1"), 0},
+                      uploader(server, disk));
+
+    for (auto _ : state) {
+        auto closed = std::atomic<std::size_t>{0};
+        for (std::size_t i = 0; i < peers; i++) {
+            auto h = wire::handshake{};
+            h.info_hash.fill(std::byte{1});
+            client.connect(endpoint, h, downloader(layout, pieces, closed));
+        }
+        for (auto n = closed.load(); n < peers; n = closed.load()) {
+            closed.wait(n);
+        }
+    }
+    const auto stats = disk.read_stats();
+    const auto lookups = stats.hits + stats.misses;
+    state.counters["hit_rate"] =
+        lookups == 0 ? 0.0
+                     : static_cast<double>(stats.hits) /
+                           static_cast<double>(lookups);
+    state.SetBytesProcessed(static_cast<std::int64_t>(
+        state.iterations() * peers * pieces * piece_length));
+}
+
+// Starting up with many torrents over unchanged content: each one loads
+// its resume file and stats its 16 files, and nothing is hashed.
+void BM_resume(benchmark::State& state) {
+    static const auto root =
+        std::filesystem::temp_directory_path() / "rush_bench_verify";
+    static const auto info = make_content(root);
+    const auto torrents = static_cast<std::size_t>(state.range(0));
+    const auto directory =
+        std::filesystem::temp_directory_path() / "rush_bench_resume";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    // Half the pieces done, and a few more under way.
+    const auto hash = crypto::sha1("resume");
+    auto data = storage::resume_data{hash};
+    data.pieces = torrent::bitfield{content_size / piece_length};
+    for (std::size_t piece = 0; piece < data.pieces.size(); piece += 2) {
+        data.pieces.set(piece);
+    }
+    data.files = storage::file_states(storage::content_paths(info, root));
+    for (std::uint32_t piece = 1; piece < 64; piece += 2) {
+        data.partial.push_back(
+            {piece, torrent::bitfield{piece_length / storage::block_size}});
+    }
+    for (std::size_t i = 0; i < torrents; i++) {
+        storage::save_resume(directory / std::to_string(i), data);
+    }
+
+    auto pool = concurrency::thread_pool{1};
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < torrents; i++) {
+            const auto saved = storage::load_resume(
+                directory / std::to_string(i), hash, data.pieces.size(),
+                data.files.size());
+            auto result = storage::restore(info, root, saved, pool);
+            benchmark::DoNotOptimize(result);
+        }
+    }
+    std::filesystem::remove_all(directory);
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * torrents));
+}
+}  // namespace
+
+BENCHMARK(BM_resume)
+    ->ArgName("torrents")
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_seed)
+    ->ArgNames({"read_cache", "peers"})
+    ->ArgsProduct({{0, 1}, {1, 8, 64}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_disk_write)
+    ->ArgName("io_uring")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_verify)
+    ->ArgName("threads")
+    ->RangeMultiplier(2)
+    ->Range(1, 16)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_create_torrent)
+    ->ArgNames({"threads", "hybrid"})
+    ->ArgsProduct({{1, 2, 4, 8, 16}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,50 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+
+#include "allocation_counter.h"
+#include "announce.h"
+#include "encoder.h"
+#include "http_tracker.h"
+
+namespace {
+// An HTTP announce response listing state.range(0) compact peers, decoded
+// into one response object the way a client re-announcing would.
+void BM_parse_announce(benchmark::State& state) {
+    const auto peers = static_cast<std::size_t>(state.range(0));
+    auto compact = std::string(peers * 6, '\0');
+    for (std::size_t i = 0; i < compact.size(); i++) {
+        compact[i] = static_cast<char>(i * 31);
+    }
+    auto body = std::string{};
+    bencode::encoder{std::back_inserter(body)}
+        .begin_dict()
+        .string("complete")
+        .integer(900)
+        .string("incomplete")
+        .integer(100)
+        .string("interval")
+        .integer(1800)
+        .string("peers")
+        .string(compact)
+        .end();
+
+    auto response = tracker::announce_response{};
+    tracker::parse_announce_response(body, response);
+    const auto before = bench::allocation_count();
+    for (auto _ : state) {
+        tracker::parse_announce_response(body, response);
+        benchmark::DoNotOptimize(response.peers.data());
+    }
+    state.counters["allocs_per_announce"] = benchmark::Counter(
+        static_cast<double>(bench::allocation_count() - before),
+        benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * peers));
+}
+}  // namespace
+
+BENCHMARK(BM_parse_announce)->Arg(50)->Arg(200);
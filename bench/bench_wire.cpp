@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+#include <boost/asio/buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <variant>
+
+#include "codec.h"
+#include "message.h"
+
+namespace {
+constexpr std::uint32_t block_size = 16384;
+
+void append(std::string& out, const wire::message& m) {
+    const auto message = wire::outgoing{m};
+    const auto offset = out.size();
+    out.resize(offset + message.size());
+    boost::asio::buffer_copy(
+        boost::asio::buffer(out.data() + offset, message.size()),
+        message.buffers());
+}
+
+// What a downloading connection mostly receives: blocks, interleaved with
+// have announcements and the odd request. messages per iteration are
+// decoded on one core.
+void BM_decode(benchmark::State& state) {
+    const auto block = std::string(block_size, 'x');
+    auto stream = std::string{};
+    std::size_t messages = 0;
+    for (std::uint32_t i = 0; i < 64; i++) {
+        append(stream, wire::piece{i, 0, block});
+        append(stream, wire::have{i});
+        append(stream, wire::have{i + 64});
+        append(stream, wire::request{i, 0, block_size});
+        messages += 4;
+    }
+
+    for (auto _ : state) {
+        auto input = std::string_view{stream};
+        std::uint64_t payload = 0;
+        for (;;) {
+            const auto f = wire::decode(input);
+            if (f.state != wire::status::complete) {
+                break;
+            }
+            if (const auto* p = std::get_if<wire::piece>(&f.value)) {
+                payload += p->block.size();
+            }
+            input.remove_prefix(f.size);
+        }
+        benchmark::DoNotOptimize(payload);
+    }
+    state.SetItemsProcessed(
+        static_cast<std::int64_t>(state.iterations() * messages));
+    state.SetBytesProcessed(
+        static_cast<std::int64_t>(state.iterations() * stream.size()));
+}
+
+// Building the gather list for an outgoing block; the block itself is only
+// referenced.
+void BM_encode_piece(benchmark::State& state) {
+    const auto block = std::string(block_size, 'x');
+    std::uint32_t index = 0;
+    for (auto _ : state) {
+        const auto out = wire::outgoing{wire::piece{index++, 0, block}};
+        auto buffers = out.buffers();
+        benchmark::DoNotOptimize(buffers);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+}  // namespace
+
+BENCHMARK(BM_decode);
+BENCHMARK(BM_encode_piece);
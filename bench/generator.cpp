@@ -0,0 +1,119 @@
+#include "generator.h"
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include "encoder.h"
+
+namespace bench {
+namespace {
+using string_encoder = bencode::encoder<std::back_insert_iterator<std::string>>;
+
+void write_path(string_encoder& out, std::size_t file, std::size_t depth) {
+    out.begin_list();
+    for (std::size_t level = 1; level < depth; level++) {
+        out.string(fmt::format("dir-{}-{}", level, file % (level * 16)));
+    }
+    out.string(fmt::format("file-{:08}.bin", file));
+    out.end();
+}
+
+void write_info(string_encoder& out, const torrent_spec& spec,
+                std::mt19937_64& random) {
+    const auto total_length =
+        static_cast<std::int64_t>(spec.piece_count) * spec.piece_length;
+
+    out.begin_dict();
+    if (spec.file_count > 1) {
+        const auto file_count = static_cast<std::int64_t>(spec.file_count);
+        const auto average = total_length / file_count;
+
+        out.string("files").begin_list();
+        std::int64_t remaining = total_length;
+        for (std::size_t i = 0; i < spec.file_count; i++) {
+            const auto length =
+                i + 1 == spec.file_count
+                    ? remaining
+                    : static_cast<std::int64_t>(
+                          random() % static_cast<std::uint64_t>(average + 1));
+            remaining -= length;
+
+            out.begin_dict();
+            out.string("length").integer(length);
+            out.string("path");
+            write_path(out, i, spec.path_depth);
+            out.end();
+        }
+        out.end();
+    } else {
+        out.string("length").integer(total_length);
+    }
+
+    out.string("name").string("synthetic");
+    out.string("piece length").integer(spec.piece_length);
+
+    auto pieces = std::string(spec.piece_count * 20, '\0');
+    for (auto& byte : pieces) {
+        byte = static_cast<char>(random());
+    }
+    out.string("pieces").string(pieces);
+    out.end();
+}
+}  // namespace
+
+std::string generate_torrent(const torrent_spec& spec) {
+    auto random = std::mt19937_64{spec.seed};
+    auto result = std::string{};
+    result.reserve(spec.piece_count * 20 + spec.file_count * 64 + 1024);
+
+    auto out = string_encoder{std::back_inserter(result)};
+    out.begin_dict();
+    out.string("announce").string("http://tracker.example.com/announce");
+    if (spec.announce_tiers > 0) {
+        out.string("announce-list").begin_list();
+        for (std::size_t tier = 0; tier < spec.announce_tiers; tier++) {
+            out.begin_list();
+            for (std::size_t i = 0; i < spec.trackers_per_tier; i++) {
+                out.string(fmt::format(
+                    "udp://tracker-{}-{}.example.com:6969/announce", tier, i));
+            }
+            out.end();
+        }
+        out.end();
+    }
+    out.string("comment").string("synthetic benchmark torrent");
+    out.string("created by").string("rush_bench");
+    out.string("creation date").integer(1700000000);
+    out.string("info");
+    write_info(out, spec, random);
+    out.end();
+
+    return result;
+}
+
+std::filesystem::path write_torrent(const torrent_spec& spec,
+                                    const std::filesystem::path& directory) {
+    std::filesystem::create_directories(directory);
+    // Every field of spec, so that no two specs share a file.
+    const auto path =
+        directory / fmt::format("p{}x{}-f{}-d{}-t{}x{}-s{}.torrent",
+                                spec.piece_count, spec.piece_length,
+                                spec.file_count, spec.path_depth,
+                                spec.announce_tiers, spec.trackers_per_tier,
+                                spec.seed);
+    if (!std::filesystem::exists(path)) {
+        const auto contents = generate_torrent(spec);
+        auto file = std::ofstream{path, std::ios::binary};
+        file.write(contents.data(),
+                   static_cast<std::streamsize>(contents.size()));
+    }
+    return path;
+}
+}  // namespace bench
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace bench {
+
+struct torrent_spec {
+    std::size_t piece_count = 1024;
+    std::size_t file_count = 1;
+    std::size_t path_depth = 1;
+    std::size_t announce_tiers = 1;
+    std::size_t trackers_per_tier = 1;
+    std::int64_t piece_length = 256 * 1024;
+    std::uint64_t seed = 1;
+};
+
+// Builds a canonical .torrent for spec. The same spec always produces the
+// same bytes, so numbers are comparable across runs and machines.
+std::string generate_torrent(const torrent_spec& spec);
+
+// Writes generate_torrent(spec) to a file named after every field of the
+// spec inside directory and returns its path, reusing an existing file.
+std::filesystem::path write_torrent(const torrent_spec& spec,
+                                    const std::filesystem::path& directory);
+
+}  // namespace bench
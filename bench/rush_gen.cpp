@@ -0,0 +1,67 @@
+#include <fmt/base.h>
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+#include "generator.h"
+
+namespace {
+template <typename T>
+bool parse_flag(std::string_view arg, std::string_view name, T& out) {
+    if (!arg.starts_with(name) || arg.size() <= name.size() ||
+        arg[name.size()] != '=') {
+        return false;
+    }
+
+    const auto value = arg.substr(name.size() + 1);
+    const auto [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), out);
+    return error == std::errc{} && end == value.data() + value.size();
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto spec = bench::torrent_spec{};
+    std::filesystem::path output;
+
+    for (int i = 1; i < argc; i++) {
+        const auto arg = std::string_view{argv[i]};
+        if (parse_flag(arg, "--pieces", spec.piece_count) ||
+            parse_flag(arg, "--files", spec.file_count) ||
+            parse_flag(arg, "--depth", spec.path_depth) ||
+            parse_flag(arg, "--tiers", spec.announce_tiers) ||
+            parse_flag(arg, "--trackers", spec.trackers_per_tier) ||
+            parse_flag(arg, "--piece-length", spec.piece_length) ||
+            parse_flag(arg, "--seed", spec.seed)) {
+            continue;
+        }
+        if (arg.starts_with("--") || !output.empty()) {
+            fmt::println(stderr,
+                         "usage: rush_gen [--pieces=N] [--files=N] "
+                         "[--depth=N] [--tiers=N] [--trackers=N] "
+                         "[--piece-length=N] [--seed=N] <output>");
+            return 1;
+        }
+        output = arg;
+    }
+
+    if (output.empty()) {
+        fmt::println(stderr, "rush_gen: missing output path");
+        return 1;
+    }
+
+    const auto contents = bench::generate_torrent(spec);
+    auto file = std::ofstream{output, std::ios::binary};
+    file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    if (!file) {
+        fmt::println(stderr, "rush_gen: could not write {}", output.string());
+        return 1;
+    }
+
+    fmt::println("Wrote {} bytes to {}", contents.size(), output.string());
+    return 0;
+}
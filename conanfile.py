@@ -18,7 +18,7 @@ class rushRecipe(ConanFile):
     settings = "os", "compiler", "build_type", "arch"
 
     # Sources are located in the same place as this recipe, copy them to the recipe
-    exports_sources = "CMakeLists.txt", "src/*"
+    exports_sources = "CMakeLists.txt", "src/*", "tests/*", "bench/*"
 
     def layout(self):
         cmake_layout(self)
@@ -39,8 +39,10 @@ class rushRecipe(ConanFile):
         cmake.install()
 
     def requirements(self):
+        self.requires("benchmark/1.9.0")
         self.requires("boost/[>=1.86 <1.87]")
         self.requires("foonathan-lexy/2022.12.1")
         self.requires("fmt/11.0.2")
         self.requires("gtest/1.15.0")
+        self.requires("openssl/[>=3 <4]")
         self.requires("tomlplusplus/3.4.0")
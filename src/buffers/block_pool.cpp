@@ -0,0 +1,152 @@
+#include "block_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace buffers {
+namespace {
+constexpr std::size_t slab_blocks = 64;
+// Blocks moved between a shard and the shared list at once; a shard holding
+// two batches gives one back.
+constexpr std::size_t batch = 32;
+
+std::atomic<std::size_t> next_thread{0};
+thread_local const std::size_t thread_index =
+    next_thread.fetch_add(1, std::memory_order_relaxed);
+}  // namespace
+
+block_pool::block_pool(std::size_t limit, std::size_t shards)
+    : limit_{limit / block_size},
+      shards_{std::make_unique<shard[]>(std::max<std::size_t>(shards, 1))},
+      shard_count_{std::max<std::size_t>(shards, 1)} {}
+
+block_pool::~block_pool() = default;
+
+block_pool::shard& block_pool::local() {
+    return shards_[thread_index % shard_count_];
+}
+
+block_ref block_pool::allocate() {
+    auto& s = local();
+    auto lock = std::unique_lock{s.mutex};
+    if (s.free == nullptr) {
+        refill(s);
+    }
+    auto* block = s.free;
+    if (block != nullptr) {
+        s.free = block->next;
+        s.count--;
+        lock.unlock();
+    } else {
+        lock.unlock();
+        block = steal(s);
+        if (block == nullptr) {
+            failures_.fetch_add(1, std::memory_order_relaxed);
+            return {};
+        }
+    }
+
+    block->references.store(1, std::memory_order_relaxed);
+    const auto in_use = in_use_.fetch_add(1, std::memory_order_relaxed) + 1;
+    auto high = high_water_.load(std::memory_order_relaxed);
+    while (in_use > high && !high_water_.compare_exchange_weak(
+                                high, in_use, std::memory_order_relaxed)) {
+    }
+    return block_ref{block};
+}
+
+void block_pool::refill(shard& s) {
+    const auto lock = std::lock_guard{mutex_};
+    if (free_ == nullptr) {
+        grow();
+    }
+    for (std::size_t i = 0; i < batch && free_ != nullptr; i++) {
+        auto* block = free_;
+        free_ = block->next;
+        block->next = s.free;
+        s.free = block;
+        s.count++;
+    }
+}
+
+detail::block_header* block_pool::steal(const shard& own) {
+    for (std::size_t i = 0; i < shard_count_; i++) {
+        auto& s = shards_[i];
+        if (&s == &own) {
+            continue;
+        }
+        const auto lock = std::lock_guard{s.mutex};
+        if (auto* block = s.free) {
+            s.free = block->next;
+            s.count--;
+            return block;
+        }
+    }
+    return nullptr;
+}
+
+void block_pool::grow() {
+    const auto count = std::min(slab_blocks, limit_ - reserved_);
+    if (count == 0) {
+        return;
+    }
+    auto memory = std::unique_ptr<char[], void (*)(void*)>{
+        static_cast<char*>(std::aligned_alloc(4096, count * block_size)),
+        std::free};
+    if (memory == nullptr) {
+        return;
+    }
+    auto headers = std::make_unique<detail::block_header[]>(count);
+    for (std::size_t i = 0; i < count; i++) {
+        headers[i].pool = this;
+        headers[i].data = memory.get() + i * block_size;
+        headers[i].next = free_;
+        free_ = &headers[i];
+    }
+    slabs_.push_back({std::move(memory), std::move(headers)});
+    reserved_ += count;
+}
+
+void block_pool::release(detail::block_header* block) {
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+
+    auto& s = local();
+    const auto lock = std::lock_guard{s.mutex};
+    block->next = s.free;
+    s.free = block;
+    if (++s.count < 2 * batch) {
+        return;
+    }
+
+    // Blocks freed on one thread and allocated on another would otherwise
+    // pile up here.
+    auto* first = s.free;
+    auto* last = first;
+    for (std::size_t i = 1; i < batch; i++) {
+        last = last->next;
+    }
+    s.free = last->next;
+    s.count -= batch;
+
+    const auto shared_lock = std::lock_guard{mutex_};
+    last->next = free_;
+    free_ = first;
+}
+
+pool_stats block_pool::stats() const {
+    auto result = pool_stats{};
+    result.in_use = in_use_.load(std::memory_order_relaxed);
+    result.high_water = high_water_.load(std::memory_order_relaxed);
+    result.limit = limit_;
+    result.failures = failures_.load(std::memory_order_relaxed);
+    const auto lock = std::lock_guard{mutex_};
+    result.reserved = reserved_;
+    return result;
+}
+
+}  // namespace buffers
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace buffers {
+
+// The unit peers request and send pieces in.
+inline constexpr std::size_t block_size = 16384;
+
+class block_pool;
+
+namespace detail {
+struct block_header {
+    std::atomic<std::uint32_t> references{0};
+    block_pool* pool = nullptr;
+    char* data = nullptr;
+    // Next free block while the block is in a free list.
+    block_header* next = nullptr;
+};
+}  // namespace detail
+
+// A counted reference to one pooled block. Copies share the block, and the
+// last one to go hands it back to its pool, from any thread. The block is
+// the same memory for its whole life, so the bytes received into it can be
+// hashed, cached for the disk and sent to other peers without a copy.
+class block_ref {
+   public:
+    block_ref() = default;
+    block_ref(const block_ref& other) noexcept : block_{other.block_} {
+        if (block_ != nullptr) {
+            block_->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    block_ref(block_ref&& other) noexcept
+        : block_{std::exchange(other.block_, nullptr)} {}
+    block_ref& operator=(block_ref other) noexcept {
+        std::swap(block_, other.block_);
+        return *this;
+    }
+    ~block_ref() { reset(); }
+
+    void reset() noexcept;
+
+    explicit operator bool() const { return block_ != nullptr; }
+    char* data() const { return block_->data; }
+    std::span<char> bytes() const { return {block_->data, block_size}; }
+    std::uint32_t use_count() const {
+        return block_ == nullptr
+                   ? 0
+                   : block_->references.load(std::memory_order_relaxed);
+    }
+
+   private:
+    friend class block_pool;
+    explicit block_ref(detail::block_header* block) : block_{block} {}
+
+    detail::block_header* block_ = nullptr;
+};
+
+// Counts are in blocks.
+struct pool_stats {
+    std::size_t in_use = 0;
+    // Most blocks ever in use at once.
+    std::size_t high_water = 0;
+    // Blocks taken from the system so far, and the most there may be.
+    std::size_t reserved = 0;
+    std::size_t limit = 0;
+    // Allocations refused because the pool was at its limit.
+    std::uint64_t failures = 0;
+};
+
+// Fixed-size 16 KiB buffers for the blocks travelling between the network
+// and the disk, carved out of 1 MiB slabs that are never given back. Each
+// thread allocates from and frees into a shard of its own, which trades
+// batches of blocks with a shared list, so once the pool has grown to the
+// working set a block costs no malloc and no contended lock. Past limit
+// bytes, allocate takes a free block from another shard, and fails only
+// when there is none. Every block must be back before the pool is
+// destroyed.
+class block_pool {
+   public:
+    explicit block_pool(
+        std::size_t limit,
+        std::size_t shards = std::thread::hardware_concurrency());
+    ~block_pool();
+
+    block_pool(const block_pool&) = delete;
+    block_pool& operator=(const block_pool&) = delete;
+
+    // An empty ref when the pool is at its limit with no block free.
+    block_ref allocate();
+
+    pool_stats stats() const;
+
+   private:
+    friend class block_ref;
+
+    struct alignas(64) shard {
+        std::mutex mutex;
+        detail::block_header* free = nullptr;
+        std::size_t count = 0;
+    };
+
+    struct slab {
+        std::unique_ptr<char[], void (*)(void*)> memory;
+        std::unique_ptr<detail::block_header[]> headers;
+    };
+
+    shard& local();
+    // Moves up to a batch of blocks from the shared list into s, growing
+    // the pool if it is empty.
+    void refill(shard& s);
+    // A free block held by a shard other than own, for when the pool is at
+    // its limit and the shared list is empty. Expects own's lock not to be
+    // held, since the other shard's is taken.
+    detail::block_header* steal(const shard& own);
+    void grow();
+    void release(detail::block_header* block);
+
+    std::size_t limit_;
+    std::unique_ptr<shard[]> shards_;
+    std::size_t shard_count_;
+
+    mutable std::mutex mutex_;
+    detail::block_header* free_ = nullptr;
+    std::vector<slab> slabs_;
+    std::size_t reserved_ = 0;
+
+    std::atomic<std::size_t> in_use_{0};
+    std::atomic<std::size_t> high_water_{0};
+    std::atomic<std::uint64_t> failures_{0};
+};
+
+inline void block_ref::reset() noexcept {
+    if (block_ != nullptr &&
+        block_->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block_->pool->release(block_);
+    }
+    block_ = nullptr;
+}
+
+}  // namespace buffers
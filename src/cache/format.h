@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// On-disk layout of the metadata cache. Every structure is fixed-size,
+// 8-byte aligned and read in place from the mapping, so nothing here may
+// hold a pointer: strings are (offset, size) pairs into the blob region.
+//
+//   header
+//   entry[entry_count]       sorted by path
+//   file[file_count]         the files of multi-file torrents, by entry
+//   v2_file[v2_file_count]   the v2 file trees, by entry
+//   layer[layer_count]       the v2 piece layers, by entry
+//   blob bytes               strings, referenced relative to blob_offset
+//
+// Bump version whenever any of these change.
+namespace cache::format {
+
+constexpr std::array<char, 8> magic = {'R', 'U', 'S', 'H', 'M', 'E', 'T', 'A'};
+constexpr std::uint32_t version = 2;
+constexpr std::uint32_t byte_order = 0x01020304;
+
+struct blob {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t entry_count;
+    std::uint64_t entries_offset;
+    std::uint64_t file_count;
+    std::uint64_t files_offset;
+    std::uint64_t v2_file_count;
+    std::uint64_t v2_files_offset;
+    std::uint64_t layer_count;
+    std::uint64_t layers_offset;
+    std::uint64_t blob_offset;
+    std::uint64_t blob_size;
+};
+
+enum entry_flags : std::uint32_t {
+    multi_file = 1 << 0,
+    has_private = 1 << 1,
+    has_md5sum = 1 << 2,
+    has_announce_list = 1 << 3,
+    has_creation_date = 1 << 4,
+    has_comment = 1 << 5,
+    has_created_by = 1 << 6,
+    has_encoding = 1 << 7,
+    has_info_hash_v2 = 1 << 8,
+    has_info_v2 = 1 << 9,
+};
+
+struct entry {
+    // Cache key: the .torrent file as it was when this entry was written.
+    blob path;
+    std::int64_t mtime;
+    std::uint64_t file_size;
+    std::array<std::byte, 20> content_hash;
+
+    std::array<std::byte, 20> info_hash;
+    std::array<std::byte, 32> info_hash_v2;
+    std::uint32_t flags;
+    std::uint32_t reserved;
+
+    std::int64_t piece_length;
+    std::int64_t private_;
+    std::int64_t length;
+    std::uint64_t total_size;
+    std::int64_t creation_date;
+    std::uint64_t first_file;
+    std::uint64_t file_count;
+    std::int64_t piece_length_v2;
+    std::uint64_t first_v2_file;
+    std::uint64_t v2_file_count;
+    std::uint64_t first_layer;
+    std::uint64_t layer_count;
+
+    blob name;
+    blob pieces;
+    blob md5sum;
+    blob announce;
+    blob announce_list;  // Bencoded, it is an arbitrary list.
+    blob comment;
+    blob created_by;
+    blob encoding;
+};
+
+struct file {
+    std::int64_t length;
+    blob path;
+    blob md5sum;
+    blob attr;
+};
+
+enum v2_file_flags : std::uint32_t {
+    has_pieces_root = 1 << 0,
+};
+
+struct v2_file {
+    std::int64_t length;
+    blob path;
+    std::array<std::byte, 32> pieces_root;
+    std::uint32_t flags;
+    std::uint32_t reserved;
+};
+
+struct layer {
+    std::array<std::byte, 32> pieces_root;
+    blob hashes;
+};
+
+static_assert(std::is_trivially_copyable_v<header>);
+static_assert(std::is_trivially_copyable_v<entry>);
+static_assert(std::is_trivially_copyable_v<file>);
+static_assert(std::is_trivially_copyable_v<v2_file>);
+static_assert(std::is_trivially_copyable_v<layer>);
+static_assert(sizeof(header) % 8 == 0);
+static_assert(sizeof(entry) % 8 == 0);
+static_assert(sizeof(file) % 8 == 0);
+static_assert(sizeof(v2_file) % 8 == 0);
+static_assert(sizeof(layer) % 8 == 0);
+
+}  // namespace cache::format
@@ -0,0 +1,529 @@
+#include "metadata_cache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "bencode.h"
+#include "encoder.h"
+#include "format.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace cache {
+namespace {
+// Whether count records of the given size starting at offset lie within a
+// file of file_size bytes, without overflowing on hostile headers.
+bool fits(std::uint64_t offset, std::uint64_t count, std::size_t size,
+          std::size_t file_size) {
+    if (offset > file_size || offset % alignof(std::uint64_t) != 0) {
+        return false;
+    }
+    return count <= (file_size - offset) / size;
+}
+
+template <typename T>
+const T* table(std::string_view bytes, std::uint64_t offset) {
+    return reinterpret_cast<const T*>(bytes.data() + offset);
+}
+
+bool write_all(int fd, std::string_view bytes) {
+    while (!bytes.empty()) {
+        const auto n = ::write(fd, bytes.data(), bytes.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes.remove_prefix(static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+// Makes a rename in directory durable.
+void sync_directory(const std::filesystem::path& directory) {
+    const auto fd = ::open(directory.empty() ? "." : directory.c_str(),
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+}  // namespace
+
+std::string_view torrent_view::string(format::blob b) const {
+    if (b.offset > blobs_.size() || b.size > blobs_.size() - b.offset) {
+        return {};
+    }
+    return blobs_.substr(b.offset, b.size);
+}
+
+template <typename T>
+std::span<const T> torrent_view::records(std::span<const T> table,
+                                         std::uint64_t first,
+                                         std::uint64_t count) {
+    if (first > table.size() || count > table.size() - first) {
+        return {};
+    }
+    return table.subspan(first, count);
+}
+
+std::optional<crypto::sha256_digest> torrent_view::info_hash_v2() const {
+    if (!has(format::has_info_hash_v2)) {
+        return {};
+    }
+    return entry_->info_hash_v2;
+}
+
+std::size_t torrent_view::file_count() const {
+    if (!is_multi_file()) {
+        return 0;
+    }
+    return records(files_, entry_->first_file, entry_->file_count).size();
+}
+
+file_view torrent_view::file(std::size_t i) const {
+    const auto& f = files_[entry_->first_file + i];
+    return {f.length, string(f.path), string(f.md5sum), string(f.attr)};
+}
+
+torrent::torrent torrent_view::to_torrent() const {
+    auto result = torrent::torrent{};
+
+    if (is_multi_file()) {
+        auto info = torrent::multi_file_info{};
+        info.piece_length = entry_->piece_length;
+        info.pieces = bencode::string{pieces()};
+        info.name = bencode::string{name()};
+        if (has(format::has_private)) {
+            info.private_ = entry_->private_;
+        }
+        info.files.reserve(file_count());
+        for (std::size_t i = 0; i < file_count(); i++) {
+            const auto f = file(i);
+            info.files.push_back({f.length, bencode::string{f.md5sum},
+                                  bencode::string{f.path},
+                                  bencode::string{f.attr}});
+        }
+        result.info = std::move(info);
+    } else {
+        auto info = torrent::single_file_info{};
+        info.piece_length = entry_->piece_length;
+        info.pieces = bencode::string{pieces()};
+        info.name = bencode::string{name()};
+        info.length = entry_->length;
+        if (has(format::has_private)) {
+            info.private_ = entry_->private_;
+        }
+        if (has(format::has_md5sum)) {
+            info.md5sum = bencode::string{string(entry_->md5sum)};
+        }
+        result.info = std::move(info);
+    }
+
+    if (has_info_v2()) {
+        auto info = torrent::v2_info{};
+        info.piece_length = entry_->piece_length_v2;
+        const auto files = records(v2_files_, entry_->first_v2_file,
+                                   entry_->v2_file_count);
+        info.files.reserve(files.size());
+        for (const auto& f : files) {
+            auto& file = info.files.emplace_back();
+            file.length = f.length;
+            file.path = bencode::string{string(f.path)};
+            if ((f.flags & format::has_pieces_root) != 0) {
+                file.pieces_root = f.pieces_root;
+            }
+        }
+        result.info_v2 = std::move(info);
+    }
+    for (const auto& l :
+         records(layers_, entry_->first_layer, entry_->layer_count)) {
+        result.piece_layers.emplace(l.pieces_root,
+                                    bencode::string{string(l.hashes)});
+    }
+
+    result.announce = bencode::string{announce()};
+    if (has(format::has_announce_list)) {
+        auto list = bencode::parse_literal(string(entry_->announce_list),
+                                           bencode::backend::fast);
+        if (list.has_value() && std::holds_alternative<bencode::list>(*list)) {
+            result.announce_list = std::get<bencode::list>(std::move(*list));
+        }
+    }
+    if (has(format::has_creation_date)) {
+        result.creation_date = entry_->creation_date;
+    }
+    if (has(format::has_comment)) {
+        result.comment = bencode::string{string(entry_->comment)};
+    }
+    if (has(format::has_created_by)) {
+        result.created_by = bencode::string{string(entry_->created_by)};
+    }
+    if (has(format::has_encoding)) {
+        result.encoding = bencode::string{string(entry_->encoding)};
+    }
+
+    result.info_hash = entry_->info_hash;
+    result.info_hash_v2 = info_hash_v2();
+    return result;
+}
+
+std::optional<metadata_cache> metadata_cache::open(
+    const std::filesystem::path& path) {
+    auto file = bencode::mapped_file::open(path);
+    if (!file.has_value() || file->size() < sizeof(format::header)) {
+        return {};
+    }
+
+    auto h = format::header{};
+    std::memcpy(&h, file->bytes().data(), sizeof(h));
+    if (h.magic != format::magic || h.version != format::version ||
+        h.byte_order != format::byte_order ||
+        !fits(h.entries_offset, h.entry_count, sizeof(format::entry),
+              file->size()) ||
+        !fits(h.files_offset, h.file_count, sizeof(format::file),
+              file->size()) ||
+        !fits(h.v2_files_offset, h.v2_file_count, sizeof(format::v2_file),
+              file->size()) ||
+        !fits(h.layers_offset, h.layer_count, sizeof(format::layer),
+              file->size()) ||
+        !fits(h.blob_offset, h.blob_size, 1, file->size())) {
+        return {};
+    }
+    return metadata_cache{std::move(file.value())};
+}
+
+const format::header& metadata_cache::header() const {
+    return *table<format::header>(file_.bytes(), 0);
+}
+
+std::size_t metadata_cache::size() const { return header().entry_count; }
+
+torrent_view metadata_cache::operator[](std::size_t i) const {
+    const auto& h = header();
+    const auto bytes = file_.bytes();
+    return {table<format::entry>(bytes, h.entries_offset) + i,
+            {table<format::file>(bytes, h.files_offset), h.file_count},
+            {table<format::v2_file>(bytes, h.v2_files_offset),
+             h.v2_file_count},
+            {table<format::layer>(bytes, h.layers_offset), h.layer_count},
+            bytes.substr(h.blob_offset, h.blob_size)};
+}
+
+std::optional<torrent_view> metadata_cache::find(std::string_view path) const {
+    std::size_t first = 0;
+    std::size_t count = size();
+    while (count > 0) {
+        const auto half = count / 2;
+        if ((*this)[first + half].path() < path) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+
+    if (first == size() || (*this)[first].path() != path) {
+        return {};
+    }
+    return (*this)[first];
+}
+
+format::blob cache_writer::store(std::string_view bytes) {
+    const auto b = format::blob{blobs_.size(), bytes.size()};
+    blobs_.append(bytes);
+    return b;
+}
+
+void cache_writer::add(const key& k, const torrent::torrent& t) {
+    auto e = format::entry{};
+    e.path = store(k.path);
+    e.mtime = k.mtime;
+    e.file_size = k.file_size;
+    e.content_hash = k.content_hash;
+    e.info_hash = t.info_hash;
+    if (t.info_hash_v2.has_value()) {
+        e.flags |= format::has_info_hash_v2;
+        e.info_hash_v2 = t.info_hash_v2.value();
+    }
+
+    const auto common = [&](const auto& info) {
+        e.piece_length = info.piece_length;
+        e.name = store(info.name);
+        e.pieces = store(info.pieces);
+        if (info.private_.has_value()) {
+            e.flags |= format::has_private;
+            e.private_ = info.private_.value();
+        }
+    };
+
+    if (const auto* single = std::get_if<torrent::single_file_info>(&t.info)) {
+        common(*single);
+        e.length = single->length;
+        e.total_size = static_cast<std::uint64_t>(single->length);
+        if (single->md5sum.has_value()) {
+            e.flags |= format::has_md5sum;
+            e.md5sum = store(single->md5sum.value());
+        }
+    } else {
+        const auto& multi = std::get<torrent::multi_file_info>(t.info);
+        common(multi);
+        e.flags |= format::multi_file;
+        e.first_file = files_.size();
+        e.file_count = multi.files.size();
+        for (const auto& f : multi.files) {
+            files_.push_back(
+                {f.length, store(f.path), store(f.md5sum), store(f.attr)});
+            if (!f.is_padding()) {
+                e.total_size += static_cast<std::uint64_t>(f.length);
+            }
+        }
+    }
+
+    if (t.info_v2.has_value()) {
+        e.flags |= format::has_info_v2;
+        e.piece_length_v2 = t.info_v2->piece_length;
+        e.first_v2_file = v2_files_.size();
+        e.v2_file_count = t.info_v2->files.size();
+        for (const auto& f : t.info_v2->files) {
+            auto& record = v2_files_.emplace_back(
+                format::v2_file{f.length, store(f.path), {}, 0, 0});
+            if (f.pieces_root.has_value()) {
+                record.flags |= format::has_pieces_root;
+                record.pieces_root = f.pieces_root.value();
+            }
+        }
+    }
+    e.first_layer = layers_.size();
+    e.layer_count = t.piece_layers.size();
+    for (const auto& [pieces_root, hashes] : t.piece_layers) {
+        layers_.push_back({pieces_root, store(hashes)});
+    }
+
+    e.announce = store(t.announce);
+    if (t.announce_list.has_value()) {
+        auto encoded = std::string{};
+        auto out = bencode::encoder{std::back_inserter(encoded)};
+        out.begin_list();
+        for (const auto& element : t.announce_list.value()) {
+            out.value(element);
+        }
+        out.end();
+        e.flags |= format::has_announce_list;
+        e.announce_list = store(encoded);
+    }
+    if (t.creation_date.has_value()) {
+        e.flags |= format::has_creation_date;
+        e.creation_date = t.creation_date.value();
+    }
+    if (t.comment.has_value()) {
+        e.flags |= format::has_comment;
+        e.comment = store(t.comment.value());
+    }
+    if (t.created_by.has_value()) {
+        e.flags |= format::has_created_by;
+        e.created_by = store(t.created_by.value());
+    }
+    if (t.encoding.has_value()) {
+        e.flags |= format::has_encoding;
+        e.encoding = store(t.encoding.value());
+    }
+    entries_.push_back(e);
+}
+
+void cache_writer::add(const key& k, const torrent_view& cached) {
+    auto e = *cached.entry_;
+    e.path = store(k.path);
+    e.mtime = k.mtime;
+    e.file_size = k.file_size;
+    e.content_hash = k.content_hash;
+
+    e.name = store(cached.string(e.name));
+    e.pieces = store(cached.string(e.pieces));
+    e.md5sum = store(cached.string(e.md5sum));
+    e.announce = store(cached.string(e.announce));
+    e.announce_list = store(cached.string(e.announce_list));
+    e.comment = store(cached.string(e.comment));
+    e.created_by = store(cached.string(e.created_by));
+    e.encoding = store(cached.string(e.encoding));
+
+    e.first_file = files_.size();
+    e.file_count = cached.file_count();
+    for (std::size_t i = 0; i < e.file_count; i++) {
+        const auto f = cached.file(i);
+        files_.push_back(
+            {f.length, store(f.path), store(f.md5sum), store(f.attr)});
+    }
+
+    const auto v2_files = torrent_view::records(
+        cached.v2_files_, e.first_v2_file, e.v2_file_count);
+    e.first_v2_file = v2_files_.size();
+    e.v2_file_count = v2_files.size();
+    for (auto f : v2_files) {
+        f.path = store(cached.string(f.path));
+        v2_files_.push_back(f);
+    }
+
+    const auto layers = torrent_view::records(cached.layers_, e.first_layer,
+                                              e.layer_count);
+    e.first_layer = layers_.size();
+    e.layer_count = layers.size();
+    for (auto l : layers) {
+        l.hashes = store(cached.string(l.hashes));
+        layers_.push_back(l);
+    }
+    entries_.push_back(e);
+}
+
+bool cache_writer::write(const std::filesystem::path& path) const {
+    const auto key_of = [this](const format::entry& e) {
+        return std::string_view{blobs_}.substr(e.path.offset, e.path.size);
+    };
+
+    auto order = std::vector<std::size_t>(entries_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return key_of(entries_[a]) < key_of(entries_[b]);
+    });
+
+    auto h = format::header{};
+    h.magic = format::magic;
+    h.version = format::version;
+    h.byte_order = format::byte_order;
+    h.entry_count = entries_.size();
+    h.entries_offset = sizeof(format::header);
+    h.file_count = files_.size();
+    h.files_offset = h.entries_offset + h.entry_count * sizeof(format::entry);
+    h.v2_file_count = v2_files_.size();
+    h.v2_files_offset = h.files_offset + h.file_count * sizeof(format::file);
+    h.layer_count = layers_.size();
+    h.layers_offset =
+        h.v2_files_offset + h.v2_file_count * sizeof(format::v2_file);
+    h.blob_offset = h.layers_offset + h.layer_count * sizeof(format::layer);
+    h.blob_size = blobs_.size();
+
+    auto bytes = std::string{};
+    bytes.reserve(h.blob_offset + blobs_.size());
+    const auto put = [&](const auto& record) {
+        bytes.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    };
+    put(h);
+    for (const auto i : order) {
+        put(entries_[i]);
+    }
+    bytes.append(reinterpret_cast<const char*>(files_.data()),
+                 files_.size() * sizeof(format::file));
+    bytes.append(reinterpret_cast<const char*>(v2_files_.data()),
+                 v2_files_.size() * sizeof(format::v2_file));
+    bytes.append(reinterpret_cast<const char*>(layers_.data()),
+                 layers_.size() * sizeof(format::layer));
+    bytes += blobs_;
+
+    auto temporary = path;
+    temporary += ".tmp";
+    const auto fd = ::open(temporary.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const auto written = write_all(fd, bytes) && ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !written) {
+        std::filesystem::remove(temporary);
+        return false;
+    }
+
+    auto ec = std::error_code{};
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        return false;
+    }
+    sync_directory(path.parent_path());
+    return true;
+}
+
+std::optional<refresh_stats> refresh(
+    const std::filesystem::path& cache_path,
+    std::span<const std::filesystem::path> torrents) {
+    const auto previous = metadata_cache::open(cache_path);
+    const auto cached = [&](std::string_view path) {
+        return previous.has_value() ? previous->find(path) : std::nullopt;
+    };
+
+    auto stats = refresh_stats{};
+    auto writer = cache_writer{};
+    for (const auto& path : torrents) {
+        auto size_error = std::error_code{};
+        auto time_error = std::error_code{};
+        const auto size = std::filesystem::file_size(path, size_error);
+        const auto mtime = std::filesystem::last_write_time(path, time_error);
+        if (size_error || time_error) {
+            stats.failed++;
+            continue;
+        }
+
+        auto k = cache_writer::key{path.string(),
+                                   mtime.time_since_epoch().count(), size, {}};
+        const auto entry = cached(k.path);
+        if (entry.has_value() && entry->mtime() == k.mtime &&
+            entry->file_size() == k.file_size) {
+            k.content_hash = entry->content_hash();
+            writer.add(k, entry.value());
+            stats.reused++;
+            continue;
+        }
+
+        const auto file = bencode::mapped_file::open(path);
+        if (!file.has_value()) {
+            stats.failed++;
+            continue;
+        }
+
+        k.file_size = file->size();
+        k.content_hash = crypto::sha1(file->bytes());
+        if (entry.has_value() && entry->content_hash() == k.content_hash) {
+            writer.add(k, entry.value());
+            stats.rehashed++;
+            continue;
+        }
+
+        const auto parsed = torrent::from_bytes(file->bytes());
+        if (!parsed.has_value()) {
+            stats.failed++;
+            continue;
+        }
+        writer.add(k, parsed.value());
+        stats.parsed++;
+    }
+
+    // A hit is any entry served from the cache, rehashed or not.
+    auto& registry = metrics::global();
+    registry.counter("cache.hits").add(stats.reused + stats.rehashed);
+    registry.counter("cache.misses").add(stats.parsed);
+
+    if (!writer.write(cache_path)) {
+        return {};
+    }
+    return stats;
+}
+
+}  // namespace cache
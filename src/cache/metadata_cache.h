@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "format.h"
+#include "mapped_file.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace cache {
+
+struct file_view {
+    std::int64_t length;
+    std::string_view path;
+    std::string_view md5sum;
+    std::string_view attr;
+};
+
+// One cached torrent, read in place from the mapping. Strings are views into
+// the cache file and stay valid for as long as the metadata_cache is alive.
+class torrent_view {
+   public:
+    torrent_view(const format::entry* entry,
+                 std::span<const format::file> files,
+                 std::span<const format::v2_file> v2_files,
+                 std::span<const format::layer> layers, std::string_view blobs)
+        : entry_{entry},
+          files_{files},
+          v2_files_{v2_files},
+          layers_{layers},
+          blobs_{blobs} {}
+
+    std::string_view path() const { return string(entry_->path); }
+    std::int64_t mtime() const { return entry_->mtime; }
+    std::uint64_t file_size() const { return entry_->file_size; }
+    crypto::sha1_digest content_hash() const { return entry_->content_hash; }
+
+    crypto::sha1_digest info_hash() const { return entry_->info_hash; }
+    std::optional<crypto::sha256_digest> info_hash_v2() const;
+    std::string_view name() const { return string(entry_->name); }
+    std::string_view announce() const { return string(entry_->announce); }
+    std::string_view pieces() const { return string(entry_->pieces); }
+    std::int64_t piece_length() const { return entry_->piece_length; }
+    std::uint64_t total_size() const { return entry_->total_size; }
+    bool is_multi_file() const { return has(format::multi_file); }
+    // Set for v2-only and hybrid torrents.
+    bool has_info_v2() const { return has(format::has_info_v2); }
+
+    // Files of a multi-file torrent; empty for a single-file one.
+    std::size_t file_count() const;
+    file_view file(std::size_t i) const;
+
+    // Decodes the entry back into a full torrent.
+    torrent::torrent to_torrent() const;
+
+   private:
+    friend class cache_writer;
+
+    bool has(format::entry_flags flag) const {
+        return (entry_->flags & flag) != 0;
+    }
+    std::string_view string(format::blob b) const;
+    // The records of this entry in one of the tables, or none if they lie
+    // outside it.
+    template <typename T>
+    static std::span<const T> records(std::span<const T> table,
+                                      std::uint64_t first,
+                                      std::uint64_t count);
+
+    const format::entry* entry_;
+    std::span<const format::file> files_;
+    std::span<const format::v2_file> v2_files_;
+    std::span<const format::layer> layers_;
+    std::string_view blobs_;
+};
+
+// A cache file mapped read-only. Opening checks the header and table bounds
+// only; entries are read on demand, so start-up costs a few page faults
+// rather than a pass over the data.
+class metadata_cache {
+   public:
+    static std::optional<metadata_cache> open(
+        const std::filesystem::path& path);
+
+    std::size_t size() const;
+    torrent_view operator[](std::size_t i) const;
+
+    // Binary search by the path the entry was stored under.
+    std::optional<torrent_view> find(std::string_view path) const;
+
+   private:
+    explicit metadata_cache(bencode::mapped_file file)
+        : file_{std::move(file)} {}
+
+    const format::header& header() const;
+
+    bencode::mapped_file file_;
+};
+
+// Collects entries and writes them out as a new cache file.
+class cache_writer {
+   public:
+    struct key {
+        std::string path;
+        std::int64_t mtime;
+        std::uint64_t file_size;
+        crypto::sha1_digest content_hash;
+    };
+
+    void add(const key& k, const torrent::torrent& t);
+
+    // Copies a cached entry without decoding it, under a refreshed key.
+    void add(const key& k, const torrent_view& cached);
+
+    // Writes to a temporary file beside path, syncs it and renames it into
+    // place, so that readers never see a partial cache and a crash leaves
+    // either the old file or the new one.
+    bool write(const std::filesystem::path& path) const;
+
+   private:
+    format::blob store(std::string_view bytes);
+
+    std::vector<format::entry> entries_;
+    std::vector<format::file> files_;
+    std::vector<format::v2_file> v2_files_;
+    std::vector<format::layer> layers_;
+    std::string blobs_;
+};
+
+struct refresh_stats {
+    std::size_t reused = 0;
+    std::size_t rehashed = 0;
+    std::size_t parsed = 0;
+    std::size_t failed = 0;
+};
+
+// Brings the cache at cache_path in line with torrents. Entries whose
+// size and mtime still match are copied over as they are; when only the
+// mtime changed, the file is hashed and its entry kept if the contents are
+// the same. Everything else is parsed again. Entries for paths no longer in
+// torrents are dropped. A missing, corrupt or outdated cache is rebuilt from
+// scratch.
+std::optional<refresh_stats> refresh(
+    const std::filesystem::path& cache_path,
+    std::span<const std::filesystem::path> torrents);
+
+}  // namespace cache
@@ -0,0 +1,111 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace concurrency {
+namespace {
+// The pool and queue index of the calling thread, if it is a worker.
+thread_local const thread_pool* current_pool = nullptr;
+thread_local std::size_t current_index = 0;
+}  // namespace
+
+thread_pool::thread_pool(std::size_t threads) {
+    threads = std::max<std::size_t>(threads, 1);
+    queues_.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<queue>());
+    }
+
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++) {
+        workers_.emplace_back([this, i] { run(i); });
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        const auto lock = std::scoped_lock{mutex_};
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    workers_.clear();
+}
+
+void thread_pool::submit(std::function<void()> task) {
+    const auto index =
+        current_pool == this
+            ? current_index
+            : next_queue_.fetch_add(1, std::memory_order_relaxed) %
+                  queues_.size();
+
+    // Counted before it is queued so a worker stealing it cannot take the
+    // count below zero; a worker woken in between just finds the queues
+    // empty and checks again.
+    pending_.fetch_add(1);
+    {
+        auto& target = *queues_[index];
+        const auto lock = std::scoped_lock{target.mutex};
+        target.tasks.push_back(std::move(task));
+    }
+
+    // Either a worker going to sleep sees the task counted, or this sees
+    // it asleep and wakes it; both are sequentially consistent so that one
+    // of the two must happen. Taking mutex_ waits out a worker between its
+    // check and its wait.
+    if (sleeping_.load() > 0) {
+        {
+            const auto lock = std::scoped_lock{mutex_};
+        }
+        wake_.notify_one();
+    }
+}
+
+void thread_pool::run(std::size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    auto task = std::function<void()>{};
+    while (true) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        auto lock = std::unique_lock{mutex_};
+        sleeping_.fetch_add(1);
+        wake_.wait(lock, [this] { return stopping_ || pending_.load() > 0; });
+        sleeping_.fetch_sub(1);
+        if (stopping_ && pending_.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool thread_pool::take(std::size_t index, std::function<void()>& task) {
+    for (std::size_t i = 0; i < queues_.size(); i++) {
+        auto& source = *queues_[(index + i) % queues_.size()];
+        const auto lock = std::scoped_lock{source.mutex};
+        if (source.tasks.empty()) {
+            continue;
+        }
+
+        if (i == 0) {
+            task = std::move(source.tasks.back());
+            source.tasks.pop_back();
+        } else {
+            task = std::move(source.tasks.front());
+            source.tasks.pop_front();
+        }
+        pending_.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+}  // namespace concurrency
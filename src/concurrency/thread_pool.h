@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace concurrency {
+
+// Fixed-size pool with one task queue per worker. Workers take from the back
+// of their own queue and steal from the front of the others' when it runs
+// dry, so a burst of submissions spreads over every core. Tasks submitted
+// from a worker go to that worker's queue.
+class thread_pool {
+   public:
+    explicit thread_pool(
+        std::size_t threads = std::thread::hardware_concurrency());
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // Runs every task already submitted, then joins the workers.
+    ~thread_pool();
+
+    void submit(std::function<void()> task);
+    std::size_t size() const { return workers_.size(); }
+
+   private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(std::size_t index);
+    bool take(std::size_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<queue>> queues_;
+    std::vector<std::jthread> workers_;
+
+    // Tasks queued and not yet taken. Submitting and taking a task only
+    // lock its queue; mutex_ is for idle workers going to sleep and being
+    // woken, and submit takes it only when one is asleep.
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> sleeping_{0};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::atomic<std::size_t> next_queue_{0};
+};
+
+}  // namespace concurrency
@@ -0,0 +1,73 @@
+#include "sha.h"
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace crypto {
+namespace {
+template <typename Digest>
+Digest digest(std::string_view data, const EVP_MD* type) {
+    Digest result{};
+    unsigned int size = 0;
+    EVP_Digest(data.data(), data.size(),
+               reinterpret_cast<unsigned char*>(result.data()), &size, type,
+               nullptr);
+    return result;
+}
+}  // namespace
+
+sha1_digest sha1(std::string_view data) {
+    return digest<sha1_digest>(data, EVP_sha1());
+}
+
+sha256_digest sha256(std::string_view data) {
+    return digest<sha256_digest>(data, EVP_sha256());
+}
+
+sha1_hasher::sha1_hasher() : context_{EVP_MD_CTX_new()} {
+    EVP_DigestInit_ex(context_, EVP_sha1(), nullptr);
+}
+
+sha1_hasher::sha1_hasher(sha1_hasher&& other) noexcept
+    : context_{std::exchange(other.context_, nullptr)} {}
+
+sha1_hasher& sha1_hasher::operator=(sha1_hasher&& other) noexcept {
+    if (this != &other) {
+        EVP_MD_CTX_free(context_);
+        context_ = std::exchange(other.context_, nullptr);
+    }
+    return *this;
+}
+
+sha1_hasher::~sha1_hasher() { EVP_MD_CTX_free(context_); }
+
+void sha1_hasher::update(std::string_view data) {
+    EVP_DigestUpdate(context_, data.data(), data.size());
+}
+
+sha1_digest sha1_hasher::finish() {
+    sha1_digest result{};
+    unsigned int size = 0;
+    EVP_DigestFinal_ex(context_,
+                       reinterpret_cast<unsigned char*>(result.data()), &size);
+    EVP_DigestInit_ex(context_, EVP_sha1(), nullptr);
+    return result;
+}
+
+std::string to_hex(std::span<const std::byte> bytes) {
+    constexpr std::string_view digits = "0123456789abcdef";
+
+    auto result = std::string{};
+    result.reserve(bytes.size() * 2);
+    for (const auto b : bytes) {
+        result.push_back(digits[std::to_integer<unsigned>(b) >> 4]);
+        result.push_back(digits[std::to_integer<unsigned>(b) & 0xf]);
+    }
+    return result;
+}
+}  // namespace crypto
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+
+struct evp_md_ctx_st;
+
+namespace crypto {
+
+using sha1_digest = std::array<std::byte, 20>;
+using sha256_digest = std::array<std::byte, 32>;
+
+sha1_digest sha1(std::string_view data);
+sha256_digest sha256(std::string_view data);
+
+// Incremental SHA-1 for data that arrives in pieces, such as a torrent piece
+// spanning several files. The context is reused across digests, and OpenSSL
+// picks SHA-NI or ARMv8 crypto instructions when the CPU has them.
+class sha1_hasher {
+   public:
+    sha1_hasher();
+    sha1_hasher(sha1_hasher&& other) noexcept;
+    sha1_hasher& operator=(sha1_hasher&& other) noexcept;
+    sha1_hasher(const sha1_hasher&) = delete;
+    sha1_hasher& operator=(const sha1_hasher&) = delete;
+    ~sha1_hasher();
+
+    void update(std::string_view data);
+
+    // Returns the digest of everything since the last finish() and starts
+    // over.
+    sha1_digest finish();
+
+   private:
+    evp_md_ctx_st* context_;
+};
+
+std::string to_hex(std::span<const std::byte> bytes);
+
+}  // namespace crypto
@@ -0,0 +1,296 @@
+#include "krpc.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "encoder.h"
+#include "node_id.h"
+#include "routing_table.h"
+#include "tape.h"
+
+namespace dht {
+namespace {
+using boost::asio::ip::udp;
+
+constexpr std::array<std::string_view, 4> method_names = {
+    "ping", "find_node", "get_peers", "announce_peer"};
+
+std::uint16_t load16(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint16_t>(u[0] << 8 | u[1]);
+}
+
+// Compact peer info: 4-byte address and 2-byte port.
+using compact_peer = std::array<char, 6>;
+
+compact_peer compact(const boost::asio::ip::address_v4& address,
+                     std::uint16_t port) {
+    const auto bytes = address.to_bytes();
+    auto out = compact_peer{};
+    std::memcpy(out.data(), bytes.data(), bytes.size());
+    out[4] = static_cast<char>(port >> 8);
+    out[5] = static_cast<char>(port);
+    return out;
+}
+
+std::string_view as_chars(const node_id& id) {
+    return {reinterpret_cast<const char*>(id.data()), id.size()};
+}
+
+bool load_id(std::optional<bencode::value_ref> v, node_id& out) {
+    if (!v.has_value() || !v->is_string() ||
+        v->as_string().size() != out.size()) {
+        return false;
+    }
+    std::memcpy(out.data(), v->as_string().data(), out.size());
+    return true;
+}
+
+std::optional<std::string_view> string_at(const bencode::dict_ref& d,
+                                          std::string_view key) {
+    const auto v = d.find(key);
+    if (!v.has_value() || !v->is_string()) {
+        return {};
+    }
+    return v->as_string();
+}
+
+bool decode_query(const bencode::dict_ref& root, message& out) {
+    const auto name = string_at(root, "q");
+    const auto args = root.find("a");
+    if (!name.has_value() || !args.has_value() || !args->is_dictionary()) {
+        return false;
+    }
+    const auto a = args->as_dict();
+    if (!load_id(a.find("id"), out.id)) {
+        return false;
+    }
+
+    const auto it =
+        std::find(method_names.begin(), method_names.end(), name.value());
+    out.method = static_cast<method>(it - method_names.begin());
+    switch (out.method) {
+        case method::ping:
+        case method::unknown:
+            return true;
+        case method::find_node:
+            return load_id(a.find("target"), out.target);
+        case method::get_peers:
+            return load_id(a.find("info_hash"), out.target);
+        case method::announce_peer:
+            break;
+    }
+
+    const auto token = string_at(a, "token");
+    if (!load_id(a.find("info_hash"), out.target) || !token.has_value()) {
+        return false;
+    }
+    out.token = token.value();
+    if (const auto implied = a.find("implied_port");
+        implied.has_value() && implied->is_integer()) {
+        out.implied_port = implied->as_integer() != 0;
+    }
+    const auto port = a.find("port");
+    if (port.has_value() && port->is_integer() && port->as_integer() >= 0 &&
+        port->as_integer() <= 65535) {
+        out.port = static_cast<std::uint16_t>(port->as_integer());
+    } else if (!out.implied_port) {
+        return false;
+    }
+    return true;
+}
+
+bool decode_response(const bencode::dict_ref& root, message& out) {
+    const auto reply = root.find("r");
+    if (!reply.has_value() || !reply->is_dictionary()) {
+        return false;
+    }
+    const auto r = reply->as_dict();
+    if (!load_id(r.find("id"), out.id)) {
+        return false;
+    }
+    if (const auto nodes = string_at(r, "nodes"); nodes.has_value()) {
+        if (nodes->size() % compact_node_size != 0) {
+            return false;
+        }
+        out.nodes = nodes.value();
+    }
+    if (const auto token = string_at(r, "token"); token.has_value()) {
+        out.token = token.value();
+    }
+    if (const auto values = r.find("values");
+        values.has_value() && values->is_list()) {
+        for (const auto v : values->as_list()) {
+            if (!v.is_string() || v.as_string().size() != 6) {
+                // Other address families (BEP 32).
+                continue;
+            }
+            const auto bytes = v.as_string();
+            auto address = boost::asio::ip::address_v4::bytes_type{};
+            std::memcpy(address.data(), bytes.data(), address.size());
+            out.values.emplace_back(boost::asio::ip::address_v4{address},
+                                    load16(bytes.data() + 4));
+        }
+    }
+    return true;
+}
+
+bool decode_error(const bencode::dict_ref& root, message& out) {
+    const auto e = root.find("e");
+    if (!e.has_value() || !e->is_list()) {
+        return false;
+    }
+    const auto list = e->as_list();
+    auto it = list.begin();
+    if (it == list.end() || !(*it).is_integer()) {
+        return false;
+    }
+    out.error_code = static_cast<int>((*it).as_integer());
+    if (++it != list.end() && (*it).is_string()) {
+        out.error_message = (*it).as_string();
+    }
+    return true;
+}
+}  // namespace
+
+bool decode(std::string_view packet, message& out) {
+    out.transaction = {};
+    out.method = method::ping;
+    out.port = 0;
+    out.implied_port = false;
+    out.token = {};
+    out.nodes = {};
+    out.values.clear();
+    out.error_code = 0;
+    out.error_message = {};
+
+    thread_local auto arena = std::pmr::unsynchronized_pool_resource{};
+    auto error = bencode::parse_error{};
+    const auto tape = bencode::parse_tape(packet, &error, &arena);
+    if (!tape.has_value() || !tape->root().is_dictionary()) {
+        return false;
+    }
+    const auto root = tape->root().as_dict();
+    const auto transaction = string_at(root, "t");
+    const auto type = string_at(root, "y");
+    if (!transaction.has_value() || !type.has_value()) {
+        return false;
+    }
+    out.transaction = transaction.value();
+
+    if (type.value() == "q") {
+        out.type = message::kind::query;
+        return decode_query(root, out);
+    }
+    if (type.value() == "r") {
+        out.type = message::kind::response;
+        return decode_response(root, out);
+    }
+    if (type.value() == "e") {
+        out.type = message::kind::error;
+        return decode_error(root, out);
+    }
+    return false;
+}
+
+void encode(const message& m, std::string& out) {
+    out.clear();
+    auto e = bencode::encoder{std::back_inserter(out)};
+    e.begin_dict();
+
+    switch (m.type) {
+        case message::kind::query: {
+            e.string("a").begin_dict();
+            e.string("id").string(as_chars(m.id));
+            if (m.method == method::announce_peer) {
+                if (m.implied_port) {
+                    e.string("implied_port").integer(1);
+                }
+                e.string("info_hash").string(as_chars(m.target));
+                e.string("port").integer(m.port);
+            } else if (m.method == method::get_peers) {
+                e.string("info_hash").string(as_chars(m.target));
+            } else if (m.method == method::find_node) {
+                e.string("target").string(as_chars(m.target));
+            }
+            if (m.method == method::announce_peer) {
+                e.string("token").string(m.token);
+            }
+            e.end();
+            const auto index = static_cast<std::size_t>(m.method);
+            e.string("q").string(index < method_names.size()
+                                     ? method_names[index]
+                                     : std::string_view{});
+            break;
+        }
+        case message::kind::response:
+            e.string("r").begin_dict();
+            e.string("id").string(as_chars(m.id));
+            if (!m.nodes.empty()) {
+                e.string("nodes").string(m.nodes);
+            }
+            if (!m.token.empty()) {
+                e.string("token").string(m.token);
+            }
+            if (!m.values.empty()) {
+                e.string("values").begin_list();
+                for (const auto& peer : m.values) {
+                    if (peer.address().is_v4()) {
+                        const auto c =
+                            compact(peer.address().to_v4(), peer.port());
+                        e.string({c.data(), c.size()});
+                    }
+                }
+                e.end();
+            }
+            e.end();
+            break;
+        case message::kind::error:
+            e.string("e").begin_list();
+            e.integer(m.error_code).string(m.error_message);
+            e.end();
+            break;
+    }
+
+    e.string("t").string(m.transaction);
+    const auto type = m.type == message::kind::query      ? "q"
+                      : m.type == message::kind::response ? "r"
+                                                          : "e";
+    e.string("y").string(type);
+    e.end();
+}
+
+void append_node(std::string& out, const node_entry& node) {
+    const auto c =
+        compact(node.endpoint.address().to_v4(), node.endpoint.port());
+    out += as_chars(node.id);
+    out.append(c.data(), c.size());
+}
+
+bool decode_nodes(std::string_view bytes, std::vector<node_entry>& out) {
+    if (bytes.size() % compact_node_size != 0) {
+        return false;
+    }
+    out.reserve(out.size() + bytes.size() / compact_node_size);
+    for (std::size_t i = 0; i < bytes.size(); i += compact_node_size) {
+        auto node = node_entry{};
+        std::memcpy(node.id.data(), bytes.data() + i, node.id.size());
+        auto address = boost::asio::ip::address_v4::bytes_type{};
+        std::memcpy(address.data(), bytes.data() + i + 20, address.size());
+        node.endpoint = udp::endpoint{boost::asio::ip::address_v4{address},
+                                      load16(bytes.data() + i + 24)};
+        out.push_back(node);
+    }
+    return true;
+}
+
+}  // namespace dht
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "node_id.h"
+#include "routing_table.h"
+
+// KRPC, the bencoded query/response protocol DHT nodes speak over UDP
+// (BEP 5). IPv4 only.
+namespace dht {
+
+enum class method : std::uint8_t {
+    ping,
+    find_node,
+    get_peers,
+    announce_peer,
+    // A query this node does not implement.
+    unknown,
+};
+
+enum error_code : int {
+    generic_error = 201,
+    server_error = 202,
+    protocol_error = 203,
+    method_unknown = 204,
+};
+
+// 20-byte id, 4-byte address and 2-byte port.
+constexpr std::size_t compact_node_size = 26;
+
+struct message {
+    enum class kind : std::uint8_t { query, response, error };
+
+    kind type = kind::query;
+    std::string_view transaction;
+    node_id id{};
+
+    dht::method method = method::ping;
+    // find_node's target, or the info-hash of get_peers and announce_peer.
+    node_id target{};
+    std::uint16_t port = 0;
+    bool implied_port = false;
+    // Handed out by get_peers responses and returned by announce_peer.
+    std::string_view token;
+
+    // Compact node info, in find_node and get_peers responses.
+    std::string_view nodes;
+    std::vector<boost::asio::ip::tcp::endpoint> values;
+
+    int error_code = 0;
+    std::string_view error_message;
+};
+
+// Decodes packet into out, reusing its capacity; strings are views into
+// packet. Returns false for anything that is not a well-formed message.
+bool decode(std::string_view packet, message& out);
+
+// Replaces the contents of out with m. Queries carry the arguments of their
+// method; responses carry whichever of nodes, token and values are set.
+void encode(const message& m, std::string& out);
+
+void append_node(std::string& out, const node_entry& node);
+// Appends the nodes in compact node info. Returns false, appending nothing,
+// if bytes is not a whole number of entries.
+bool decode_nodes(std::string_view bytes, std::vector<node_entry>& out);
+
+}  // namespace dht
@@ -0,0 +1,577 @@
+#include "node.h"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "krpc.h"
+#include "node_id.h"
+#include "routing_table.h"
+#include "sha.h"
+
+namespace dht {
+namespace {
+using boost::asio::redirect_error;
+using boost::asio::use_awaitable;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using std::chrono::steady_clock;
+
+constexpr std::size_t token_size = 8;
+// Candidates a lookup keeps, per slot of a bucket.
+constexpr std::size_t candidates_per_slot = 4;
+// Peers returned for one get_peers, which keeps the response in one
+// unfragmented datagram.
+constexpr std::size_t max_values = 100;
+
+// Lookups hear of the same peer from many nodes.
+void dedupe(std::vector<tcp::endpoint>& peers, std::size_t from) {
+    const auto first = peers.begin() + static_cast<std::ptrdiff_t>(from);
+    std::sort(first, peers.end());
+    peers.erase(std::unique(first, peers.end()), peers.end());
+}
+
+std::uint16_t load16(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint16_t>(u[0] << 8 | u[1]);
+}
+}  // namespace
+
+struct node::channel {
+    struct pending {
+        udp::endpoint endpoint;
+        boost::asio::steady_timer* timer;
+        std::function<void(const message&)>* on_reply;
+        bool answered = false;
+        bool ok = false;
+    };
+
+    channel(boost::asio::any_io_executor executor, const udp::endpoint& bind)
+        : socket{executor, bind} {}
+
+    udp::socket socket;
+    // Cleared when the node goes away.
+    node* owner = nullptr;
+    std::unordered_map<std::uint16_t, pending*> pending_replies;
+    // Large enough for any datagram.
+    std::array<char, 65536> buffer;
+};
+
+struct node::lookup {
+    enum class state : std::uint8_t { fresh, querying, answered, failed };
+
+    struct candidate {
+        node_entry node;
+        std::size_t hop;
+        lookup::state status = state::fresh;
+        std::string token;
+    };
+
+    lookup(boost::asio::any_io_executor executor, const node_id& target,
+           dht::method method, std::vector<tcp::endpoint>* peers)
+        : target{target}, method{method}, peers{peers}, wake{executor} {}
+
+    // Keeps candidates sorted by distance, each node once.
+    void add(const node_entry& n, std::size_t hop, const node_id& self,
+             std::size_t limit) {
+        if (n.id == self || n.endpoint.port() == 0) {
+            return;
+        }
+        const auto it = std::lower_bound(
+            candidates.begin(), candidates.end(), n.id,
+            [this](const candidate& c, const node_id& id) {
+                return closer(target, c.node.id, id);
+            });
+        if (it != candidates.end() && it->node.id == n.id) {
+            return;
+        }
+        if (candidates.size() == limit) {
+            if (it == candidates.end()) {
+                return;
+            }
+            candidates.pop_back();
+        }
+        candidates.insert(it, candidate{n, hop, state::fresh, {}});
+    }
+
+    candidate* find(const node_id& id) {
+        for (auto& c : candidates) {
+            if (c.node.id == id) {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+
+    node_id target;
+    dht::method method;
+    std::vector<tcp::endpoint>* peers;
+    // Closest to the target first.
+    std::vector<candidate> candidates;
+    std::size_t in_flight = 0;
+    // Cancelled whenever a query finishes.
+    boost::asio::steady_timer wake;
+    lookup_result result;
+};
+
+std::size_t node::id_hash::operator()(const node_id& id) const {
+    // Ids are as good as random already.
+    auto h = std::size_t{};
+    std::memcpy(&h, id.data(), sizeof(h));
+    return h;
+}
+
+node::node(boost::asio::any_io_executor executor, const udp::endpoint& bind,
+           const node_id& id, const node_options& options)
+    : executor_{executor},
+      options_{options},
+      table_{id, options.bucket_size},
+      channel_{std::make_shared<channel>(executor, bind)},
+      random_{std::random_device{}()},
+      next_transaction_{static_cast<std::uint16_t>(random_())},
+      secrets_{random_(), random_()},
+      next_rotation_{steady_clock::now() + options.token_rotation},
+      rate_window_{steady_clock::now()} {
+    channel_->owner = this;
+    boost::asio::co_spawn(executor_, receive(channel_), boost::asio::detached);
+}
+
+node::~node() {
+    channel_->owner = nullptr;
+    close();
+}
+
+udp::endpoint node::local_endpoint() const {
+    auto ec = boost::system::error_code{};
+    return channel_->socket.local_endpoint(ec);
+}
+
+void node::close() {
+    auto ec = boost::system::error_code{};
+    channel_->socket.close(ec);
+    for (const auto& [id, p] : channel_->pending_replies) {
+        p->timer->cancel();
+    }
+}
+
+boost::asio::awaitable<void> node::receive(std::shared_ptr<channel> c) {
+    auto m = message{};
+    auto reply = std::string{};
+    while (c->socket.is_open()) {
+        auto ec = boost::system::error_code{};
+        auto from = udp::endpoint{};
+        const auto n = co_await c->socket.async_receive_from(
+            boost::asio::buffer(c->buffer), from,
+            redirect_error(use_awaitable, ec));
+        if (c->owner == nullptr) {
+            break;
+        }
+        if (ec) {
+            continue;
+        }
+        c->owner->packets_received_++;
+        if (!from.address().is_v4() || !decode({c->buffer.data(), n}, m)) {
+            continue;
+        }
+
+        if (m.type == message::kind::query) {
+            c->owner->answer(m, from, reply);
+            if (!reply.empty()) {
+                co_await c->socket.async_send_to(
+                    boost::asio::buffer(reply), from,
+                    redirect_error(use_awaitable, ec));
+                if (c->owner != nullptr) {
+                    c->owner->packets_sent_++;
+                }
+            }
+            continue;
+        }
+
+        if (m.transaction.size() != 2) {
+            continue;
+        }
+        const auto it = c->pending_replies.find(load16(m.transaction.data()));
+        if (it == c->pending_replies.end() || it->second->endpoint != from) {
+            continue;
+        }
+        auto& p = *it->second;
+        c->pending_replies.erase(it);
+        p.answered = true;
+        if (m.type == message::kind::response) {
+            p.ok = true;
+            (*p.on_reply)(m);
+            c->owner->table_.heard_from({m.id, from});
+        }
+        p.timer->cancel();
+    }
+}
+
+void node::answer(const message& q, const udp::endpoint& from,
+                  std::string& reply) {
+    reply.clear();
+    const auto address = from.address().to_v4();
+    if (over_rate(address)) {
+        return;
+    }
+    rotate_secrets();
+    table_.heard_from({q.id, from});
+
+    auto r = message{};
+    r.type = message::kind::response;
+    r.transaction = q.transaction;
+    r.id = id();
+
+    auto nodes = std::string{};
+    auto token = std::string{};
+    const auto add_closest = [&] {
+        auto closest = std::vector<node_entry>(options_.bucket_size);
+        closest.resize(table_.closest(q.target, closest));
+        for (const auto& n : closest) {
+            append_node(nodes, n);
+        }
+        r.nodes = nodes;
+    };
+
+    switch (q.method) {
+        case method::ping:
+            break;
+        case method::find_node:
+            add_closest();
+            break;
+        case method::get_peers:
+            // Nodes as well as any peers, so lookups can go on past us.
+            add_closest();
+            append_peers(q.target, r.values);
+            token = token_for(address, secrets_[0]);
+            r.token = token;
+            break;
+        case method::announce_peer:
+            if (!valid_token(q.token, address)) {
+                r.type = message::kind::error;
+                r.error_code = protocol_error;
+                r.error_message = "Bad token";
+                break;
+            }
+            store_peer(q.target,
+                       {address, q.implied_port ? from.port() : q.port});
+            break;
+        case method::unknown:
+            r.type = message::kind::error;
+            r.error_code = method_unknown;
+            r.error_message = "Method Unknown";
+            break;
+    }
+    encode(r, reply);
+}
+
+bool node::over_rate(const boost::asio::ip::address_v4& address) {
+    if (options_.rate_limit == 0) {
+        return false;
+    }
+    const auto now = steady_clock::now();
+    if (now - rate_window_ >= std::chrono::seconds{1}) {
+        rates_.clear();
+        rate_window_ = now;
+    }
+    return ++rates_[address.to_uint()] > options_.rate_limit;
+}
+
+void node::rotate_secrets() {
+    const auto now = steady_clock::now();
+    if (now < next_rotation_) {
+        return;
+    }
+    secrets_[1] = secrets_[0];
+    secrets_[0] = random_();
+    next_rotation_ = now + options_.token_rotation;
+}
+
+std::string node::token_for(const boost::asio::ip::address_v4& address,
+                            std::uint64_t secret) const {
+    auto input = std::array<char, sizeof(secret) + 4>{};
+    std::memcpy(input.data(), &secret, sizeof(secret));
+    const auto bytes = address.to_bytes();
+    std::memcpy(input.data() + sizeof(secret), bytes.data(), bytes.size());
+    const auto digest = crypto::sha1({input.data(), input.size()});
+    return {reinterpret_cast<const char*>(digest.data()), token_size};
+}
+
+bool node::valid_token(std::string_view token,
+                       const boost::asio::ip::address_v4& address) {
+    return token.size() == token_size &&
+           (token == token_for(address, secrets_[0]) ||
+            token == token_for(address, secrets_[1]));
+}
+
+void node::store_peer(const node_id& info_hash, const tcp::endpoint& peer) {
+    auto it = peers_.find(info_hash);
+    if (it == peers_.end()) {
+        if (peers_.size() >= options_.max_torrents) {
+            return;
+        }
+        it = peers_.try_emplace(info_hash).first;
+    }
+
+    auto& stored = it->second;
+    const auto now = steady_clock::now();
+    for (auto& s : stored) {
+        if (s.endpoint == peer) {
+            s.added = now;
+            return;
+        }
+    }
+    if (stored.size() < options_.max_peers) {
+        stored.push_back({peer, now});
+        return;
+    }
+    // Full: the peer heard from longest ago makes room.
+    *std::min_element(stored.begin(), stored.end(),
+                      [](const stored_peer& a, const stored_peer& b) {
+                          return a.added < b.added;
+                      }) = {peer, now};
+}
+
+void node::append_peers(const node_id& info_hash,
+                        std::vector<tcp::endpoint>& out) {
+    const auto it = peers_.find(info_hash);
+    if (it == peers_.end()) {
+        return;
+    }
+    auto& stored = it->second;
+    const auto expired = steady_clock::now() - options_.peer_lifetime;
+    std::erase_if(stored, [expired](const stored_peer& s) {
+        return s.added < expired;
+    });
+    if (stored.empty()) {
+        peers_.erase(it);
+        return;
+    }
+    for (std::size_t i = 0; i < stored.size() && i < max_values; i++) {
+        out.push_back(stored[i].endpoint);
+    }
+}
+
+boost::asio::awaitable<bool> node::transact(
+    const udp::endpoint& endpoint, message& q,
+    std::function<void(const message&)> on_reply) {
+    const auto c = channel_;
+    if (!c->socket.is_open()) {
+        co_return false;
+    }
+    auto id = next_transaction_++;
+    while (c->pending_replies.contains(id)) {
+        id = next_transaction_++;
+    }
+    const auto transaction = std::array<char, 2>{static_cast<char>(id >> 8),
+                                                 static_cast<char>(id)};
+    q.type = message::kind::query;
+    q.transaction = {transaction.data(), transaction.size()};
+    auto packet = std::string{};
+    encode(q, packet);
+
+    auto timer = boost::asio::steady_timer{executor_};
+    auto p = channel::pending{endpoint, &timer, &on_reply};
+    c->pending_replies.emplace(id, &p);
+
+    auto ec = boost::system::error_code{};
+    co_await c->socket.async_send_to(boost::asio::buffer(packet), endpoint,
+                                     redirect_error(use_awaitable, ec));
+    packets_sent_++;
+    if (!ec && !p.answered) {
+        timer.expires_after(options_.timeout);
+        co_await timer.async_wait(redirect_error(use_awaitable, ec));
+    }
+    if (!p.answered) {
+        c->pending_replies.erase(id);
+    }
+    co_return p.ok;
+}
+
+boost::asio::awaitable<bool> node::ping(const udp::endpoint& endpoint) {
+    auto q = message{};
+    q.method = method::ping;
+    q.id = id();
+    co_return co_await transact(endpoint, q, [](const message&) {});
+}
+
+boost::asio::awaitable<lookup_result> node::bootstrap(
+    std::span<const udp::endpoint> contacts) {
+    for (const auto& contact : contacts) {
+        co_await ping(contact);
+    }
+    co_return co_await find_node(id());
+}
+
+boost::asio::awaitable<lookup_result> node::find_node(const node_id& target) {
+    const auto l = std::make_shared<lookup>(executor_, target,
+                                            method::find_node, nullptr);
+    co_await run_lookup(l);
+    co_return l->result;
+}
+
+boost::asio::awaitable<lookup_result> node::get_peers(
+    const node_id& info_hash, std::vector<tcp::endpoint>& peers) {
+    const auto before = peers.size();
+    const auto l = std::make_shared<lookup>(executor_, info_hash,
+                                            method::get_peers, &peers);
+    co_await run_lookup(l);
+
+    dedupe(peers, before);
+    co_return l->result;
+}
+
+boost::asio::awaitable<lookup_result> node::announce(
+    const node_id& info_hash, std::uint16_t port,
+    std::vector<tcp::endpoint>& peers) {
+    const auto before = peers.size();
+    const auto l = std::make_shared<lookup>(executor_, info_hash,
+                                            method::get_peers, &peers);
+    co_await run_lookup(l);
+
+    dedupe(peers, before);
+
+    std::size_t sent = 0;
+    for (const auto& c : l->candidates) {
+        if (sent == options_.bucket_size) {
+            break;
+        }
+        if (c.status != lookup::state::answered || c.token.empty()) {
+            continue;
+        }
+        sent++;
+        l->in_flight++;
+        boost::asio::co_spawn(executor_,
+                              send_announce(l, c.node, c.token, port),
+                              boost::asio::detached);
+    }
+    while (l->in_flight > 0) {
+        auto ec = boost::system::error_code{};
+        l->wake.expires_at(steady_clock::time_point::max());
+        co_await l->wake.async_wait(redirect_error(use_awaitable, ec));
+    }
+    co_return l->result;
+}
+
+boost::asio::awaitable<void> node::run_lookup(std::shared_ptr<lookup> l) {
+    const auto k = options_.bucket_size;
+    const auto limit = k * candidates_per_slot;
+    auto seeds = std::vector<node_entry>(k);
+    seeds.resize(table_.closest(l->target, seeds));
+    for (const auto& n : seeds) {
+        l->add(n, 1, id(), limit);
+    }
+
+    while (true) {
+        // Keep alpha queries going to the k closest nodes not known to have
+        // failed; once all of those have answered, the lookup is done.
+        std::size_t considered = 0;
+        for (auto& c : l->candidates) {
+            if (considered == k || l->in_flight >= options_.alpha) {
+                break;
+            }
+            if (c.status == lookup::state::failed) {
+                continue;
+            }
+            considered++;
+            if (c.status == lookup::state::fresh) {
+                c.status = lookup::state::querying;
+                l->in_flight++;
+                boost::asio::co_spawn(executor_, visit(l, c.node, c.hop),
+                                      boost::asio::detached);
+            }
+        }
+        if (l->in_flight == 0) {
+            break;
+        }
+        auto ec = boost::system::error_code{};
+        l->wake.expires_at(steady_clock::time_point::max());
+        co_await l->wake.async_wait(redirect_error(use_awaitable, ec));
+    }
+
+    std::size_t closest = 0;
+    for (const auto& c : l->candidates) {
+        if (closest == k) {
+            break;
+        }
+        if (c.status == lookup::state::answered) {
+            l->result.hops = std::max(l->result.hops, c.hop);
+            closest++;
+        }
+    }
+}
+
+boost::asio::awaitable<void> node::visit(std::shared_ptr<lookup> l,
+                                         node_entry n, std::size_t hop) {
+    auto q = message{};
+    q.method = l->method;
+    q.id = id();
+    q.target = l->target;
+
+    auto learned = std::vector<node_entry>{};
+    auto token = std::string{};
+    l->result.queries++;
+    const auto ok = co_await transact(n.endpoint, q, [&](const message& r) {
+        decode_nodes(r.nodes, learned);
+        token = r.token;
+        if (l->peers != nullptr) {
+            l->peers->insert(l->peers->end(), r.values.begin(),
+                             r.values.end());
+        }
+    });
+
+    l->in_flight--;
+    if (auto* c = l->find(n.id); c != nullptr) {
+        c->status = ok ? lookup::state::answered : lookup::state::failed;
+        c->token = std::move(token);
+    }
+    if (ok) {
+        l->result.responses++;
+        for (const auto& next : learned) {
+            l->add(next, hop + 1, id(),
+                   options_.bucket_size * candidates_per_slot);
+        }
+    } else {
+        table_.failed(n.id);
+    }
+    l->wake.cancel();
+}
+
+boost::asio::awaitable<void> node::send_announce(std::shared_ptr<lookup> l,
+                                                 node_entry n,
+                                                 std::string token,
+                                                 std::uint16_t port) {
+    auto q = message{};
+    q.method = method::announce_peer;
+    q.id = id();
+    q.target = l->target;
+    q.port = port;
+    q.implied_port = port == 0;
+    q.token = token;
+
+    l->result.queries++;
+    if (co_await transact(n.endpoint, q, [](const message&) {})) {
+        l->result.announced++;
+    }
+    l->in_flight--;
+    l->wake.cancel();
+}
+
+}  // namespace dht
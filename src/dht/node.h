@@ -0,0 +1,162 @@
+#pragma once
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "krpc.h"
+#include "node_id.h"
+#include "routing_table.h"
+
+namespace dht {
+
+struct node_options {
+    // How long a query waits for its answer before the lookup moves on.
+    std::chrono::milliseconds timeout{2000};
+    // Queries a lookup keeps in flight.
+    std::size_t alpha = 3;
+    std::size_t bucket_size = 8;
+    // Queries answered per second from one address; 0 for no limit.
+    std::size_t rate_limit = 50;
+    // Secrets tokens are derived from are replaced this often, and a token
+    // stays good until the secret after next.
+    std::chrono::milliseconds token_rotation = std::chrono::minutes{5};
+    // Announced peers are forgotten after this long.
+    std::chrono::milliseconds peer_lifetime = std::chrono::minutes{30};
+    std::size_t max_peers = 100;
+    std::size_t max_torrents = 2000;
+};
+
+struct lookup_result {
+    // Rounds of queries it took to reach the closest nodes that answered.
+    std::size_t hops = 0;
+    std::size_t queries = 0;
+    std::size_t responses = 0;
+    // Nodes that took the announcement.
+    std::size_t announced = 0;
+};
+
+// A BEP 5 DHT node on one IPv4 UDP socket. It answers ping, find_node,
+// get_peers and announce_peer for others, and runs iterative lookups with
+// alpha queries in flight, every answer narrowing the candidates towards
+// the target. Replies are matched to queries by transaction id and read
+// straight out of the receive buffer. Use from a single thread.
+class node {
+   public:
+    node(boost::asio::any_io_executor executor,
+         const boost::asio::ip::udp::endpoint& bind, const node_id& id,
+         const node_options& options = {});
+    ~node();
+
+    node(const node&) = delete;
+    node& operator=(const node&) = delete;
+
+    const node_id& id() const { return table_.self(); }
+    const routing_table& table() const { return table_; }
+    boost::asio::ip::udp::endpoint local_endpoint() const;
+
+    // Stops answering; queries in flight time out.
+    void close();
+
+    boost::asio::awaitable<bool> ping(
+        const boost::asio::ip::udp::endpoint& endpoint);
+
+    // Pings the contacts, then looks up our own id to fill the table.
+    boost::asio::awaitable<lookup_result> bootstrap(
+        std::span<const boost::asio::ip::udp::endpoint> contacts);
+
+    boost::asio::awaitable<lookup_result> find_node(const node_id& target);
+
+    // Appends the peers found for info_hash, each once.
+    boost::asio::awaitable<lookup_result> get_peers(
+        const node_id& info_hash,
+        std::vector<boost::asio::ip::tcp::endpoint>& peers);
+
+    // get_peers, then announce_peer to the k closest nodes that answered.
+    // A port of 0 asks them to use the port our queries come from.
+    boost::asio::awaitable<lookup_result> announce(
+        const node_id& info_hash, std::uint16_t port,
+        std::vector<boost::asio::ip::tcp::endpoint>& peers);
+
+    std::size_t packets_sent() const { return packets_sent_; }
+    std::size_t packets_received() const { return packets_received_; }
+
+   private:
+    // The socket side is shared with the loop reading it, which may outlive
+    // the node by one completion.
+    struct channel;
+    struct lookup;
+
+    struct stored_peer {
+        boost::asio::ip::tcp::endpoint endpoint;
+        std::chrono::steady_clock::time_point added;
+    };
+
+    struct id_hash {
+        std::size_t operator()(const node_id& id) const;
+    };
+
+    static boost::asio::awaitable<void> receive(std::shared_ptr<channel> c);
+
+    // Fills reply with the answer to q, or leaves it empty to stay silent.
+    void answer(const message& q, const boost::asio::ip::udp::endpoint& from,
+                std::string& reply);
+    bool over_rate(const boost::asio::ip::address_v4& address);
+    void rotate_secrets();
+    std::string token_for(const boost::asio::ip::address_v4& address,
+                          std::uint64_t secret) const;
+    bool valid_token(std::string_view token,
+                     const boost::asio::ip::address_v4& address);
+    void store_peer(const node_id& info_hash,
+                    const boost::asio::ip::tcp::endpoint& peer);
+    void append_peers(const node_id& info_hash,
+                      std::vector<boost::asio::ip::tcp::endpoint>& out);
+
+    // Sends q, whose transaction id is filled in here, and waits for the
+    // answer. on_reply sees a response in place.
+    boost::asio::awaitable<bool> transact(
+        const boost::asio::ip::udp::endpoint& endpoint, message& q,
+        std::function<void(const message&)> on_reply);
+
+    // Queries the closest candidates until the k closest have answered.
+    boost::asio::awaitable<void> run_lookup(std::shared_ptr<lookup> l);
+    boost::asio::awaitable<void> visit(std::shared_ptr<lookup> l,
+                                       node_entry n, std::size_t hop);
+    boost::asio::awaitable<void> send_announce(std::shared_ptr<lookup> l,
+                                               node_entry n,
+                                               std::string token,
+                                               std::uint16_t port);
+
+    boost::asio::any_io_executor executor_;
+    node_options options_;
+    routing_table table_;
+    std::shared_ptr<channel> channel_;
+    std::mt19937_64 random_;
+    std::uint16_t next_transaction_;
+
+    std::array<std::uint64_t, 2> secrets_;
+    std::chrono::steady_clock::time_point next_rotation_;
+
+    std::unordered_map<std::uint32_t, std::size_t> rates_;
+    std::chrono::steady_clock::time_point rate_window_;
+
+    std::unordered_map<node_id, std::vector<stored_peer>, id_hash> peers_;
+
+    std::size_t packets_sent_ = 0;
+    std::size_t packets_received_ = 0;
+};
+
+}  // namespace dht
@@ -0,0 +1,50 @@
+#include "node_id.h"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace dht {
+
+node_id distance(const node_id& a, const node_id& b) {
+    auto d = node_id{};
+    for (std::size_t i = 0; i < d.size(); i++) {
+        d[i] = a[i] ^ b[i];
+    }
+    return d;
+}
+
+std::size_t common_prefix(const node_id& a, const node_id& b) {
+    for (std::size_t i = 0; i < a.size(); i++) {
+        const auto x = static_cast<std::uint8_t>(a[i] ^ b[i]);
+        if (x != 0) {
+            return i * 8 + static_cast<std::size_t>(std::countl_zero(x));
+        }
+    }
+    return a.size() * 8;
+}
+
+bool closer(const node_id& target, const node_id& a, const node_id& b) {
+    for (std::size_t i = 0; i < target.size(); i++) {
+        const auto x = a[i] ^ target[i];
+        const auto y = b[i] ^ target[i];
+        if (x != y) {
+            return x < y;
+        }
+    }
+    return false;
+}
+
+node_id random_id(std::mt19937_64& random) {
+    auto id = node_id{};
+    for (std::size_t i = 0; i < id.size(); i += 8) {
+        const auto word = random();
+        for (std::size_t j = i; j < id.size() && j < i + 8; j++) {
+            id[j] = static_cast<std::byte>(word >> ((j - i) * 8));
+        }
+    }
+    return id;
+}
+
+}  // namespace dht
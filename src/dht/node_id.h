@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <random>
+
+#include "sha.h"
+
+namespace dht {
+
+// Node ids and info-hashes share one 160-bit space, ordered by XOR distance.
+using node_id = crypto::sha1_digest;
+
+node_id distance(const node_id& a, const node_id& b);
+
+// Number of leading bits a and b have in common: 160 when they are equal.
+std::size_t common_prefix(const node_id& a, const node_id& b);
+
+// Whether a is closer to target than b.
+bool closer(const node_id& target, const node_id& a, const node_id& b);
+
+node_id random_id(std::mt19937_64& random);
+
+}  // namespace dht
@@ -0,0 +1,144 @@
+#include "routing_table.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "node_id.h"
+
+namespace dht {
+namespace {
+constexpr std::size_t id_bits = 160;
+}  // namespace
+
+routing_table::routing_table(const node_id& self, std::size_t bucket_size)
+    : self_{self},
+      k_{std::max<std::size_t>(bucket_size, 1)},
+      ids_(k_),
+      endpoints_(k_),
+      fails_(k_),
+      counts_(1) {}
+
+std::size_t routing_table::size() const {
+    std::size_t n = 0;
+    for (const auto c : counts_) {
+        n += c;
+    }
+    return n;
+}
+
+std::size_t routing_table::bucket_for(const node_id& id) const {
+    return std::min(common_prefix(self_, id), counts_.size() - 1);
+}
+
+std::ptrdiff_t routing_table::find(std::size_t b, const node_id& id) const {
+    const auto first = b * k_;
+    for (std::size_t i = first; i < first + counts_[b]; i++) {
+        if (ids_[i] == id) {
+            return static_cast<std::ptrdiff_t>(i);
+        }
+    }
+    return -1;
+}
+
+void routing_table::remove(std::size_t slot) {
+    const auto b = slot / k_;
+    const auto last = b * k_ + counts_[b] - 1;
+    for (auto i = slot; i < last; i++) {
+        ids_[i] = ids_[i + 1];
+        endpoints_[i] = endpoints_[i + 1];
+        fails_[i] = fails_[i + 1];
+    }
+    counts_[b]--;
+}
+
+void routing_table::split() {
+    const auto b = counts_.size() - 1;
+    counts_.push_back(0);
+    ids_.resize(counts_.size() * k_);
+    endpoints_.resize(counts_.size() * k_);
+    fails_.resize(counts_.size() * k_);
+
+    // Nodes sharing more than b bits with us move to the new bucket.
+    auto kept = b * k_;
+    auto moved = (b + 1) * k_;
+    for (auto i = b * k_; i < b * k_ + counts_[b]; i++) {
+        const auto to = common_prefix(self_, ids_[i]) > b ? moved++ : kept++;
+        ids_[to] = ids_[i];
+        endpoints_[to] = endpoints_[i];
+        fails_[to] = fails_[i];
+    }
+    counts_[b + 1] = moved - (b + 1) * k_;
+    counts_[b] = kept - b * k_;
+}
+
+bool routing_table::heard_from(const node_entry& node) {
+    if (node.id == self_) {
+        return false;
+    }
+
+    for (;;) {
+        const auto b = bucket_for(node.id);
+        const auto first = b * k_;
+        if (const auto i = find(b, node.id); i >= 0) {
+            // Most recently heard from goes last.
+            remove(static_cast<std::size_t>(i));
+        } else if (counts_[b] == k_) {
+            if (b + 1 == counts_.size() && b + 1 < id_bits) {
+                split();
+                continue;
+            }
+            const auto worst = std::max_element(
+                fails_.begin() + static_cast<std::ptrdiff_t>(first),
+                fails_.begin() + static_cast<std::ptrdiff_t>(first + k_));
+            if (*worst == 0) {
+                return false;
+            }
+            remove(static_cast<std::size_t>(worst - fails_.begin()));
+        }
+
+        const auto slot = first + counts_[b]++;
+        ids_[slot] = node.id;
+        endpoints_[slot] = node.endpoint;
+        fails_[slot] = 0;
+        return true;
+    }
+}
+
+void routing_table::failed(const node_id& id) {
+    const auto b = bucket_for(id);
+    if (const auto i = find(b, id); i >= 0) {
+        const auto slot = static_cast<std::size_t>(i);
+        if (++fails_[slot] >= max_fails) {
+            remove(slot);
+        }
+    }
+}
+
+std::size_t routing_table::closest(const node_id& target,
+                                   std::span<node_entry> out) const {
+    if (out.empty()) {
+        return 0;
+    }
+
+    // Insertion into the few slots of out, over every slot of the table.
+    std::size_t n = 0;
+    for (std::size_t b = 0; b < counts_.size(); b++) {
+        for (auto i = b * k_; i < b * k_ + counts_[b]; i++) {
+            if (n == out.size() && !closer(target, ids_[i], out[n - 1].id)) {
+                continue;
+            }
+            auto at = std::min(n, out.size() - 1);
+            while (at > 0 && closer(target, ids_[i], out[at - 1].id)) {
+                out[at] = out[at - 1];
+                at--;
+            }
+            out[at] = {ids_[i], endpoints_[i]};
+            n = std::min(n + 1, out.size());
+        }
+    }
+    return n;
+}
+
+}  // namespace dht
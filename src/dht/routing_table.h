@@ -0,0 +1,68 @@
+#pragma once
+
+#include <boost/asio/ip/udp.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "node_id.h"
+
+namespace dht {
+
+struct node_entry {
+    node_id id;
+    boost::asio::ip::udp::endpoint endpoint;
+};
+
+// Kademlia buckets of up to k nodes, by how many leading bits a node
+// shares with our own id. The last bucket holds everyone closer still and
+// splits when it overflows, so the table only grows deep around us.
+// Buckets are fixed-size runs of slots in flat arrays, ids apart from the
+// rest, so a lookup scans one contiguous block of ids.
+class routing_table {
+   public:
+    explicit routing_table(const node_id& self, std::size_t bucket_size = 8);
+
+    const node_id& self() const { return self_; }
+    std::size_t size() const;
+    std::size_t bucket_count() const { return counts_.size(); }
+    std::size_t bucket_size() const { return k_; }
+
+    // Adds or refreshes a node that answered or queried us. A full bucket
+    // makes room only by dropping a node that has stopped answering, so
+    // long-lived nodes are kept over new ones. Returns whether the node is
+    // in the table.
+    bool heard_from(const node_entry& node);
+
+    // A query to id went unanswered. Nodes that keep failing are dropped.
+    void failed(const node_id& id);
+
+    // Fills out with the nodes closest to target, closest first, and
+    // returns how many there were.
+    std::size_t closest(const node_id& target,
+                        std::span<node_entry> out) const;
+
+   private:
+    // Unanswered queries in a row before a node is dropped.
+    static constexpr std::uint8_t max_fails = 3;
+
+    std::size_t bucket_for(const node_id& id) const;
+    // Position of id in bucket b, or -1.
+    std::ptrdiff_t find(std::size_t b, const node_id& id) const;
+    void remove(std::size_t slot);
+    void split();
+
+    node_id self_;
+    std::size_t k_;
+
+    // Slots [b * k, b * k + counts_[b]) hold bucket b, least recently
+    // heard from first.
+    std::vector<node_id> ids_;
+    std::vector<boost::asio::ip::udp::endpoint> endpoints_;
+    std::vector<std::uint8_t> fails_;
+    std::vector<std::size_t> counts_;
+};
+
+}  // namespace dht
@@ -0,0 +1,223 @@
+#include "exchange.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "extension.h"
+#include "fetcher.h"
+#include "message.h"
+#include "peer_connection.h"
+
+namespace metadata {
+namespace {
+// Requests in flight per peer. Pieces are small, so a few cover the round
+// trip.
+constexpr std::size_t pipeline = 4;
+
+struct peer_state {
+    // The peer's id for ut_metadata, once its extension handshake is in.
+    std::uint8_t ut_metadata = 0;
+    std::vector<std::uint32_t> outstanding;
+};
+
+// Connections on every core share one handler, so their state is kept by
+// connection. Each entry is only touched from its connection's core.
+class peer_table {
+   public:
+    peer_state& get(const session::peer_connection& peer) {
+        const auto lock = std::lock_guard{mutex_};
+        return peers_[&peer];
+    }
+
+    peer_state take(const session::peer_connection& peer) {
+        const auto lock = std::lock_guard{mutex_};
+        auto node = peers_.extract(&peer);
+        return node.empty() ? peer_state{} : std::move(node.mapped());
+    }
+
+   private:
+    std::mutex mutex_;
+    std::unordered_map<const session::peer_connection*, peer_state> peers_;
+};
+
+void send_extended(session::peer_connection& peer, std::string payload) {
+    const auto owned = std::make_shared<std::string>(std::move(payload));
+    peer.send(wire::unknown{extended_id, *owned}, owned);
+}
+
+// The extension id and the rest of m, if it is an extension message.
+std::optional<std::pair<std::uint8_t, std::string_view>> extension(
+    const wire::message& m) {
+    const auto* u = std::get_if<wire::unknown>(&m);
+    if (u == nullptr || u->id != extended_id || u->payload.empty()) {
+        return {};
+    }
+    return std::pair{static_cast<std::uint8_t>(u->payload[0]),
+                     u->payload.substr(1)};
+}
+
+void request_more(session::peer_connection& peer, peer_state& s,
+                  fetcher& f) {
+    auto payload = std::string{};
+    while (s.outstanding.size() < pipeline) {
+        const auto piece = f.pick(s.outstanding.empty());
+        if (!piece.has_value()) {
+            break;
+        }
+        s.outstanding.push_back(piece.value());
+        encode(s.ut_metadata,
+               {metadata_type::request, piece.value(), 0, {}}, payload);
+        send_extended(peer, std::move(payload));
+    }
+    // An idle peer gets nothing only once another one has finished.
+    if (s.outstanding.empty()) {
+        peer.close();
+    }
+}
+}  // namespace
+
+session::peer_handler serve(std::shared_ptr<const std::string> info,
+                            const wire::handshake& local) {
+    const auto peers = std::make_shared<peer_table>();
+    auto handler = session::peer_handler{};
+
+    handler.on_handshake =
+        [info, local](session::peer_connection& peer,
+                      const wire::handshake& remote)
+        -> std::optional<wire::handshake> {
+        if (remote.info_hash != local.info_hash ||
+            !supports_extensions(remote)) {
+            return {};
+        }
+        auto payload = std::string{};
+        encode(extension_handshake{local_ut_metadata, info->size()}, payload);
+        send_extended(peer, std::move(payload));
+        return local;
+    };
+
+    handler.on_message = [info, peers](session::peer_connection& peer,
+                                       const wire::message& m) {
+        const auto e = extension(m);
+        if (!e.has_value()) {
+            return;
+        }
+        auto& s = peers->get(peer);
+        if (e->first == extension_handshake_id) {
+            if (const auto h = decode_extension_handshake(e->second)) {
+                s.ut_metadata = h->ut_metadata;
+            }
+            return;
+        }
+        const auto request = e->first == local_ut_metadata
+                                 ? decode_metadata_message(e->second)
+                                 : std::nullopt;
+        if (s.ut_metadata == 0 || !request.has_value() ||
+            request->type != metadata_type::request) {
+            return;
+        }
+
+        auto reply =
+            metadata_message{metadata_type::reject, request->piece, 0, {}};
+        const auto offset = std::size_t{request->piece} * piece_size;
+        if (offset < info->size()) {
+            reply.type = metadata_type::data;
+            reply.total_size = info->size();
+            reply.data = std::string_view{*info}.substr(offset, piece_size);
+        }
+        auto payload = std::string{};
+        encode(s.ut_metadata, reply, payload);
+        send_extended(peer, std::move(payload));
+    };
+
+    handler.on_close = [peers](session::peer_connection& peer) {
+        peers->take(peer);
+    };
+    return handler;
+}
+
+session::peer_handler fetch(std::shared_ptr<fetcher> f,
+                            const wire::handshake& local) {
+    const auto peers = std::make_shared<peer_table>();
+    auto handler = session::peer_handler{};
+
+    handler.on_handshake =
+        [f, local](session::peer_connection& peer,
+                   const wire::handshake& remote)
+        -> std::optional<wire::handshake> {
+        if (remote.info_hash != f->info_hash() ||
+            !supports_extensions(remote) || f->complete()) {
+            return {};
+        }
+        auto payload = std::string{};
+        encode(extension_handshake{local_ut_metadata, 0}, payload);
+        send_extended(peer, std::move(payload));
+        return local;
+    };
+
+    handler.on_message = [f, peers](session::peer_connection& peer,
+                                    const wire::message& m) {
+        const auto e = extension(m);
+        if (!e.has_value()) {
+            return;
+        }
+        auto& s = peers->get(peer);
+        if (e->first == extension_handshake_id) {
+            const auto h = decode_extension_handshake(e->second);
+            if (!h.has_value() || h->ut_metadata == 0 ||
+                !f->set_size(h->metadata_size)) {
+                peer.close();
+                return;
+            }
+            s.ut_metadata = h->ut_metadata;
+            request_more(peer, s, *f);
+            return;
+        }
+
+        const auto reply = e->first == local_ut_metadata
+                               ? decode_metadata_message(e->second)
+                               : std::nullopt;
+        if (!reply.has_value() || reply->type == metadata_type::request) {
+            return;
+        }
+        const auto it = std::find(s.outstanding.begin(), s.outstanding.end(),
+                                  reply->piece);
+        if (it == s.outstanding.end()) {
+            return;
+        }
+        s.outstanding.erase(it);
+        if (reply->type == metadata_type::reject) {
+            f->released(reply->piece);
+            peer.close();
+            return;
+        }
+        if (reply->total_size != f->size() ||
+            !f->received(reply->piece, reply->data)) {
+            peer.close();
+            return;
+        }
+        if (f->complete()) {
+            peer.close();
+            return;
+        }
+        request_more(peer, s, *f);
+    };
+
+    handler.on_close = [f, peers](session::peer_connection& peer) {
+        for (const auto piece : peers->take(peer).outstanding) {
+            f->released(piece);
+        }
+    };
+    return handler;
+}
+
+}  // namespace metadata
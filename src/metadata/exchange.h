@@ -0,0 +1,26 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "fetcher.h"
+#include "message.h"
+#include "peer_connection.h"
+
+// ut_metadata over the session engine. Both handlers send the extension
+// handshake right behind the BitTorrent one, so local should have
+// extensions enabled.
+namespace metadata {
+
+// Hands out info, the info dictionary of local's info-hash, to peers that
+// ask, on connections in either direction.
+session::peer_handler serve(std::shared_ptr<const std::string> info,
+                            const wire::handshake& local);
+
+// Fetches into f over every connection it is used for, keeping a few
+// requests in flight on each. A connection closes once f is complete, or
+// when its peer turns out not to have the metadata.
+session::peer_handler fetch(std::shared_ptr<fetcher> f,
+                            const wire::handshake& local);
+
+}  // namespace metadata
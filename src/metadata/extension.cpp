@@ -0,0 +1,134 @@
+#include "extension.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "encoder.h"
+#include "message.h"
+#include "tape.h"
+
+namespace metadata {
+namespace {
+// Reserved bit 20 from the right, in byte 5.
+constexpr std::size_t extension_byte = 5;
+constexpr std::byte extension_bit{0x10};
+
+std::optional<bencode::tape> parse(std::string_view payload) {
+    thread_local auto arena = std::pmr::unsynchronized_pool_resource{};
+    auto error = bencode::parse_error{};
+    auto tape = bencode::parse_tape(payload, &error, &arena);
+    if (!tape.has_value() || !tape->root().is_dictionary()) {
+        return {};
+    }
+    return tape;
+}
+
+std::optional<bencode::integer> integer_at(const bencode::dict_ref& d,
+                                           std::string_view key) {
+    const auto v = d.find(key);
+    if (!v.has_value() || !v->is_integer()) {
+        return {};
+    }
+    return v->as_integer();
+}
+}  // namespace
+
+void enable_extensions(wire::handshake& h) {
+    h.reserved[extension_byte] |= extension_bit;
+}
+
+bool supports_extensions(const wire::handshake& h) {
+    return (h.reserved[extension_byte] & extension_bit) != std::byte{0};
+}
+
+void encode(const extension_handshake& h, std::string& out) {
+    out.assign(1, static_cast<char>(extension_handshake_id));
+    auto e = bencode::encoder{std::back_inserter(out)};
+    e.begin_dict();
+    e.string("m").begin_dict();
+    e.string("ut_metadata").integer(h.ut_metadata);
+    e.end();
+    if (h.metadata_size != 0) {
+        e.string("metadata_size")
+            .integer(static_cast<bencode::integer>(h.metadata_size));
+    }
+    e.end();
+}
+
+void encode(std::uint8_t id, const metadata_message& m, std::string& out) {
+    out.assign(1, static_cast<char>(id));
+    auto e = bencode::encoder{std::back_inserter(out)};
+    e.begin_dict();
+    e.string("msg_type").integer(static_cast<bencode::integer>(m.type));
+    e.string("piece").integer(m.piece);
+    if (m.type == metadata_type::data) {
+        e.string("total_size")
+            .integer(static_cast<bencode::integer>(m.total_size));
+    }
+    e.end();
+    if (m.type == metadata_type::data) {
+        out += m.data;
+    }
+}
+
+std::optional<extension_handshake> decode_extension_handshake(
+    std::string_view payload) {
+    const auto tape = parse(payload);
+    if (!tape.has_value()) {
+        return {};
+    }
+    const auto root = tape->root().as_dict();
+
+    auto result = extension_handshake{};
+    if (const auto m = root.find("m"); m.has_value() && m->is_dictionary()) {
+        const auto id = integer_at(m->as_dict(), "ut_metadata");
+        if (id.has_value() && id.value() > 0 && id.value() < 256) {
+            result.ut_metadata = static_cast<std::uint8_t>(id.value());
+        }
+    }
+    const auto size = integer_at(root, "metadata_size");
+    if (size.has_value() && size.value() > 0 &&
+        static_cast<std::uint64_t>(size.value()) <= max_metadata_size) {
+        result.metadata_size = static_cast<std::size_t>(size.value());
+    }
+    return result;
+}
+
+std::optional<metadata_message> decode_metadata_message(
+    std::string_view payload) {
+    const auto tape = parse(payload);
+    if (!tape.has_value()) {
+        return {};
+    }
+    const auto root = tape->root().as_dict();
+    const auto type = integer_at(root, "msg_type");
+    const auto piece = integer_at(root, "piece");
+    if (!type.has_value() || type.value() < 0 || type.value() > 2 ||
+        !piece.has_value() || piece.value() < 0 ||
+        piece.value() >= static_cast<bencode::integer>(
+                             max_metadata_size / piece_size)) {
+        return {};
+    }
+
+    auto result = metadata_message{};
+    result.type = static_cast<metadata_type>(type.value());
+    result.piece = static_cast<std::uint32_t>(piece.value());
+    if (result.type == metadata_type::data) {
+        const auto total = integer_at(root, "total_size");
+        if (!total.has_value() || total.value() <= 0 ||
+            static_cast<std::uint64_t>(total.value()) > max_metadata_size) {
+            return {};
+        }
+        result.total_size = static_cast<std::size_t>(total.value());
+        // The piece follows the dictionary.
+        result.data = payload.substr(tape->root().raw().size());
+    }
+    return result;
+}
+
+}  // namespace metadata
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "message.h"
+
+// The extension protocol (BEP 10) and ut_metadata (BEP 9), which peers use
+// to hand out the info dictionary of a torrent known only by its info-hash.
+namespace metadata {
+
+// Message id of every extension message. The first payload byte picks the
+// extension, 0 being the extension handshake.
+constexpr std::uint8_t extended_id = 20;
+constexpr std::uint8_t extension_handshake_id = 0;
+// The id peers are asked to send our ut_metadata messages with.
+constexpr std::uint8_t local_ut_metadata = 1;
+
+// Metadata moves in pieces of this size, the last one shorter.
+constexpr std::size_t piece_size = 16384;
+// Larger info dictionaries are refused rather than allocated for.
+constexpr std::size_t max_metadata_size = 16 << 20;
+
+void enable_extensions(wire::handshake& h);
+bool supports_extensions(const wire::handshake& h);
+
+struct extension_handshake {
+    // The peer's id for ut_metadata; 0 when it does not speak it.
+    std::uint8_t ut_metadata = 0;
+    // 0 when unknown.
+    std::size_t metadata_size = 0;
+};
+
+enum class metadata_type : std::uint8_t { request = 0, data = 1, reject = 2 };
+
+struct metadata_message {
+    metadata_type type = metadata_type::request;
+    std::uint32_t piece = 0;
+    // Data messages only. data is a view into the decoded payload.
+    std::size_t total_size = 0;
+    std::string_view data;
+};
+
+// Each encode replaces out with a whole extension message payload: the
+// extension id, the bencoded dictionary and, for data, the piece. Send it
+// as wire::unknown{extended_id, out}.
+void encode(const extension_handshake& h, std::string& out);
+void encode(std::uint8_t id, const metadata_message& m, std::string& out);
+
+// Decode an extension message payload after its extension id.
+std::optional<extension_handshake> decode_extension_handshake(
+    std::string_view payload);
+std::optional<metadata_message> decode_metadata_message(
+    std::string_view payload);
+
+}  // namespace metadata
@@ -0,0 +1,156 @@
+#include "fetcher.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "extension.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace metadata {
+namespace {
+// Requests outstanding for one piece at the end, counting the first.
+constexpr std::uint16_t max_requests = 2;
+}  // namespace
+
+fetcher::fetcher(const crypto::sha1_digest& info_hash,
+                 std::function<void()> on_complete)
+    : info_hash_{info_hash}, on_complete_{std::move(on_complete)} {}
+
+bool fetcher::set_size(std::size_t size) {
+    const auto lock = std::lock_guard{mutex_};
+    if (size == 0 || size > max_metadata_size) {
+        return false;
+    }
+    if (size_ != 0) {
+        return size == size_;
+    }
+    size_ = size;
+    buffer_ = std::make_unique_for_overwrite<char[]>(size);
+    const auto count = (size + piece_size - 1) / piece_size;
+    states_.assign(count, state::missing);
+    requests_.assign(count, 0);
+    asked_.assign(count, 0);
+    return true;
+}
+
+std::size_t fetcher::size() const {
+    const auto lock = std::lock_guard{mutex_};
+    return size_;
+}
+
+std::size_t fetcher::piece_count() const {
+    const auto lock = std::lock_guard{mutex_};
+    return states_.size();
+}
+
+std::size_t fetcher::piece_length(std::uint32_t piece) const {
+    return std::min(piece_size, size_ - std::size_t{piece} * piece_size);
+}
+
+std::optional<std::uint32_t> fetcher::pick(bool idle) {
+    const auto lock = std::lock_guard{mutex_};
+    std::optional<std::uint32_t> oldest;
+    for (std::uint32_t i = 0; i < states_.size(); i++) {
+        if (states_[i] == state::missing) {
+            oldest = i;
+            break;
+        }
+        if (states_[i] == state::requested &&
+            (idle || requests_[i] < max_requests) &&
+            (!oldest.has_value() || asked_[i] < asked_[oldest.value()])) {
+            oldest = i;
+        }
+    }
+    if (!oldest.has_value()) {
+        return {};
+    }
+    const auto i = oldest.value();
+    states_[i] = state::requested;
+    requests_[i]++;
+    asked_[i] = ++sequence_;
+    return i;
+}
+
+bool fetcher::received(std::uint32_t piece, std::string_view data) {
+    {
+        const auto lock = std::lock_guard{mutex_};
+        if (piece >= states_.size() || data.size() != piece_length(piece)) {
+            return false;
+        }
+        if (states_[piece] == state::have) {
+            duplicates_++;
+            return true;
+        }
+        std::memcpy(buffer_.get() + std::size_t{piece} * piece_size,
+                    data.data(), data.size());
+        states_[piece] = state::have;
+        requests_[piece] = 0;
+        if (++have_ < states_.size()) {
+            return true;
+        }
+
+        if (crypto::sha1({buffer_.get(), size_}) != info_hash_) {
+            // Some peer sent a bad piece, and there is no telling which.
+            failures_++;
+            have_ = 0;
+            std::fill(states_.begin(), states_.end(), state::missing);
+            std::fill(requests_.begin(), requests_.end(), 0);
+            return true;
+        }
+        complete_ = true;
+    }
+    if (on_complete_) {
+        on_complete_();
+    }
+    return true;
+}
+
+void fetcher::released(std::uint32_t piece) {
+    const auto lock = std::lock_guard{mutex_};
+    if (piece < states_.size() && states_[piece] == state::requested &&
+        --requests_[piece] == 0) {
+        states_[piece] = state::missing;
+    }
+}
+
+bool fetcher::complete() const {
+    const auto lock = std::lock_guard{mutex_};
+    return complete_;
+}
+
+std::size_t fetcher::failures() const {
+    const auto lock = std::lock_guard{mutex_};
+    return failures_;
+}
+
+std::size_t fetcher::duplicates() const {
+    const auto lock = std::lock_guard{mutex_};
+    return duplicates_;
+}
+
+std::optional<std::string_view> fetcher::info() const {
+    const auto lock = std::lock_guard{mutex_};
+    if (!complete_) {
+        return {};
+    }
+    return std::string_view{buffer_.get(), size_};
+}
+
+std::optional<torrent::torrent> fetcher::to_torrent() const {
+    const auto bytes = info();
+    if (!bytes.has_value()) {
+        return {};
+    }
+    return torrent::from_info(bytes.value());
+}
+
+}  // namespace metadata
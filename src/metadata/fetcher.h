@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "sha.h"
+#include "torrent.h"
+
+namespace metadata {
+
+// Assembles an info dictionary from ut_metadata pieces fetched from any
+// number of peers at once, straight into one buffer allocated when the
+// size is first known. Once every piece is in, the buffer is checked
+// against the info-hash and parsed where it lies. Safe to share between
+// threads.
+class fetcher {
+   public:
+    // on_complete runs once, on the thread that delivered the last piece.
+    explicit fetcher(const crypto::sha1_digest& info_hash,
+                     std::function<void()> on_complete = {});
+
+    fetcher(const fetcher&) = delete;
+    fetcher& operator=(const fetcher&) = delete;
+
+    const crypto::sha1_digest& info_hash() const { return info_hash_; }
+
+    // The size a peer advertised. The first size in bounds is taken; false
+    // for one that is out of bounds or disagrees with it.
+    bool set_size(std::size_t size);
+    std::size_t size() const;
+    std::size_t piece_count() const;
+
+    // A piece to ask for next: one nobody has asked for, or once all have
+    // been, one asked for only once, longest ago, so that a slow peer does
+    // not hold up the end. A peer with nothing in flight passes idle and
+    // gets a piece while any is missing, so every peer keeps working to the
+    // end. Nothing when there is no such piece or the size is not known.
+    std::optional<std::uint32_t> pick(bool idle = false);
+
+    // Stores a piece. Returns false if it cannot be right, such as a piece
+    // past the end or of the wrong length; pieces already in are ignored.
+    bool received(std::uint32_t piece, std::string_view data);
+
+    // A request for piece will not be answered: rejected, or its peer left.
+    void released(std::uint32_t piece);
+
+    bool complete() const;
+    // Whole dictionaries that failed the hash check and were started over.
+    std::size_t failures() const;
+    // Pieces that arrived after they were already in.
+    std::size_t duplicates() const;
+
+    // The verified info dictionary, which stays put once complete, and the
+    // torrent parsed from it.
+    std::optional<std::string_view> info() const;
+    std::optional<torrent::torrent> to_torrent() const;
+
+   private:
+    enum class state : std::uint8_t { missing, requested, have };
+
+    std::size_t piece_length(std::uint32_t piece) const;
+
+    const crypto::sha1_digest info_hash_;
+    const std::function<void()> on_complete_;
+
+    mutable std::mutex mutex_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t size_ = 0;
+    std::vector<state> states_;
+    // Outstanding requests for each piece, and when it was last asked for.
+    std::vector<std::uint16_t> requests_;
+    std::vector<std::uint64_t> asked_;
+    std::uint64_t sequence_ = 0;
+    std::size_t have_ = 0;
+    bool complete_ = false;
+    std::size_t failures_ = 0;
+    std::size_t duplicates_ = 0;
+};
+
+}  // namespace metadata
@@ -0,0 +1,70 @@
+#include <toml++/toml.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "exporter.h"
+
+namespace metrics {
+namespace {
+std::optional<export_options> fail(config_error* error, std::string message) {
+    if (error != nullptr) {
+        error->message = std::move(message);
+    }
+    return {};
+}
+}  // namespace
+
+std::optional<export_options> load_options(const std::filesystem::path& config,
+                                           config_error* error) {
+    auto root = toml::table{};
+    try {
+        root = toml::parse_file(config.string());
+    } catch (const toml::parse_error& e) {
+        return fail(error, std::string{e.description()});
+    }
+
+    auto result = export_options{};
+    const auto table = root["metrics"];
+    if (!table) {
+        return result;
+    }
+    if (!table.is_table()) {
+        return fail(error, "metrics must be a table");
+    }
+
+    if (const auto file = table["file"]; file) {
+        const auto path = file.value<std::string>();
+        if (!path.has_value()) {
+            return fail(error, "metrics.file must be a string");
+        }
+        result.path = path.value();
+    }
+
+    if (const auto format = table["format"]; format) {
+        const auto name = format.value<std::string>();
+        if (name == "json") {
+            result.format = format::json;
+        } else if (name == "text") {
+            result.format = format::text;
+        } else {
+            return fail(error, "metrics.format must be \"json\" or \"text\"");
+        }
+    }
+
+    if (const auto interval = table["interval_ms"]; interval) {
+        const auto millis = interval.value<std::int64_t>();
+        if (!millis.has_value() || millis.value() <= 0) {
+            return fail(error,
+                        "metrics.interval_ms must be a positive integer");
+        }
+        result.interval = std::chrono::milliseconds{millis.value()};
+    }
+    return result;
+}
+
+}  // namespace metrics
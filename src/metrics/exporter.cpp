@@ -0,0 +1,127 @@
+#include "exporter.h"
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "metrics.h"
+
+namespace metrics {
+namespace {
+struct quantile {
+    std::string_view name;
+    double q;
+};
+
+constexpr quantile quantiles[] = {
+    {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+
+std::int64_t unix_millis(std::chrono::system_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               t.time_since_epoch())
+        .count();
+}
+
+// Names are dotted identifiers chosen in code, so they need no escaping.
+void write_json(const snapshot& s, std::string& out) {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "{{\"time\":{},\"counters\":{{", unix_millis(s.time));
+    const char* separator = "";
+    for (const auto& [name, value] : s.counters) {
+        fmt::format_to(it, "{}\"{}\":{}", separator, name, value);
+        separator = ",";
+    }
+    out += "},\"gauges\":{";
+    separator = "";
+    for (const auto& [name, value] : s.gauges) {
+        fmt::format_to(it, "{}\"{}\":{}", separator, name, value);
+        separator = ",";
+    }
+    out += "},\"histograms\":{";
+    separator = "";
+    for (const auto& [name, h] : s.histograms) {
+        fmt::format_to(it, "{}\"{}\":{{\"count\":{},\"mean\":{:.1f}", separator,
+                       name, h.count, h.mean());
+        for (const auto& [label, q] : quantiles) {
+            fmt::format_to(it, ",\"{}\":{}", label, h.percentile(q));
+        }
+        fmt::format_to(it, ",\"max\":{}}}", h.max);
+        separator = ",";
+    }
+    out += "}}\n";
+}
+
+void write_text(const snapshot& s, std::string& out) {
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "time {}\n", unix_millis(s.time));
+    for (const auto& [name, value] : s.counters) {
+        fmt::format_to(it, "{} {}\n", name, value);
+    }
+    for (const auto& [name, value] : s.gauges) {
+        fmt::format_to(it, "{} {}\n", name, value);
+    }
+    for (const auto& [name, h] : s.histograms) {
+        fmt::format_to(it, "{}.count {}\n{}.mean {:.1f}\n", name, h.count,
+                       name, h.mean());
+        for (const auto& [label, q] : quantiles) {
+            fmt::format_to(it, "{}.{} {}\n", name, label, h.percentile(q));
+        }
+        fmt::format_to(it, "{}.max {}\n", name, h.max);
+    }
+    out += '\n';
+}
+}  // namespace
+
+std::string format_snapshot(const snapshot& s, metrics::format f) {
+    auto out = std::string{};
+    if (f == format::json) {
+        write_json(s, out);
+    } else {
+        write_text(s, out);
+    }
+    return out;
+}
+
+exporter::exporter(const registry& source, export_options options)
+    : source_{source},
+      options_{std::move(options)},
+      thread_{[this](std::stop_token stop) { run(stop); }} {}
+
+exporter::~exporter() {
+    thread_.request_stop();
+    thread_.join();
+    write();
+}
+
+bool exporter::write() {
+    if (options_.path.empty()) {
+        return true;
+    }
+    const auto text = format_snapshot(source_.read(), options_.format);
+    auto file = std::ofstream{options_.path, std::ios::binary | std::ios::app};
+    file << text;
+    return static_cast<bool>(file.flush());
+}
+
+void exporter::run(std::stop_token stop) {
+    auto lock = std::unique_lock{mutex_};
+    for (;;) {
+        // Nothing but a stop request ends the wait early.
+        wake_.wait_for(lock, stop, options_.interval, [] { return false; });
+        if (stop.stop_requested()) {
+            return;
+        }
+        write();
+    }
+}
+
+}  // namespace metrics
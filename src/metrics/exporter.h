@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "metrics.h"
+
+namespace metrics {
+
+enum class format {
+    // One JSON object per snapshot and line.
+    json,
+    // "name value" lines, a snapshot per paragraph.
+    text,
+};
+
+struct export_options {
+    // Nothing is exported while empty.
+    std::filesystem::path path;
+    metrics::format format = format::json;
+    std::chrono::milliseconds interval{1000};
+};
+
+struct config_error {
+    std::string message;
+};
+
+// Reads the [metrics] table of a TOML config file:
+//
+//   [metrics]
+//   file = "rush-metrics.jsonl"
+//   format = "json"  # or "text"
+//   interval_ms = 1000
+//
+// A config without the table, or without file in it, exports nothing. Fails
+// on a file that does not parse and on values of the wrong type or range.
+std::optional<export_options> load_options(const std::filesystem::path& config,
+                                           config_error* error = nullptr);
+
+// Histograms come out as count, mean, p50, p90, p99, p999 and max.
+std::string format_snapshot(const snapshot& s, metrics::format f);
+
+// Appends a snapshot of a registry to a file at a fixed interval from its
+// own thread, and a last one when destroyed.
+class exporter {
+   public:
+    exporter(const registry& source, export_options options);
+    ~exporter();
+
+    exporter(const exporter&) = delete;
+    exporter& operator=(const exporter&) = delete;
+
+    // Appends a snapshot now; false if the file could not be written.
+    bool write();
+
+   private:
+    void run(std::stop_token stop);
+
+    const registry& source_;
+    export_options options_;
+    std::mutex mutex_;
+    std::condition_variable_any wake_;
+    // Last, so that it stops before the rest goes.
+    std::jthread thread_;
+};
+
+}  // namespace metrics
@@ -0,0 +1,129 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace metrics {
+
+std::size_t detail::assign_shard() {
+    static std::atomic<std::size_t> next{0};
+    return next.fetch_add(1, std::memory_order_relaxed) % shard_count;
+}
+
+void set_enabled(bool enabled) {
+    enabled_flag.store(enabled, std::memory_order_relaxed);
+}
+
+std::uint64_t counter::value() const {
+    std::uint64_t total = 0;
+    for (const auto& s : slots_) {
+        total += s.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+histogram::histogram()
+    : shards_{std::make_unique<shard_buckets[]>(shard_count)} {}
+
+histogram::snapshot histogram::read() const {
+    auto result = snapshot{};
+    result.buckets.resize(bucket_count);
+    for (std::size_t i = 0; i < shard_count; i++) {
+        const auto& s = shards_[i];
+        for (std::size_t b = 0; b < bucket_count; b++) {
+            const auto n = s.buckets[b].load(std::memory_order_relaxed);
+            result.buckets[b] += n;
+            result.count += n;
+        }
+        result.sum += s.sum.load(std::memory_order_relaxed);
+        result.max =
+            std::max(result.max, s.max.load(std::memory_order_relaxed));
+    }
+    return result;
+}
+
+std::uint64_t histogram::snapshot::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<std::uint64_t>(
+        static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count))),
+        1);
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < buckets.size(); b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            if (b + 1 == bucket_count) {
+                return max;
+            }
+            return std::min(lowest(b + 1) - 1, max);
+        }
+    }
+    return max;
+}
+
+counter& registry::counter(std::string_view name) {
+    const auto lock = std::lock_guard{mutex_};
+    auto it = counters_.find(name);
+    if (it == counters_.end()) {
+        it = counters_
+                 .emplace(std::string{name},
+                          std::make_unique<metrics::counter>())
+                 .first;
+    }
+    return *it->second;
+}
+
+gauge& registry::gauge(std::string_view name) {
+    const auto lock = std::lock_guard{mutex_};
+    auto it = gauges_.find(name);
+    if (it == gauges_.end()) {
+        it = gauges_
+                 .emplace(std::string{name}, std::make_unique<metrics::gauge>())
+                 .first;
+    }
+    return *it->second;
+}
+
+histogram& registry::histogram(std::string_view name) {
+    const auto lock = std::lock_guard{mutex_};
+    auto it = histograms_.find(name);
+    if (it == histograms_.end()) {
+        it = histograms_
+                 .emplace(std::string{name},
+                          std::make_unique<metrics::histogram>())
+                 .first;
+    }
+    return *it->second;
+}
+
+snapshot registry::read() const {
+    auto result = snapshot{};
+    result.time = std::chrono::system_clock::now();
+    const auto lock = std::lock_guard{mutex_};
+    for (const auto& [name, c] : counters_) {
+        result.counters.emplace(name, c->value());
+    }
+    for (const auto& [name, g] : gauges_) {
+        result.gauges.emplace(name, g->value());
+    }
+    for (const auto& [name, h] : histograms_) {
+        result.histograms.emplace(name, h->read());
+    }
+    return result;
+}
+
+registry& global() {
+    static auto instance = registry{};
+    return instance;
+}
+
+}  // namespace metrics
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace metrics {
+
+// Updates go to one of this many slots, each on its own cache line, chosen
+// per thread; reads add the slots up. Threads beyond it share slots, which
+// stays correct and costs only some contention.
+inline constexpr std::size_t shard_count = 16;
+
+namespace detail {
+std::size_t assign_shard();
+// shard_count until assigned, so that reading it needs no guard.
+inline thread_local std::size_t shard_index = shard_count;
+}  // namespace detail
+
+// The calling thread's slot, assigned round robin on first use.
+inline std::size_t shard() {
+    if (detail::shard_index == shard_count) [[unlikely]] {
+        detail::shard_index = detail::assign_shard();
+    }
+    return detail::shard_index;
+}
+
+// Timers read the clock only while this is set; counters and gauges always
+// count, an uncontended relaxed add being cheaper than checking first.
+void set_enabled(bool enabled);
+inline std::atomic<bool> enabled_flag{true};
+inline bool enabled() { return enabled_flag.load(std::memory_order_relaxed); }
+
+class counter {
+   public:
+    void add(std::uint64_t n = 1) {
+        slots_[shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    std::uint64_t value() const;
+
+   private:
+    struct alignas(64) slot {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<slot, shard_count> slots_;
+};
+
+// A level rather than a running total, such as a queue depth.
+class gauge {
+   public:
+    void set(std::int64_t value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+    void add(std::int64_t delta) {
+        value_.fetch_add(delta, std::memory_order_relaxed);
+    }
+    std::int64_t value() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+   private:
+    alignas(64) std::atomic<std::int64_t> value_{0};
+};
+
+// Log-linear buckets in the manner of HdrHistogram: values below 16 get a
+// bucket each, and every power of two above is split into 16, so a value
+// is known to within 1/16 of itself across the whole 64-bit range.
+class histogram {
+   public:
+    static constexpr unsigned sub_bits = 4;
+    static constexpr std::size_t sub_buckets = std::size_t{1} << sub_bits;
+    static constexpr std::size_t bucket_count =
+        (64 - sub_bits + 1) * sub_buckets;
+
+    static constexpr std::size_t bucket_of(std::uint64_t value) {
+        if (value < sub_buckets) {
+            return static_cast<std::size_t>(value);
+        }
+        const auto exponent = static_cast<unsigned>(std::bit_width(value)) - 1;
+        const auto mantissa = (value >> (exponent - sub_bits)) &
+                              (sub_buckets - 1);
+        return (exponent - sub_bits + 1) * sub_buckets +
+               static_cast<std::size_t>(mantissa);
+    }
+    // The smallest value that lands in bucket.
+    static constexpr std::uint64_t lowest(std::size_t bucket) {
+        if (bucket < sub_buckets) {
+            return bucket;
+        }
+        const auto exponent = bucket / sub_buckets + sub_bits - 1;
+        return (sub_buckets + bucket % sub_buckets)
+               << (exponent - sub_bits);
+    }
+
+    struct snapshot {
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t max = 0;
+        std::vector<std::uint64_t> buckets;
+
+        // The highest value of the bucket holding quantile q of the values,
+        // q in [0, 1]; 0 when empty.
+        std::uint64_t percentile(double q) const;
+        double mean() const {
+            return count == 0 ? 0.0
+                              : static_cast<double>(sum) /
+                                    static_cast<double>(count);
+        }
+    };
+
+    histogram();
+
+    void record(std::uint64_t value) {
+        auto& s = shards_[shard()];
+        s.buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(value, std::memory_order_relaxed);
+        auto max = s.max.load(std::memory_order_relaxed);
+        while (value > max && !s.max.compare_exchange_weak(
+                                  max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    snapshot read() const;
+
+   private:
+    struct alignas(64) shard_buckets {
+        std::array<std::atomic<std::uint64_t>, bucket_count> buckets{};
+        std::atomic<std::uint64_t> sum{0};
+        std::atomic<std::uint64_t> max{0};
+    };
+    // About 8 KiB a shard, so they live on the heap.
+    std::unique_ptr<shard_buckets[]> shards_;
+};
+
+// Records the nanoseconds from construction to destruction, if active and
+// metrics are enabled when it starts.
+class scoped_timer {
+   public:
+    explicit scoped_timer(histogram& h, bool active = true) : histogram_{h} {
+        if (active && enabled()) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~scoped_timer() {
+        if (start_ != std::chrono::steady_clock::time_point{}) {
+            histogram_.record(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start_)
+                    .count()));
+        }
+    }
+
+    scoped_timer(const scoped_timer&) = delete;
+    scoped_timer& operator=(const scoped_timer&) = delete;
+
+   private:
+    histogram& histogram_;
+    std::chrono::steady_clock::time_point start_{};
+};
+
+struct snapshot {
+    std::chrono::system_clock::time_point time;
+    std::map<std::string, std::uint64_t> counters;
+    std::map<std::string, std::int64_t> gauges;
+    std::map<std::string, histogram::snapshot> histograms;
+};
+
+// Metrics by name. Looking one up takes a lock, so hot paths do it once and
+// keep the reference, which stays valid for the registry's lifetime.
+class registry {
+   public:
+    metrics::counter& counter(std::string_view name);
+    metrics::gauge& gauge(std::string_view name);
+    metrics::histogram& histogram(std::string_view name);
+
+    metrics::snapshot read() const;
+
+   private:
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<metrics::counter>, std::less<>>
+        counters_;
+    std::map<std::string, std::unique_ptr<metrics::gauge>, std::less<>>
+        gauges_;
+    std::map<std::string, std::unique_ptr<metrics::histogram>, std::less<>>
+        histograms_;
+};
+
+// The process-wide registry the libraries report to.
+registry& global();
+
+}  // namespace metrics
@@ -26,6 +26,7 @@
 #include <lexy/dsl/parse_as.hpp>
 #include <lexy/dsl/scan.hpp>
 #include <lexy/dsl/sign.hpp>
+#include <lexy/dsl/terminator.hpp>
 #include <lexy/encoding.hpp>
 #include <lexy/error.hpp>
 #include <lexy/grammar.hpp>
@@ -34,13 +35,15 @@
 #include <lexy/input/string_input.hpp>
 #include <lexy_ext/report_error.hpp>
 #include <ranges>
-#include <sstream>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include "fast_parser.h"
+#include "mapped_file.h"
+
 template <class... Ts>
 struct visitor : Ts... {
     using Ts::operator()...;
@@ -49,57 +52,10 @@ template <class... Ts>
 visitor(Ts...) -> visitor<Ts...>;
 
 namespace bencode {
-std::string value_printer::operator()(integer i) {
-    return std::to_string(i);
-}
-
-std::string value_printer::operator()(string s) {
-    return s;
-}
-
-std::string value_printer::operator()(list l) {
-    auto result = std::stringstream{};
-    result << '[';
-
-    std::size_t i = 0;
-    const auto last_index = l.size() - 1;
-
-    for (const auto& element : l) {
-        const auto printed_element = std::visit(value_printer{}, element);
-        result << printed_element;
-        if (i < last_index) {
-            result << ", ";
-        }
-        i++;
-    }
-
-    result << ']';
-    return result.str();
-}
-
-std::string value_printer::operator()(dictionary d) {
-    auto result = std::stringstream{};
-    result << '{';
-
-    std::size_t i = 0;
-    const auto last_index = d.size() - 1;
-
-    for (const auto& [key, element] : d) {
-        const auto printed_element = std::visit(value_printer{}, element);
-        result << key << ": " << printed_element;
-        if (i < last_index) {
-            result << ", ";
-        }
-        i++;
-    }
-
-    result << '}';
-    return result.str();
-}
-
 template <typename Production>
 std::optional<bencode::value> parse_literal(std::string_view input) {
-    const auto literal = lexy::zstring_input<lexy::byte_encoding>(input.data());
+    const auto literal =
+        lexy::string_input<lexy::byte_encoding>(input.data(), input.size());
     const auto result =
         lexy::parse<Production>(literal, lexy_ext::report_error);
 
@@ -177,12 +133,12 @@ struct list {
     static constexpr auto rule = [] {
         const auto open = lexy::dsl::lit_c<'l'>;
         const auto close = lexy::dsl::lit_c<'e'>;
-        const auto elements =
-            lexy::dsl::list(lexy::dsl::p<integer> | lexy::dsl::p<byte_string> |
-                            lexy::dsl::recurse_branch<list> |
-                            lexy::dsl::recurse_branch<dictionary>);
+        const auto element =
+            lexy::dsl::p<integer> | lexy::dsl::p<byte_string> |
+            lexy::dsl::recurse_branch<list> |
+            lexy::dsl::recurse_branch<dictionary>;
 
-        return (open >> elements) + close;
+        return open >> lexy::dsl::terminator(close).opt_list(element);
     }();
 
     static constexpr auto value = lexy::as_list<bencode::list>;
@@ -192,12 +148,12 @@ struct dictionary {
     static constexpr auto rule = [] {
         const auto open = lexy::dsl::lit_c<'d'>;
         const auto close = lexy::dsl::lit_c<'e'>;
-        const auto elements = lexy::dsl::list(
+        const auto element =
             lexy::dsl::p<byte_string> >>
             (lexy::dsl::p<integer> | lexy::dsl::p<byte_string> |
-             lexy::dsl::p<list> | lexy::dsl::recurse_branch<dictionary>));
+             lexy::dsl::p<list> | lexy::dsl::recurse_branch<dictionary>);
 
-        return (open >> elements) + close;
+        return open >> lexy::dsl::terminator(close).opt_list(element);
     }();
 
     static constexpr auto value = lexy::as_collection<bencode::dictionary>;
@@ -213,11 +169,26 @@ struct bencode_value {
 };
 }  // namespace grammar
 
-std::optional<bencode::value> parse_literal(std::string_view input) {
+std::optional<bencode::value> parse_literal(std::string_view input,
+                                            backend b) {
+    if (b == backend::fast) {
+        return detail::parse_fast(input);
+    }
     return parse_literal<bencode::grammar::bencode_value>(input);
 }
 
-std::optional<bencode::value> parse(const std::filesystem::path& input) {
+std::optional<bencode::value> parse(const std::filesystem::path& input,
+                                    backend b) {
+    if (b == backend::fast) {
+        const auto file = mapped_file::open(input);
+        if (!file) {
+            fmt::println("Could not open file: {}",
+                         std::filesystem::absolute(input).string());
+            return {};
+        }
+        return detail::parse_fast(file->bytes());
+    }
+
     const auto file = lexy::read_file<lexy::byte_encoding>(input.c_str());
     if (!file) {
         fmt::println("Could not open file: {} - error {}",
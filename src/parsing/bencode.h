@@ -3,10 +3,13 @@
 #include <fmt/format.h>
 #include <fmt/base.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -23,40 +26,101 @@ using value = std::variant<integer, string, list, dictionary>;
 struct list : std::vector<value> {};
 struct dictionary : std::unordered_map<string, value> {};
 
-std::optional<bencode::value> parse_literal(std::string_view input);
-std::optional<bencode::value> parse(const std::filesystem::path& input);
+struct parse_error {
+    std::size_t offset;
+    std::string_view message;
+};
+
+// lexy is the reference grammar; fast is a hand-written scanner that skips
+// string bodies by length and converts digits in bulk.
+enum class backend { lexy, fast };
 
+std::optional<bencode::value> parse_literal(std::string_view input,
+                                            backend b = backend::lexy);
+std::optional<bencode::value> parse(const std::filesystem::path& input,
+                                    backend b = backend::lexy);
+
+// Writes a readable rendering of a value straight to out. Subtrees are
+// visited in place, never copied or rendered into temporary strings.
+template <typename OutputIt>
 struct value_printer {
-    std::string operator()(integer i);
-    std::string operator()(string s);
-    std::string operator()(list l);
-    std::string operator()(dictionary d);
+    OutputIt out;
+
+    OutputIt operator()(integer i) { return fmt::format_to(out, "{}", i); }
+
+    OutputIt operator()(const string& s) {
+        return std::copy(s.begin(), s.end(), out);
+    }
+
+    OutputIt operator()(const list& l) {
+        *out++ = '[';
+        bool first = true;
+        for (const auto& element : l) {
+            if (!first) {
+                out = separator();
+            }
+            first = false;
+            out = std::visit(value_printer{out}, element);
+        }
+        *out++ = ']';
+        return out;
+    }
+
+    OutputIt operator()(const dictionary& d) {
+        *out++ = '{';
+        bool first = true;
+        for (const auto& [key, element] : d) {
+            if (!first) {
+                out = separator();
+            }
+            first = false;
+            out = std::copy(key.begin(), key.end(), out);
+            *out++ = ':';
+            *out++ = ' ';
+            out = std::visit(value_printer{out}, element);
+        }
+        *out++ = '}';
+        return out;
+    }
+
+   private:
+    OutputIt separator() {
+        *out++ = ',';
+        *out++ = ' ';
+        return out;
+    }
 };
+
+template <typename OutputIt>
+value_printer(OutputIt) -> value_printer<OutputIt>;
 }  // namespace bencode
 
 template <>
-struct fmt::formatter<bencode::value> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        bencode::value v, fmt::format_context& ctx) const {
-        return fmt::formatter<std::string>::format(
-            std::visit(bencode::value_printer{}, v), ctx);
+struct fmt::formatter<bencode::value> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const bencode::value& v,
+                                         fmt::format_context& ctx) const {
+        return std::visit(bencode::value_printer{ctx.out()}, v);
     }
 };
 
 template <>
-struct fmt::formatter<bencode::list> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        bencode::list v, fmt::format_context& ctx) const {
-        return fmt::formatter<std::string>::format(bencode::value_printer{}(v),
-                                                   ctx);
+struct fmt::formatter<bencode::list> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const bencode::list& v,
+                                         fmt::format_context& ctx) const {
+        return bencode::value_printer{ctx.out()}(v);
     }
 };
 
 template <>
-struct fmt::formatter<bencode::dictionary> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        const bencode::dictionary& v, fmt::format_context& ctx) const {
-        return fmt::formatter<std::string>::format(bencode::value_printer{}(v),
-                                                   ctx);
+struct fmt::formatter<bencode::dictionary> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const bencode::dictionary& v,
+                                         fmt::format_context& ctx) const {
+        return bencode::value_printer{ctx.out()}(v);
     }
 };
@@ -0,0 +1,187 @@
+#include "decoder.h"
+
+#include <fmt/base.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <utility>
+
+#include "bencode.h"
+#include "scanner.h"
+
+namespace bencode {
+namespace {
+constexpr std::size_t max_depth = 512;
+
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+}  // namespace
+
+decoder::decoder(std::string_view input)
+    : input_{input},
+      cursor_{input.data(), input.data() + input.size()},
+      scope_{input} {}
+
+decoder::kind decoder::next() const {
+    if (cursor_.at_end()) {
+        return kind::end;
+    }
+    switch (cursor_.peek()) {
+        case 'i':
+            return kind::integer;
+        case 'l':
+            return kind::list;
+        case 'd':
+            return kind::dictionary;
+        default:
+            return kind::string;
+    }
+}
+
+parse_error decoder::error() const {
+    if (!failed()) {
+        return {};
+    }
+    return {offset_of(cursor_.error_position), cursor_.error};
+}
+
+void decoder::report(parse_error* error) const {
+    const auto e = this->error();
+    if (error != nullptr) {
+        *error = e;
+    } else {
+        fmt::println(stderr, "Invalid bencode at offset {}: {}", e.offset,
+                     e.message);
+    }
+}
+
+bool decoder::fail_at(const char* where, std::string_view message) {
+    if (!failed()) {
+        cursor_.fail(where, message);
+        scope_.failed();
+    }
+    return false;
+}
+
+bool decoder::read(integer& out) {
+    if (failed()) {
+        return false;
+    }
+    if (next() != kind::integer) {
+        return fail("expected integer");
+    }
+    return detail::scan_integer(cursor_, out);
+}
+
+bool decoder::read(std::string_view& out) {
+    if (failed()) {
+        return false;
+    }
+    if (cursor_.at_end() || !is_digit(cursor_.peek())) {
+        return fail("expected string");
+    }
+    return detail::scan_string(cursor_, out);
+}
+
+bool decoder::read(string& out) {
+    auto view = std::string_view{};
+    if (!read(view)) {
+        return false;
+    }
+    out.assign(view);
+    return true;
+}
+
+bool decoder::read(value& out) {
+    switch (next()) {
+        case kind::integer: {
+            auto i = integer{};
+            if (!read(i)) {
+                return false;
+            }
+            out = i;
+            return true;
+        }
+        case kind::list: {
+            auto result = list{};
+            if (!read_list([&](decoder& element) {
+                    return element.read(result.emplace_back());
+                })) {
+                return false;
+            }
+            out = std::move(result);
+            return true;
+        }
+        case kind::dictionary: {
+            auto result = dictionary{};
+            if (!read_dict([&](decoder& member, std::string_view key) {
+                    return member.read(result[string{key}]);
+                })) {
+                return false;
+            }
+            out = std::move(result);
+            return true;
+        }
+        case kind::string:
+        case kind::end: {
+            auto s = string{};
+            if (!read(s)) {
+                return false;
+            }
+            out = std::move(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool decoder::skip() {
+    switch (next()) {
+        case kind::integer: {
+            auto ignored = integer{};
+            return read(ignored);
+        }
+        case kind::list:
+            return read_list([](decoder& element) { return element.skip(); });
+        case kind::dictionary:
+            return read_dict([](decoder& member, std::string_view) {
+                return member.skip();
+            });
+        case kind::string:
+        case kind::end: {
+            auto ignored = std::string_view{};
+            return read(ignored);
+        }
+    }
+    return false;
+}
+
+bool decoder::enter(char opener, std::string_view message) {
+    if (failed()) {
+        return false;
+    }
+    if (cursor_.at_end() || cursor_.peek() != opener) {
+        return fail(message);
+    }
+    if (depth_ == max_depth) {
+        return fail("nesting too deep");
+    }
+    ++cursor_.position;
+    ++depth_;
+    return true;
+}
+
+bool decoder::leave() {
+    if (cursor_.at_end()) {
+        fail("expected 'e'");
+        return true;
+    }
+    if (cursor_.peek() != 'e') {
+        return false;
+    }
+    ++cursor_.position;
+    --depth_;
+    return true;
+}
+
+}  // namespace bencode
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bencode.h"
+#include "parse_stats.h"
+#include "scanner.h"
+
+namespace bencode {
+
+// Reads one bencoded document front to back, decoding values straight into
+// the caller's objects; nothing is materialized that the caller did not ask
+// for. The first failure is kept, with the byte offset of the value that
+// caused it, and every later call fails.
+class decoder {
+   public:
+    enum class kind : std::uint8_t { integer, string, list, dictionary, end };
+
+    explicit decoder(std::string_view input);
+
+    // The type of the next value.
+    kind next() const;
+    const char* position() const { return cursor_.position; }
+    std::size_t offset() const { return offset_of(cursor_.position); }
+    std::size_t offset_of(const char* p) const {
+        return static_cast<std::size_t>(p - input_.data());
+    }
+    bool at_end() const { return cursor_.at_end(); }
+
+    bool failed() const { return cursor_.error_position != nullptr; }
+    parse_error error() const;
+    // Stores the error in error when given and prints it otherwise, as
+    // parse_tape does.
+    void report(parse_error* error) const;
+    // Fails at the start of the next value; false, for use in returns.
+    bool fail(std::string_view message) { return fail_at(position(), message); }
+    bool fail_at(const char* where, std::string_view message);
+
+    bool read(integer& out);
+    bool read(std::string_view& out);
+    bool read(string& out);
+    // Materializes the next value whatever its type, for the few places that
+    // keep bencode as it is.
+    bool read(value& out);
+    // Steps over the next value, checking it but keeping nothing.
+    bool skip();
+
+    // Calls on_element(*this) for each element of the list at the cursor;
+    // on_element must consume exactly one value and return false on error.
+    template <typename OnElement>
+    bool read_list(OnElement&& on_element);
+    // Calls on_key(*this, key) for each key of the dictionary at the cursor;
+    // on_key must consume the key's value and return false on error.
+    template <typename OnKey>
+    bool read_dict(OnKey&& on_key);
+
+   private:
+    bool enter(char opener, std::string_view message);
+    // Consumes the closing 'e' if it is next.
+    bool leave();
+
+    std::string_view input_;
+    detail::cursor cursor_;
+    std::size_t depth_ = 0;
+    detail::parse_scope scope_;
+};
+
+template <typename OnElement>
+bool decoder::read_list(OnElement&& on_element) {
+    if (!enter('l', "expected list")) {
+        return false;
+    }
+    while (!leave()) {
+        if (failed() || !on_element(*this)) {
+            return false;
+        }
+    }
+    return !failed();
+}
+
+template <typename OnKey>
+bool decoder::read_dict(OnKey&& on_key) {
+    if (!enter('d', "expected dictionary")) {
+        return false;
+    }
+    while (!leave()) {
+        auto key = std::string_view{};
+        if (failed() || !read(key) || !on_key(*this, key)) {
+            return false;
+        }
+    }
+    return !failed();
+}
+
+// A struct is decoded from a dictionary by specializing schema with a tuple
+// of the keys it binds:
+//
+//   template <>
+//   struct bencode::schema<peer> {
+//       static constexpr auto fields = std::tuple{
+//           bencode::required("ip", &peer::ip),
+//           bencode::field("port", &peer::port),
+//       };
+//   };
+//
+// A field names its target with a member pointer, or with any callable that
+// returns a reference to it from the struct. Keys the schema does not name
+// are skipped; a required key that never shows up fails at the offset of
+// the dictionary.
+template <typename T>
+struct schema;
+
+template <typename T>
+concept has_schema = requires { schema<T>::fields; };
+
+// Decodes into target with decode(decoder&, Target&) found for its type.
+struct default_decode {};
+
+template <typename Access, typename Decode>
+struct field_spec {
+    std::string_view key;
+    Access access;
+    Decode decode;
+    bool required;
+};
+
+template <typename Access, typename Decode = default_decode>
+constexpr auto field(std::string_view key, Access access,
+                     Decode decode = {}) {
+    return field_spec<Access, Decode>{key, access, decode, false};
+}
+
+template <typename Access, typename Decode = default_decode>
+constexpr auto required(std::string_view key, Access access,
+                        Decode decode = {}) {
+    return field_spec<Access, Decode>{key, access, decode, true};
+}
+
+inline bool decode(decoder& d, integer& out) { return d.read(out); }
+inline bool decode(decoder& d, string& out) { return d.read(out); }
+inline bool decode(decoder& d, value& out) { return d.read(out); }
+
+inline bool decode(decoder& d, list& out) {
+    return d.read_list([&](decoder& element) {
+        return element.read(out.emplace_back());
+    });
+}
+
+template <typename T>
+bool decode(decoder& d, std::optional<T>& out) {
+    return decode(d, out.emplace());
+}
+
+template <typename T>
+bool decode(decoder& d, std::vector<T>& out) {
+    return d.read_list(
+        [&](decoder& element) { return decode(element, out.emplace_back()); });
+}
+
+template <has_schema T>
+bool decode(decoder& d, T& out);
+
+namespace detail {
+template <typename T, typename Access, typename Decode>
+bool decode_field(decoder& d, T& out,
+                  const field_spec<Access, Decode>& spec) {
+    auto& target = std::invoke(spec.access, out);
+    if constexpr (std::is_same_v<Decode, default_decode>) {
+        return decode(d, target);
+    } else {
+        return spec.decode(d, target);
+    }
+}
+
+// Required fields are tracked in a bit mask.
+template <typename Fields>
+constexpr std::uint64_t required_mask(const Fields& fields) {
+    return std::apply(
+        [](const auto&... spec) {
+            std::uint64_t mask = 0;
+            std::uint64_t bit = 1;
+            ((mask |= spec.required ? bit : 0, bit <<= 1), ...);
+            return mask;
+        },
+        fields);
+}
+}  // namespace detail
+
+template <has_schema T>
+bool decode(decoder& d, T& out) {
+    constexpr auto& fields = schema<T>::fields;
+    static_assert(std::tuple_size_v<std::remove_cvref_t<decltype(fields)>> <=
+                  64);
+    constexpr auto required = detail::required_mask(fields);
+
+    const char* const start = d.position();
+    std::uint64_t seen = 0;
+    const auto ok = d.read_dict([&](decoder& member, std::string_view key) {
+        // The first field with the key takes the value; nothing matching
+        // means it is skipped.
+        auto result = true;
+        auto matched = false;
+        std::uint64_t bit = 1;
+        const auto try_field = [&](const auto& spec) {
+            if (!matched && key == spec.key) {
+                matched = true;
+                seen |= bit;
+                result = detail::decode_field(member, out, spec);
+            }
+            bit <<= 1;
+        };
+        std::apply([&](const auto&... spec) { (try_field(spec), ...); },
+                   fields);
+        return matched ? result : member.skip();
+    });
+    if (!ok) {
+        return false;
+    }
+    if ((seen & required) != required) {
+        return d.fail_at(start, "missing required key");
+    }
+    return true;
+}
+
+}  // namespace bencode
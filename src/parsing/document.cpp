@@ -0,0 +1,332 @@
+#include "document.h"
+
+#include <fmt/base.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "bencode.h"
+#include "parse_stats.h"
+#include "scanner.h"
+
+namespace bencode {
+node node::make_integer(integer i) {
+    node n;
+    n.kind_ = kind::integer;
+    n.integer_ = i;
+    return n;
+}
+
+node node::make_string(std::string_view s) {
+    node n;
+    n.kind_ = kind::string;
+    n.size_ = s.size();
+    n.string_ = s.data();
+    return n;
+}
+
+node node::make_list(std::span<const node> items) {
+    node n;
+    n.kind_ = kind::list;
+    n.size_ = items.size();
+    n.items_ = items.data();
+    return n;
+}
+
+node node::make_dictionary(std::span<const member> members) {
+    node n;
+    n.kind_ = kind::dictionary;
+    n.size_ = members.size();
+    n.members_ = members.data();
+    return n;
+}
+
+const node* node::find(std::string_view key) const {
+    if (!is_dictionary()) {
+        return nullptr;
+    }
+
+    for (const auto& m : as_dictionary()) {
+        if (m.key == key) {
+            return &m.value;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<std::string_view> document::raw_member(
+    std::string_view key) const {
+    if (!root_->is_dictionary()) {
+        return {};
+    }
+
+    const auto members = root_->as_dictionary();
+    for (std::size_t i = 0; i < members.size(); i++) {
+        if (members[i].key == key) {
+            return root_spans_[i];
+        }
+    }
+    return {};
+}
+
+namespace {
+class document_builder {
+   public:
+    document_builder(std::string_view input,
+                     std::pmr::monotonic_buffer_resource& arena)
+        : input_{input}, arena_{arena} {}
+
+    const node* build() {
+        const char* cursor = input_.data();
+        const char* const end = cursor + input_.size();
+
+        do {
+            if (cursor == end) {
+                return fail(cursor, "unexpected end of input");
+            }
+
+            if (frames_.size() == 1 &&
+                frames_[0].type == node::kind::dictionary &&
+                frames_[0].expecting_value) {
+                member_begin_ = cursor;
+            }
+
+            if (!step(cursor, end)) {
+                return nullptr;
+            }
+
+            if (member_begin_ != nullptr && frames_.size() == 1 &&
+                !frames_[0].expecting_value) {
+                root_spans_.emplace_back(member_begin_,
+                                         cursor - member_begin_);
+                member_begin_ = nullptr;
+            }
+        } while (!frames_.empty());
+
+        return std::construct_at(allocate<node>(1), values_.back());
+    }
+
+    std::span<const std::string_view> root_spans() {
+        auto* spans = allocate<std::string_view>(root_spans_.size());
+        std::uninitialized_copy(root_spans_.begin(), root_spans_.end(), spans);
+        return {spans, root_spans_.size()};
+    }
+
+   private:
+    struct frame {
+        node::kind type;
+        std::size_t first_value;
+        std::size_t first_key;
+        bool expecting_value;
+    };
+
+    bool step(const char*& cursor, const char* end) {
+        auto& top = frames_.empty() ? root_frame_ : frames_.back();
+        if (top.type == node::kind::dictionary && !top.expecting_value) {
+            if (*cursor == 'e') {
+                ++cursor;
+                close_dictionary();
+                return true;
+            }
+
+            std::string_view key;
+            if (!parse_string(cursor, end, key)) {
+                return false;
+            }
+            keys_.push_back(key);
+            top.expecting_value = true;
+            return true;
+        }
+
+        if (top.type == node::kind::list && *cursor == 'e') {
+            ++cursor;
+            close_list();
+            return true;
+        }
+
+        switch (*cursor) {
+            case 'i': {
+                integer i = 0;
+                if (!parse_integer(cursor, end, i)) {
+                    return false;
+                }
+                push(node::make_integer(i));
+                return true;
+            }
+            case 'l':
+                ++cursor;
+                frames_.push_back(
+                    {node::kind::list, values_.size(), keys_.size(), false});
+                return true;
+            case 'd':
+                ++cursor;
+                frames_.push_back({node::kind::dictionary, values_.size(),
+                                   keys_.size(), false});
+                return true;
+            default: {
+                std::string_view s;
+                if (!parse_string(cursor, end, s)) {
+                    return false;
+                }
+                push(node::make_string(s));
+                return true;
+            }
+        }
+    }
+
+    template <typename T>
+    T* allocate(std::size_t count) {
+        return static_cast<T*>(
+            arena_.allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void push(const node& n) {
+        values_.push_back(n);
+        if (!frames_.empty()) {
+            frames_.back().expecting_value = false;
+        }
+    }
+
+    void close_list() {
+        const auto top = frames_.back();
+        frames_.pop_back();
+
+        const auto count = values_.size() - top.first_value;
+        auto* items = allocate<node>(count);
+        std::uninitialized_copy(values_.begin() + top.first_value,
+                                values_.end(), items);
+        values_.resize(top.first_value);
+
+        push(node::make_list({items, count}));
+    }
+
+    void close_dictionary() {
+        const auto top = frames_.back();
+        frames_.pop_back();
+
+        const auto count = values_.size() - top.first_value;
+        auto* members = allocate<member>(count);
+        for (std::size_t i = 0; i < count; i++) {
+            std::construct_at(members + i, keys_[top.first_key + i],
+                              values_[top.first_value + i]);
+        }
+        values_.resize(top.first_value);
+        keys_.resize(top.first_key);
+
+        push(node::make_dictionary({members, count}));
+    }
+
+    bool parse_integer(const char*& cursor, const char* end, integer& out) {
+        auto c = detail::cursor{cursor, end};
+        if (!detail::scan_integer(c, out)) {
+            fail(c.error_position, c.error);
+            return false;
+        }
+        cursor = c.position;
+        return true;
+    }
+
+    bool parse_string(const char*& cursor, const char* end,
+                      std::string_view& out) {
+        auto c = detail::cursor{cursor, end};
+        if (!detail::scan_string(c, out)) {
+            fail(c.error_position, c.error);
+            return false;
+        }
+        cursor = c.position;
+        return true;
+    }
+
+    const node* fail(const char* position, std::string_view message) {
+        fmt::println(stderr, "Invalid bencode at offset {}: {}",
+                     position - input_.data(), message);
+        return nullptr;
+    }
+
+    std::string_view input_;
+    std::pmr::monotonic_buffer_resource& arena_;
+
+    frame root_frame_{node::kind::integer, 0, 0, false};
+    std::vector<frame> frames_;
+    std::vector<node> values_;
+    std::vector<std::string_view> keys_;
+
+    const char* member_begin_ = nullptr;
+    std::vector<std::string_view> root_spans_;
+};
+
+std::size_t initial_arena_size(std::string_view input) {
+    return std::max<std::size_t>(input.size() / 8, 4096);
+}
+}  // namespace
+
+std::optional<document> parse_document(std::string_view input) {
+    auto scope = detail::parse_scope{input};
+    document result;
+    result.arena_ = std::make_unique<std::pmr::monotonic_buffer_resource>(
+        initial_arena_size(input));
+    result.source_ = input;
+
+    auto builder = document_builder{input, *result.arena_};
+    result.root_ = builder.build();
+    if (result.root_ == nullptr) {
+        scope.failed();
+        return {};
+    }
+
+    result.root_spans_ = builder.root_spans();
+    return result;
+}
+
+std::optional<document> load_document(const std::filesystem::path& input) {
+    auto file = mapped_file::open(input);
+    if (!file) {
+        fmt::println("Could not open file: {}",
+                     std::filesystem::absolute(input).string());
+        return {};
+    }
+
+    auto result = parse_document(file->bytes());
+    if (!result) {
+        return {};
+    }
+
+    result->file_ = std::move(file);
+    return result;
+}
+
+bencode::value to_value(const node& n) {
+    switch (n.type()) {
+        case node::kind::integer:
+            return n.as_integer();
+        case node::kind::string:
+            return bencode::string{n.as_string()};
+        case node::kind::list: {
+            auto result = bencode::list{};
+            result.reserve(n.as_list().size());
+            for (const auto& item : n.as_list()) {
+                result.push_back(to_value(item));
+            }
+            return result;
+        }
+        case node::kind::dictionary: {
+            auto result = bencode::dictionary{};
+            result.reserve(n.as_dictionary().size());
+            for (const auto& [key, item] : n.as_dictionary()) {
+                result.emplace(bencode::string{key}, to_value(item));
+            }
+            return result;
+        }
+    }
+    return {};
+}
+}  // namespace bencode
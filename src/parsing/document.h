@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "bencode.h"
+#include "mapped_file.h"
+
+namespace bencode {
+
+struct member;
+
+// Non-owning bencode node. Strings point into the document source, lists and
+// dictionaries point into the document arena.
+class node {
+   public:
+    enum class kind : std::uint8_t { integer, string, list, dictionary };
+
+    static node make_integer(integer i);
+    static node make_string(std::string_view s);
+    static node make_list(std::span<const node> items);
+    static node make_dictionary(std::span<const member> members);
+
+    kind type() const { return kind_; }
+    bool is_integer() const { return kind_ == kind::integer; }
+    bool is_string() const { return kind_ == kind::string; }
+    bool is_list() const { return kind_ == kind::list; }
+    bool is_dictionary() const { return kind_ == kind::dictionary; }
+
+    integer as_integer() const { return integer_; }
+    std::string_view as_string() const { return {string_, size_}; }
+    std::span<const node> as_list() const { return {items_, size_}; }
+    std::span<const member> as_dictionary() const;
+
+    const node* find(std::string_view key) const;
+
+   private:
+    kind kind_ = kind::integer;
+    std::size_t size_ = 0;
+    union {
+        integer integer_ = 0;
+        const char* string_;
+        const node* items_;
+        const member* members_;
+    };
+};
+
+struct member {
+    std::string_view key;
+    node value;
+};
+
+inline std::span<const member> node::as_dictionary() const {
+    return {members_, size_};
+}
+
+// A parsed bencode document. Every node lives in a single arena that is
+// released in one go, and strings are views into the source bytes.
+class document {
+   public:
+    const node& root() const { return *root_; }
+    std::string_view source() const { return source_; }
+
+    // Exact source bytes of a member of the root dictionary, so that e.g.
+    // the info dictionary can be hashed without re-encoding it.
+    std::optional<std::string_view> raw_member(std::string_view key) const;
+
+   private:
+    friend std::optional<document> parse_document(std::string_view input);
+    friend std::optional<document> load_document(
+        const std::filesystem::path& input);
+
+    std::optional<mapped_file> file_;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    std::string_view source_;
+    const node* root_ = nullptr;
+    std::span<const std::string_view> root_spans_;
+};
+
+// The returned document borrows input, which must outlive it.
+std::optional<document> parse_document(std::string_view input);
+std::optional<document> load_document(const std::filesystem::path& input);
+
+bencode::value to_value(const node& n);
+
+}  // namespace bencode
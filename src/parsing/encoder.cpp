@@ -0,0 +1,52 @@
+#include "encoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include "bencode.h"
+
+namespace bencode {
+namespace {
+std::size_t decimal_size(integer i) {
+    std::size_t size = i < 0 ? 2 : 1;
+    for (auto magnitude = i < 0 ? 0 - static_cast<std::uint64_t>(i)
+                                : static_cast<std::uint64_t>(i);
+         magnitude >= 10; magnitude /= 10) {
+        size++;
+    }
+    return size;
+}
+
+std::size_t string_size(std::string_view s) {
+    return decimal_size(static_cast<integer>(s.size())) + 1 + s.size();
+}
+}  // namespace
+
+std::size_t encoded_size(const value& v) {
+    return std::visit(
+        [](const auto& element) -> std::size_t {
+            using type = std::decay_t<decltype(element)>;
+            if constexpr (std::is_same_v<type, integer>) {
+                return decimal_size(element) + 2;
+            } else if constexpr (std::is_same_v<type, string>) {
+                return string_size(element);
+            } else if constexpr (std::is_same_v<type, list>) {
+                std::size_t size = 2;
+                for (const auto& item : element) {
+                    size += encoded_size(item);
+                }
+                return size;
+            } else {
+                std::size_t size = 2;
+                for (const auto& [key, item] : element) {
+                    size += string_size(key) + encoded_size(item);
+                }
+                return size;
+            }
+        },
+        v);
+}
+}  // namespace bencode
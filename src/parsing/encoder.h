@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "bencode.h"
+#include "document.h"
+
+namespace bencode {
+
+// Streaming bencode writer. Values are written straight to the output
+// iterator; dictionary keys must be supplied in sorted order.
+template <typename OutputIt>
+class encoder {
+   public:
+    explicit encoder(OutputIt out) : out_{out} {}
+
+    encoder& integer(bencode::integer i) {
+        char digits[24];
+        const auto end = std::to_chars(std::begin(digits), std::end(digits), i);
+        *out_++ = 'i';
+        out_ = std::copy(std::begin(digits), end.ptr, out_);
+        *out_++ = 'e';
+        return *this;
+    }
+
+    encoder& string(std::string_view s) {
+        char digits[24];
+        const auto end =
+            std::to_chars(std::begin(digits), std::end(digits), s.size());
+        out_ = std::copy(std::begin(digits), end.ptr, out_);
+        *out_++ = ':';
+        out_ = std::copy(s.begin(), s.end(), out_);
+        return *this;
+    }
+
+    encoder& begin_list() {
+        *out_++ = 'l';
+        return *this;
+    }
+
+    encoder& begin_dict() {
+        *out_++ = 'd';
+        return *this;
+    }
+
+    encoder& end() {
+        *out_++ = 'e';
+        return *this;
+    }
+
+    encoder& value(const bencode::value& v) {
+        std::visit([this](const auto& element) { write(element); }, v);
+        return *this;
+    }
+
+    encoder& value(const node& n) {
+        switch (n.type()) {
+            case node::kind::integer:
+                return integer(n.as_integer());
+            case node::kind::string:
+                return string(n.as_string());
+            case node::kind::list:
+                begin_list();
+                for (const auto& item : n.as_list()) {
+                    value(item);
+                }
+                return end();
+            case node::kind::dictionary: {
+                auto members = std::vector<const member*>{};
+                members.reserve(n.as_dictionary().size());
+                for (const auto& m : n.as_dictionary()) {
+                    members.push_back(&m);
+                }
+                std::sort(members.begin(), members.end(),
+                          [](const member* a, const member* b) {
+                              return a->key < b->key;
+                          });
+
+                begin_dict();
+                for (const auto* m : members) {
+                    string(m->key);
+                    value(m->value);
+                }
+                return end();
+            }
+        }
+        return *this;
+    }
+
+    OutputIt out() const { return out_; }
+
+   private:
+    void write(bencode::integer i) { integer(i); }
+    void write(const bencode::string& s) { string(s); }
+
+    void write(const bencode::list& l) {
+        begin_list();
+        for (const auto& item : l) {
+            value(item);
+        }
+        end();
+    }
+
+    void write(const bencode::dictionary& d) {
+        using entry = bencode::dictionary::value_type;
+        auto entries = std::vector<const entry*>{};
+        entries.reserve(d.size());
+        for (const auto& e : d) {
+            entries.push_back(&e);
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const entry* a, const entry* b) {
+                      return a->first < b->first;
+                  });
+
+        begin_dict();
+        for (const auto* e : entries) {
+            string(e->first);
+            value(e->second);
+        }
+        end();
+    }
+
+    OutputIt out_;
+};
+
+// Writes v in canonical form (dictionary keys sorted) and returns the
+// iterator past the last byte written.
+template <typename OutputIt>
+OutputIt encode(const value& v, OutputIt out) {
+    return encoder<OutputIt>{out}.value(v).out();
+}
+
+template <typename OutputIt>
+OutputIt encode(const node& n, OutputIt out) {
+    return encoder<OutputIt>{out}.value(n).out();
+}
+
+// Number of bytes encode() will write, for sizing a caller-supplied buffer.
+std::size_t encoded_size(const value& v);
+
+}  // namespace bencode
@@ -0,0 +1,134 @@
+#include "fast_parser.h"
+
+#include <fmt/base.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "bencode.h"
+#include "parse_stats.h"
+#include "scanner.h"
+
+namespace bencode::detail {
+namespace {
+constexpr std::size_t max_depth = 512;
+
+class fast_parser {
+   public:
+    explicit fast_parser(std::string_view input)
+        : input_{input}, cursor_{input.data(), input.data() + input.size()} {}
+
+    std::optional<bencode::value> parse() {
+        auto result = bencode::value{};
+        if (!parse_value(result, 0)) {
+            fmt::println(stderr, "Invalid bencode at offset {}: {}",
+                         cursor_.error_position - input_.data(),
+                         cursor_.error);
+            return {};
+        }
+        return result;
+    }
+
+   private:
+    bool parse_value(bencode::value& out, std::size_t depth) {
+        if (cursor_.at_end()) {
+            return cursor_.fail(cursor_.position, "unexpected end of input");
+        }
+
+        switch (cursor_.peek()) {
+            case 'i': {
+                integer i = 0;
+                if (!scan_integer(cursor_, i)) {
+                    return false;
+                }
+                out = i;
+                return true;
+            }
+            case 'l':
+                return depth < max_depth ? parse_list(out, depth)
+                                         : cursor_.fail(cursor_.position,
+                                                        "nesting too deep");
+            case 'd':
+                return depth < max_depth ? parse_dictionary(out, depth)
+                                         : cursor_.fail(cursor_.position,
+                                                        "nesting too deep");
+            default: {
+                std::string_view s;
+                if (!scan_string(cursor_, s)) {
+                    return false;
+                }
+                out = bencode::string{s};
+                return true;
+            }
+        }
+    }
+
+    bool parse_list(bencode::value& out, std::size_t depth) {
+        ++cursor_.position;
+
+        auto result = bencode::list{};
+        while (true) {
+            if (cursor_.at_end()) {
+                return cursor_.fail(cursor_.position, "expected 'e'");
+            }
+            if (cursor_.peek() == 'e') {
+                ++cursor_.position;
+                break;
+            }
+
+            result.emplace_back();
+            if (!parse_value(result.back(), depth + 1)) {
+                return false;
+            }
+        }
+
+        out = std::move(result);
+        return true;
+    }
+
+    bool parse_dictionary(bencode::value& out, std::size_t depth) {
+        ++cursor_.position;
+
+        auto result = bencode::dictionary{};
+        while (true) {
+            if (cursor_.at_end()) {
+                return cursor_.fail(cursor_.position, "expected 'e'");
+            }
+            if (cursor_.peek() == 'e') {
+                ++cursor_.position;
+                break;
+            }
+
+            std::string_view key;
+            if (!scan_string(cursor_, key)) {
+                return false;
+            }
+
+            auto element = bencode::value{};
+            if (!parse_value(element, depth + 1)) {
+                return false;
+            }
+            result.emplace(bencode::string{key}, std::move(element));
+        }
+
+        out = std::move(result);
+        return true;
+    }
+
+    std::string_view input_;
+    cursor cursor_;
+};
+}  // namespace
+
+std::optional<bencode::value> parse_fast(std::string_view input) {
+    auto scope = parse_scope{input};
+    auto result = fast_parser{input}.parse();
+    if (!result) {
+        scope.failed();
+    }
+    return result;
+}
+}  // namespace bencode::detail
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+#include "bencode.h"
+
+namespace bencode::detail {
+
+std::optional<bencode::value> parse_fast(std::string_view input);
+
+}  // namespace bencode::detail
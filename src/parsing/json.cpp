@@ -0,0 +1,67 @@
+#include "json.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace bencode::detail {
+
+bool is_utf8(std::string_view s) {
+    const auto* p = reinterpret_cast<const std::uint8_t*>(s.data());
+    const auto* const end = p + s.size();
+
+    while (p != end) {
+        // Skip ASCII eight bytes at a time.
+        if (end - p >= 8) {
+            std::uint64_t chunk = 0;
+            std::memcpy(&chunk, p, sizeof(chunk));
+            if ((chunk & 0x8080808080808080) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+
+        const auto lead = *p;
+        if (lead < 0x80) {
+            ++p;
+            continue;
+        }
+
+        std::size_t length = 0;
+        std::uint32_t code_point = 0;
+        if ((lead & 0xe0) == 0xc0) {
+            length = 2;
+            code_point = lead & 0x1f;
+        } else if ((lead & 0xf0) == 0xe0) {
+            length = 3;
+            code_point = lead & 0x0f;
+        } else if ((lead & 0xf8) == 0xf0) {
+            length = 4;
+            code_point = lead & 0x07;
+        } else {
+            return false;
+        }
+
+        if (static_cast<std::size_t>(end - p) < length) {
+            return false;
+        }
+        for (std::size_t i = 1; i < length; i++) {
+            if ((p[i] & 0xc0) != 0x80) {
+                return false;
+            }
+            code_point = (code_point << 6) | (p[i] & 0x3f);
+        }
+
+        // Reject overlong forms, surrogates and values past U+10FFFF.
+        constexpr std::uint32_t minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (code_point < minimum[length] || code_point > 0x10ffff ||
+            (code_point >= 0xd800 && code_point <= 0xdfff)) {
+            return false;
+        }
+        p += length;
+    }
+    return true;
+}
+
+}  // namespace bencode::detail
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <fmt/base.h>
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bencode.h"
+#include "push_parser.h"
+
+namespace bencode {
+
+enum class binary_format { hex, base64 };
+
+namespace detail {
+bool is_utf8(std::string_view s);
+}  // namespace detail
+
+// push_parser handler that writes a value as compact JSON while it streams
+// past. Strings of up to inline_limit bytes that are valid UTF-8 become JSON
+// strings; all other strings are written as {"hex": "..."} or
+// {"base64": "..."}, encoded chunk by chunk. Keys must be JSON strings, so
+// binary keys are written as a plain string in the binary encoding. Memory
+// use is bounded by inline_limit and the nesting depth, never by the size of
+// the document.
+template <typename OutputIt>
+class json_writer {
+   public:
+    static constexpr std::size_t inline_limit = 64 * 1024;
+
+    explicit json_writer(OutputIt out,
+                         binary_format binary = binary_format::hex)
+        : out_{out}, binary_{binary} {}
+
+    void begin_list() { open('[', ']'); }
+    void begin_dict() { open('{', '}'); }
+
+    void end() {
+        *out_++ = containers_.back().close;
+        containers_.pop_back();
+    }
+
+    void integer(bencode::integer i) {
+        separate();
+        char digits[24];
+        const auto end = std::to_chars(std::begin(digits), std::end(digits), i);
+        write({digits, static_cast<std::size_t>(end.ptr - digits)});
+    }
+
+    void key(std::size_t length) {
+        separate();
+        begin_string(length, true);
+    }
+
+    void string(std::size_t length) {
+        separate();
+        begin_string(length, false);
+    }
+
+    void string_chunk(std::string_view data, bool last) {
+        if (buffering_) {
+            pending_.append(data);
+            if (last) {
+                flush_pending();
+            }
+        } else {
+            encode(data);
+            if (last) {
+                end_binary();
+            }
+        }
+
+        if (last && is_key_) {
+            after_key_ = true;
+        }
+    }
+
+    OutputIt out() const { return out_; }
+
+   private:
+    static constexpr std::string_view hex_digits = "0123456789abcdef";
+    static constexpr std::string_view alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    struct container {
+        char close;
+        bool first;
+    };
+
+    void open(char opening, char closing) {
+        separate();
+        *out_++ = opening;
+        containers_.push_back({closing, true});
+    }
+
+    // Writes whatever has to come between the previous token and a new
+    // value or key.
+    void separate() {
+        if (after_key_) {
+            *out_++ = ':';
+            after_key_ = false;
+        } else if (!containers_.empty()) {
+            if (!containers_.back().first) {
+                *out_++ = ',';
+            }
+            containers_.back().first = false;
+        }
+    }
+
+    void begin_string(std::size_t length, bool is_key) {
+        is_key_ = is_key;
+        buffering_ = length <= inline_limit;
+        if (buffering_) {
+            pending_.clear();
+        } else {
+            begin_binary();
+        }
+    }
+
+    void flush_pending() {
+        if (detail::is_utf8(pending_)) {
+            write_escaped(pending_);
+            return;
+        }
+        begin_binary();
+        encode(pending_);
+        end_binary();
+    }
+
+    void begin_binary() {
+        if (!is_key_) {
+            write(binary_ == binary_format::hex ? "{\"hex\":" : "{\"base64\":");
+        }
+        *out_++ = '"';
+        carry_size_ = 0;
+    }
+
+    void end_binary() {
+        if (carry_size_ > 0) {
+            const auto b0 = carry_[0];
+            const auto b1 = carry_size_ > 1 ? carry_[1] : std::uint8_t{0};
+            *out_++ = alphabet[b0 >> 2];
+            *out_++ = alphabet[((b0 & 0x03) << 4) | (b1 >> 4)];
+            *out_++ = carry_size_ > 1 ? alphabet[(b1 & 0x0f) << 2] : '=';
+            *out_++ = '=';
+            carry_size_ = 0;
+        }
+
+        *out_++ = '"';
+        if (!is_key_) {
+            *out_++ = '}';
+        }
+    }
+
+    void encode(std::string_view data) {
+        if (binary_ == binary_format::hex) {
+            for (const auto c : data) {
+                const auto byte = static_cast<std::uint8_t>(c);
+                *out_++ = hex_digits[byte >> 4];
+                *out_++ = hex_digits[byte & 0x0f];
+            }
+            return;
+        }
+
+        for (const auto c : data) {
+            carry_[carry_size_++] = static_cast<std::uint8_t>(c);
+            if (carry_size_ == 3) {
+                const auto group = (std::uint32_t{carry_[0]} << 16) |
+                                   (std::uint32_t{carry_[1]} << 8) | carry_[2];
+                *out_++ = alphabet[(group >> 18) & 0x3f];
+                *out_++ = alphabet[(group >> 12) & 0x3f];
+                *out_++ = alphabet[(group >> 6) & 0x3f];
+                *out_++ = alphabet[group & 0x3f];
+                carry_size_ = 0;
+            }
+        }
+    }
+
+    void write_escaped(std::string_view s) {
+        *out_++ = '"';
+        for (const auto c : s) {
+            switch (c) {
+                case '"':
+                    write("\\\"");
+                    break;
+                case '\\':
+                    write("\\\\");
+                    break;
+                case '\b':
+                    write("\\b");
+                    break;
+                case '\f':
+                    write("\\f");
+                    break;
+                case '\n':
+                    write("\\n");
+                    break;
+                case '\r':
+                    write("\\r");
+                    break;
+                case '\t':
+                    write("\\t");
+                    break;
+                default:
+                    if (static_cast<std::uint8_t>(c) < 0x20) {
+                        write("\\u00");
+                        *out_++ = hex_digits[(c >> 4) & 0x0f];
+                        *out_++ = hex_digits[c & 0x0f];
+                    } else {
+                        *out_++ = c;
+                    }
+            }
+        }
+        *out_++ = '"';
+    }
+
+    void write(std::string_view s) {
+        for (const auto c : s) {
+            *out_++ = c;
+        }
+    }
+
+    OutputIt out_;
+    binary_format binary_;
+
+    std::vector<container> containers_;
+    std::string pending_;
+    bool buffering_ = false;
+    bool is_key_ = false;
+    bool after_key_ = false;
+    std::uint8_t carry_[3] = {};
+    std::size_t carry_size_ = 0;
+};
+
+// Reads a single bencode value from input in fixed-size chunks and writes it
+// to out as JSON. Returns the iterator past the output, or nothing if input
+// is not valid bencode, in which case a partial document may have been
+// written.
+template <typename OutputIt>
+std::optional<OutputIt> write_json(std::istream& input, OutputIt out,
+                                   binary_format binary = binary_format::hex) {
+    auto writer = json_writer<OutputIt>{out, binary};
+    auto parser = push_parser{writer};
+    auto buffer = std::vector<char>(64 * 1024);
+
+    using status = typename decltype(parser)::status;
+    while (parser.state() == status::incomplete) {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto read = static_cast<std::size_t>(input.gcount());
+        if (read == 0) {
+            break;
+        }
+        parser.feed({buffer.data(), read});
+    }
+
+    if (!parser.finish()) {
+        fmt::println(stderr, "Invalid bencode at offset {}: {}",
+                     parser.error()->offset, parser.error()->message);
+        return {};
+    }
+    return writer.out();
+}
+
+}  // namespace bencode
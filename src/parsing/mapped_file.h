@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace bencode {
+
+// Read-only memory mapping of a whole file. Views handed out by bytes() stay
+// valid for as long as the mapping is alive.
+class mapped_file {
+   public:
+    static std::optional<mapped_file> open(const std::filesystem::path& path);
+
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file&& other) noexcept;
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file();
+
+    std::string_view bytes() const { return {data_, size_}; }
+    std::size_t size() const { return size_; }
+
+   private:
+    mapped_file(const char* data, std::size_t size);
+    void reset();
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+}  // namespace bencode
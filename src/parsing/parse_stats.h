@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "metrics.h"
+
+// Counters and parse time shared by every bencode parser, reported under
+// "bencode." in the global metrics registry.
+namespace bencode::detail {
+
+struct parse_stats {
+    metrics::counter& documents =
+        metrics::global().counter("bencode.documents");
+    metrics::counter& bytes = metrics::global().counter("bencode.bytes");
+    metrics::counter& errors = metrics::global().counter("bencode.errors");
+    metrics::histogram& parse_ns =
+        metrics::global().histogram("bencode.parse_ns");
+};
+
+inline parse_stats& stats() {
+    static auto instance = parse_stats{};
+    return instance;
+}
+
+// Reading the clock twice costs about as much as parsing a small torrent,
+// so each thread times one document in this many.
+inline constexpr std::uint32_t timed_one_in = 16;
+
+// Counts a document and times it until destroyed if sampled; call failed()
+// if it did not parse.
+class parse_scope {
+   public:
+    explicit parse_scope(std::string_view input)
+        : stats_{stats()}, timer_{stats_.parse_ns, sampled()} {
+        stats_.documents.add();
+        stats_.bytes.add(input.size());
+    }
+
+    void failed() { stats_.errors.add(); }
+
+   private:
+    static bool sampled() {
+        thread_local std::uint32_t documents = 0;
+        return documents++ % timed_one_in == 0;
+    }
+
+    parse_stats& stats_;
+    metrics::scoped_timer timer_;
+};
+
+}  // namespace bencode::detail
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "bencode.h"
+
+namespace bencode {
+
+// Incremental bencode parser that reports a single value as a stream of
+// events, keeping only one byte of state per open container. Input may be
+// split at any byte, including inside string lengths, string data and
+// integers.
+//
+// Handler must provide:
+//   void begin_list();
+//   void begin_dict();
+//   void end();
+//   void integer(bencode::integer i);
+//   void key(std::size_t length);
+//   void string(std::size_t length);
+//   void string_chunk(std::string_view data, bool last);
+//
+// key() and string() announce a string of the given length. Its contents
+// follow as one or more string_chunk() calls, the final one with last set.
+template <typename Handler>
+class push_parser {
+   public:
+    enum class status : std::uint8_t { incomplete, complete, error };
+
+    explicit push_parser(Handler& handler, std::size_t max_depth = 512)
+        : handler_{handler}, max_depth_{max_depth} {}
+
+    // Consumes bytes up to the end of the value or the first error and
+    // returns how many were used, so trailing data can be handed elsewhere.
+    std::size_t feed(std::string_view chunk) {
+        const char* cursor = chunk.data();
+        const char* const end = cursor + chunk.size();
+        chunk_begin_ = cursor;
+
+        while (cursor != end && status_ == status::incomplete) {
+            switch (mode_) {
+                case mode::value:
+                    cursor = on_value(cursor);
+                    break;
+                case mode::integer_sign:
+                    if (*cursor == '-') {
+                        negative_ = true;
+                        mode_ = mode::integer_first_digit;
+                        ++cursor;
+                        break;
+                    }
+                    mode_ = mode::integer_first_digit;
+                    [[fallthrough]];
+                case mode::integer_first_digit:
+                    if (!is_digit(*cursor)) {
+                        fail(cursor, "expected digit");
+                        break;
+                    }
+                    mode_ = mode::integer_digits;
+                    [[fallthrough]];
+                case mode::integer_digits:
+                    cursor = on_integer_digits(cursor, end);
+                    break;
+                case mode::length_digits:
+                    cursor = on_length_digits(cursor, end);
+                    break;
+                case mode::string_data:
+                    cursor = on_string_data(cursor, end);
+                    break;
+            }
+        }
+
+        const auto used = static_cast<std::size_t>(cursor - chunk.data());
+        offset_ += used;
+        return used;
+    }
+
+    // Signals that no more input will arrive.
+    bool finish() {
+        if (status_ == status::incomplete) {
+            status_ = status::error;
+            error_ = parse_error{offset_, "unexpected end of input"};
+        }
+        return status_ == status::complete;
+    }
+
+    status state() const { return status_; }
+    const std::optional<parse_error>& error() const { return error_; }
+    std::size_t offset() const { return offset_; }
+    std::size_t depth() const { return frames_.size(); }
+
+   private:
+    enum class mode : std::uint8_t {
+        value,
+        integer_sign,
+        integer_first_digit,
+        integer_digits,
+        length_digits,
+        string_data,
+    };
+
+    enum class frame : std::uint8_t { list, dict_key, dict_value };
+
+    static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+    const char* on_value(const char* cursor) {
+        const bool in_list = !frames_.empty() && frames_.back() == frame::list;
+        const bool expecting_key =
+            !frames_.empty() && frames_.back() == frame::dict_key;
+
+        if (*cursor == 'e' && (in_list || expecting_key)) {
+            frames_.pop_back();
+            handler_.end();
+            complete_value();
+            return cursor + 1;
+        }
+
+        if (expecting_key) {
+            if (!is_digit(*cursor)) {
+                fail(cursor, "expected dictionary key");
+                return cursor;
+            }
+            is_key_ = true;
+            magnitude_ = 0;
+            mode_ = mode::length_digits;
+            return cursor;
+        }
+
+        switch (*cursor) {
+            case 'i':
+                negative_ = false;
+                magnitude_ = 0;
+                mode_ = mode::integer_sign;
+                return cursor + 1;
+            case 'l':
+            case 'd':
+                if (frames_.size() == max_depth_) {
+                    fail(cursor, "nesting too deep");
+                    return cursor;
+                }
+                if (*cursor == 'l') {
+                    frames_.push_back(frame::list);
+                    handler_.begin_list();
+                } else {
+                    frames_.push_back(frame::dict_key);
+                    handler_.begin_dict();
+                }
+                return cursor + 1;
+            default:
+                if (!is_digit(*cursor)) {
+                    fail(cursor, "expected value");
+                    return cursor;
+                }
+                is_key_ = false;
+                magnitude_ = 0;
+                mode_ = mode::length_digits;
+                return cursor;
+        }
+    }
+
+    const char* on_integer_digits(const char* cursor, const char* end) {
+        const std::uint64_t limit =
+            static_cast<std::uint64_t>(std::numeric_limits<integer>::max()) +
+            (negative_ ? 1 : 0);
+
+        while (cursor != end && is_digit(*cursor)) {
+            const auto digit = static_cast<std::uint64_t>(*cursor - '0');
+            if (magnitude_ > (limit - digit) / 10) {
+                fail(cursor, "integer overflow");
+                return cursor;
+            }
+            magnitude_ = magnitude_ * 10 + digit;
+            ++cursor;
+        }
+
+        if (cursor == end) {
+            return cursor;
+        }
+        if (*cursor != 'e') {
+            fail(cursor, "expected 'e'");
+            return cursor;
+        }
+
+        handler_.integer(negative_ ? static_cast<integer>(0 - magnitude_)
+                                   : static_cast<integer>(magnitude_));
+        mode_ = mode::value;
+        complete_value();
+        return cursor + 1;
+    }
+
+    const char* on_length_digits(const char* cursor, const char* end) {
+        while (cursor != end && is_digit(*cursor)) {
+            const auto digit = static_cast<std::uint64_t>(*cursor - '0');
+            if (magnitude_ >
+                (std::numeric_limits<std::uint64_t>::max() - digit) / 10) {
+                fail(cursor, "string length overflow");
+                return cursor;
+            }
+            magnitude_ = magnitude_ * 10 + digit;
+            ++cursor;
+        }
+
+        if (cursor == end) {
+            return cursor;
+        }
+        if (*cursor != ':') {
+            fail(cursor, "expected ':'");
+            return cursor;
+        }
+
+        const auto length = static_cast<std::size_t>(magnitude_);
+        if (is_key_) {
+            handler_.key(length);
+        } else {
+            handler_.string(length);
+        }
+
+        remaining_ = length;
+        mode_ = mode::string_data;
+        if (remaining_ == 0) {
+            end_string({});
+        }
+        return cursor + 1;
+    }
+
+    const char* on_string_data(const char* cursor, const char* end) {
+        const auto available = static_cast<std::size_t>(end - cursor);
+        const auto n = remaining_ < available ? remaining_ : available;
+        remaining_ -= n;
+
+        if (remaining_ == 0) {
+            end_string({cursor, n});
+        } else {
+            handler_.string_chunk({cursor, n}, false);
+        }
+        return cursor + n;
+    }
+
+    void end_string(std::string_view last_chunk) {
+        handler_.string_chunk(last_chunk, true);
+        mode_ = mode::value;
+        if (is_key_) {
+            frames_.back() = frame::dict_value;
+        } else {
+            complete_value();
+        }
+    }
+
+    void complete_value() {
+        if (frames_.empty()) {
+            status_ = status::complete;
+        } else if (frames_.back() == frame::dict_value) {
+            frames_.back() = frame::dict_key;
+        }
+    }
+
+    void fail(const char* cursor, std::string_view message) {
+        status_ = status::error;
+        error_ = parse_error{
+            offset_ + static_cast<std::size_t>(cursor - chunk_begin_), message};
+    }
+
+    Handler& handler_;
+    std::size_t max_depth_;
+
+    std::vector<frame> frames_;
+    mode mode_ = mode::value;
+    status status_ = status::incomplete;
+    bool negative_ = false;
+    bool is_key_ = false;
+    std::uint64_t magnitude_ = 0;
+    std::size_t remaining_ = 0;
+    std::size_t offset_ = 0;
+    const char* chunk_begin_ = nullptr;
+    std::optional<parse_error> error_;
+};
+
+}  // namespace bencode
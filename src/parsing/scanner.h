@@ -0,0 +1,174 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bencode.h"
+
+// Scanning primitives shared by the hand-written bencode parsers. Digit runs
+// are found 16 bytes at a time and converted 8 digits at a time; string
+// bodies are never looked at, only bounds-checked and skipped.
+namespace bencode::detail {
+
+struct cursor {
+    cursor(const char* begin, const char* last) : position{begin}, end{last} {}
+
+    const char* position;
+    const char* end;
+    const char* error_position = nullptr;
+    std::string_view error;
+
+    bool fail(const char* where, std::string_view message) {
+        error_position = where;
+        error = message;
+        return false;
+    }
+
+    bool at_end() const { return position == end; }
+    char peek() const { return *position; }
+    std::size_t remaining() const {
+        return static_cast<std::size_t>(end - position);
+    }
+};
+
+inline std::size_t count_digits(const char* p, const char* end) {
+    const char* const begin = p;
+#if defined(__SSE2__)
+    const auto below = _mm_set1_epi8('0' - 1);
+    const auto above = _mm_set1_epi8('9' + 1);
+    while (end - p >= 16) {
+        const auto bytes =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const auto digits = _mm_and_si128(_mm_cmpgt_epi8(bytes, below),
+                                          _mm_cmplt_epi8(bytes, above));
+        const auto mask =
+            static_cast<std::uint32_t>(_mm_movemask_epi8(digits)) ^ 0xffffu;
+        if (mask != 0) {
+            return static_cast<std::size_t>(p - begin) + std::countr_zero(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p != end && *p >= '0' && *p <= '9') {
+        ++p;
+    }
+    return static_cast<std::size_t>(p - begin);
+}
+
+// Converts exactly n (1 to 8) ASCII digits with three multiplies. Requires
+// 8 readable bytes at p.
+inline std::uint64_t parse_digits_swar(const char* p, std::size_t n) {
+    std::uint64_t chunk = 0;
+    std::memcpy(&chunk, p, sizeof(chunk));
+    if constexpr (std::endian::native == std::endian::big) {
+        chunk = __builtin_bswap64(chunk);
+    }
+    chunk <<= 8 * (8 - n);
+
+    chunk = ((chunk & 0x0f0f0f0f0f0f0f0f) * 2561) >> 8;
+    chunk = ((chunk & 0x00ff00ff00ff00ff) * 6553601) >> 16;
+    return ((chunk & 0x0000ffff0000ffff) * 42949672960001) >> 32;
+}
+
+// Converts a run of n digits without leading zeros; n must be at most 19 so
+// that the result fits in 64 bits.
+inline std::uint64_t parse_digits(const char* p, std::size_t n,
+                                  const char* end) {
+    std::uint64_t result = 0;
+    if (end - p >= 24) {
+        const auto head = n % 8 == 0 ? 8 : n % 8;
+        result = parse_digits_swar(p, head);
+        for (auto i = head; i < n; i += 8) {
+            result = result * 100000000 + parse_digits_swar(p + i, 8);
+        }
+        return result;
+    }
+
+    for (std::size_t i = 0; i < n; i++) {
+        result = result * 10 + static_cast<std::uint64_t>(p[i] - '0');
+    }
+    return result;
+}
+
+// Parses an unsigned decimal run at the cursor, checked against limit.
+inline bool scan_unsigned(cursor& c, std::uint64_t limit,
+                          std::uint64_t& out) {
+    const char* const digits = c.position;
+    auto n = count_digits(digits, c.end);
+    if (n == 0) {
+        return c.fail(digits, "expected digit");
+    }
+
+    const char* significant = digits;
+    while (n > 1 && *significant == '0') {
+        ++significant;
+        --n;
+    }
+
+    if (n > 19) {
+        return c.fail(digits, "integer overflow");
+    }
+    out = parse_digits(significant, n, c.end);
+    if (out > limit) {
+        return c.fail(digits, "integer overflow");
+    }
+
+    c.position = significant + n;
+    return true;
+}
+
+inline bool scan_integer(cursor& c, integer& out) {
+    ++c.position;
+    const bool negative = !c.at_end() && c.peek() == '-';
+    if (negative) {
+        ++c.position;
+    }
+
+    const auto limit =
+        static_cast<std::uint64_t>(std::numeric_limits<integer>::max()) +
+        (negative ? 1 : 0);
+    std::uint64_t magnitude = 0;
+    if (!scan_unsigned(c, limit, magnitude)) {
+        return false;
+    }
+
+    if (c.at_end() || c.peek() != 'e') {
+        return c.fail(c.position, "expected 'e'");
+    }
+    ++c.position;
+
+    out = negative ? static_cast<integer>(0 - magnitude)
+                   : static_cast<integer>(magnitude);
+    return true;
+}
+
+inline bool scan_string(cursor& c, std::string_view& out) {
+    std::uint64_t length = 0;
+    if (!scan_unsigned(c, std::numeric_limits<std::uint64_t>::max(),
+                       length)) {
+        return false;
+    }
+
+    if (c.at_end() || c.peek() != ':') {
+        return c.fail(c.position, "expected ':'");
+    }
+    ++c.position;
+
+    if (c.remaining() < length) {
+        return c.fail(c.end, "string runs past end of input");
+    }
+
+    out = std::string_view{c.position, static_cast<std::size_t>(length)};
+    c.position += length;
+    return true;
+}
+
+}  // namespace bencode::detail
@@ -0,0 +1,365 @@
+#include "tape.h"
+
+#include <fmt/base.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bencode.h"
+#include "mapped_file.h"
+#include "parse_stats.h"
+#include "scanner.h"
+
+namespace bencode {
+namespace {
+constexpr std::uint64_t payload_mask = (std::uint64_t{1} << 56) - 1;
+constexpr std::uint64_t short_length_bits = 20;
+constexpr std::uint64_t short_length_limit = std::uint64_t{1}
+                                             << short_length_bits;
+constexpr std::uint64_t short_offset_limit = std::uint64_t{1}
+                                             << (56 - short_length_bits);
+constexpr integer short_integer_limit = integer{1} << 55;
+
+std::uint64_t make_word(tape_tag tag, std::uint64_t payload) {
+    return (static_cast<std::uint64_t>(tag) << 56) | (payload & payload_mask);
+}
+
+std::uint64_t payload(std::uint64_t word) { return word & payload_mask; }
+}  // namespace
+
+value_ref::kind value_ref::type() const {
+    switch (tag()) {
+        case tape_tag::integer:
+        case tape_tag::long_integer:
+            return kind::integer;
+        case tape_tag::string:
+        case tape_tag::long_string:
+            return kind::string;
+        case tape_tag::list:
+            return kind::list;
+        default:
+            return kind::dictionary;
+    }
+}
+
+integer value_ref::as_integer() const {
+    if (tag() == tape_tag::long_integer) {
+        return static_cast<integer>(word_[1]);
+    }
+    return static_cast<integer>(*word_ << 8) >> 8;
+}
+
+std::string_view value_ref::as_string() const {
+    if (tag() == tape_tag::long_string) {
+        return {source_ + word_[1], static_cast<std::size_t>(payload(*word_))};
+    }
+    const auto p = payload(*word_);
+    return {source_ + (p >> short_length_bits),
+            static_cast<std::size_t>(p & (short_length_limit - 1))};
+}
+
+list_ref value_ref::as_list() const { return list_ref{*this}; }
+
+dict_ref value_ref::as_dict() const { return dict_ref{*this}; }
+
+std::string_view value_ref::raw() const {
+    const auto begin = word_[1];
+    const auto end = payload(word_[width() - 1]);
+    return {source_ + begin, static_cast<std::size_t>(end - begin)};
+}
+
+std::size_t value_ref::width() const {
+    switch (tag()) {
+        case tape_tag::integer:
+        case tape_tag::string:
+            return 1;
+        case tape_tag::long_integer:
+        case tape_tag::long_string:
+            return 2;
+        default:
+            return static_cast<std::size_t>(payload(*word_));
+    }
+}
+
+std::size_t list_ref::size() const {
+    return static_cast<std::size_t>(std::distance(begin(), end()));
+}
+
+std::size_t dict_ref::size() const {
+    return static_cast<std::size_t>(std::distance(begin(), end()));
+}
+
+std::optional<value_ref> dict_ref::find(std::string_view key) const {
+    for (const auto& [k, v] : *this) {
+        if (k == key) {
+            return v;
+        }
+        if (k > key) {
+            break;
+        }
+    }
+    return {};
+}
+
+namespace {
+class tape_builder {
+   public:
+    tape_builder(std::string_view input, std::pmr::vector<std::uint64_t>& words,
+                 parse_error* error)
+        : input_{input},
+          cursor_{input.data(), input.data() + input.size()},
+          words_{words},
+          error_{error} {}
+
+    bool build() {
+        do {
+            if (cursor_.at_end()) {
+                return fail(cursor_.fail(cursor_.position,
+                                         "unexpected end of input"));
+            }
+            if (!step()) {
+                return fail(false);
+            }
+        } while (!frames_.empty());
+        return true;
+    }
+
+   private:
+    struct frame {
+        std::size_t header;
+        bool dictionary;
+        bool expecting_value;
+        bool sorted;
+        std::string_view last_key;
+    };
+
+    bool step() {
+        auto* top = frames_.empty() ? nullptr : &frames_.back();
+        if (top != nullptr && top->dictionary && !top->expecting_value) {
+            if (cursor_.peek() == 'e') {
+                close();
+                return true;
+            }
+
+            std::string_view key;
+            if (!detail::scan_string(cursor_, key)) {
+                return false;
+            }
+            if (key < top->last_key) {
+                top->sorted = false;
+            }
+            top->last_key = key;
+            top->expecting_value = true;
+            emit_string(key);
+            return true;
+        }
+
+        if (top != nullptr && !top->dictionary && cursor_.peek() == 'e') {
+            close();
+            return true;
+        }
+
+        switch (cursor_.peek()) {
+            case 'i': {
+                integer i = 0;
+                if (!detail::scan_integer(cursor_, i)) {
+                    return false;
+                }
+                emit_integer(i);
+                break;
+            }
+            case 'l':
+            case 'd':
+                open(cursor_.peek() == 'd');
+                return true;
+            default: {
+                std::string_view s;
+                if (!detail::scan_string(cursor_, s)) {
+                    return false;
+                }
+                emit_string(s);
+                break;
+            }
+        }
+
+        complete_value();
+        return true;
+    }
+
+    void open(bool dictionary) {
+        frames_.push_back({words_.size(), dictionary, false, true, {}});
+        words_.push_back(0);
+        words_.push_back(offset(cursor_.position));
+        ++cursor_.position;
+    }
+
+    void close() {
+        ++cursor_.position;
+        const auto top = frames_.back();
+        frames_.pop_back();
+
+        words_.push_back(make_word(tape_tag::end, offset(cursor_.position)));
+        words_[top.header] =
+            make_word(top.dictionary ? tape_tag::dictionary : tape_tag::list,
+                      words_.size() - top.header);
+
+        if (top.dictionary && !top.sorted) {
+            sort_members(top.header);
+        }
+        complete_value();
+    }
+
+    void complete_value() {
+        if (!frames_.empty() && frames_.back().dictionary) {
+            frames_.back().expecting_value = false;
+        }
+    }
+
+    void sort_members(std::size_t header) {
+        struct member_block {
+            std::string_view key;
+            std::size_t begin;
+            std::size_t width;
+        };
+
+        const auto dict = value_ref{words_.data() + header, input_.data()};
+        auto members = std::vector<member_block>{};
+        for (auto it = dict.as_dict().begin(); it != dict.as_dict().end();) {
+            const auto begin = it;
+            const auto key = (*it).first;
+            ++it;
+            members.push_back(
+                {key, static_cast<std::size_t>(begin.word() - words_.data()),
+                 static_cast<std::size_t>(it.word() - begin.word())});
+        }
+
+        std::stable_sort(members.begin(), members.end(),
+                         [](const member_block& a, const member_block& b) {
+                             return a.key < b.key;
+                         });
+
+        auto sorted = std::vector<std::uint64_t>{};
+        sorted.reserve(dict.width() - 3);
+        for (const auto& m : members) {
+            sorted.insert(sorted.end(), words_.begin() + m.begin,
+                          words_.begin() + m.begin + m.width);
+        }
+        std::copy(sorted.begin(), sorted.end(), words_.begin() + header + 2);
+    }
+
+    void emit_integer(integer i) {
+        if (i >= -short_integer_limit && i < short_integer_limit) {
+            words_.push_back(
+                make_word(tape_tag::integer, static_cast<std::uint64_t>(i)));
+            return;
+        }
+        words_.push_back(make_word(tape_tag::long_integer, 0));
+        words_.push_back(static_cast<std::uint64_t>(i));
+    }
+
+    void emit_string(std::string_view s) {
+        const auto where = offset(s.data());
+        if (where < short_offset_limit && s.size() < short_length_limit) {
+            words_.push_back(make_word(
+                tape_tag::string, (where << short_length_bits) | s.size()));
+            return;
+        }
+        words_.push_back(make_word(tape_tag::long_string, s.size()));
+        words_.push_back(where);
+    }
+
+    std::uint64_t offset(const char* position) const {
+        return static_cast<std::uint64_t>(position - input_.data());
+    }
+
+    bool fail(bool) {
+        const auto where =
+            static_cast<std::size_t>(cursor_.error_position - input_.data());
+        if (error_ != nullptr) {
+            *error_ = parse_error{where, cursor_.error};
+        } else {
+            fmt::println(stderr, "Invalid bencode at offset {}: {}", where,
+                         cursor_.error);
+        }
+        return false;
+    }
+
+    std::string_view input_;
+    detail::cursor cursor_;
+    std::pmr::vector<std::uint64_t>& words_;
+    parse_error* error_;
+    std::vector<frame> frames_;
+};
+}  // namespace
+
+std::optional<tape> parse_tape(std::string_view input, parse_error* error,
+                               std::pmr::memory_resource* arena) {
+    auto scope = detail::parse_scope{input};
+    auto result = tape{arena};
+    result.source_ = input;
+    result.words_.reserve(input.size() / 16 + 16);
+
+    if (!tape_builder{input, result.words_, error}.build()) {
+        scope.failed();
+        return {};
+    }
+    result.words_.shrink_to_fit();
+    return result;
+}
+
+std::optional<tape> load_tape(const std::filesystem::path& input,
+                              parse_error* error,
+                              std::pmr::memory_resource* arena) {
+    auto file = mapped_file::open(input);
+    if (!file) {
+        if (error != nullptr) {
+            *error = parse_error{0, "could not open file"};
+        } else {
+            fmt::println("Could not open file: {}",
+                         std::filesystem::absolute(input).string());
+        }
+        return {};
+    }
+
+    auto result = parse_tape(file->bytes(), error, arena);
+    if (!result) {
+        return {};
+    }
+
+    result->file_ = std::move(file);
+    return result;
+}
+
+bencode::value to_value(value_ref v) {
+    switch (v.type()) {
+        case value_ref::kind::integer:
+            return v.as_integer();
+        case value_ref::kind::string:
+            return bencode::string{v.as_string()};
+        case value_ref::kind::list: {
+            auto result = bencode::list{};
+            for (const auto item : v.as_list()) {
+                result.push_back(to_value(item));
+            }
+            return result;
+        }
+        case value_ref::kind::dictionary: {
+            auto result = bencode::dictionary{};
+            for (const auto& [key, item] : v.as_dict()) {
+                result.emplace(bencode::string{key}, to_value(item));
+            }
+            return result;
+        }
+    }
+    return {};
+}
+}  // namespace bencode
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bencode.h"
+#include "mapped_file.h"
+
+namespace bencode {
+
+// A parsed document stored as one contiguous array of 64-bit words. The top
+// byte of each word is a tag and the low 56 bits its payload:
+//
+//   integer       [integer | value]             (values that fit 56 bits)
+//   long integer  [long_integer | 0] [value]
+//   string        [string | offset:36 length:20]
+//   long string   [long_string | length] [offset]
+//   list, dict    [list/dictionary | words up to and including the end word]
+//                 [source offset of 'l'/'d'] elements... [end | source end]
+//
+// Offsets point into the source, which must stay alive with the tape.
+// Dictionary members are kept in sorted key order, as canonical bencode
+// requires, even if the input was not.
+enum class tape_tag : std::uint8_t {
+    integer,
+    long_integer,
+    string,
+    long_string,
+    list,
+    dictionary,
+    end,
+};
+
+class list_ref;
+class dict_ref;
+
+class value_ref {
+   public:
+    enum class kind : std::uint8_t { integer, string, list, dictionary };
+
+    value_ref(const std::uint64_t* word, const char* source)
+        : word_{word}, source_{source} {}
+
+    kind type() const;
+    bool is_integer() const { return type() == kind::integer; }
+    bool is_string() const { return type() == kind::string; }
+    bool is_list() const { return type() == kind::list; }
+    bool is_dictionary() const { return type() == kind::dictionary; }
+
+    integer as_integer() const;
+    std::string_view as_string() const;
+    list_ref as_list() const;
+    dict_ref as_dict() const;
+
+    // Exact source bytes of a list or dictionary.
+    std::string_view raw() const;
+
+    // Number of tape words this value occupies.
+    std::size_t width() const;
+
+   private:
+    friend class list_ref;
+    friend class dict_ref;
+
+    tape_tag tag() const { return static_cast<tape_tag>(*word_ >> 56); }
+
+    const std::uint64_t* word_;
+    const char* source_;
+};
+
+class list_ref {
+   public:
+    class iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = value_ref;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_ref;
+
+        iterator() = default;
+        iterator(const std::uint64_t* word, const char* source)
+            : word_{word}, source_{source} {}
+
+        value_ref operator*() const { return {word_, source_}; }
+        iterator& operator++() {
+            word_ += value_ref{word_, source_}.width();
+            return *this;
+        }
+        iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const iterator& other) const {
+            return word_ == other.word_;
+        }
+
+       private:
+        const std::uint64_t* word_ = nullptr;
+        const char* source_ = nullptr;
+    };
+
+    explicit list_ref(value_ref list) : list_{list} {}
+
+    iterator begin() const { return {list_.word_ + 2, list_.source_}; }
+    iterator end() const {
+        return {list_.word_ + list_.width() - 1, list_.source_};
+    }
+    bool empty() const { return begin() == end(); }
+    std::size_t size() const;
+
+   private:
+    value_ref list_;
+};
+
+class dict_ref {
+   public:
+    class iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<std::string_view, value_ref>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        iterator() = default;
+        iterator(const std::uint64_t* word, const char* source)
+            : word_{word}, source_{source} {}
+
+        value_type operator*() const {
+            const auto key = value_ref{word_, source_};
+            return {key.as_string(), {word_ + key.width(), source_}};
+        }
+        iterator& operator++() {
+            const auto key = value_ref{word_, source_};
+            word_ += key.width();
+            word_ += value_ref{word_, source_}.width();
+            return *this;
+        }
+        iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const iterator& other) const {
+            return word_ == other.word_;
+        }
+
+        const std::uint64_t* word() const { return word_; }
+
+       private:
+        const std::uint64_t* word_ = nullptr;
+        const char* source_ = nullptr;
+    };
+
+    explicit dict_ref(value_ref dict) : dict_{dict} {}
+
+    iterator begin() const { return {dict_.word_ + 2, dict_.source_}; }
+    iterator end() const {
+        return {dict_.word_ + dict_.width() - 1, dict_.source_};
+    }
+    bool empty() const { return begin() == end(); }
+    std::size_t size() const;
+
+    // Linear scan over the sorted keys, stopping early once past key.
+    std::optional<value_ref> find(std::string_view key) const;
+    bool contains(std::string_view key) const { return find(key).has_value(); }
+
+    std::string_view raw() const { return dict_.raw(); }
+
+   private:
+    value_ref dict_;
+};
+
+class tape {
+   public:
+    value_ref root() const { return {words_.data(), source_.data()}; }
+    std::string_view source() const { return source_; }
+    std::size_t size_in_bytes() const {
+        return words_.size() * sizeof(std::uint64_t);
+    }
+
+   private:
+    friend std::optional<tape> parse_tape(std::string_view input,
+                                          parse_error* error,
+                                          std::pmr::memory_resource* arena);
+    friend std::optional<tape> load_tape(const std::filesystem::path& input,
+                                         parse_error* error,
+                                         std::pmr::memory_resource* arena);
+
+    explicit tape(std::pmr::memory_resource* arena) : words_{arena} {}
+
+    std::optional<mapped_file> file_;
+    std::string_view source_;
+    std::pmr::vector<std::uint64_t> words_;
+};
+
+// The returned tape borrows input, which must outlive it. Errors are stored
+// in error when it is given and printed otherwise. The tape's words come
+// from arena, so that a thread loading many files can recycle one pool.
+std::optional<tape> parse_tape(
+    std::string_view input, parse_error* error = nullptr,
+    std::pmr::memory_resource* arena = std::pmr::get_default_resource());
+std::optional<tape> load_tape(
+    const std::filesystem::path& input, parse_error* error = nullptr,
+    std::pmr::memory_resource* arena = std::pmr::get_default_resource());
+
+bencode::value to_value(value_ref v);
+
+}  // namespace bencode
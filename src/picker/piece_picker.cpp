@@ -0,0 +1,288 @@
+#include "piece_picker.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "layout.h"
+#include "piece_set.h"
+
+namespace picker {
+namespace {
+// Below this many candidate pieces, scanning the peer's candidates
+// directly beats walking the availability order looking for them.
+constexpr std::size_t sparse_candidates = 64;
+
+std::uint32_t blocks_for(std::uint64_t bytes) {
+    return static_cast<std::uint32_t>(
+        (bytes + piece_picker::block_size - 1) / piece_picker::block_size);
+}
+}  // namespace
+
+piece_picker::piece_picker(const torrent::file_layout& layout)
+    : piece_picker{layout.piece_count(), blocks_for(layout.piece_length()),
+                   layout.piece_count() == 0
+                       ? 0
+                       : blocks_for(layout.piece_size(
+                             layout.piece_count() - 1))} {}
+
+piece_picker::piece_picker(std::size_t pieces, std::uint32_t blocks_per_piece,
+                           std::uint32_t blocks_in_last_piece)
+    : blocks_per_piece_{blocks_per_piece},
+      blocks_in_last_piece_{blocks_in_last_piece},
+      availability_(pieces),
+      order_(pieces),
+      position_(pieces),
+      bucket_start_{0, 0, static_cast<std::uint32_t>(pieces)},
+      have_{pieces},
+      wanted_{pieces},
+      wanted_count_{pieces} {
+    std::iota(order_.begin(), order_.end(), 0);
+    std::iota(position_.begin(), position_.end(), 0);
+    wanted_.fill();
+}
+
+void piece_picker::swap_positions(std::size_t a, std::size_t b) {
+    std::swap(order_[a], order_[b]);
+    position_[order_[a]] = static_cast<std::uint32_t>(a);
+    position_[order_[b]] = static_cast<std::uint32_t>(b);
+}
+
+void piece_picker::add_have(std::size_t piece) {
+    if (!have_.test(piece)) {
+        const auto k = bucket(piece);
+        if (k + 2 == bucket_start_.size()) {
+            bucket_start_.insert(bucket_start_.end() - 1, bucket_start_.back());
+        }
+        // The last of bucket k becomes the first of bucket k + 1.
+        swap_positions(position_[piece], bucket_start_[k + 1] - 1);
+        bucket_start_[k + 1]--;
+    }
+    availability_[piece]++;
+}
+
+void piece_picker::add_peer(const piece_set& peer) {
+    for (auto i = peer.find_next(0); i < peer.size();
+         i = peer.find_next(i + 1)) {
+        add_have(i);
+    }
+}
+
+void piece_picker::remove_peer(const piece_set& peer) {
+    for (auto i = peer.find_next(0); i < peer.size();
+         i = peer.find_next(i + 1)) {
+        if (!have_.test(i)) {
+            // The first of bucket k becomes the last of bucket k - 1.
+            const auto k = bucket(i);
+            swap_positions(position_[i], bucket_start_[k]);
+            bucket_start_[k]++;
+        }
+        availability_[i]--;
+    }
+}
+
+void piece_picker::move_to_have(std::size_t piece) {
+    for (auto k = bucket(piece); k > 0; k--) {
+        swap_positions(position_[piece], bucket_start_[k]);
+        bucket_start_[k]++;
+    }
+    have_.set(piece);
+}
+
+void piece_picker::set_wanted(std::size_t piece, bool wanted) {
+    if (wanted_.test(piece) == wanted) {
+        return;
+    }
+    if (wanted) {
+        wanted_.set(piece);
+        wanted_count_++;
+    } else {
+        wanted_.reset(piece);
+        wanted_count_--;
+    }
+}
+
+piece_picker::partial* piece_picker::find(std::uint32_t piece) {
+    const auto it =
+        std::find_if(partials_.begin(), partials_.end(),
+                     [piece](const partial& p) { return p.piece == piece; });
+    return it == partials_.end() ? nullptr : &*it;
+}
+
+piece_picker::partial& piece_picker::start(std::uint32_t piece) {
+    const auto blocks = blocks_in(piece);
+    return partials_.emplace_back(
+        partial{piece, blocks, 0, std::vector<block_state>(blocks)});
+}
+
+std::size_t piece_picker::request_open(partial& p, std::span<block> out) {
+    std::size_t n = 0;
+    for (std::uint32_t i = 0; i < p.blocks.size() && n < out.size(); i++) {
+        auto& state = p.blocks[i];
+        if (state.requests == 0 && !state.finished) {
+            state.requests = 1;
+            p.unrequested--;
+            out[n++] = {p.piece, i};
+        }
+    }
+    if (p.unrequested == 0) {
+        set_wanted(p.piece, false);
+    }
+    return n;
+}
+
+std::size_t piece_picker::pick(const piece_set& peer, std::span<block> out,
+                               std::span<const block> pending) {
+    auto n = pick_partial(peer, out);
+    if (n < out.size()) {
+        n += pick_new(peer, out.subspan(n));
+    }
+    if (n < out.size() && endgame()) {
+        n = pick_endgame(peer, out, n, pending);
+    }
+    return n;
+}
+
+std::size_t piece_picker::pick_partial(const piece_set& peer,
+                                       std::span<block> out) {
+    std::size_t n = 0;
+    for (auto& p : partials_) {
+        if (n == out.size()) {
+            break;
+        }
+        if (p.unrequested > 0 && peer.test(p.piece)) {
+            n += request_open(p, out.subspan(n));
+        }
+    }
+    return n;
+}
+
+std::size_t piece_picker::pick_new(const piece_set& peer,
+                                   std::span<block> out) {
+    // Partial pieces this peer has were exhausted by pick_partial, so what
+    // is left in wanted_ is untouched pieces.
+    const auto candidates =
+        count_common(peer, wanted_, sparse_candidates);
+    if (candidates == 0) {
+        return 0;
+    }
+
+    std::size_t n = 0;
+    if (candidates <= sparse_candidates) {
+        auto pieces = std::vector<std::uint32_t>{};
+        pieces.reserve(candidates);
+        for_each_common(peer, wanted_, [&](std::size_t piece) {
+            pieces.push_back(static_cast<std::uint32_t>(piece));
+        });
+        std::sort(pieces.begin(), pieces.end(),
+                  [this](std::uint32_t a, std::uint32_t b) {
+                      return availability_[a] < availability_[b];
+                  });
+        for (const auto piece : pieces) {
+            if (n == out.size()) {
+                break;
+            }
+            n += request_open(start(piece), out.subspan(n));
+        }
+        return n;
+    }
+
+    for (auto i = bucket_start_[1]; i < order_.size() && n < out.size();
+         i++) {
+        const auto piece = order_[i];
+        if (wanted_.test(piece) && peer.test(piece)) {
+            n += request_open(start(piece), out.subspan(n));
+        }
+    }
+    return n;
+}
+
+// Neither the blocks already pending from this peer nor the first n of
+// out, picked in this same call, are requested twice.
+std::size_t piece_picker::pick_endgame(const piece_set& peer,
+                                       std::span<block> out, std::size_t n,
+                                       std::span<const block> pending) {
+    const auto picked = n;
+    for (auto& p : partials_) {
+        if (!peer.test(p.piece)) {
+            continue;
+        }
+        for (std::uint32_t i = 0; i < p.blocks.size() && n < out.size();
+             i++) {
+            auto& state = p.blocks[i];
+            const auto b = block{p.piece, i};
+            if (state.finished || state.requests >= max_requests ||
+                std::find(pending.begin(), pending.end(), b) !=
+                    pending.end() ||
+                std::find(out.begin(), out.begin() + picked, b) !=
+                    out.begin() + picked) {
+                continue;
+            }
+            state.requests++;
+            out[n++] = b;
+        }
+    }
+    return n;
+}
+
+bool piece_picker::finished(block b) {
+    auto* p = find(b.piece);
+    if (p == nullptr || p->blocks[b.index].finished) {
+        return false;
+    }
+    auto& state = p->blocks[b.index];
+    if (state.requests == 0) {
+        p->unrequested--;
+        if (p->unrequested == 0) {
+            set_wanted(b.piece, false);
+        }
+    }
+    state.requests = 0;
+    state.finished = true;
+    p->finished++;
+    return p->finished == p->blocks.size();
+}
+
+void piece_picker::aborted(block b) {
+    auto* p = find(b.piece);
+    if (p == nullptr) {
+        return;
+    }
+    auto& state = p->blocks[b.index];
+    if (state.finished || state.requests == 0) {
+        return;
+    }
+    if (--state.requests == 0) {
+        p->unrequested++;
+        set_wanted(b.piece, true);
+    }
+}
+
+void piece_picker::passed(std::size_t piece) {
+    if (have_.test(piece)) {
+        return;
+    }
+    if (auto* p = find(static_cast<std::uint32_t>(piece))) {
+        std::swap(*p, partials_.back());
+        partials_.pop_back();
+    }
+    set_wanted(piece, false);
+    move_to_have(piece);
+}
+
+void piece_picker::failed(std::size_t piece) {
+    auto* p = find(static_cast<std::uint32_t>(piece));
+    if (p == nullptr) {
+        return;
+    }
+    std::fill(p->blocks.begin(), p->blocks.end(), block_state{});
+    p->unrequested = static_cast<std::uint32_t>(p->blocks.size());
+    p->finished = 0;
+    set_wanted(piece, true);
+}
+
+}  // namespace picker
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "layout.h"
+#include "piece_set.h"
+
+namespace picker {
+
+// The index-th block of a piece; blocks are block_size bytes except at the
+// end of the last piece.
+struct block {
+    std::uint32_t piece;
+    std::uint32_t index;
+
+    bool operator==(const block&) const = default;
+};
+
+// Decides which blocks to request from which peer: blocks of pieces already
+// being downloaded first, then new pieces rarest first, and once every
+// missing block has been requested, endgame duplicates.
+//
+// Pieces are kept in one array ordered by availability, with the start of
+// each availability bucket recorded, so a have or a lost peer moves a piece
+// by a single swap at a bucket boundary and a bitfield costs one such swap
+// per piece it holds. Pieces we have sit in a bucket of their own in front.
+class piece_picker {
+   public:
+    static constexpr std::uint32_t block_size = 16384;
+    // Outstanding requests a block may have in endgame.
+    static constexpr std::uint8_t max_requests = 3;
+
+    explicit piece_picker(const torrent::file_layout& layout);
+    piece_picker(std::size_t pieces, std::uint32_t blocks_per_piece,
+                 std::uint32_t blocks_in_last_piece);
+
+    std::size_t piece_count() const { return availability_.size(); }
+    std::uint32_t blocks_in(std::size_t piece) const {
+        return piece + 1 == piece_count() ? blocks_in_last_piece_
+                                          : blocks_per_piece_;
+    }
+
+    // Availability, from bitfield and have messages and departing peers.
+    std::uint32_t availability(std::size_t piece) const {
+        return availability_[piece];
+    }
+    void add_peer(const piece_set& peer);
+    void remove_peer(const piece_set& peer);
+    void add_have(std::size_t piece);
+
+    // Our own pieces.
+    const piece_set& have() const { return have_; }
+    std::size_t have_count() const { return bucket_start_[1]; }
+    bool complete() const { return have_count() == piece_count(); }
+
+    // Whether a peer holding peer has a piece we lack.
+    bool interesting(const piece_set& peer) const {
+        return any_missing(peer, have_);
+    }
+
+    // Fills out with blocks to request from a peer holding peer and returns
+    // how many were written. pending are the blocks already requested from
+    // this peer, which endgame will not request again.
+    std::size_t pick(const piece_set& peer, std::span<block> out,
+                     std::span<const block> pending = {});
+
+    // Whether every missing block has been requested at least once.
+    bool endgame() const { return wanted_count_ == 0 && !complete(); }
+
+    // A requested block arrived. Returns true when that completes its
+    // piece, which is then ready to be verified. In endgame the caller
+    // cancels its other requests for the block.
+    bool finished(block b);
+    // A request was cancelled or lost with its peer.
+    void aborted(block b);
+
+    // The verdict on a completed piece.
+    void passed(std::size_t piece);
+    void failed(std::size_t piece);
+
+   private:
+    struct block_state {
+        std::uint8_t requests = 0;
+        bool finished = false;
+    };
+
+    // A piece with at least one block requested.
+    struct partial {
+        std::uint32_t piece;
+        std::uint32_t unrequested;
+        std::uint32_t finished;
+        std::vector<block_state> blocks;
+    };
+
+    std::size_t bucket(std::size_t piece) const {
+        return have_.test(piece) ? 0 : availability_[piece] + 1;
+    }
+    void swap_positions(std::size_t a, std::size_t b);
+    void move_to_have(std::size_t piece);
+
+    partial* find(std::uint32_t piece);
+    partial& start(std::uint32_t piece);
+    void set_wanted(std::size_t piece, bool wanted);
+
+    std::size_t pick_partial(const piece_set& peer, std::span<block> out);
+    std::size_t pick_new(const piece_set& peer, std::span<block> out);
+    std::size_t pick_endgame(const piece_set& peer, std::span<block> out,
+                             std::size_t n, std::span<const block> pending);
+    std::size_t request_open(partial& p, std::span<block> out);
+
+    std::uint32_t blocks_per_piece_;
+    std::uint32_t blocks_in_last_piece_;
+
+    std::vector<std::uint32_t> availability_;
+    // Pieces by bucket, and each piece's index in it.
+    std::vector<std::uint32_t> order_;
+    std::vector<std::uint32_t> position_;
+    // bucket_start_[k] is where bucket k begins in order_; bucket 0 holds
+    // our pieces and bucket k + 1 the missing pieces k peers have. The last
+    // entry is the end of order_.
+    std::vector<std::uint32_t> bucket_start_;
+
+    piece_set have_;
+    // Missing pieces with a block nobody has been asked for.
+    piece_set wanted_;
+    std::size_t wanted_count_;
+    std::vector<partial> partials_;
+};
+
+}  // namespace picker
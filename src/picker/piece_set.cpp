@@ -0,0 +1,195 @@
+#include "piece_set.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bitfield.h"
+
+namespace picker {
+namespace {
+std::uint64_t load_big_endian(const unsigned char* p, std::size_t n) {
+    std::uint64_t word = 0;
+    for (std::size_t i = 0; i < n; i++) {
+        word |= static_cast<std::uint64_t>(p[i]) << (56 - 8 * i);
+    }
+    return word;
+}
+
+std::vector<std::uint64_t> to_words(const unsigned char* bytes,
+                                    std::size_t length) {
+    auto words = std::vector<std::uint64_t>((length + 7) / 8);
+    for (std::size_t w = 0; w < words.size(); w++) {
+        words[w] = load_big_endian(bytes + w * 8,
+                                   std::min<std::size_t>(8, length - w * 8));
+    }
+    return words;
+}
+
+// Bits of the last word that lie past size.
+std::uint64_t spare_bits(std::size_t size) {
+    return size % 64 == 0 ? 0 : ~std::uint64_t{0} >> (size % 64);
+}
+
+#if defined(__SSE2__)
+// 512 pieces per step: four registers are combined and tested once, so the
+// common case of a long run of empty words costs one branch per step.
+constexpr std::size_t block_words = 8;
+
+__m128i load(const std::uint64_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+bool nonzero(__m128i v) {
+    const auto zero = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+    return _mm_movemask_epi8(zero) != 0xffff;
+}
+
+std::size_t popcount(__m128i v) {
+    std::uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+    return static_cast<std::size_t>(std::popcount(lanes[0]) +
+                                    std::popcount(lanes[1]));
+}
+#endif
+}  // namespace
+
+piece_set::piece_set(std::size_t size)
+    : words_((size + 63) / 64), size_{size} {}
+
+piece_set::piece_set(const torrent::bitfield& bits)
+    : words_{to_words(bits.bytes().data(), bits.bytes().size())},
+      size_{bits.size()} {}
+
+std::optional<piece_set> piece_set::from_bytes(std::string_view bytes,
+                                               std::size_t size) {
+    if (bytes.size() != (size + 7) / 8) {
+        return {};
+    }
+    auto result = piece_set{};
+    result.words_ = to_words(
+        reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+    result.size_ = size;
+    if (!result.words_.empty() &&
+        (result.words_.back() & spare_bits(size)) != 0) {
+        return {};
+    }
+    return result;
+}
+
+void piece_set::fill() {
+    std::fill(words_.begin(), words_.end(), ~std::uint64_t{0});
+    if (!words_.empty()) {
+        words_.back() &= ~spare_bits(size_);
+    }
+}
+
+std::size_t piece_set::count() const {
+    std::size_t result = 0;
+    for (const auto word : words_) {
+        result += static_cast<std::size_t>(std::popcount(word));
+    }
+    return result;
+}
+
+bool piece_set::any() const {
+    return std::any_of(words_.begin(), words_.end(),
+                       [](std::uint64_t word) { return word != 0; });
+}
+
+std::size_t piece_set::find_next(std::size_t from) const {
+    if (from >= size_) {
+        return size_;
+    }
+    auto w = from / 64;
+    auto word = words_[w] & (~std::uint64_t{0} >> (from % 64));
+    while (word == 0) {
+        if (++w == words_.size()) {
+            return size_;
+        }
+        word = words_[w];
+    }
+    return w * 64 + static_cast<std::size_t>(std::countl_zero(word));
+}
+
+std::size_t count_common(const piece_set& a, const piece_set& b,
+                         std::size_t limit) {
+    const auto* x = a.words().data();
+    const auto* y = b.words().data();
+    const auto n = a.words().size();
+    std::size_t result = 0;
+    std::size_t w = 0;
+#if defined(__SSE2__)
+    for (; w + block_words <= n && result <= limit; w += block_words) {
+        result += popcount(_mm_and_si128(load(x + w), load(y + w))) +
+                  popcount(_mm_and_si128(load(x + w + 2), load(y + w + 2))) +
+                  popcount(_mm_and_si128(load(x + w + 4), load(y + w + 4))) +
+                  popcount(_mm_and_si128(load(x + w + 6), load(y + w + 6)));
+    }
+#endif
+    for (; w < n && result <= limit; w++) {
+        result += static_cast<std::size_t>(std::popcount(x[w] & y[w]));
+    }
+    return result;
+}
+
+bool intersects(const piece_set& a, const piece_set& b) {
+    const auto* x = a.words().data();
+    const auto* y = b.words().data();
+    const auto n = a.words().size();
+    std::size_t w = 0;
+#if defined(__SSE2__)
+    for (; w + block_words <= n; w += block_words) {
+        const auto v = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(load(x + w), load(y + w)),
+                         _mm_and_si128(load(x + w + 2), load(y + w + 2))),
+            _mm_or_si128(_mm_and_si128(load(x + w + 4), load(y + w + 4)),
+                         _mm_and_si128(load(x + w + 6), load(y + w + 6))));
+        if (nonzero(v)) {
+            return true;
+        }
+    }
+#endif
+    for (; w < n; w++) {
+        if ((x[w] & y[w]) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool any_missing(const piece_set& a, const piece_set& b) {
+    const auto* x = a.words().data();
+    const auto* y = b.words().data();
+    const auto n = a.words().size();
+    std::size_t w = 0;
+#if defined(__SSE2__)
+    // _mm_andnot_si128 complements its first operand.
+    for (; w + block_words <= n; w += block_words) {
+        const auto v = _mm_or_si128(
+            _mm_or_si128(_mm_andnot_si128(load(y + w), load(x + w)),
+                         _mm_andnot_si128(load(y + w + 2), load(x + w + 2))),
+            _mm_or_si128(_mm_andnot_si128(load(y + w + 4), load(x + w + 4)),
+                         _mm_andnot_si128(load(y + w + 6), load(x + w + 6))));
+        if (nonzero(v)) {
+            return true;
+        }
+    }
+#endif
+    for (; w < n; w++) {
+        if ((x[w] & ~y[w]) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace picker
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "bitfield.h"
+
+namespace picker {
+
+// A set of pieces stored as 64-bit words, so that the bulk operations a
+// picker runs against every peer work a word or a vector register at a
+// time. Piece i is bit 63 - i % 64 of word i / 64: the wire bitfield read as
+// big-endian words. Bits past size() are always zero.
+class piece_set {
+   public:
+    piece_set() = default;
+    explicit piece_set(std::size_t size);
+    explicit piece_set(const torrent::bitfield& bits);
+
+    // A peer's bitfield message payload. Fails if the length does not match
+    // size or a spare bit at the end is set.
+    static std::optional<piece_set> from_bytes(std::string_view bytes,
+                                               std::size_t size);
+
+    std::size_t size() const { return size_; }
+
+    bool test(std::size_t i) const { return (words_[i / 64] & mask(i)) != 0; }
+    void set(std::size_t i) { words_[i / 64] |= mask(i); }
+    void reset(std::size_t i) { words_[i / 64] &= ~mask(i); }
+    void fill();
+
+    std::size_t count() const;
+    bool any() const;
+
+    // The first piece at or after from in the set, or size().
+    std::size_t find_next(std::size_t from) const;
+
+    std::span<const std::uint64_t> words() const { return words_; }
+
+    bool operator==(const piece_set&) const = default;
+
+   private:
+    static std::uint64_t mask(std::size_t i) {
+        return std::uint64_t{1} << (63 - i % 64);
+    }
+
+    std::vector<std::uint64_t> words_;
+    std::size_t size_ = 0;
+};
+
+// Bulk operations between sets of the same size.
+
+// |a & b|, or some number above limit once it is known to exceed it.
+std::size_t count_common(const piece_set& a, const piece_set& b,
+                         std::size_t limit = SIZE_MAX);
+// a & b is not empty.
+bool intersects(const piece_set& a, const piece_set& b);
+// a & ~b is not empty: a peer with a has something we, with b, lack.
+bool any_missing(const piece_set& a, const piece_set& b);
+// Calls f(piece) for each piece of a & b in order.
+template <typename F>
+void for_each_common(const piece_set& a, const piece_set& b, F f) {
+    const auto x = a.words();
+    const auto y = b.words();
+    for (std::size_t w = 0; w < x.size(); w++) {
+        auto bits = x[w] & y[w];
+        while (bits != 0) {
+            const auto lead = static_cast<std::size_t>(std::countl_zero(bits));
+            f(w * 64 + lead);
+            bits &= ~(std::uint64_t{1} << (63 - lead));
+        }
+    }
+}
+
+}  // namespace picker
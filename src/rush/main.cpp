@@ -1,11 +1,55 @@
 #include <fmt/base.h>
 
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
 
 #include "bencode.h"
+#include "catalog.h"
+#include "create.h"
+#include "disk_io.h"
+#include "exporter.h"
+#include "json.h"
+#include "metadata_cache.h"
+#include "metrics.h"
+#include "resume.h"
 #include "rush.h"
+#include "sha.h"
+#include "thread_pool.h"
 #include "torrent.h"
 
+namespace {
+void print_usage() {
+    fmt::println(stderr,
+                 "usage: rush [--config=<file>] <torrent>...\n"
+                 "       rush [--config=<file>] dump [--json] "
+                 "[--binary=hex|base64] <file or directory>...\n"
+                 "       rush [--config=<file>] scan [--threads=N] "
+                 "<directory>\n"
+                 "       rush [--config=<file>] cache <cache file> "
+                 "<directory>\n"
+                 "       rush [--config=<file>] create [--piece-length=N] "
+                 "[--hybrid] [--tracker=URL]... [--comment=TEXT] [--private] "
+                 "[--threads=N] <file or directory> <output.torrent>\n"
+                 "       rush [--config=<file>] check [--resume=<file>] "
+                 "[--threads=N] <torrent> <directory>");
+}
+
 void parse(std::string_view filepath) {
     const auto result = torrent::from_file(std::filesystem::path{filepath});
     if (result.has_value()) {
@@ -15,12 +59,398 @@ void parse(std::string_view filepath) {
     }
 }
 
-int main() {
-    parse("tests/resources/bunny.torrent");
-    parse("tests/resources/cosmos-laundromat.torrent");
-    parse("tests/resources/lots-of-numbers.torrent");
-    parse("tests/resources/tears-of-steel.torrent");
-    parse("tests/resources/wired-cd.torrent");
+struct dump_options {
+    bool json = false;
+    bencode::binary_format binary = bencode::binary_format::hex;
+};
+
+bool dump_file(const std::filesystem::path& path,
+               const dump_options& options) {
+    if (!options.json) {
+        const auto value = bencode::parse(path, bencode::backend::fast);
+        if (!value.has_value()) {
+            return false;
+        }
+        fmt::println("{}", value.value());
+        return true;
+    }
+
+    auto file = std::ifstream{path, std::ios::binary};
+    if (!file) {
+        fmt::println(stderr, "Could not open file: {}", path.string());
+        return false;
+    }
+
+    // One document per line, streamed straight to stdout.
+    const auto out = bencode::write_json(
+        file, std::ostreambuf_iterator<char>{std::cout}, options.binary);
+    if (!out.has_value()) {
+        std::cout << std::endl;
+        fmt::println(stderr, "Could not convert {}", path.string());
+        return false;
+    }
+    std::cout << '\n';
+    return true;
+}
+
+int dump(std::span<char* const> args) {
+    auto options = dump_options{};
+    auto inputs = std::vector<std::filesystem::path>{};
+    for (const std::string_view arg : args) {
+        if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--binary=hex") {
+            options.binary = bencode::binary_format::hex;
+        } else if (arg == "--binary=base64") {
+            options.binary = bencode::binary_format::base64;
+        } else if (arg.starts_with("--")) {
+            fmt::println(stderr, "Unknown option: {}", arg);
+            print_usage();
+            return 1;
+        } else {
+            inputs.emplace_back(arg);
+        }
+    }
+
+    if (inputs.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    bool ok = true;
+    for (const auto& input : inputs) {
+        if (!std::filesystem::is_directory(input)) {
+            ok = dump_file(input, options) && ok;
+            continue;
+        }
+
+        auto ec = std::error_code{};
+        auto it = std::filesystem::recursive_directory_iterator{
+            input, std::filesystem::directory_options::skip_permission_denied,
+            ec};
+        for (; !ec && it != std::filesystem::recursive_directory_iterator{};
+             it.increment(ec)) {
+            if (it->path().extension() == ".torrent" &&
+                it->is_regular_file(ec)) {
+                ok = dump_file(it->path(), options) && ok;
+            }
+        }
+        if (ec) {
+            fmt::println(stderr, "{}: {}", input.string(), ec.message());
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+template <typename T>
+bool parse_number(std::string_view text, T& out) {
+    const auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc{} && end == text.data() + text.size();
+}
+
+int scan(std::span<char* const> args) {
+    constexpr std::string_view threads_option = "--threads=";
+
+    std::size_t threads = std::thread::hardware_concurrency();
+    auto directory = std::optional<std::filesystem::path>{};
+    for (const std::string_view arg : args) {
+        if (arg.starts_with(threads_option)) {
+            const auto value = arg.substr(threads_option.size());
+            if (!parse_number(value, threads)) {
+                fmt::println(stderr, "Invalid thread count: {}", value);
+                return 1;
+            }
+        } else if (arg.starts_with("--") || directory.has_value()) {
+            print_usage();
+            return 1;
+        } else {
+            directory = std::filesystem::path{arg};
+        }
+    }
+
+    if (!directory.has_value()) {
+        print_usage();
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto pool = concurrency::thread_pool{threads};
+    const auto result = torrent::scan(directory.value(), pool);
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+
+    for (const auto& entry : result.entries) {
+        const auto* version = !entry.info_hash_v2.has_value() ? "v1"
+                              : entry.has_v1                  ? "hybrid"
+                                                              : "v2";
+        fmt::println("{}  {:>15}  {:>8}  {:>6}  {:<6}  {}",
+                     crypto::to_hex(entry.info_hash), entry.total_size,
+                     entry.piece_count, entry.file_count, version,
+                     entry.name);
+    }
+    for (const auto& error : result.errors) {
+        fmt::println(stderr, "{}: {} (offset {})", error.path.string(),
+                     error.message, error.offset);
+    }
+
+    const auto total = result.entries.size() + result.errors.size();
+    fmt::println(stderr,
+                 "Catalogued {} of {} files in {:.3f} s ({:.0f} files/s, "
+                 "{} threads)",
+                 result.entries.size(), total, elapsed.count(),
+                 static_cast<double>(total) / elapsed.count(), pool.size());
+    return result.errors.empty() ? 0 : 1;
+}
+
+int refresh_cache(std::span<char* const> args) {
+    if (args.size() != 2) {
+        print_usage();
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto torrents = std::vector<std::filesystem::path>{};
+    auto ec = std::error_code{};
+    auto it = std::filesystem::recursive_directory_iterator{
+        args[1], std::filesystem::directory_options::skip_permission_denied,
+        ec};
+    for (; !ec && it != std::filesystem::recursive_directory_iterator{};
+         it.increment(ec)) {
+        if (it->path().extension() == ".torrent" && it->is_regular_file(ec)) {
+            torrents.push_back(it->path());
+        }
+    }
+    if (ec) {
+        fmt::println(stderr, "{}: {}", args[1], ec.message());
+        return 1;
+    }
+
+    const auto stats = cache::refresh(args[0], torrents);
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+    if (!stats.has_value()) {
+        fmt::println(stderr, "Could not write cache: {}", args[0]);
+        return 1;
+    }
+
+    fmt::println(stderr,
+                 "Cached {} files in {:.3f} s: {} reused, {} rehashed, "
+                 "{} parsed, {} failed",
+                 torrents.size(), elapsed.count(), stats->reused,
+                 stats->rehashed, stats->parsed, stats->failed);
+    return stats->failed == 0 ? 0 : 1;
+}
 
+int create(std::span<char* const> args) {
+    constexpr std::string_view piece_length_option = "--piece-length=";
+    constexpr std::string_view tracker_option = "--tracker=";
+    constexpr std::string_view comment_option = "--comment=";
+    constexpr std::string_view threads_option = "--threads=";
+
+    auto options = storage::create_options{};
+    options.created_by = "rush";
+    options.creation_date = std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::system_clock::now()
+                                    .time_since_epoch())
+                                .count();
+    std::size_t threads = std::thread::hardware_concurrency();
+    auto paths = std::vector<std::filesystem::path>{};
+    for (const std::string_view arg : args) {
+        if (arg.starts_with(piece_length_option)) {
+            const auto value = arg.substr(piece_length_option.size());
+            if (!parse_number(value, options.piece_length)) {
+                fmt::println(stderr, "Invalid piece length: {}", value);
+                return 1;
+            }
+        } else if (arg == "--hybrid") {
+            options.hybrid = true;
+        } else if (arg.starts_with(tracker_option)) {
+            options.trackers.emplace_back(arg.substr(tracker_option.size()));
+        } else if (arg.starts_with(comment_option)) {
+            options.comment = arg.substr(comment_option.size());
+        } else if (arg == "--private") {
+            options.private_ = true;
+        } else if (arg.starts_with(threads_option)) {
+            const auto value = arg.substr(threads_option.size());
+            if (!parse_number(value, threads)) {
+                fmt::println(stderr, "Invalid thread count: {}", value);
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            fmt::println(stderr, "Unknown option: {}", arg);
+            print_usage();
+            return 1;
+        } else {
+            paths.emplace_back(arg);
+        }
+    }
+
+    if (paths.size() != 2) {
+        print_usage();
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto pool = concurrency::thread_pool{threads};
+    auto error = storage::create_error{};
+    const auto created =
+        storage::create_torrent(paths[0], options, pool, &error);
+    if (!created.has_value()) {
+        fmt::println(stderr, "{}: {}", error.path.string(), error.message);
+        return 1;
+    }
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+
+    auto file = std::ofstream{paths[1], std::ios::binary};
+    file.write(created->metainfo.data(),
+               static_cast<std::streamsize>(created->metainfo.size()));
+    if (!file.flush()) {
+        fmt::println(stderr, "Could not write {}", paths[1].string());
+        return 1;
+    }
+
+    fmt::println("{}", crypto::to_hex(created->info_hash));
+    if (created->info_hash_v2.has_value()) {
+        fmt::println("{}", crypto::to_hex(created->info_hash_v2.value()));
+    }
+    fmt::println(stderr,
+                 "Hashed {} bytes in {:.3f} s ({:.0f} MiB/s, {} threads)",
+                 created->total_size, elapsed.count(),
+                 static_cast<double>(created->total_size) / (1 << 20) /
+                     elapsed.count(),
+                 pool.size());
+    return 0;
+}
+
+// Checks the content of a torrent under a directory. With a resume file,
+// only the pieces of files changed since it was saved are hashed, and the
+// file is brought up to date afterwards.
+int check(std::span<char* const> args) {
+    constexpr std::string_view resume_option = "--resume=";
+    constexpr std::string_view threads_option = "--threads=";
+
+    std::size_t threads = std::thread::hardware_concurrency();
+    auto resume = std::optional<std::filesystem::path>{};
+    auto paths = std::vector<std::filesystem::path>{};
+    for (const std::string_view arg : args) {
+        if (arg.starts_with(resume_option)) {
+            resume = std::filesystem::path{arg.substr(resume_option.size())};
+        } else if (arg.starts_with(threads_option)) {
+            const auto value = arg.substr(threads_option.size());
+            if (!parse_number(value, threads)) {
+                fmt::println(stderr, "Invalid thread count: {}", value);
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            fmt::println(stderr, "Unknown option: {}", arg);
+            print_usage();
+            return 1;
+        } else {
+            paths.emplace_back(arg);
+        }
+    }
+
+    if (paths.size() != 2) {
+        print_usage();
+        return 1;
+    }
+    const auto parsed = torrent::from_file(paths[0]);
+    if (!parsed.has_value()) {
+        fmt::println(stderr, "Could not parse {}", paths[0].string());
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto pool = concurrency::thread_pool{threads};
+    const auto [result, content, loaded] = std::visit(
+        [&](const auto& info) {
+            auto content = storage::content_paths(info, paths[1]);
+            const auto saved =
+                resume.has_value()
+                    ? storage::load_resume(resume.value(), parsed->info_hash,
+                                           torrent::piece_hashes(info).size(),
+                                           content.size())
+                    : std::nullopt;
+            return std::tuple{storage::restore(info, paths[1], saved, pool),
+                              std::move(content), saved.has_value()};
+        },
+        parsed->info);
+    const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+
+    if (resume.has_value()) {
+        auto data = storage::resume_data{parsed->info_hash, result.pieces,
+                                         storage::file_states(content),
+                                         result.partial};
+        if (!storage::save_resume(resume.value(), data)) {
+            fmt::println(stderr, "Could not write {}", resume->string());
+            return 1;
+        }
+    }
+
+    fmt::println("{} of {} pieces", result.pieces.count(),
+                 result.pieces.size());
+    fmt::println(stderr,
+                 "Checked in {:.3f} s: {} files changed, {} pieces hashed{}",
+                 elapsed.count(), result.changed_files,
+                 result.rechecked_pieces,
+                 loaded ? "" : " (no resume data)");
+    return result.pieces.all() ? 0 : 1;
+}
+
+int run(std::span<char* const> args) {
+    if (args.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    if (std::string_view{args.front()} == "dump") {
+        return dump(args.subspan(1));
+    }
+    if (std::string_view{args.front()} == "scan") {
+        return scan(args.subspan(1));
+    }
+    if (std::string_view{args.front()} == "cache") {
+        return refresh_cache(args.subspan(1));
+    }
+    if (std::string_view{args.front()} == "create") {
+        return create(args.subspan(1));
+    }
+    if (std::string_view{args.front()} == "check") {
+        return check(args.subspan(1));
+    }
+
+    for (const std::string_view path : args) {
+        parse(path);
+    }
     return 0;
 }
+}  // namespace
+
+int main(int argc, char** argv) {
+    constexpr std::string_view config_option = "--config=";
+
+    auto args = std::span<char* const>{argv + 1, argv + argc};
+    auto exporter = std::unique_ptr<metrics::exporter>{};
+    if (!args.empty() &&
+        std::string_view{args.front()}.starts_with(config_option)) {
+        const auto path =
+            std::string_view{args.front()}.substr(config_option.size());
+        auto error = metrics::config_error{};
+        auto options = metrics::load_options(path, &error);
+        if (!options.has_value()) {
+            fmt::println(stderr, "{}: {}", path, error.message);
+            return 1;
+        }
+        if (!options->path.empty()) {
+            exporter = std::make_unique<metrics::exporter>(
+                metrics::global(), std::move(options.value()));
+        }
+        args = args.subspan(1);
+    }
+
+    return run(args);
+}
@@ -0,0 +1,180 @@
+#include "engine.h"
+
+#include <sys/resource.h>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "peer_connection.h"
+#include "ring_buffer.h"
+
+namespace session {
+namespace {
+using boost::asio::ip::tcp;
+
+// Room for every connection plus listeners and files. The soft limit is
+// often far below what thousands of peers need.
+void raise_file_limit(std::size_t connections) {
+    auto limit = rlimit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    const auto wanted = static_cast<rlim_t>(connections + 256);
+    if (limit.rlim_cur < wanted) {
+        limit.rlim_cur = std::min(wanted, limit.rlim_max);
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+}  // namespace
+
+engine::engine(const engine_options& options) : options_{options} {
+    options_.threads = std::max<std::size_t>(options_.threads, 1);
+    raise_file_limit(options_.max_connections);
+
+    cores_.reserve(options_.threads);
+    for (std::size_t i = 0; i < options_.threads; i++) {
+        cores_.push_back(std::make_unique<core>());
+    }
+
+    threads_.reserve(options_.threads);
+    for (auto& c : cores_) {
+        threads_.emplace_back([&context = c->context] { context.run(); });
+    }
+}
+
+engine::~engine() {
+    stop();
+    for (auto& c : cores_) {
+        c->work.reset();
+    }
+    threads_.clear();
+}
+
+void engine::stop() {
+    if (stopping_.exchange(true)) {
+        return;
+    }
+
+    for (auto& acceptor : acceptors_) {
+        post(0, [&acceptor] {
+            auto ec = boost::system::error_code{};
+            acceptor->close(ec);
+        });
+    }
+    for (std::size_t i = 0; i < cores_.size(); i++) {
+        post(i, [&peers = cores_[i]->peers] {
+            for (auto* peer : peers) {
+                peer->close();
+            }
+        });
+    }
+}
+
+tcp::endpoint engine::listen(const tcp::endpoint& endpoint,
+                             peer_handler handler) {
+    auto& acceptor = *acceptors_.emplace_back(
+        std::make_unique<tcp::acceptor>(context(0), endpoint));
+    const auto bound = acceptor.local_endpoint();
+
+    auto accept_loop = [this, &acceptor,
+                        handler = std::move(handler)]() mutable
+        -> boost::asio::awaitable<void> {
+        while (!stopping_) {
+            const auto target = next_core();
+            auto ec = boost::system::error_code{};
+            auto socket = co_await acceptor.async_accept(
+                context(target),
+                boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if (ec == boost::asio::error::operation_aborted) {
+                break;
+            }
+            if (ec) {
+                continue;
+            }
+            if (!acquire()) {
+                socket.close(ec);
+                continue;
+            }
+            post(target, [this, target, socket = std::move(socket),
+                          handler]() mutable {
+                start(target, std::move(socket), {}, {}, std::move(handler));
+            });
+        }
+    };
+    boost::asio::co_spawn(context(0), std::move(accept_loop),
+                          boost::asio::detached);
+    return bound;
+}
+
+void engine::connect(const tcp::endpoint& endpoint,
+                     const wire::handshake& local, peer_handler handler) {
+    if (!acquire()) {
+        return;
+    }
+
+    const auto target = next_core();
+    post(target, [this, target, endpoint, local,
+                  handler = std::move(handler)]() mutable {
+        auto socket = tcp::socket{context(target)};
+        start(target, std::move(socket), endpoint, local, std::move(handler));
+    });
+}
+
+std::size_t engine::next_core() {
+    return next_.fetch_add(1, std::memory_order_relaxed) % cores_.size();
+}
+
+bool engine::acquire() {
+    auto current = connections_.load(std::memory_order_relaxed);
+    do {
+        if (current >= options_.max_connections) {
+            return false;
+        }
+    } while (!connections_.compare_exchange_weak(current, current + 1,
+                                                 std::memory_order_relaxed));
+    return true;
+}
+
+void engine::release() {
+    connections_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void engine::start(std::size_t core, tcp::socket socket,
+                   std::optional<tcp::endpoint> endpoint,
+                   std::optional<wire::handshake> local, peer_handler handler) {
+    auto ec = boost::system::error_code{};
+    if (endpoint.has_value()) {
+        socket.open(endpoint->protocol(), ec);
+    }
+    auto buffer = wire::ring_buffer::create(options_.receive_buffer);
+    if (stopping_ || ec || !buffer.has_value()) {
+        socket.close(ec);
+        release();
+        return;
+    }
+
+    socket.set_option(tcp::no_delay{true}, ec);
+    const auto peer = std::make_shared<peer_connection>(
+        *this, core, std::move(socket), std::move(buffer.value()),
+        std::move(handler));
+    cores_[core]->peers.insert(peer.get());
+    boost::asio::co_spawn(
+        context(core),
+        [peer, endpoint, local] { return peer->run(endpoint, local); },
+        boost::asio::detached);
+}
+
+void engine::finished(peer_connection& peer) {
+    cores_[peer.core()]->peers.erase(&peer);
+    release();
+}
+
+}  // namespace session
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "block_pool.h"
+#include "message.h"
+#include "peer_connection.h"
+
+namespace session {
+
+struct engine_options {
+    std::size_t threads = std::thread::hardware_concurrency();
+    std::size_t max_connections = 8192;
+    std::chrono::milliseconds connect_timeout = std::chrono::seconds{10};
+    std::chrono::milliseconds handshake_timeout = std::chrono::seconds{10};
+    // BEP 3 peers send a keep-alive every two minutes.
+    std::chrono::milliseconds idle_timeout = std::chrono::minutes{3};
+    std::chrono::milliseconds keep_alive_interval = std::chrono::minutes{2};
+    // Per-connection receive buffer, and so the longest message accepted.
+    std::size_t receive_buffer = 256 * 1024;
+    // Where piece payloads are received for peer_handler::on_block. Must
+    // outlive the engine and every block handed out.
+    buffers::block_pool* blocks = nullptr;
+};
+
+// One io_context per core, each run by a single thread. A connection lives
+// on the core that accepted or opened it for its whole life, so everything
+// it touches on the hot path is owned by that thread and needs no locking.
+// State shared across torrents moves between cores as posted messages.
+class engine {
+   public:
+    explicit engine(const engine_options& options = {});
+    engine(const engine&) = delete;
+    engine& operator=(const engine&) = delete;
+
+    // Closes every connection and joins the threads.
+    ~engine();
+
+    std::size_t size() const { return cores_.size(); }
+    const engine_options& options() const { return options_; }
+    boost::asio::io_context& context(std::size_t core) {
+        return cores_[core]->context;
+    }
+
+    // Runs f on core's thread.
+    template <typename F>
+    void post(std::size_t core, F&& f) {
+        boost::asio::post(context(core), std::forward<F>(f));
+    }
+
+    // Accepts connections on endpoint and spreads them over the cores.
+    // Returns the bound endpoint, which tells the port when endpoint asked
+    // for any.
+    boost::asio::ip::tcp::endpoint listen(
+        const boost::asio::ip::tcp::endpoint& endpoint, peer_handler handler);
+
+    // Opens a connection to endpoint and sends local as the handshake.
+    void connect(const boost::asio::ip::tcp::endpoint& endpoint,
+                 const wire::handshake& local, peer_handler handler);
+
+    std::size_t connections() const {
+        return connections_.load(std::memory_order_relaxed);
+    }
+
+    // Stops accepting and closes every connection; pending handlers still
+    // run. Called by the destructor.
+    void stop();
+
+   private:
+    friend class peer_connection;
+
+    struct core {
+        using work_guard = boost::asio::executor_work_guard<
+            boost::asio::io_context::executor_type>;
+
+        // A concurrency hint of one tells Asio a single thread runs the
+        // context, which lets it skip most of its internal locking.
+        boost::asio::io_context context{1};
+        work_guard work = boost::asio::make_work_guard(context);
+        // Live connections, touched only by the core's own thread.
+        std::unordered_set<peer_connection*> peers;
+    };
+
+    std::size_t next_core();
+    bool acquire();
+    void release();
+
+    // Runs on core's thread, with a connection slot already taken.
+    void start(std::size_t core, boost::asio::ip::tcp::socket socket,
+               std::optional<boost::asio::ip::tcp::endpoint> endpoint,
+               std::optional<wire::handshake> local, peer_handler handler);
+    void finished(peer_connection& peer);
+
+    engine_options options_;
+    std::vector<std::unique_ptr<core>> cores_;
+    std::vector<std::jthread> threads_;
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> acceptors_;
+
+    std::atomic<std::size_t> next_{0};
+    std::atomic<std::size_t> connections_{0};
+    std::atomic<bool> stopping_{false};
+};
+
+}  // namespace session
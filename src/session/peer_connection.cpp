@@ -0,0 +1,394 @@
+#include "peer_connection.h"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <sys/sendfile.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "block_pool.h"
+#include "codec.h"
+#include "engine.h"
+#include "message.h"
+#include "metrics.h"
+
+namespace session {
+namespace {
+// Messages gathered into a single write.
+constexpr std::size_t max_batch = 64;
+
+struct session_metrics {
+    metrics::counter& received =
+        metrics::global().counter("session.bytes_received");
+    metrics::counter& sent = metrics::global().counter("session.bytes_sent");
+    // Bytes per second over a connection's lifetime, taken as it closes.
+    metrics::histogram& receive_rate =
+        metrics::global().histogram("session.peer_receive_rate");
+    metrics::histogram& send_rate =
+        metrics::global().histogram("session.peer_send_rate");
+};
+
+session_metrics& stats() {
+    static auto instance = session_metrics{};
+    return instance;
+}
+}  // namespace
+
+using boost::asio::redirect_error;
+using boost::asio::use_awaitable;
+
+peer_connection::peer_connection(engine& owner, std::size_t core,
+                                 boost::asio::ip::tcp::socket socket,
+                                 wire::ring_buffer buffer,
+                                 peer_handler handler)
+    : owner_{owner},
+      core_{core},
+      socket_{std::move(socket)},
+      buffer_{std::move(buffer)},
+      handler_{std::move(handler)},
+      wake_{socket_.get_executor()},
+      timer_{socket_.get_executor()} {}
+
+void peer_connection::send(const wire::message& m,
+                           std::shared_ptr<const void> owner) {
+    enqueue({wire::outgoing{m}, std::move(owner), {}, {}});
+}
+
+void peer_connection::send(const wire::message& m, buffers::block_ref block) {
+    enqueue({wire::outgoing{m}, {}, std::move(block), {}});
+}
+
+void peer_connection::send(const wire::piece_header& h,
+                           std::vector<file_slice> slices,
+                           std::shared_ptr<const void> owner) {
+    enqueue({wire::outgoing{h}, std::move(owner), {}, std::move(slices)});
+}
+
+void peer_connection::enqueue(queued q) {
+    if (!is_open()) {
+        return;
+    }
+    queue_.push_back(std::move(q));
+    if (queue_.size() == 1) {
+        wake_.cancel();
+    }
+}
+
+void peer_connection::close() {
+    auto ec = boost::system::error_code{};
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+    socket_.close(ec);
+    wake_.cancel();
+    timer_.cancel();
+}
+
+void peer_connection::spawn(
+    boost::asio::awaitable<void> (peer_connection::*task)()) {
+    // The function object, and with it the reference to this connection,
+    // lives until the coroutine finishes.
+    boost::asio::co_spawn(
+        socket_.get_executor(),
+        [self = shared_from_this(), task] { return ((*self).*task)(); },
+        boost::asio::detached);
+}
+
+void peer_connection::extend_deadline(std::chrono::milliseconds timeout) {
+    deadline_ = std::chrono::steady_clock::now() + timeout;
+}
+
+boost::asio::awaitable<void> peer_connection::run(
+    std::optional<boost::asio::ip::tcp::endpoint> endpoint,
+    std::optional<wire::handshake> local) {
+    const auto& options = owner_.options();
+    const auto started = std::chrono::steady_clock::now();
+    extend_deadline(endpoint.has_value() ? options.connect_timeout
+                                         : options.handshake_timeout);
+    spawn(&peer_connection::watchdog);
+
+    auto ec = boost::system::error_code{};
+    if (endpoint.has_value()) {
+        co_await socket_.async_connect(endpoint.value(),
+                                       redirect_error(use_awaitable, ec));
+        extend_deadline(options.handshake_timeout);
+    }
+
+    if (!ec && co_await handshake(local)) {
+        extend_deadline(options.idle_timeout);
+        spawn(&peer_connection::write_loop);
+        co_await read_loop();
+    }
+
+    close();
+    queue_.clear();
+    const auto lifetime = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started);
+    if (lifetime.count() > 0) {
+        stats().receive_rate.record(static_cast<std::uint64_t>(
+            static_cast<double>(bytes_received_) / lifetime.count()));
+        stats().send_rate.record(static_cast<std::uint64_t>(
+            static_cast<double>(bytes_sent_) / lifetime.count()));
+    }
+    owner_.finished(*this);
+    if (handler_.on_close) {
+        handler_.on_close(*this);
+    }
+}
+
+boost::asio::awaitable<bool> peer_connection::handshake(
+    const std::optional<wire::handshake>& local) {
+    auto ec = boost::system::error_code{};
+    if (local.has_value()) {
+        const auto bytes = wire::encode(local.value());
+        bytes_sent_ += co_await boost::asio::async_write(
+            socket_, boost::asio::buffer(bytes),
+            redirect_error(use_awaitable, ec));
+        if (ec) {
+            co_return false;
+        }
+    }
+
+    while (buffer_.size() < wire::handshake_size) {
+        if (!co_await receive()) {
+            co_return false;
+        }
+    }
+
+    const auto remote = wire::decode_handshake(buffer_.readable());
+    if (!remote.has_value() || !handler_.on_handshake ||
+        (local.has_value() && remote->info_hash != local->info_hash)) {
+        co_return false;
+    }
+    remote_ = remote.value();
+    const auto answer = handler_.on_handshake(*this, remote_);
+    if (!answer.has_value()) {
+        co_return false;
+    }
+    buffer_.consume(wire::handshake_size);
+
+    if (!local.has_value()) {
+        const auto bytes = wire::encode(answer.value());
+        bytes_sent_ += co_await boost::asio::async_write(
+            socket_, boost::asio::buffer(bytes),
+            redirect_error(use_awaitable, ec));
+    }
+    co_return !ec;
+}
+
+boost::asio::awaitable<bool> peer_connection::receive() {
+    const auto space = buffer_.writable();
+    if (space.empty()) {
+        co_return false;
+    }
+
+    auto ec = boost::system::error_code{};
+    const auto n = co_await socket_.async_read_some(
+        boost::asio::buffer(space.data(), space.size()),
+        redirect_error(use_awaitable, ec));
+    if (ec) {
+        co_return false;
+    }
+    buffer_.commit(n);
+    bytes_received_ += n;
+    stats().received.add(n);
+    co_return true;
+}
+
+boost::asio::awaitable<void> peer_connection::read_loop() {
+    // A message must fit in the buffer along with its length prefix.
+    const auto max_length =
+        static_cast<std::uint32_t>(std::min<std::size_t>(
+            buffer_.capacity() - 4, wire::max_message_length));
+
+    // Messages that came in behind the handshake are already buffered.
+    for (;;) {
+        for (;;) {
+            if (co_await receive_block(max_length)) {
+                if (!is_open()) {
+                    co_return;
+                }
+                continue;
+            }
+            const auto f = wire::decode(buffer_.readable(), max_length);
+            if (f.state == wire::status::invalid) {
+                co_return;
+            }
+            if (f.state == wire::status::incomplete) {
+                break;
+            }
+            if (handler_.on_message) {
+                handler_.on_message(*this, f.value);
+            }
+            if (!is_open()) {
+                co_return;
+            }
+            buffer_.consume(f.size);
+        }
+        if (!co_await receive()) {
+            co_return;
+        }
+        extend_deadline(owner_.options().idle_timeout);
+    }
+}
+
+boost::asio::awaitable<bool> peer_connection::receive_block(
+    std::uint32_t max_length) {
+    auto* pool = owner_.options().blocks;
+    const auto input = buffer_.readable();
+    const auto header = wire::decode_piece_header(input);
+    if (pool == nullptr || !handler_.on_block || !header.has_value() ||
+        header->length > buffers::block_size ||
+        header->length + wire::piece_header_size - 4 > max_length) {
+        co_return false;
+    }
+    auto block = pool->allocate();
+    if (!block) {
+        co_return false;
+    }
+
+    const auto here = std::min<std::size_t>(
+        input.size() - wire::piece_header_size, header->length);
+    std::memcpy(block.data(), input.data() + wire::piece_header_size, here);
+    buffer_.consume(wire::piece_header_size + here);
+    if (here < header->length) {
+        auto ec = boost::system::error_code{};
+        const auto n = co_await boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(block.data() + here, header->length - here),
+            redirect_error(use_awaitable, ec));
+        bytes_received_ += n;
+        stats().received.add(n);
+        if (ec) {
+            close();
+            co_return true;
+        }
+        extend_deadline(owner_.options().idle_timeout);
+    }
+    handler_.on_block(*this, header->index, header->begin, std::move(block),
+                      header->length);
+    co_return true;
+}
+
+boost::asio::awaitable<void> peer_connection::write_loop() {
+    const auto interval = owner_.options().keep_alive_interval;
+
+    while (is_open()) {
+        if (queue_.empty()) {
+            auto ec = boost::system::error_code{};
+            wake_.expires_after(interval);
+            co_await wake_.async_wait(redirect_error(use_awaitable, ec));
+            if (!is_open()) {
+                break;
+            }
+            if (queue_.empty()) {
+                // Woken by send() for a message that is gone again, or idle
+                // for a whole interval.
+                if (ec) {
+                    continue;
+                }
+                queue_.push_back(
+                    {wire::outgoing{wire::keep_alive{}}, {}, {}, {}});
+            }
+        }
+
+        // A message sent from files ends the batch, its header gathered
+        // with the messages before it.
+        auto batch = std::size_t{0};
+        while (batch < std::min(queue_.size(), max_batch)) {
+            if (!queue_[batch++].slices.empty()) {
+                break;
+            }
+        }
+        // Taken out of the queue, which run() drops if the connection
+        // closes while they are being sent.
+        const auto slices = std::move(queue_[batch - 1].slices);
+        const auto files = queue_[batch - 1].owner;
+        gather_.clear();
+        for (std::size_t i = 0; i < batch; i++) {
+            for (const auto& b : queue_[i].message.buffers()) {
+                if (b.size() != 0) {
+                    gather_.push_back(b);
+                }
+            }
+        }
+
+        auto ec = boost::system::error_code{};
+        const auto written = co_await boost::asio::async_write(
+            socket_, gather_, redirect_error(use_awaitable, ec));
+        bytes_sent_ += written;
+        stats().sent.add(written);
+        // Closed while the write was in flight: run() has already dropped
+        // the queue.
+        if (ec || !is_open()) {
+            close();
+            break;
+        }
+        auto sent = true;
+        for (const auto& slice : slices) {
+            if (!co_await send_file(slice)) {
+                sent = false;
+                break;
+            }
+        }
+        if (!sent || !is_open()) {
+            close();
+            break;
+        }
+        queue_.erase(queue_.begin(),
+                     queue_.begin() + static_cast<std::ptrdiff_t>(batch));
+    }
+}
+
+boost::asio::awaitable<bool> peer_connection::send_file(
+    const file_slice& slice) {
+    auto ec = boost::system::error_code{};
+    socket_.native_non_blocking(true, ec);
+    auto offset = static_cast<off_t>(slice.offset);
+    auto left = std::size_t{slice.length};
+    while (!ec && left > 0) {
+        const auto n =
+            ::sendfile(socket_.native_handle(), slice.fd, &offset, left);
+        if (n > 0) {
+            left -= static_cast<std::size_t>(n);
+            bytes_sent_ += static_cast<std::uint64_t>(n);
+            stats().sent.add(static_cast<std::uint64_t>(n));
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await socket_.async_wait(boost::asio::socket_base::wait_write,
+                                        redirect_error(use_awaitable, ec));
+            if (!is_open()) {
+                co_return false;
+            }
+        } else if (n == 0 || errno != EINTR) {
+            // The file is shorter than the slice, or sendfile failed.
+            co_return false;
+        }
+    }
+    co_return !ec;
+}
+
+boost::asio::awaitable<void> peer_connection::watchdog() {
+    while (is_open()) {
+        auto ec = boost::system::error_code{};
+        timer_.expires_at(deadline_);
+        co_await timer_.async_wait(redirect_error(use_awaitable, ec));
+        if (deadline_ <= std::chrono::steady_clock::now()) {
+            close();
+        }
+    }
+}
+
+}  // namespace session
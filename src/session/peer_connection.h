@@ -0,0 +1,139 @@
+#pragma once
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "block_pool.h"
+#include "codec.h"
+#include "message.h"
+#include "ring_buffer.h"
+
+namespace session {
+
+class engine;
+class peer_connection;
+
+// Bytes of an open file, sent to the socket with sendfile.
+struct file_slice {
+    int fd;
+    std::uint64_t offset;
+    std::uint32_t length;
+};
+
+// What a connection does with its peer. Every callback runs on the
+// connection's own core, one at a time.
+struct peer_handler {
+    // Called with the remote handshake. Returns the handshake to answer
+    // with, or nothing to drop the connection. For connections this side
+    // opened, the answer was already sent and only the decision counts.
+    // Messages sent from here follow the handshake.
+    std::function<std::optional<wire::handshake>(peer_connection&,
+                                                 const wire::handshake&)>
+        on_handshake;
+
+    // Payloads are views into the receive buffer, valid during the call.
+    std::function<void(peer_connection&, const wire::message&)> on_message;
+
+    // When set, and the engine has a block pool, a piece message of at most
+    // a block comes here instead, its length bytes at the start of block.
+    // The bytes are received into the block directly, or copied there once
+    // from the receive buffer. Pieces arriving while the pool is exhausted
+    // still go to on_message.
+    std::function<void(peer_connection&, std::uint32_t index,
+                       std::uint32_t begin, buffers::block_ref block,
+                       std::uint32_t length)>
+        on_block;
+
+    std::function<void(peer_connection&)> on_close;
+};
+
+// One peer connection, driven by coroutines on a single io_context: one
+// reads and dispatches messages, one drains the send queue with gathered
+// writes, and a watchdog closes the socket when a deadline passes. Only
+// call into it from its core.
+class peer_connection : public std::enable_shared_from_this<peer_connection> {
+   public:
+    peer_connection(engine& owner, std::size_t core,
+                    boost::asio::ip::tcp::socket socket,
+                    wire::ring_buffer buffer, peer_handler handler);
+
+    std::size_t core() const { return core_; }
+    bool is_open() const { return socket_.is_open(); }
+    const wire::handshake& remote() const { return remote_; }
+
+    std::uint64_t bytes_received() const { return bytes_received_; }
+    std::uint64_t bytes_sent() const { return bytes_sent_; }
+
+    // Queues m. Its payload is written from where it lies, so it must stay
+    // valid until then; owner is kept alive until the write completes.
+    void send(const wire::message& m, std::shared_ptr<const void> owner = {});
+    // Queues m with its payload held by block.
+    void send(const wire::message& m, buffers::block_ref block);
+    // Queues a piece message whose block is sent from slices, in order,
+    // without being read into memory; owner keeps their files open until
+    // then.
+    void send(const wire::piece_header& h, std::vector<file_slice> slices,
+              std::shared_ptr<const void> owner);
+
+    void close();
+
+   private:
+    friend class engine;
+
+    struct queued {
+        wire::outgoing message;
+        std::shared_ptr<const void> owner;
+        buffers::block_ref block;
+        // Sent after message, which is then the last of its batch.
+        std::vector<file_slice> slices;
+    };
+
+    // Connects first when endpoint is set, and sends local before reading
+    // the remote handshake when that is set.
+    boost::asio::awaitable<void> run(
+        std::optional<boost::asio::ip::tcp::endpoint> endpoint,
+        std::optional<wire::handshake> local);
+    boost::asio::awaitable<bool> handshake(
+        const std::optional<wire::handshake>& local);
+    boost::asio::awaitable<bool> receive();
+    // Moves the piece message at the front of the buffer into a pooled
+    // block and hands it to on_block. Returns false if it is not one.
+    boost::asio::awaitable<bool> receive_block(std::uint32_t max_length);
+    boost::asio::awaitable<void> read_loop();
+    boost::asio::awaitable<void> write_loop();
+    boost::asio::awaitable<bool> send_file(const file_slice& slice);
+    boost::asio::awaitable<void> watchdog();
+
+    void enqueue(queued q);
+    void spawn(boost::asio::awaitable<void> (peer_connection::*task)());
+    void extend_deadline(std::chrono::milliseconds timeout);
+
+    engine& owner_;
+    std::size_t core_;
+    boost::asio::ip::tcp::socket socket_;
+    wire::ring_buffer buffer_;
+    peer_handler handler_;
+    wire::handshake remote_{};
+
+    std::deque<queued> queue_;
+    std::vector<boost::asio::const_buffer> gather_;
+    boost::asio::steady_timer wake_;
+
+    std::chrono::steady_clock::time_point deadline_;
+    boost::asio::steady_timer timer_;
+
+    std::uint64_t bytes_received_ = 0;
+    std::uint64_t bytes_sent_ = 0;
+};
+
+}  // namespace session
@@ -0,0 +1,591 @@
+#include "create.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <latch>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "encoder.h"
+#include "merkle.h"
+#include "sha.h"
+#include "thread_pool.h"
+
+namespace storage {
+namespace {
+constexpr std::uint64_t min_piece_length = torrent::merkle_block_size;
+constexpr std::uint64_t max_piece_length = 16 << 20;
+constexpr std::uint64_t target_pieces = 2048;
+
+// Roughly how much data one task hashes, as in verify.
+constexpr std::uint64_t bytes_per_task = 4 << 20;
+// The most the reader gets ahead of the hashers, whatever the piece length.
+constexpr std::uint64_t max_buffered = 256 << 20;
+
+using string_encoder = bencode::encoder<std::back_insert_iterator<std::string>>;
+
+struct input_file {
+    std::filesystem::path source;
+    // Components of the path under the torrent's name; for a single-file
+    // torrent, the name itself.
+    std::vector<std::string> path;
+    std::uint64_t length = 0;
+    // Where the file starts among the v1 pieces, and how many zeros follow
+    // it there to pad the next file to a piece boundary.
+    std::uint64_t offset = 0;
+    std::uint64_t padding = 0;
+    std::optional<crypto::sha256_digest> pieces_root;
+};
+
+struct content {
+    std::string name;
+    bool single = false;
+    std::vector<input_file> files;
+    // Of the v1 pieces, padding included.
+    std::uint64_t total = 0;
+};
+
+std::nullopt_t fail(create_error* error, const std::filesystem::path& path,
+                    std::string message) {
+    if (error != nullptr) {
+        *error = create_error{path, std::move(message)};
+    }
+    return std::nullopt;
+}
+
+std::string_view bytes_of(const crypto::sha256_digest& digest) {
+    return {reinterpret_cast<const char*>(digest.data()), digest.size()};
+}
+
+std::optional<content> collect(const std::filesystem::path& root,
+                               create_error* error) {
+    auto ec = std::error_code{};
+    auto base = std::filesystem::absolute(root, ec).lexically_normal();
+    if (!base.has_filename()) {
+        base = base.parent_path();
+    }
+
+    auto result = content{};
+    result.name = base.filename().string();
+    if (result.name.empty()) {
+        return fail(error, root, "cannot name a torrent after it");
+    }
+
+    const auto status = std::filesystem::status(root, ec);
+    if (ec) {
+        return fail(error, root, ec.message());
+    }
+    if (std::filesystem::is_regular_file(status)) {
+        const auto size = std::filesystem::file_size(root, ec);
+        if (ec) {
+            return fail(error, root, ec.message());
+        }
+        result.single = true;
+        result.files.push_back({root, {result.name}, size});
+        return result;
+    }
+    if (!std::filesystem::is_directory(status)) {
+        return fail(error, root, "not a file or directory");
+    }
+
+    auto it = std::filesystem::recursive_directory_iterator{root, ec};
+    for (; !ec && it != std::filesystem::recursive_directory_iterator{};
+         it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        auto file = input_file{it->path(), {}, it->file_size(ec)};
+        if (ec) {
+            return fail(error, it->path(), ec.message());
+        }
+        for (const auto& component : it->path().lexically_relative(root)) {
+            file.path.push_back(component.string());
+        }
+        result.files.push_back(std::move(file));
+    }
+    if (ec) {
+        return fail(error, root, ec.message());
+    }
+
+    // Comparing components byte by byte gives the order of the keys in the
+    // v2 file tree, which the v1 file list has to follow.
+    std::ranges::sort(result.files, {}, &input_file::path);
+    return result;
+}
+
+// Places the files among the v1 pieces. A hybrid torrent starts every file
+// on a piece boundary, with padding only before files that hold data.
+void lay_out(content& c, std::uint64_t piece_length, bool hybrid) {
+    auto data_follows = false;
+    for (auto it = c.files.rbegin(); it != c.files.rend(); ++it) {
+        if (hybrid && data_follows && it->length % piece_length != 0) {
+            it->padding = piece_length - it->length % piece_length;
+        }
+        data_follows = data_follows || it->length > 0;
+    }
+
+    c.total = 0;
+    for (auto& file : c.files) {
+        file.offset = c.total;
+        c.total += file.length + file.padding;
+    }
+}
+
+// Reads the v1 pieces front to back, padding included, with one file open
+// at a time. Reading in order from one thread is what disks do best, and
+// leaves the kernel's read-ahead to hide the latency.
+class content_reader {
+   public:
+    explicit content_reader(const std::vector<input_file>& files)
+        : files_{files} {}
+    content_reader(const content_reader&) = delete;
+    content_reader& operator=(const content_reader&) = delete;
+    ~content_reader() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool read(std::span<char> out, create_error* error);
+    // Checks that the last file read is still the size it was.
+    bool finish(create_error* error) { return close(error); }
+
+   private:
+    bool close(create_error* error);
+
+    const std::vector<input_file>& files_;
+    std::size_t file_ = 0;
+    // Into the current file and its padding.
+    std::uint64_t at_ = 0;
+    int fd_ = -1;
+};
+
+bool content_reader::read(std::span<char> out, create_error* error) {
+    while (!out.empty()) {
+        const auto& file = files_[file_];
+        if (at_ >= file.length) {
+            if (!close(error)) {
+                return false;
+            }
+            const auto end = file.length + file.padding;
+            if (at_ == end) {
+                file_++;
+                at_ = 0;
+                continue;
+            }
+            const auto zeros = std::min<std::uint64_t>(out.size(), end - at_);
+            std::memset(out.data(), 0, zeros);
+            out = out.subspan(zeros);
+            at_ += zeros;
+            continue;
+        }
+
+        if (fd_ < 0) {
+            fd_ = ::open(file.source.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd_ < 0) {
+                fail(error, file.source,
+                     std::system_category().message(errno));
+                return false;
+            }
+            ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        const auto want =
+            std::min<std::uint64_t>(out.size(), file.length - at_);
+        const auto n = ::pread(fd_, out.data(), want, static_cast<off_t>(at_));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fail(error, file.source, std::system_category().message(errno));
+            return false;
+        }
+        if (n == 0) {
+            fail(error, file.source, "file shrank while it was read");
+            return false;
+        }
+        out = out.subspan(static_cast<std::size_t>(n));
+        at_ += static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+bool content_reader::close(create_error* error) {
+    if (fd_ < 0) {
+        return true;
+    }
+    struct stat st {};
+    const auto changed = ::fstat(fd_, &st) == 0 &&
+                      static_cast<std::uint64_t>(st.st_size) !=
+                          files_[file_].length;
+    ::close(fd_);
+    fd_ = -1;
+    if (changed) {
+        fail(error, files_[file_].source,
+             "file changed size while it was read");
+        return false;
+    }
+    return true;
+}
+
+struct hash_job {
+    const content& c;
+    std::uint64_t piece_length;
+    bool hybrid;
+    // SHA-1 of every piece, written in place by the task hashing it.
+    std::string pieces;
+    // For hybrid torrents, the v2 hash of every piece: the root of its
+    // file's subtree over the blocks the piece holds, padding left out.
+    std::vector<crypto::sha256_digest> piece_roots;
+};
+
+const input_file& file_at(const content& c, std::uint64_t offset) {
+    auto it = std::ranges::upper_bound(c.files, offset, {},
+                                       &input_file::offset);
+    do {
+        --it;
+    } while (it->length == 0);
+    return *it;
+}
+
+// Both hashes walk the piece a block at a time, so that SHA-256 finds each
+// block still in cache after SHA-1.
+void hash_piece(hash_job& job, std::size_t piece, std::string_view data) {
+    thread_local auto hasher = crypto::sha1_hasher{};
+    thread_local auto leaves = std::vector<crypto::sha256_digest>{};
+
+    if (!job.hybrid) {
+        hasher.update(data);
+    } else {
+        const auto start = piece * job.piece_length;
+        const auto& file = file_at(job.c, start);
+        const auto end = file.offset + file.length - start;
+        leaves.clear();
+        for (std::size_t b = 0; b < data.size();
+             b += torrent::merkle_block_size) {
+            const auto block = data.substr(b, torrent::merkle_block_size);
+            hasher.update(block);
+            if (b < end) {
+                leaves.push_back(crypto::sha256(
+                    block.substr(0, static_cast<std::size_t>(end - b))));
+            }
+        }
+        // A file of one piece has a tree only as wide as its blocks.
+        const auto width =
+            file.length <= job.piece_length
+                ? std::bit_ceil(leaves.size())
+                : static_cast<std::size_t>(job.piece_length /
+                                           torrent::merkle_block_size);
+        job.piece_roots[piece] = torrent::merkle_root(leaves, width);
+    }
+
+    const auto digest = hasher.finish();
+    std::memcpy(job.pieces.data() + piece * digest.size(), digest.data(),
+                digest.size());
+}
+
+void hash_pieces(hash_job& job, std::size_t first, std::size_t last,
+                 std::string_view data) {
+    for (auto piece = first; piece < last; piece++) {
+        const auto offset = (piece - first) * job.piece_length;
+        hash_piece(job, piece,
+                   data.substr(static_cast<std::size_t>(offset),
+                               static_cast<std::size_t>(job.piece_length)));
+    }
+}
+
+// The calling thread reads a task's worth of whole pieces at a time and
+// hands them to the pool; it waits for a free buffer once it is as far
+// ahead as the buffers allow.
+bool hash_content(hash_job& job, concurrency::thread_pool& pool,
+                  create_error* error) {
+    const auto length = job.piece_length;
+    const auto piece_count = (job.c.total + length - 1) / length;
+    const auto pieces_per_task =
+        std::max<std::uint64_t>(bytes_per_task / length, 1);
+    const auto task_bytes = pieces_per_task * length;
+    const auto task_count =
+        (piece_count + pieces_per_task - 1) / pieces_per_task;
+    const auto buffer_count = std::max<std::uint64_t>(
+        std::min<std::uint64_t>(2 * pool.size(), max_buffered / task_bytes),
+        2);
+
+    auto buffers = std::vector<std::unique_ptr<char[]>>{};
+    auto free = std::vector<std::size_t>{};
+    auto mutex = std::mutex{};
+    auto returned = std::condition_variable{};
+    auto done = std::latch{static_cast<std::ptrdiff_t>(task_count)};
+    auto reader = content_reader{job.c.files};
+
+    auto ok = true;
+    for (std::uint64_t task = 0; task < task_count; task++) {
+        const auto first = task * pieces_per_task;
+        const auto last = std::min(first + pieces_per_task, piece_count);
+        const auto size = std::min(task_bytes, job.c.total - first * length);
+
+        auto slot = std::size_t{0};
+        {
+            auto lock = std::unique_lock{mutex};
+            if (free.empty() && buffers.size() < buffer_count) {
+                buffers.push_back(std::make_unique_for_overwrite<char[]>(
+                    static_cast<std::size_t>(task_bytes)));
+                free.push_back(buffers.size() - 1);
+            }
+            returned.wait(lock, [&] { return !free.empty(); });
+            slot = free.back();
+            free.pop_back();
+        }
+
+        const auto data = std::span<char>{buffers[slot].get(),
+                                          static_cast<std::size_t>(size)};
+        if (!reader.read(data, error)) {
+            done.count_down(static_cast<std::ptrdiff_t>(task_count - task));
+            ok = false;
+            break;
+        }
+        pool.submit([&, slot, first, last, data] {
+            hash_pieces(job, first, last, {data.data(), data.size()});
+            {
+                const auto lock = std::lock_guard{mutex};
+                free.push_back(slot);
+            }
+            returned.notify_one();
+            done.count_down();
+        });
+    }
+    done.wait();
+    return ok && reader.finish(error);
+}
+
+// Sets every file's pieces root and returns the piece layers of the files
+// larger than a piece, keyed by root.
+std::map<crypto::sha256_digest, std::string> build_trees(content& c,
+                                                         hash_job& job) {
+    const auto length = job.piece_length;
+    const auto piece_height = static_cast<std::size_t>(
+        std::countr_zero(length / torrent::merkle_block_size));
+
+    auto layers = std::map<crypto::sha256_digest, std::string>{};
+    for (auto& file : c.files) {
+        if (file.length == 0) {
+            continue;
+        }
+        const auto first = static_cast<std::size_t>(file.offset / length);
+        const auto count =
+            static_cast<std::size_t>((file.length + length - 1) / length);
+        if (count == 1) {
+            file.pieces_root = job.piece_roots[first];
+            continue;
+        }
+
+        const auto layer =
+            std::span{job.piece_roots}.subspan(first, count);
+        file.pieces_root = torrent::merkle_root(layer, std::bit_ceil(count),
+                                                piece_height);
+        auto& bytes = layers[file.pieces_root.value()];
+        bytes.resize(layer.size_bytes());
+        std::memcpy(bytes.data(), layer.data(), layer.size_bytes());
+    }
+    return layers;
+}
+
+// Directories are dictionaries keyed by name, and a file's details sit under
+// the empty key; files are in path order, so every directory's entries come
+// out sorted.
+void write_file_tree(string_encoder& e, std::span<const input_file> files,
+                     std::size_t depth) {
+    e.begin_dict();
+    while (!files.empty()) {
+        const auto& file = files.front();
+        const auto& name = file.path[depth];
+        e.string(name);
+        if (file.path.size() == depth + 1) {
+            e.begin_dict().string("").begin_dict();
+            e.string("length").integer(
+                static_cast<bencode::integer>(file.length));
+            if (file.pieces_root.has_value()) {
+                e.string("pieces root").string(bytes_of(*file.pieces_root));
+            }
+            e.end().end();
+            files = files.subspan(1);
+            continue;
+        }
+
+        const auto next = std::ranges::find_if(files, [&](const auto& f) {
+            return f.path.size() <= depth || f.path[depth] != name;
+        });
+        const auto count = static_cast<std::size_t>(next - files.begin());
+        write_file_tree(e, files.first(count), depth + 1);
+        files = files.subspan(count);
+    }
+    e.end();
+}
+
+std::string encode_info(const content& c, const hash_job& job,
+                        const create_options& options) {
+    auto info = std::string{};
+    auto e = string_encoder{std::back_inserter(info)};
+    e.begin_dict();
+    if (job.hybrid) {
+        e.string("file tree");
+        write_file_tree(e, c.files, 0);
+    }
+    if (c.single) {
+        e.string("length").integer(
+            static_cast<bencode::integer>(c.files.front().length));
+    } else {
+        e.string("files").begin_list();
+        for (const auto& file : c.files) {
+            e.begin_dict();
+            e.string("length").integer(
+                static_cast<bencode::integer>(file.length));
+            e.string("path").begin_list();
+            for (const auto& component : file.path) {
+                e.string(component);
+            }
+            e.end().end();
+
+            // BEP 47 padding, named the way other clients name it.
+            if (file.padding > 0) {
+                e.begin_dict();
+                e.string("attr").string("p");
+                e.string("length").integer(
+                    static_cast<bencode::integer>(file.padding));
+                e.string("path").begin_list().string(".pad").string(
+                    std::to_string(file.padding));
+                e.end().end();
+            }
+        }
+        e.end();
+    }
+    if (job.hybrid) {
+        e.string("meta version").integer(2);
+    }
+    e.string("name").string(c.name);
+    e.string("piece length").integer(
+        static_cast<bencode::integer>(job.piece_length));
+    e.string("pieces").string(job.pieces);
+    if (options.private_) {
+        e.string("private").integer(1);
+    }
+    e.end();
+    return info;
+}
+}  // namespace
+
+std::uint64_t pick_piece_length(std::uint64_t total_size) {
+    auto length = min_piece_length;
+    while (length < max_piece_length && total_size / length > target_pieces) {
+        length *= 2;
+    }
+    return length;
+}
+
+std::optional<created_torrent> create_torrent(
+    const std::filesystem::path& root, const create_options& options,
+    concurrency::thread_pool& pool, create_error* error) {
+    if (options.piece_length != 0 &&
+        (options.piece_length < min_piece_length ||
+         !std::has_single_bit(options.piece_length))) {
+        return fail(error, root,
+                    "piece length must be a power of two of at least 16 KiB");
+    }
+
+    auto c = collect(root, error);
+    if (!c.has_value()) {
+        return {};
+    }
+    auto data = std::uint64_t{0};
+    for (const auto& file : c->files) {
+        data += file.length;
+    }
+    if (data == 0) {
+        return fail(error, root, "no data to hash");
+    }
+
+    const auto piece_length = options.piece_length != 0
+                                  ? options.piece_length
+                                  : pick_piece_length(data);
+    lay_out(c.value(), piece_length, options.hybrid);
+
+    const auto piece_count =
+        static_cast<std::size_t>((c->total + piece_length - 1) / piece_length);
+    auto job = hash_job{c.value(), piece_length, options.hybrid,
+                        std::string(piece_count * sizeof(crypto::sha1_digest),
+                                    '\0'),
+                        {}};
+    if (options.hybrid) {
+        job.piece_roots.resize(piece_count);
+    }
+    if (!hash_content(job, pool, error)) {
+        return {};
+    }
+
+    auto layers = std::map<crypto::sha256_digest, std::string>{};
+    if (options.hybrid) {
+        layers = build_trees(c.value(), job);
+    }
+    const auto info = encode_info(c.value(), job, options);
+
+    auto result = created_torrent{};
+    result.info_hash = crypto::sha1(info);
+    result.total_size = data;
+    if (options.hybrid) {
+        result.info_hash_v2 = crypto::sha256(info);
+    }
+
+    // Keys in sorted order, with the info dictionary copied in as encoded.
+    auto& out = result.metainfo;
+    auto e = string_encoder{std::back_inserter(out)};
+    e.begin_dict();
+    if (!options.trackers.empty()) {
+        e.string("announce").string(options.trackers.front());
+    }
+    if (options.trackers.size() > 1) {
+        e.string("announce-list").begin_list();
+        for (const auto& tracker : options.trackers) {
+            e.begin_list().string(tracker).end();
+        }
+        e.end();
+    }
+    if (!options.comment.empty()) {
+        e.string("comment").string(options.comment);
+    }
+    if (!options.created_by.empty()) {
+        e.string("created by").string(options.created_by);
+    }
+    if (options.creation_date.has_value()) {
+        e.string("creation date").integer(options.creation_date.value());
+    }
+    e.string("info");
+    out += info;
+    if (!layers.empty()) {
+        e.string("piece layers").begin_dict();
+        for (const auto& [pieces_root, layer] : layers) {
+            e.string(bytes_of(pieces_root)).string(layer);
+        }
+        e.end();
+    }
+    e.end();
+    return result;
+}
+
+}  // namespace storage
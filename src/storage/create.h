@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "sha.h"
+#include "thread_pool.h"
+
+namespace storage {
+
+struct create_options {
+    // A power of two of at least 16 KiB; 0 picks one from the total size.
+    std::uint64_t piece_length = 0;
+    // Adds v2 metadata (BEP 52) next to the v1 pieces. Files are padded to
+    // piece boundaries so that both views hash the same pieces.
+    bool hybrid = false;
+    // The first is the announce URL; with more than one, every tracker gets
+    // its own tier in announce-list.
+    std::vector<std::string> trackers;
+    std::string comment;
+    std::string created_by;
+    std::optional<std::int64_t> creation_date;
+    bool private_ = false;
+};
+
+struct create_error {
+    std::filesystem::path path;
+    std::string message;
+};
+
+struct created_torrent {
+    // Canonical bencode, ready to be written to a .torrent file.
+    std::string metainfo;
+    crypto::sha1_digest info_hash;
+    std::optional<crypto::sha256_digest> info_hash_v2;
+    // Bytes of file data hashed, padding left out.
+    std::uint64_t total_size = 0;
+};
+
+// Aims for about 2048 pieces, between 16 KiB and 16 MiB.
+std::uint64_t pick_piece_length(std::uint64_t total_size);
+
+// Builds a torrent for root, a single file or a directory whose files are
+// taken in path order. The calling thread reads the content front to back
+// into a bounded set of buffers while pool hashes the ones already read,
+// so that disk and hashing overlap. Fails if the content is empty, cannot
+// be read, or changes size while it is hashed.
+//
+// Blocks until every piece is hashed, so it must not be called from one of
+// pool's own workers.
+std::optional<created_torrent> create_torrent(
+    const std::filesystem::path& root, const create_options& options,
+    concurrency::thread_pool& pool, create_error* error = nullptr);
+
+}  // namespace storage
@@ -0,0 +1,605 @@
+#include "disk_io.h"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "bitfield.h"
+#include "block_pool.h"
+#include "file_pool.h"
+#include "io_queue.h"
+#include "layout.h"
+#include "metrics.h"
+#include "read_cache.h"
+#include "torrent.h"
+
+namespace storage {
+namespace {
+struct disk_metrics {
+    // Jobs queued or running, over every torrent.
+    metrics::gauge& queue_depth = metrics::global().gauge("disk.queue_depth");
+    metrics::counter& read_hits = metrics::global().counter("disk.read_hits");
+    metrics::counter& read_misses =
+        metrics::global().counter("disk.read_misses");
+    // Pieces read whole for uploading, and uploads left to sendfile.
+    metrics::counter& read_ahead = metrics::global().counter("disk.read_ahead");
+    metrics::counter& upload_ranges =
+        metrics::global().counter("disk.upload_ranges");
+};
+
+disk_metrics& stats() {
+    static auto instance = disk_metrics{};
+    return instance;
+}
+
+std::vector<std::uint64_t> file_sizes(const torrent::file_layout& layout) {
+    auto sizes = std::vector<std::uint64_t>(layout.file_count());
+    for (std::size_t i = 0; i < sizes.size(); i++) {
+        sizes[i] = layout.file_size(i);
+    }
+    return sizes;
+}
+
+// An op before its buffers are final: iovecs may still move while the
+// batch is being built.
+struct planned_op {
+    std::shared_ptr<const file_handle> file;
+    std::uint64_t offset;
+    std::size_t first;
+    std::size_t count;
+    std::size_t size;
+};
+
+// Batches are built in buffers each disk thread keeps.
+struct scratch {
+    std::vector<iovec> iovecs;
+    std::vector<planned_op> plan;
+    std::vector<io_op> ops;
+
+    // Also lets go of the files, which the pool may want to close.
+    void clear() {
+        iovecs.clear();
+        plan.clear();
+        ops.clear();
+    }
+};
+
+scratch& local_scratch() {
+    thread_local auto s = scratch{};
+    s.clear();
+    return s;
+}
+
+std::error_code check(std::span<const io_op> ops,
+                      std::span<const planned_op> plan) {
+    for (std::size_t i = 0; i < ops.size(); i++) {
+        if (ops[i].result < 0) {
+            return {static_cast<int>(-ops[i].result), std::system_category()};
+        }
+        if (static_cast<std::size_t>(ops[i].result) != plan[i].size) {
+            return {EIO, std::system_category()};
+        }
+    }
+    return {};
+}
+
+void plan_ops(scratch& s, bool write) {
+    const auto iovecs = std::span<const iovec>{s.iovecs};
+    for (const auto& p : s.plan) {
+        s.ops.push_back({p.file->fd(), p.offset,
+                         iovecs.subspan(p.first, p.count), write, 0});
+    }
+}
+
+// Plans the bytes from begin to end of piece, all in blocks, as one op per
+// file they cover. Padding is never written, and reads as zeros.
+void plan_run(scratch& s, file_pool& files,
+              const torrent::file_layout& layout, std::uint32_t piece,
+              std::span<const buffers::block_ref> blocks, std::uint64_t begin,
+              std::uint64_t end, bool write, std::error_code& error) {
+    auto position = begin;
+    for (const auto slice : layout.block_slices(piece, begin, end - begin)) {
+        if (layout.is_padding(slice.file)) {
+            for (auto left = slice.length; left > 0;) {
+                const auto within = position % block_size;
+                const auto n =
+                    std::min<std::uint64_t>(block_size - within, left);
+                if (!write) {
+                    std::memset(blocks[position / block_size].data() + within,
+                                0, n);
+                }
+                position += n;
+                left -= n;
+            }
+            continue;
+        }
+        auto file = files.open(slice.file, write, error);
+        if (error) {
+            return;
+        }
+        auto op = planned_op{file, slice.offset, s.iovecs.size(), 0, 0};
+        for (auto left = slice.length; left > 0;) {
+            if (op.count == IOV_MAX) {
+                s.plan.push_back(op);
+                op = planned_op{file, op.offset + op.size, s.iovecs.size(), 0,
+                                0};
+            }
+            const auto within = position % block_size;
+            const auto n = std::min<std::uint64_t>(block_size - within, left);
+            s.iovecs.push_back({blocks[position / block_size].data() + within,
+                                n});
+            op.count++;
+            op.size += n;
+            position += n;
+            left -= n;
+        }
+        s.plan.push_back(op);
+    }
+}
+
+bool touches_padding(const torrent::file_layout& layout, std::uint32_t piece,
+                     std::uint32_t begin, std::uint32_t length) {
+    for (const auto slice : layout.block_slices(piece, begin, length)) {
+        if (layout.is_padding(slice.file)) {
+            return true;
+        }
+    }
+    return false;
+}
+}  // namespace
+
+disk_io::disk_io(torrent::file_layout layout,
+                 std::vector<std::filesystem::path> paths,
+                 buffers::block_pool& blocks, const disk_options& options,
+                 disk_handler handler)
+    : layout_{std::move(layout)},
+      files_{std::move(paths), file_sizes(layout_), options.max_open_files,
+             options.allocation},
+      blocks_{blocks},
+      options_{options},
+      handler_{std::move(handler)},
+      read_cache_{options.read_cache_size, layout_.piece_length()},
+      pool_{std::max<std::size_t>(options.threads, 1)} {}
+
+disk_io::~disk_io() { flush(); }
+
+std::uint32_t disk_io::blocks_in(std::uint32_t piece) const {
+    return static_cast<std::uint32_t>(
+        (layout_.piece_size(piece) + block_size - 1) / block_size);
+}
+
+std::size_t disk_io::cached_bytes() const {
+    const auto lock = std::lock_guard{mutex_};
+    return cached_bytes_;
+}
+
+bool disk_io::congested() const {
+    const auto lock = std::lock_guard{mutex_};
+    return congested_;
+}
+
+bool disk_io::write(std::uint32_t piece, std::uint32_t begin,
+                    buffers::block_ref block, std::uint32_t length) {
+    const auto lock = std::lock_guard{mutex_};
+    if (!block || piece >= layout_.piece_count() || begin % block_size != 0 ||
+        begin >= layout_.piece_size(piece) ||
+        length != std::min<std::uint64_t>(block_size,
+                                          layout_.piece_size(piece) - begin)) {
+        return !congested_;
+    }
+
+    auto& c = cache_[piece];
+    if (c.blocks.empty()) {
+        c.blocks.resize(blocks_in(piece));
+        c.sequence = sequence_++;
+        if (const auto it = evicted_.find(piece); it != evicted_.end()) {
+            c.evicted = std::move(it->second);
+            c.evicted_count = static_cast<std::uint32_t>(c.evicted.count());
+            evicted_.erase(it);
+        }
+    }
+    const auto index = begin / block_size;
+    auto& slot = c.blocks[index];
+    if (!slot) {
+        slot = std::move(block);
+        c.present++;
+        dirty_bytes_ += block_size;
+        cached_bytes_ += block_size;
+        // Sent again, as after a failed hash: this copy is the one to write.
+        if (c.evicted_count != 0 && c.evicted.test(index)) {
+            c.evicted.reset(index);
+            c.evicted_count--;
+        }
+    }
+
+    if (c.present + c.evicted_count == c.blocks.size()) {
+        flush_piece(piece);
+    }
+    if (cached_bytes_ > options_.cache_size) {
+        congested_ = true;
+        evict();
+    }
+    return !congested_;
+}
+
+void disk_io::evict() {
+    auto oldest = std::vector<std::pair<std::uint64_t, std::uint32_t>>{};
+    oldest.reserve(cache_.size());
+    for (const auto& [piece, c] : cache_) {
+        oldest.emplace_back(c.sequence, piece);
+    }
+    std::sort(oldest.begin(), oldest.end());
+    for (const auto& [sequence, piece] : oldest) {
+        if (dirty_bytes_ <= options_.cache_size / 2) {
+            break;
+        }
+        flush_piece(piece);
+    }
+}
+
+void disk_io::flush_piece(std::uint32_t piece) {
+    const auto it = cache_.find(piece);
+    auto c = std::make_shared<cached_piece>(std::move(it->second));
+    cache_.erase(it);
+    if (c->present + c->evicted_count < c->blocks.size()) {
+        auto& evicted = evicted_[piece];
+        evicted = c->evicted_count != 0 ? std::move(c->evicted)
+                                        : torrent::bitfield{c->blocks.size()};
+        for (std::size_t b = 0; b < c->blocks.size(); b++) {
+            if (c->blocks[b]) {
+                evicted.set(b);
+            }
+        }
+    }
+    dirty_bytes_ -= c->present * std::size_t{block_size};
+    schedule(piece, [this, piece, c] { return write_blocks(piece, *c); });
+}
+
+void disk_io::schedule(std::uint32_t piece, job j) {
+    jobs_++;
+    stats().queue_depth.add(1);
+    auto [it, idle] = busy_.try_emplace(piece);
+    if (idle) {
+        submit(piece, std::move(j));
+    } else {
+        it->second.push_back(std::move(j));
+    }
+}
+
+void disk_io::submit(std::uint32_t piece, job j) {
+    pool_.submit([this, piece, j = std::move(j)]() mutable {
+        const auto released = j();
+        // The blocks go back to their pool before anyone hears of it.
+        j = nullptr;
+        finished(piece, released);
+    });
+}
+
+void disk_io::finished(std::uint32_t piece, std::size_t released) {
+    bool drained = false;
+    {
+        const auto lock = std::lock_guard{mutex_};
+        const auto it = busy_.find(piece);
+        if (it->second.empty()) {
+            busy_.erase(it);
+        } else {
+            // Rarely more than a couple waiting.
+            submit(piece, std::move(it->second.front()));
+            it->second.erase(it->second.begin());
+        }
+        jobs_--;
+        stats().queue_depth.add(-1);
+        cached_bytes_ -= released;
+        if (congested_ && cached_bytes_ <= options_.cache_size / 2) {
+            congested_ = false;
+            drained = true;
+        }
+    }
+    idle_.notify_all();
+    if (drained && handler_.on_drain) {
+        handler_.on_drain();
+    }
+}
+
+std::optional<cached_range> disk_io::cached_block(std::uint32_t piece,
+                                                  std::uint32_t begin,
+                                                  std::uint32_t length) {
+    // Left to the job to answer as invalid.
+    if (!valid(piece, begin, length)) {
+        return {};
+    }
+    const auto it = cache_.find(piece);
+    if (it == cache_.end()) {
+        stats().read_misses.add();
+        return {};
+    }
+    const auto& block = it->second.blocks[begin / block_size];
+    const auto offset = begin % block_size;
+    if (block && offset + std::uint64_t{length} <= block_size) {
+        stats().read_hits.add();
+        return cached_range{block, {block.data() + offset, length}};
+    }
+    flush_piece(piece);
+    stats().read_misses.add();
+    return {};
+}
+
+void disk_io::read(std::uint32_t piece, std::uint32_t begin,
+                   std::uint32_t length, read_handler handler) {
+    const auto lock = std::lock_guard{mutex_};
+    if (auto hit = cached_block(piece, begin, length)) {
+        schedule(piece, [hit = std::move(hit.value()),
+                         handler = std::move(handler)] {
+            handler(hit.block, hit.bytes, {});
+            return std::size_t{0};
+        });
+        return;
+    }
+    schedule(piece, [this, piece, begin, length,
+                     handler = std::move(handler)] {
+        read_blocks(piece, begin, length, handler);
+        return std::size_t{0};
+    });
+}
+
+void disk_io::upload(std::uint32_t piece, std::uint32_t begin,
+                     std::uint32_t length, upload_handler handler) {
+    const auto lock = std::lock_guard{mutex_};
+    if (auto hit = cached_block(piece, begin, length)) {
+        schedule(piece, [hit = std::move(hit.value()),
+                         handler = std::move(handler)] {
+            handler({hit.block, hit.bytes, {}}, {});
+            return std::size_t{0};
+        });
+        return;
+    }
+
+    // A request starting where the last one for the piece ended.
+    auto ahead = false;
+    if (read_cache_.enabled() && valid(piece, begin, length)) {
+        if (next_begin_.size() >= max_tracked_pieces) {
+            next_begin_.clear();
+        }
+        const auto [it, added] = next_begin_.try_emplace(piece, 0);
+        ahead = !added && it->second == begin;
+        it->second = begin + length;
+    }
+    schedule(piece, [this, piece, begin, length, ahead,
+                     handler = std::move(handler)] {
+        upload_blocks(piece, begin, length, ahead, handler);
+        return std::size_t{0};
+    });
+}
+
+void disk_io::flush() {
+    auto lock = std::unique_lock{mutex_};
+    while (!cache_.empty()) {
+        flush_piece(cache_.begin()->first);
+    }
+    idle_.wait(lock, [this] { return jobs_ == 0; });
+}
+
+io_queue& disk_io::queue() {
+    // Each disk thread keeps its ring for good.
+    thread_local auto q = std::unique_ptr<io_queue>{};
+    if (q == nullptr) {
+        q = std::make_unique<io_queue>(options_.io_uring);
+        if (q->uses_io_uring()) {
+            io_uring_.store(true);
+        }
+    }
+    return *q;
+}
+
+std::size_t disk_io::write_blocks(std::uint32_t piece, const cached_piece& c) {
+    const auto piece_size = layout_.piece_size(piece);
+    auto& s = local_scratch();
+    auto error = std::error_code{};
+
+    // Each run of adjacent blocks is one write per file it covers.
+    for (std::uint32_t first = 0; first < c.blocks.size() && !error;) {
+        if (!c.blocks[first]) {
+            first++;
+            continue;
+        }
+        auto last = first;
+        while (last < c.blocks.size() && c.blocks[last]) {
+            last++;
+        }
+
+        const auto run_end =
+            std::min<std::uint64_t>(std::uint64_t{last} * block_size,
+                                    piece_size);
+        plan_run(s, files_, layout_, piece, c.blocks,
+                 std::uint64_t{first} * block_size, run_end, true, error);
+        first = last;
+    }
+
+    if (!error) {
+        plan_ops(s, true);
+        queue().run(s.ops);
+        error = check(s.ops, s.plan);
+    }
+    s.clear();
+    // Uploads of the piece after this job read what was just written.
+    read_cache_.erase(piece);
+    if (error && handler_.on_error) {
+        handler_.on_error(piece, error);
+    } else if (!error && handler_.on_written) {
+        auto written = torrent::bitfield{c.blocks.size()};
+        for (std::size_t b = 0; b < c.blocks.size(); b++) {
+            if (c.blocks[b]) {
+                written.set(b);
+            }
+        }
+        handler_.on_written(piece, written);
+    }
+    return c.present * std::size_t{block_size};
+}
+
+bool disk_io::valid(std::uint32_t piece, std::uint32_t begin,
+                    std::uint32_t length) const {
+    return piece < layout_.piece_count() && length <= block_size &&
+           begin + std::uint64_t{length} <= layout_.piece_size(piece);
+}
+
+void disk_io::read_blocks(std::uint32_t piece, std::uint32_t begin,
+                          std::uint32_t length, const read_handler& handler) {
+    if (!valid(piece, begin, length)) {
+        handler({}, {}, std::make_error_code(std::errc::invalid_argument));
+        return;
+    }
+    auto block = blocks_.allocate();
+    if (!block) {
+        handler({}, {}, std::make_error_code(std::errc::not_enough_memory));
+        return;
+    }
+
+    auto& s = local_scratch();
+    auto error = std::error_code{};
+    std::uint64_t position = 0;
+    for (const auto slice : layout_.block_slices(piece, begin, length)) {
+        if (layout_.is_padding(slice.file)) {
+            std::memset(block.data() + position, 0, slice.length);
+            position += slice.length;
+            continue;
+        }
+        auto file = files_.open(slice.file, false, error);
+        if (error) {
+            break;
+        }
+        s.plan.push_back(
+            {file, slice.offset, s.iovecs.size(), 1, slice.length});
+        s.iovecs.push_back({block.data() + position, slice.length});
+        position += slice.length;
+    }
+
+    if (!error) {
+        plan_ops(s, false);
+        queue().run(s.ops);
+        error = check(s.ops, s.plan);
+    }
+    s.clear();
+    if (error) {
+        handler({}, {}, error);
+    } else {
+        handler(block, {block.data(), length}, {});
+    }
+}
+
+std::vector<buffers::block_ref> disk_io::read_piece(std::uint32_t piece,
+                                                    std::error_code& error) {
+    auto blocks = std::vector<buffers::block_ref>(blocks_in(piece));
+    for (auto& block : blocks) {
+        block = blocks_.allocate();
+        if (!block) {
+            return {};
+        }
+    }
+
+    auto& s = local_scratch();
+    plan_run(s, files_, layout_, piece, blocks, 0, layout_.piece_size(piece),
+             false, error);
+    if (!error) {
+        plan_ops(s, false);
+        queue().run(s.ops);
+        error = check(s.ops, s.plan);
+    }
+    s.clear();
+    if (error) {
+        return {};
+    }
+    return blocks;
+}
+
+std::vector<file_range> disk_io::locate(std::uint32_t piece,
+                                        std::uint32_t begin,
+                                        std::uint32_t length,
+                                        std::error_code& error) {
+    auto ranges = std::vector<file_range>{};
+    for (const auto slice : layout_.block_slices(piece, begin, length)) {
+        auto file = files_.open(slice.file, false, error);
+        if (error) {
+            return {};
+        }
+        ranges.push_back({std::move(file), slice.offset,
+                          static_cast<std::uint32_t>(slice.length)});
+    }
+    return ranges;
+}
+
+void disk_io::upload_blocks(std::uint32_t piece, std::uint32_t begin,
+                            std::uint32_t length, bool ahead,
+                            const upload_handler& handler) {
+    if (!valid(piece, begin, length)) {
+        handler({}, std::make_error_code(std::errc::invalid_argument));
+        return;
+    }
+    // Read ahead for an earlier request, or by another peer's.
+    if (auto hit = read_cache_.find(piece, begin, length)) {
+        handler({std::move(hit->block), hit->bytes, {}}, {});
+        return;
+    }
+
+    auto error = std::error_code{};
+    const auto offset = begin % block_size;
+    if (ahead && offset + std::uint64_t{length} <= block_size) {
+        auto blocks = read_piece(piece, error);
+        if (error) {
+            handler({}, error);
+            return;
+        }
+        // Without blocks to spare, the files will do.
+        if (!blocks.empty()) {
+            stats().read_ahead.add();
+            const auto index = begin / block_size;
+            const auto block = blocks[index];
+            read_cache_.insert(piece, std::move(blocks), index);
+            handler({block, {block.data() + offset, length}, {}}, {});
+            return;
+        }
+    }
+
+    // Padding is nowhere on disk to send from.
+    if (touches_padding(layout_, piece, begin, length)) {
+        read_blocks(piece, begin, length,
+                    [&](buffers::block_ref block, std::span<const char> bytes,
+                        std::error_code ec) {
+                        handler({std::move(block), bytes, {}}, ec);
+                    });
+        return;
+    }
+
+    stats().upload_ranges.add();
+    auto ranges = locate(piece, begin, length, error);
+    handler({{}, {}, std::move(ranges)}, error);
+}
+
+std::vector<std::filesystem::path> content_paths(
+    const torrent::single_file_info& info, const std::filesystem::path& root) {
+    return {root / info.name};
+}
+
+std::vector<std::filesystem::path> content_paths(
+    const torrent::multi_file_info& info, const std::filesystem::path& root) {
+    auto paths = std::vector<std::filesystem::path>{};
+    paths.reserve(info.files.size());
+    for (const auto& file : info.files) {
+        paths.push_back(root / info.name / file.path);
+    }
+    return paths;
+}
+
+}  // namespace storage
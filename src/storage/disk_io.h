@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "bitfield.h"
+#include "block_pool.h"
+#include "file_pool.h"
+#include "io_queue.h"
+#include "layout.h"
+#include "read_cache.h"
+#include "thread_pool.h"
+#include "torrent.h"
+
+namespace storage {
+
+inline constexpr std::uint32_t block_size = buffers::block_size;
+
+struct disk_options {
+    std::size_t threads = 2;
+    // Bytes of blocks held in memory, cached or being written. Past it,
+    // write asks the network to back off until half of it has drained.
+    std::size_t cache_size = 64 << 20;
+    // Bytes of whole pieces kept for uploading, read ahead when a peer asks
+    // for a piece block after block; 0 turns it off.
+    std::size_t read_cache_size = 32 << 20;
+    std::size_t max_open_files = 512;
+    bool io_uring = true;
+    storage::allocation allocation = allocation::sparse;
+};
+
+// Bytes of a file an upload can be sent from without reading them.
+struct file_range {
+    std::shared_ptr<const file_handle> file;
+    std::uint64_t offset = 0;
+    std::uint32_t length = 0;
+};
+
+// What upload answers with: bytes held by block, or failing that the file
+// ranges they lie in, in order.
+struct upload_data {
+    buffers::block_ref block;
+    std::span<const char> bytes;
+    std::vector<file_range> ranges;
+};
+
+struct disk_handler {
+    // Runs on a disk thread once the cache has drained after write returned
+    // false.
+    std::function<void()> on_drain;
+    // Runs on a disk thread when blocks of piece could not be written and
+    // have to be downloaded again.
+    std::function<void(std::uint32_t piece, std::error_code)> on_error;
+    // Runs on a disk thread once blocks of piece, one bit per block, are
+    // written, as for keeping resume data.
+    std::function<void(std::uint32_t piece, const torrent::bitfield& blocks)>
+        on_written;
+};
+
+// The files of one torrent where the network hands over blocks in whatever
+// order they arrive. Blocks are cached per piece, by reference to the pooled
+// buffer they were received into, and written once the piece is complete,
+// as one gathering write per file it touches; memory pressure writes out
+// the oldest partial pieces instead, still merging adjacent blocks, and the
+// rest of such a piece is written as soon as it has arrived. The I/O
+// runs on the subsystem's own threads, and jobs on one piece run in order,
+// so a read sees every write before it. Padding files are never created:
+// their bytes are dropped on write and read back as zeros.
+class disk_io {
+   public:
+    // Reads take their buffers from blocks.
+    disk_io(torrent::file_layout layout,
+            std::vector<std::filesystem::path> paths,
+            buffers::block_pool& blocks, const disk_options& options = {},
+            disk_handler handler = {});
+    // Writes everything cached.
+    ~disk_io();
+
+    disk_io(const disk_io&) = delete;
+    disk_io& operator=(const disk_io&) = delete;
+
+    // Caches the block begin bytes into piece, its length bytes held at the
+    // start of block, without copying it. Returns false when the cache is
+    // over its size: the caller should stop reading from peers until
+    // on_drain. Duplicates, offsets that do not start a block of the piece
+    // and blocks that are not exactly the block at begin are ignored.
+    bool write(std::uint32_t piece, std::uint32_t begin,
+               buffers::block_ref block, std::uint32_t length);
+
+    // Calls handler on a disk thread with length bytes, at most a block,
+    // and the block holding them; keep the block to keep the bytes. A range
+    // inside one cached block is answered from the cache.
+    using read_handler = std::function<void(
+        buffers::block_ref, std::span<const char>, std::error_code)>;
+    void read(std::uint32_t piece, std::uint32_t begin, std::uint32_t length,
+              read_handler handler);
+
+    // Like read, for sending to a peer. A peer asking for a piece block
+    // after block gets the whole piece read into the read cache, which
+    // answers the rest of its requests and those of other peers; anything
+    // else is answered with the file ranges to send, so that the bytes
+    // never pass through a buffer of ours.
+    using upload_handler = std::function<void(upload_data, std::error_code)>;
+    void upload(std::uint32_t piece, std::uint32_t begin,
+                std::uint32_t length, upload_handler handler);
+
+    // Blocks until every block given to write is on disk.
+    void flush();
+
+    std::size_t cached_bytes() const;
+    bool congested() const;
+    std::size_t open_files() const { return files_.open_count(); }
+    bool uses_io_uring() const { return io_uring_.load(); }
+    read_cache_stats read_stats() const { return read_cache_.stats(); }
+
+   private:
+    struct cached_piece {
+        std::vector<buffers::block_ref> blocks;
+        std::uint32_t present = 0;
+        // Blocks written out by an earlier eviction, and not cached since:
+        // the piece is complete once the rest are present.
+        torrent::bitfield evicted;
+        std::uint32_t evicted_count = 0;
+        // Arrival order of the first block, for choosing what to evict.
+        std::uint64_t sequence = 0;
+    };
+
+    // A job returns the cache bytes it released.
+    using job = std::function<std::size_t()>;
+
+    // Pieces whose next upload request is predicted, at most.
+    static constexpr std::size_t max_tracked_pieces = 4096;
+
+    std::uint32_t blocks_in(std::uint32_t piece) const;
+    bool valid(std::uint32_t piece, std::uint32_t begin,
+               std::uint32_t length) const;
+
+    // The following expect mutex_ to be held.
+    // The range, if it lies in a block of the write cache; flushes the
+    // piece if it does not. Nothing for a range outside the piece.
+    std::optional<cached_range> cached_block(std::uint32_t piece,
+                                             std::uint32_t begin,
+                                             std::uint32_t length);
+    // Writes out what piece has cached, remembering which blocks that was
+    // if the piece is not complete.
+    void flush_piece(std::uint32_t piece);
+    void evict();
+    void schedule(std::uint32_t piece, job j);
+    void submit(std::uint32_t piece, job j);
+
+    void finished(std::uint32_t piece, std::size_t released);
+    io_queue& queue();
+    std::size_t write_blocks(std::uint32_t piece, const cached_piece& c);
+    void read_blocks(std::uint32_t piece, std::uint32_t begin,
+                     std::uint32_t length, const read_handler& handler);
+    // Every block of piece, or none if the pool has too few to spare.
+    std::vector<buffers::block_ref> read_piece(std::uint32_t piece,
+                                               std::error_code& error);
+    std::vector<file_range> locate(std::uint32_t piece, std::uint32_t begin,
+                                   std::uint32_t length,
+                                   std::error_code& error);
+    void upload_blocks(std::uint32_t piece, std::uint32_t begin,
+                       std::uint32_t length, bool ahead,
+                       const upload_handler& handler);
+
+    torrent::file_layout layout_;
+    file_pool files_;
+    buffers::block_pool& blocks_;
+    disk_options options_;
+    disk_handler handler_;
+    std::atomic<bool> io_uring_{false};
+    read_cache read_cache_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    std::unordered_map<std::uint32_t, cached_piece> cache_;
+    // Blocks of partial pieces written out and not cached since, by piece.
+    std::unordered_map<std::uint32_t, torrent::bitfield> evicted_;
+    std::uint64_t sequence_ = 0;
+    // Blocks in cache_, and those plus the ones being written.
+    std::size_t dirty_bytes_ = 0;
+    std::size_t cached_bytes_ = 0;
+    // Pieces with a job running, and the jobs waiting behind it.
+    std::unordered_map<std::uint32_t, std::vector<job>> busy_;
+    std::size_t jobs_ = 0;
+    bool congested_ = false;
+    // Where the next upload request of a piece read block after block
+    // would begin.
+    std::unordered_map<std::uint32_t, std::uint32_t> next_begin_;
+
+    // Last, so that its workers are joined before the state they use goes.
+    concurrency::thread_pool pool_;
+};
+
+// Where the files of a torrent live under root.
+std::vector<std::filesystem::path> content_paths(
+    const torrent::single_file_info& info, const std::filesystem::path& root);
+std::vector<std::filesystem::path> content_paths(
+    const torrent::multi_file_info& info, const std::filesystem::path& root);
+
+}  // namespace storage
@@ -0,0 +1,123 @@
+#include "file_pool.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace storage {
+namespace {
+std::error_code last_error() { return {errno, std::system_category()}; }
+
+// Extends a file that is shorter than size.
+bool allocate(int fd, std::uint64_t size, allocation mode,
+              std::error_code& error) {
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        error = last_error();
+        return false;
+    }
+    if (static_cast<std::uint64_t>(st.st_size) >= size) {
+        return true;
+    }
+
+    if (mode == allocation::full) {
+        const auto result =
+            ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+        if (result == 0) {
+            return true;
+        }
+        if (result != EOPNOTSUPP && result != EINVAL) {
+            error = {result, std::system_category()};
+            return false;
+        }
+    }
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        error = last_error();
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+file_handle::~file_handle() { ::close(fd_); }
+
+file_pool::file_pool(std::vector<std::filesystem::path> paths,
+                     std::vector<std::uint64_t> sizes, std::size_t max_open,
+                     storage::allocation allocation)
+    : paths_{std::move(paths)},
+      sizes_{std::move(sizes)},
+      max_open_{std::max<std::size_t>(max_open, 1)},
+      allocation_{allocation} {}
+
+std::size_t file_pool::open_count() const {
+    const auto lock = std::lock_guard{mutex_};
+    return open_.size();
+}
+
+std::shared_ptr<const file_handle> file_pool::open(std::size_t file,
+                                                   bool write,
+                                                   std::error_code& error) {
+    const auto lock = std::lock_guard{mutex_};
+    if (const auto it = open_.find(file);
+        it != open_.end() && (it->second.writable || !write)) {
+        recent_.splice(recent_.begin(), recent_, it->second.recent);
+        return it->second.handle;
+    }
+
+    auto handle = open_file(file, write, error);
+    if (handle == nullptr) {
+        return nullptr;
+    }
+
+    if (const auto it = open_.find(file); it != open_.end()) {
+        // Reopened for writing.
+        it->second.handle = handle;
+        it->second.writable = true;
+        recent_.splice(recent_.begin(), recent_, it->second.recent);
+        return handle;
+    }
+
+    if (open_.size() == max_open_) {
+        open_.erase(recent_.back());
+        recent_.pop_back();
+    }
+    recent_.push_front(file);
+    open_.emplace(file, entry{handle, write, recent_.begin()});
+    return handle;
+}
+
+std::shared_ptr<const file_handle> file_pool::open_file(
+    std::size_t file, bool write, std::error_code& error) {
+    const auto& path = paths_[file];
+    if (write && path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), error);
+        if (error) {
+            return nullptr;
+        }
+    }
+
+    const auto flags = write ? O_RDWR | O_CREAT : O_RDONLY;
+    const auto fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = last_error();
+        return nullptr;
+    }
+    auto handle = std::make_shared<const file_handle>(fd);
+    if (write && !allocate(fd, sizes_[file], allocation_, error)) {
+        return nullptr;
+    }
+    return handle;
+}
+
+}  // namespace storage
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+namespace storage {
+
+enum class allocation {
+    // Files are extended to their final size without reserving blocks.
+    sparse,
+    // Blocks are reserved up front, so the file cannot fragment or run out
+    // of space halfway.
+    full,
+};
+
+// An open file descriptor, closed with the last reference.
+class file_handle {
+   public:
+    explicit file_handle(int fd) : fd_{fd} {}
+    ~file_handle();
+
+    file_handle(const file_handle&) = delete;
+    file_handle& operator=(const file_handle&) = delete;
+
+    int fd() const { return fd_; }
+
+   private:
+    int fd_;
+};
+
+// Opens a torrent's files on demand and keeps at most max_open of them
+// open, closing the least recently used. A torrent with 100k files thus
+// costs a bounded number of descriptors; a handle in use when it is
+// evicted stays valid until its holder lets go. Safe to use from any
+// thread.
+class file_pool {
+   public:
+    file_pool(std::vector<std::filesystem::path> paths,
+              std::vector<std::uint64_t> sizes, std::size_t max_open,
+              storage::allocation allocation);
+
+    // Files opened for writing are created with their directories and
+    // extended to their full size the first time.
+    std::shared_ptr<const file_handle> open(std::size_t file, bool write,
+                                            std::error_code& error);
+
+    std::size_t open_count() const;
+
+   private:
+    struct entry {
+        std::shared_ptr<const file_handle> handle;
+        bool writable = false;
+        std::list<std::size_t>::iterator recent;
+    };
+
+    std::shared_ptr<const file_handle> open_file(std::size_t file, bool write,
+                                                 std::error_code& error);
+
+    std::vector<std::filesystem::path> paths_;
+    std::vector<std::uint64_t> sizes_;
+    std::size_t max_open_;
+    storage::allocation allocation_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::size_t, entry> open_;
+    // Most recently used first.
+    std::list<std::size_t> recent_;
+};
+
+}  // namespace storage
@@ -0,0 +1,263 @@
+#include "io_queue.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define RUSH_IO_URING 1
+#endif
+
+namespace storage {
+namespace {
+std::size_t total_size(std::span<const iovec> buffers) {
+    std::size_t size = 0;
+    for (const auto& b : buffers) {
+        size += b.iov_len;
+    }
+    return size;
+}
+
+// Transfers what is left of op after done bytes, one call at a time.
+void finish(io_op& op, std::size_t done) {
+    // Most transfers complete in one call, straight from the op's buffers.
+    if (done == 0 && op.buffers.size() <= IOV_MAX) {
+        const auto count = static_cast<int>(op.buffers.size());
+        const auto offset = static_cast<off_t>(op.offset);
+        const auto n =
+            op.write ? ::pwritev(op.fd, op.buffers.data(), count, offset)
+                     : ::preadv(op.fd, op.buffers.data(), count, offset);
+        if (n < 0 && errno != EINTR) {
+            op.result = -errno;
+            return;
+        }
+        if (n >= 0 && static_cast<std::size_t>(n) == total_size(op.buffers)) {
+            op.result = n;
+            return;
+        }
+        done = n < 0 ? 0 : static_cast<std::size_t>(n);
+    }
+
+    auto buffers = std::vector<iovec>(op.buffers.begin(), op.buffers.end());
+    std::size_t first = 0;
+    const auto skip = [&](std::size_t n) {
+        while (first < buffers.size() && n >= buffers[first].iov_len) {
+            n -= buffers[first++].iov_len;
+        }
+        if (first < buffers.size()) {
+            auto& b = buffers[first];
+            b.iov_base = static_cast<char*>(b.iov_base) + n;
+            b.iov_len -= n;
+        }
+    };
+    skip(done);
+
+    while (first < buffers.size()) {
+        const auto count = static_cast<int>(
+            std::min<std::size_t>(buffers.size() - first, IOV_MAX));
+        const auto offset = static_cast<off_t>(op.offset + done);
+        const auto n =
+            op.write ? ::pwritev(op.fd, &buffers[first], count, offset)
+                     : ::preadv(op.fd, &buffers[first], count, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            op.result = -errno;
+            return;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<std::size_t>(n);
+        skip(static_cast<std::size_t>(n));
+    }
+    op.result = static_cast<std::int64_t>(done);
+}
+
+#if defined(RUSH_IO_URING)
+int setup(unsigned entries, io_uring_params& params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, submit, wait,
+                                      flags, nullptr, 0));
+}
+
+unsigned load_acquire(unsigned* p) {
+    return std::atomic_ref<unsigned>{*p}.load(std::memory_order_acquire);
+}
+
+void store_release(unsigned* p, unsigned v) {
+    std::atomic_ref<unsigned>{*p}.store(v, std::memory_order_release);
+}
+
+template <typename T>
+T* at(void* base, std::uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+void* map(std::size_t size, int fd, off_t offset) {
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? nullptr : p;
+}
+#endif
+}  // namespace
+
+io_queue::io_queue(bool use_io_uring, unsigned entries) {
+#if defined(RUSH_IO_URING)
+    if (!use_io_uring) {
+        return;
+    }
+    auto params = io_uring_params{};
+    ring_fd_ = setup(entries, params);
+    if (ring_fd_ < 0) {
+        ring_fd_ = -1;
+        return;
+    }
+    entries_ = params.sq_entries;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = map(sq_ring_size_, ring_fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_map ? sq_ring_
+                          : map(cq_ring_size_, ring_fd_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = map(sqes_size_, ring_fd_, IORING_OFF_SQES);
+    if (sq_ring_ == nullptr || cq_ring_ == nullptr || sqes_ == nullptr) {
+        close_ring();
+        return;
+    }
+
+    sq_tail_ = at<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *at<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, params.sq_off.array);
+    cq_head_ = at<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = *at<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = at<void>(cq_ring_, params.cq_off.cqes);
+#else
+    (void)use_io_uring;
+    (void)entries;
+#endif
+}
+
+io_queue::~io_queue() { close_ring(); }
+
+void io_queue::close_ring() {
+    if (sqes_ != nullptr) {
+        ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) {
+        ::munmap(sq_ring_, sq_ring_size_);
+    }
+    sqes_ = cq_ring_ = sq_ring_ = nullptr;
+    if (ring_fd_ >= 0) {
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+void io_queue::run(std::span<io_op> ops) {
+    if (uses_io_uring()) {
+        for (std::size_t i = 0; i < ops.size() && uses_io_uring();
+             i += entries_) {
+            run_ring(ops.subspan(i, std::min<std::size_t>(entries_,
+                                                          ops.size() - i)));
+        }
+    }
+
+    for (auto& op : ops) {
+        if (!uses_io_uring()) {
+            finish(op, 0);
+        } else if (op.result >= 0) {
+            const auto done = static_cast<std::size_t>(op.result);
+            if (done < total_size(op.buffers) && done > 0) {
+                finish(op, done);
+            }
+        }
+    }
+}
+
+void io_queue::run_ring(std::span<io_op> ops) {
+#if defined(RUSH_IO_URING)
+    auto tail = *sq_tail_;
+    for (std::size_t i = 0; i < ops.size(); i++) {
+        const auto index = tail & sq_mask_;
+        auto* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = ops[i].write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = ops[i].fd;
+        sqe->off = ops[i].offset;
+        sqe->addr = reinterpret_cast<std::uint64_t>(ops[i].buffers.data());
+        sqe->len = static_cast<std::uint32_t>(ops[i].buffers.size());
+        sqe->user_data = i;
+        sq_array_[index] = index;
+        tail++;
+    }
+    store_release(sq_tail_, tail);
+
+    const auto count = static_cast<unsigned>(ops.size());
+    unsigned submitted = 0;
+    while (submitted < count) {
+        const auto n = enter(ring_fd_, count - submitted, 0, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // The ring is stuck with our entries in it; run this batch and
+            // every later one without it. Ops are positioned, so any the
+            // kernel did get to can safely run again.
+            close_ring();
+            for (auto& op : ops) {
+                op.result = 0;
+            }
+            return;
+        }
+        submitted += static_cast<unsigned>(n);
+    }
+
+    unsigned reaped = 0;
+    auto head = *cq_head_;
+    while (reaped < count) {
+        if (head == load_acquire(cq_tail_)) {
+            const auto n = enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+            if (n < 0 && errno != EINTR) {
+                close_ring();
+                return;
+            }
+            continue;
+        }
+        const auto& cqe = static_cast<io_uring_cqe*>(cqes_)[head & cq_mask_];
+        ops[cqe.user_data].result = cqe.res;
+        head++;
+        reaped++;
+        store_release(cq_head_, head);
+    }
+#else
+    (void)ops;
+#endif
+}
+
+}  // namespace storage
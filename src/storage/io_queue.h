@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace storage {
+
+// One positioned vector read or write.
+struct io_op {
+    int fd = -1;
+    std::uint64_t offset = 0;
+    std::span<const iovec> buffers;
+    bool write = false;
+    // Bytes transferred, or -errno.
+    std::int64_t result = 0;
+};
+
+// Runs batches of reads and writes for one thread. With io_uring the whole
+// batch is handed to the kernel in one system call and completes in
+// parallel; without it, or where the kernel refuses a ring, every op is a
+// preadv or pwritev. Short transfers are finished either way, so a result
+// below the op's size means an error or end of file.
+class io_queue {
+   public:
+    explicit io_queue(bool use_io_uring, unsigned entries = 64);
+    ~io_queue();
+
+    io_queue(const io_queue&) = delete;
+    io_queue& operator=(const io_queue&) = delete;
+
+    bool uses_io_uring() const { return ring_fd_ >= 0; }
+
+    void run(std::span<io_op> ops);
+
+   private:
+    void run_ring(std::span<io_op> ops);
+    void close_ring();
+
+    int ring_fd_ = -1;
+    unsigned entries_ = 0;
+
+    void* sq_ring_ = nullptr;
+    std::size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    std::size_t cq_ring_size_ = 0;
+    void* sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    void* cqes_ = nullptr;
+};
+
+}  // namespace storage
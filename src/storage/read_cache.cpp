@@ -0,0 +1,201 @@
+#include "read_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "bitfield.h"
+#include "block_pool.h"
+#include "metrics.h"
+
+namespace storage {
+namespace {
+struct cache_metrics {
+    metrics::counter& hits = metrics::global().counter("read_cache.hits");
+    metrics::counter& misses =
+        metrics::global().counter("read_cache.misses");
+    // Over every torrent.
+    metrics::gauge& bytes = metrics::global().gauge("read_cache.bytes");
+};
+
+cache_metrics& counters() {
+    static auto instance = cache_metrics{};
+    return instance;
+}
+}  // namespace
+
+read_cache::read_cache(std::size_t capacity, std::uint64_t piece_length)
+    : capacity_{piece_length == 0
+                    ? 0
+                    : static_cast<std::size_t>(capacity / piece_length)} {}
+
+read_cache::~read_cache() {
+    counters().bytes.add(-static_cast<std::int64_t>(bytes_));
+}
+
+std::list<std::uint32_t>& read_cache::list(list_id id) {
+    switch (id) {
+        case list_id::recent:
+            return recent_;
+        case list_id::frequent:
+            return frequent_;
+        case list_id::recent_ghost:
+            return recent_ghosts_;
+        case list_id::frequent_ghost:
+            break;
+    }
+    return frequent_ghosts_;
+}
+
+std::size_t read_cache::cached_pieces() const {
+    return recent_.size() + frequent_.size();
+}
+
+void read_cache::move(entry& e, list_id to) {
+    auto& destination = list(to);
+    destination.splice(destination.begin(), list(e.list), e.position);
+    e.list = to;
+}
+
+std::optional<cached_range> read_cache::find(std::uint32_t piece,
+                                             std::uint32_t begin,
+                                             std::uint32_t length) {
+    const auto lock = std::lock_guard{mutex_};
+    const auto it = entries_.find(piece);
+    const auto index = begin / buffers::block_size;
+    const auto offset = begin % buffers::block_size;
+    if (it == entries_.end() || it->second.blocks.size() <= index ||
+        offset + std::uint64_t{length} > buffers::block_size) {
+        misses_++;
+        counters().misses.add();
+        return {};
+    }
+
+    hits_++;
+    counters().hits.add();
+    auto& e = it->second;
+    if (e.served.test(index)) {
+        // Read again: by another peer, or by the same one from the start.
+        e.served = torrent::bitfield{e.blocks.size()};
+        move(e, list_id::frequent);
+    } else if (e.list == list_id::frequent) {
+        move(e, list_id::frequent);
+    }
+    e.served.set(index);
+    const auto& block = e.blocks[index];
+    return cached_range{block, {block.data() + offset, length}};
+}
+
+void read_cache::insert(std::uint32_t piece,
+                        std::vector<buffers::block_ref> blocks,
+                        std::optional<std::uint32_t> served) {
+    const auto lock = std::lock_guard{mutex_};
+    if (capacity_ == 0) {
+        return;
+    }
+
+    const auto [it, added] = entries_.try_emplace(piece);
+    auto& e = it->second;
+    if (!added) {
+        if (!e.blocks.empty()) {
+            return;
+        }
+        // A ghost come back: grow the list it was evicted from.
+        const auto recent = e.list == list_id::recent_ghost;
+        if (recent) {
+            target_ = std::min(
+                capacity_,
+                target_ + std::max<std::size_t>(
+                              frequent_ghosts_.size() / recent_ghosts_.size(),
+                              1));
+        } else {
+            target_ -= std::min(
+                target_, std::max<std::size_t>(recent_ghosts_.size() /
+                                                   frequent_ghosts_.size(),
+                                               1));
+        }
+        make_room(!recent);
+        move(e, list_id::frequent);
+    } else {
+        // Keeps the keys remembered to at most twice the capacity.
+        if (recent_.size() + recent_ghosts_.size() >= capacity_) {
+            if (!recent_ghosts_.empty()) {
+                drop_oldest(list_id::recent_ghost);
+            } else {
+                drop_oldest(list_id::recent);
+            }
+        } else if (entries_.size() > 2 * capacity_ &&
+                   !frequent_ghosts_.empty()) {
+            drop_oldest(list_id::frequent_ghost);
+        }
+        make_room(false);
+        recent_.push_front(piece);
+        e.list = list_id::recent;
+        e.position = recent_.begin();
+    }
+
+    const auto size = blocks.size() * buffers::block_size;
+    bytes_ += size;
+    counters().bytes.add(static_cast<std::int64_t>(size));
+    e.served = torrent::bitfield{blocks.size()};
+    if (served.has_value() && *served < blocks.size()) {
+        e.served.set(*served);
+    }
+    e.blocks = std::move(blocks);
+}
+
+void read_cache::make_room(bool frequent_ghost_hit) {
+    while (cached_pieces() >= capacity_) {
+        const auto recent = recent_.size();
+        if (recent > 0 && (recent > target_ || frequent_.empty() ||
+                           (frequent_ghost_hit && recent == target_))) {
+            demote(list_id::recent, list_id::recent_ghost);
+        } else {
+            demote(list_id::frequent, list_id::frequent_ghost);
+        }
+    }
+}
+
+void read_cache::release(entry& e) {
+    const auto size = e.blocks.size() * buffers::block_size;
+    bytes_ -= size;
+    counters().bytes.add(-static_cast<std::int64_t>(size));
+    e.blocks.clear();
+    e.served = {};
+}
+
+void read_cache::demote(list_id from, list_id to) {
+    auto& e = entries_.at(list(from).back());
+    release(e);
+    move(e, to);
+}
+
+void read_cache::drop_oldest(list_id id) {
+    auto& l = list(id);
+    const auto it = entries_.find(l.back());
+    release(it->second);
+    entries_.erase(it);
+    l.pop_back();
+}
+
+void read_cache::erase(std::uint32_t piece) {
+    const auto lock = std::lock_guard{mutex_};
+    const auto it = entries_.find(piece);
+    if (it == entries_.end()) {
+        return;
+    }
+    release(it->second);
+    list(it->second.list).erase(it->second.position);
+    entries_.erase(it);
+}
+
+read_cache_stats read_cache::stats() const {
+    const auto lock = std::lock_guard{mutex_};
+    return {hits_, misses_, cached_pieces(), bytes_};
+}
+
+}  // namespace storage
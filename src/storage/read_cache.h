@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "bitfield.h"
+#include "block_pool.h"
+
+namespace storage {
+
+struct read_cache_stats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::size_t pieces = 0;
+    std::size_t bytes = 0;
+};
+
+// Bytes found in the cache, held by the block they lie in.
+struct cached_range {
+    buffers::block_ref block;
+    std::span<const char> bytes;
+};
+
+// Whole pieces read from disk for peers downloading from us, held as
+// pooled blocks and evicted by ARC (Megiddo and Modha). Pieces read through
+// once and pieces read again live in lists of their own, and the split
+// between them follows which of the recently evicted pieces, whose keys are
+// remembered, come back. A piece is read again when a block of it already
+// handed out is asked for, which is how a second peer, or a second pass,
+// shows; the rest of the blocks of the request that read it ahead are not.
+// So a peer reading through the torrent once only cycles the first list,
+// while the pieces a swarm keeps asking for stay in the second. Safe to use
+// from any thread.
+class read_cache {
+   public:
+    // Holds as many pieces of piece_length as fit in capacity bytes; none
+    // turns it off.
+    read_cache(std::size_t capacity, std::uint64_t piece_length);
+    ~read_cache();
+
+    read_cache(const read_cache&) = delete;
+    read_cache& operator=(const read_cache&) = delete;
+
+    bool enabled() const { return capacity_ > 0; }
+
+    // Length bytes at begin into piece, if the piece is cached and they lie
+    // within one of its blocks. Counts as a hit or a miss.
+    std::optional<cached_range> find(std::uint32_t piece, std::uint32_t begin,
+                                     std::uint32_t length);
+    // Takes the blocks of a whole piece, evicting others to make room.
+    // served is the block already handed out of them, if any.
+    void insert(std::uint32_t piece, std::vector<buffers::block_ref> blocks,
+                std::optional<std::uint32_t> served = {});
+    // Forgets piece, as when it is written again.
+    void erase(std::uint32_t piece);
+
+    read_cache_stats stats() const;
+
+   private:
+    enum class list_id : std::uint8_t {
+        recent,
+        frequent,
+        recent_ghost,
+        frequent_ghost,
+    };
+
+    struct entry {
+        list_id list;
+        std::list<std::uint32_t>::iterator position;
+        // Empty for ghosts.
+        std::vector<buffers::block_ref> blocks;
+        // Blocks handed out since the piece was read or last read again.
+        torrent::bitfield served;
+    };
+    using entry_map = std::unordered_map<std::uint32_t, entry>;
+
+    // The following expect mutex_ to be held.
+    std::list<std::uint32_t>& list(list_id id);
+    // Moves e to the most recent end of the list.
+    void move(entry& e, list_id to);
+    void drop_oldest(list_id id);
+    // Turns the oldest piece of one of the lists into a ghost, as ARC's
+    // REPLACE does, until there is room for another piece.
+    void make_room(bool frequent_ghost_hit);
+    void demote(list_id from, list_id to);
+    // Lets go of e's blocks, leaving a ghost.
+    void release(entry& e);
+    std::size_t cached_pieces() const;
+
+    // In pieces.
+    std::size_t capacity_;
+
+    mutable std::mutex mutex_;
+    entry_map entries_;
+    // Most recent first.
+    std::list<std::uint32_t> recent_;
+    std::list<std::uint32_t> frequent_;
+    std::list<std::uint32_t> recent_ghosts_;
+    std::list<std::uint32_t> frequent_ghosts_;
+    // Target size of recent_, ARC's p.
+    std::size_t target_ = 0;
+    std::size_t bytes_ = 0;
+    std::uint64_t hits_ = 0;
+    std::uint64_t misses_ = 0;
+};
+
+}  // namespace storage
@@ -0,0 +1,485 @@
+#include "resume.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bitfield.h"
+#include "disk_io.h"
+#include "layout.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "sha.h"
+#include "thread_pool.h"
+#include "torrent.h"
+#include "verify.h"
+
+namespace storage {
+namespace {
+// On-disk layout of a resume file, in the byte order of the machine that
+// wrote it:
+//
+//   header
+//   file_record[file_count]
+//   piece bits               (piece_count + 7) / 8 bytes, left out when
+//                            every piece is set
+//   partial_record[partial_count], each followed by the bits of its blocks
+//
+// checksum is the SHA-1 of the whole file with checksum zeroed, which
+// catches a file cut short or written over by something else. Bump version
+// whenever any of this changes.
+namespace format {
+constexpr std::array<char, 8> magic = {'R', 'U', 'S', 'H', 'R', 'S', 'U', 'M'};
+constexpr std::uint32_t version = 2;
+constexpr std::uint32_t byte_order = 0x01020304;
+
+enum header_flags : std::uint32_t {
+    complete = 1 << 0,
+};
+
+struct header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::array<std::byte, 20> info_hash;
+    std::uint32_t flags;
+    std::array<std::byte, 20> checksum;
+    std::uint32_t reserved;
+    std::uint64_t piece_count;
+    std::uint64_t file_count;
+    std::uint64_t partial_count;
+};
+
+struct file_record {
+    std::uint64_t size;
+    std::int64_t mtime;
+};
+
+struct partial_record {
+    std::uint32_t piece;
+    std::uint32_t block_count;
+};
+
+static_assert(std::is_trivially_copyable_v<header>);
+static_assert(std::is_trivially_copyable_v<file_record>);
+static_assert(std::is_trivially_copyable_v<partial_record>);
+static_assert(sizeof(header) % 8 == 0);
+
+crypto::sha1_digest checksum(header h, std::string_view body) {
+    h.checksum = {};
+    auto hasher = crypto::sha1_hasher{};
+    hasher.update({reinterpret_cast<const char*>(&h), sizeof(h)});
+    hasher.update(body);
+    return hasher.finish();
+}
+}  // namespace format
+
+struct resume_metrics {
+    metrics::counter& saves = metrics::global().counter("resume.saves");
+    metrics::counter& save_failures =
+        metrics::global().counter("resume.save_failures");
+    // Resume files that could not be used, and so full rechecks.
+    metrics::counter& rejected = metrics::global().counter("resume.rejected");
+    metrics::counter& rechecked_pieces =
+        metrics::global().counter("resume.rechecked_pieces");
+};
+
+resume_metrics& stats() {
+    static auto instance = resume_metrics{};
+    return instance;
+}
+
+template <typename T>
+void put(std::string& out, const T& record) {
+    out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+void put(std::string& out, const torrent::bitfield& bits) {
+    const auto bytes = bits.bytes();
+    out.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+// Reads from the front of input, which it advances. Returns false if input
+// is too short.
+template <typename T>
+bool take(std::string_view& input, T& record) {
+    if (input.size() < sizeof(record)) {
+        return false;
+    }
+    std::memcpy(&record, input.data(), sizeof(record));
+    input.remove_prefix(sizeof(record));
+    return true;
+}
+
+std::optional<torrent::bitfield> take_bits(std::string_view& input,
+                                           std::uint64_t size) {
+    const auto length = (size + 7) / 8;
+    if (input.size() < length) {
+        return {};
+    }
+    const auto* data = reinterpret_cast<const std::uint8_t*>(input.data());
+    input.remove_prefix(length);
+    return torrent::bitfield{std::span{data, length}, size};
+}
+
+bool write_all(int fd, std::string_view bytes) {
+    while (!bytes.empty()) {
+        const auto n = ::write(fd, bytes.data(), bytes.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes.remove_prefix(static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+// Makes a rename in directory durable.
+void sync_directory(const std::filesystem::path& directory) {
+    const auto fd = ::open(directory.empty() ? "." : directory.c_str(),
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+template <typename Info>
+resume_result restore_info(const Info& info, const std::filesystem::path& root,
+                           const std::optional<resume_data>& saved,
+                           concurrency::thread_pool& pool,
+                           std::stop_token stop) {
+    const auto layout = torrent::file_layout::build(info);
+    if (!layout.has_value()) {
+        return {torrent::bitfield{torrent::piece_hashes(info).size()}};
+    }
+
+    const auto now = file_states(content_paths(info, root));
+    const auto piece_count = layout->piece_count();
+    if (!saved.has_value() || saved->pieces.size() != piece_count ||
+        saved->files.size() != now.size()) {
+        stats().rejected.add();
+        stats().rechecked_pieces.add(piece_count);
+        auto checked = verify(info, root, pool, std::move(stop));
+        return {std::move(checked.pieces), {}, now.size(), piece_count,
+                checked.cancelled};
+    }
+
+    // Every piece with a byte in a changed file.
+    auto result = resume_result{saved->pieces};
+    auto recheck = torrent::bitfield{piece_count};
+    for (std::size_t file = 0; file < now.size(); file++) {
+        if (now[file] == saved->files[file]) {
+            continue;
+        }
+        result.changed_files++;
+        const auto size = layout->file_size(file);
+        if (size == 0) {
+            continue;
+        }
+        const auto offset = layout->file_offset(file);
+        const auto last = (offset + size - 1) / layout->piece_length();
+        for (auto piece = offset / layout->piece_length(); piece <= last;
+             piece++) {
+            if (!recheck.test(piece)) {
+                recheck.set(piece);
+                result.rechecked_pieces++;
+            }
+        }
+    }
+
+    // Blocks saved for another block count say nothing about this layout.
+    for (const auto& p : saved->partial) {
+        if (p.piece < piece_count && !recheck.test(p.piece) &&
+            !saved->pieces.test(p.piece) &&
+            p.blocks.size() ==
+                (layout->piece_size(p.piece) + block_size - 1) / block_size) {
+            result.partial.push_back(p);
+        }
+    }
+    if (result.rechecked_pieces == 0) {
+        return result;
+    }
+
+    stats().rechecked_pieces.add(result.rechecked_pieces);
+    const auto checked = verify(info, root, recheck, pool, std::move(stop));
+    for (std::size_t piece = 0; piece < piece_count; piece++) {
+        if (!recheck.test(piece)) {
+            continue;
+        }
+        if (checked.pieces.test(piece)) {
+            result.pieces.set(piece);
+        } else {
+            result.pieces.reset(piece);
+        }
+    }
+    result.cancelled = checked.cancelled;
+    return result;
+}
+}  // namespace
+
+std::vector<file_state> file_states(
+    const std::vector<std::filesystem::path>& paths) {
+    auto states = std::vector<file_state>(paths.size());
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        struct stat s {};
+        if (::stat(paths[i].c_str(), &s) == 0) {
+            states[i] = {static_cast<std::uint64_t>(s.st_size),
+                         std::int64_t{s.st_mtim.tv_sec} * 1'000'000'000 +
+                             s.st_mtim.tv_nsec};
+        }
+    }
+    return states;
+}
+
+std::optional<resume_data> load_resume(const std::filesystem::path& path,
+                                       const crypto::sha1_digest& info_hash,
+                                       std::size_t piece_count,
+                                       std::size_t file_count) {
+    const auto file = bencode::mapped_file::open(path);
+    if (!file.has_value()) {
+        return {};
+    }
+
+    // The counts are checked before anything is sized by them.
+    auto input = file->bytes();
+    auto h = format::header{};
+    if (!take(input, h) || h.magic != format::magic ||
+        h.version != format::version || h.byte_order != format::byte_order ||
+        h.info_hash != info_hash || h.piece_count != piece_count ||
+        h.file_count != file_count || h.partial_count > piece_count ||
+        format::checksum(h, input) != h.checksum) {
+        return {};
+    }
+
+    auto data = resume_data{info_hash};
+    data.files.resize(file_count);
+    for (auto& state : data.files) {
+        auto record = format::file_record{};
+        if (!take(input, record)) {
+            return {};
+        }
+        state = {record.size, record.mtime};
+    }
+
+    if ((h.flags & format::complete) != 0) {
+        data.pieces = torrent::bitfield{h.piece_count};
+        for (std::size_t piece = 0; piece < h.piece_count; piece++) {
+            data.pieces.set(piece);
+        }
+    } else {
+        auto pieces = take_bits(input, h.piece_count);
+        if (!pieces.has_value()) {
+            return {};
+        }
+        data.pieces = std::move(pieces.value());
+    }
+
+    for (std::uint64_t i = 0; i < h.partial_count; i++) {
+        auto record = format::partial_record{};
+        if (!take(input, record)) {
+            return {};
+        }
+        auto blocks = take_bits(input, record.block_count);
+        if (!blocks.has_value()) {
+            return {};
+        }
+        data.partial.push_back({record.piece, std::move(blocks.value())});
+    }
+    return data;
+}
+
+bool save_resume(const std::filesystem::path& path, const resume_data& data) {
+    const auto complete = data.pieces.all();
+    auto body = std::string{};
+    for (const auto& state : data.files) {
+        put(body, format::file_record{state.size, state.mtime});
+    }
+    if (!complete) {
+        put(body, data.pieces);
+    }
+    for (const auto& p : data.partial) {
+        put(body, format::partial_record{
+                      p.piece, static_cast<std::uint32_t>(p.blocks.size())});
+        put(body, p.blocks);
+    }
+
+    auto h = format::header{};
+    h.magic = format::magic;
+    h.version = format::version;
+    h.byte_order = format::byte_order;
+    h.info_hash = data.info_hash;
+    h.flags = complete ? format::complete : 0;
+    h.piece_count = data.pieces.size();
+    h.file_count = data.files.size();
+    h.partial_count = data.partial.size();
+    h.checksum = format::checksum(h, body);
+    auto bytes = std::string{};
+    bytes.reserve(sizeof(h) + body.size());
+    put(bytes, h);
+    bytes += body;
+
+    auto temporary = path;
+    temporary += ".tmp";
+    const auto fd = ::open(temporary.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const auto written = write_all(fd, bytes) && ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !written) {
+        std::filesystem::remove(temporary);
+        return false;
+    }
+
+    auto ec = std::error_code{};
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        return false;
+    }
+    sync_directory(path.parent_path());
+    return true;
+}
+
+resume_result restore(const torrent::single_file_info& info,
+                      const std::filesystem::path& root,
+                      const std::optional<resume_data>& saved,
+                      concurrency::thread_pool& pool, std::stop_token stop) {
+    return restore_info(info, root, saved, pool, std::move(stop));
+}
+
+resume_result restore(const torrent::multi_file_info& info,
+                      const std::filesystem::path& root,
+                      const std::optional<resume_data>& saved,
+                      concurrency::thread_pool& pool, std::stop_token stop) {
+    return restore_info(info, root, saved, pool, std::move(stop));
+}
+
+resume_file::resume_file(std::filesystem::path path,
+                         std::vector<std::filesystem::path> content,
+                         resume_data data, std::chrono::milliseconds interval)
+    : path_{std::move(path)},
+      content_{std::move(content)},
+      interval_{interval},
+      data_{std::move(data)},
+      // What was restored may differ from what is on disk.
+      dirty_{true} {}
+
+std::vector<partial_piece>::iterator resume_file::find_partial(
+    std::uint32_t piece) {
+    return std::lower_bound(
+        data_.partial.begin(), data_.partial.end(), piece,
+        [](const partial_piece& p, std::uint32_t i) { return p.piece < i; });
+}
+
+void resume_file::blocks_written(std::uint32_t piece,
+                                 const torrent::bitfield& blocks) {
+    const auto lock = std::lock_guard{mutex_};
+    if (piece >= data_.pieces.size() || data_.pieces.test(piece)) {
+        return;
+    }
+    auto it = find_partial(piece);
+    if (it == data_.partial.end() || it->piece != piece ||
+        it->blocks.size() != blocks.size()) {
+        if (it != data_.partial.end() && it->piece == piece) {
+            it = data_.partial.erase(it);
+        }
+        it = data_.partial.insert(
+            it, {piece, torrent::bitfield{blocks.size()}});
+    }
+    for (std::size_t b = 0; b < blocks.size(); b++) {
+        if (blocks.test(b) && !it->blocks.test(b)) {
+            it->blocks.set(b);
+            dirty_ = true;
+        }
+    }
+}
+
+void resume_file::piece_passed(std::uint32_t piece) {
+    const auto lock = std::lock_guard{mutex_};
+    if (piece >= data_.pieces.size()) {
+        return;
+    }
+    if (const auto it = find_partial(piece);
+        it != data_.partial.end() && it->piece == piece) {
+        data_.partial.erase(it);
+    }
+    data_.pieces.set(piece);
+    dirty_ = true;
+}
+
+void resume_file::piece_failed(std::uint32_t piece) {
+    const auto lock = std::lock_guard{mutex_};
+    if (const auto it = find_partial(piece);
+        it != data_.partial.end() && it->piece == piece) {
+        data_.partial.erase(it);
+        dirty_ = true;
+    }
+}
+
+bool resume_file::save_if_due() {
+    {
+        const auto lock = std::lock_guard{mutex_};
+        if (!dirty_ || (saved_.has_value() &&
+                        std::chrono::steady_clock::now() - saved_.value() <
+                            interval_)) {
+            return true;
+        }
+    }
+    return save();
+}
+
+bool resume_file::save() {
+    const auto saving = std::lock_guard{save_mutex_};
+    auto data = resume_data{};
+    {
+        const auto lock = std::lock_guard{mutex_};
+        if (!dirty_) {
+            return true;
+        }
+        data = data_;
+        dirty_ = false;
+        saved_ = std::chrono::steady_clock::now();
+    }
+
+    // Taken after the pieces, so that the writes of every piece saved are
+    // older than the mtimes saved with them.
+    data.files = file_states(content_);
+    if (save_resume(path_, data)) {
+        stats().saves.add();
+        const auto lock = std::lock_guard{mutex_};
+        data_.files = std::move(data.files);
+        return true;
+    }
+    stats().save_failures.add();
+    const auto lock = std::lock_guard{mutex_};
+    dirty_ = true;
+    return false;
+}
+
+resume_data resume_file::data() const {
+    const auto lock = std::lock_guard{mutex_};
+    return data_;
+}
+
+}  // namespace storage
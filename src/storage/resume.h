@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+#include "bitfield.h"
+#include "sha.h"
+#include "thread_pool.h"
+#include "torrent.h"
+
+namespace storage {
+
+// A content file as last seen. A missing file has size 0 and mtime -1.
+struct file_state {
+    std::uint64_t size = 0;
+    // Nanoseconds since the epoch.
+    std::int64_t mtime = -1;
+
+    bool operator==(const file_state&) const = default;
+};
+
+// The blocks of an unfinished piece that are on disk.
+struct partial_piece {
+    std::uint32_t piece = 0;
+    torrent::bitfield blocks;
+
+    bool operator==(const partial_piece&) const = default;
+};
+
+// What was known about a torrent's content when it was saved: the pieces
+// that passed their hash, the files they were in and the blocks of the
+// pieces still being downloaded.
+struct resume_data {
+    crypto::sha1_digest info_hash{};
+    torrent::bitfield pieces;
+    std::vector<file_state> files;
+    // By piece.
+    std::vector<partial_piece> partial;
+
+    bool operator==(const resume_data&) const = default;
+};
+
+// One stat per path.
+std::vector<file_state> file_states(
+    const std::vector<std::filesystem::path>& paths);
+
+// Reads the resume file at path, or nothing if it is missing, torn, of
+// another version, for another torrent than info_hash or for a layout
+// other than piece_count pieces in file_count files.
+std::optional<resume_data> load_resume(const std::filesystem::path& path,
+                                       const crypto::sha1_digest& info_hash,
+                                       std::size_t piece_count,
+                                       std::size_t file_count);
+
+// Writes to a temporary file beside path, syncs it and renames it into
+// place, so that a crash at any point leaves either the old file or the new
+// one.
+bool save_resume(const std::filesystem::path& path, const resume_data& data);
+
+struct resume_result {
+    torrent::bitfield pieces;
+    std::vector<partial_piece> partial;
+    // Files whose size or mtime changed since saved, or all of them when
+    // there was nothing to go by.
+    std::size_t changed_files = 0;
+    std::size_t rechecked_pieces = 0;
+    bool cancelled = false;
+};
+
+// The state of info's content under root, taken from saved where it can be
+// trusted. Files with the size and mtime saved keep their pieces and partial
+// pieces; every piece touching another file is hashed again on pool. With
+// nothing saved, or data for a different layout, that is every piece.
+resume_result restore(const torrent::single_file_info& info,
+                      const std::filesystem::path& root,
+                      const std::optional<resume_data>& saved,
+                      concurrency::thread_pool& pool,
+                      std::stop_token stop = {});
+resume_result restore(const torrent::multi_file_info& info,
+                      const std::filesystem::path& root,
+                      const std::optional<resume_data>& saved,
+                      concurrency::thread_pool& pool,
+                      std::stop_token stop = {});
+
+// Keeps a torrent's resume file up to date as blocks are written and pieces
+// pass their hash. Changes are collected in memory and saved together, at
+// most once per interval unless asked for, so a busy torrent costs a small
+// atomic rewrite every few seconds. Report pieces and blocks only once they
+// are written: the file sizes and mtimes are taken as the file is saved,
+// and any write after that marks the file as changed on the next restore.
+// Safe to use from any thread.
+class resume_file {
+   public:
+    resume_file(std::filesystem::path path,
+                std::vector<std::filesystem::path> content, resume_data data,
+                std::chrono::milliseconds interval = std::chrono::seconds{10});
+
+    // Blocks of an unfinished piece, one bit per block, that reached disk.
+    void blocks_written(std::uint32_t piece, const torrent::bitfield& blocks);
+    void piece_passed(std::uint32_t piece);
+    // The piece failed its hash, so none of its blocks count.
+    void piece_failed(std::uint32_t piece);
+
+    // Saves if anything changed and this is the first save or the interval
+    // has passed since the last one. Returns false only if saving failed.
+    bool save_if_due();
+    // Saves now if anything changed.
+    bool save();
+
+    resume_data data() const;
+
+   private:
+    // Expects mutex_ to be held.
+    std::vector<partial_piece>::iterator find_partial(std::uint32_t piece);
+
+    std::filesystem::path path_;
+    std::vector<std::filesystem::path> content_;
+    std::chrono::milliseconds interval_;
+
+    // Held across a save, so that saves land in the order their data was
+    // taken while mutex_ stays free for the writers.
+    std::mutex save_mutex_;
+    mutable std::mutex mutex_;
+    resume_data data_;
+    bool dirty_ = false;
+    std::optional<std::chrono::steady_clock::time_point> saved_;
+};
+
+}  // namespace storage
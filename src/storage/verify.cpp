@@ -0,0 +1,216 @@
+#include "verify.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <latch>
+#include <map>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+#include "bitfield.h"
+#include "disk_io.h"
+#include "layout.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "sha.h"
+#include "thread_pool.h"
+#include "torrent.h"
+
+namespace storage {
+namespace {
+// Roughly how much data one task hashes, enough to keep the pool's overhead
+// out of the profile while still giving every worker something to steal.
+constexpr std::uint64_t bytes_per_task = 4 << 20;
+
+// Hashed in place of padding, which is never on disk.
+constexpr std::size_t zeros_size = 64 << 10;
+constexpr std::array<char, zeros_size> zeros{};
+
+struct content {
+    torrent::file_layout layout;
+    std::vector<std::filesystem::path> paths;
+    std::span<const crypto::sha1_digest> hashes;
+    // Pieces to hash, or null for all of them.
+    const torrent::bitfield* which = nullptr;
+};
+
+// The files one task has mapped. Each task maps only the files its pieces
+// touch, as it reaches them, and lets go of them once past, so that however
+// many files a torrent has, only a few per worker are mapped at a time.
+class task_files {
+   public:
+    explicit task_files(const content& c) : c_{c} {}
+
+    // Unmaps the files before first, which pieces further on do not touch.
+    void advance(std::size_t first) {
+        mapped_.erase(mapped_.begin(), mapped_.lower_bound(first));
+    }
+
+    // Nothing if the file is missing.
+    const std::optional<bencode::mapped_file>& get(std::size_t file) {
+        auto [it, added] = mapped_.try_emplace(file);
+        if (added) {
+            it->second = bencode::mapped_file::open(c_.paths[file]);
+        }
+        return it->second;
+    }
+
+   private:
+    const content& c_;
+    std::map<std::size_t, std::optional<bencode::mapped_file>> mapped_;
+};
+
+// Feeds the bytes of a piece to hasher, walking across file boundaries.
+// Returns false if any of them are missing on disk.
+bool hash_piece(const content& c, std::size_t piece, task_files& files,
+                crypto::sha1_hasher& hasher) {
+    auto first = true;
+    for (const auto slice : c.layout.piece_slices(piece)) {
+        if (first) {
+            files.advance(slice.file);
+            first = false;
+        }
+        if (c.layout.is_padding(slice.file)) {
+            for (auto left = slice.length; left > 0;) {
+                const auto n = std::min<std::uint64_t>(left, zeros_size);
+                hasher.update({zeros.data(), static_cast<std::size_t>(n)});
+                left -= n;
+            }
+            continue;
+        }
+        const auto& file = files.get(slice.file);
+        if (!file.has_value() || file->size() < slice.offset + slice.length) {
+            return false;
+        }
+        hasher.update(file->bytes().substr(slice.offset, slice.length));
+    }
+    return true;
+}
+
+void check_pieces(const content& c, std::size_t first, std::size_t last,
+                  torrent::bitfield& pieces, std::stop_token stop,
+                  verify_progress* progress, std::atomic<bool>& skipped) {
+    thread_local auto hasher = crypto::sha1_hasher{};
+    static auto& latency = metrics::global().histogram("hash.piece_ns");
+    auto files = task_files{c};
+
+    for (auto i = first; i < last; i++) {
+        if (stop.stop_requested()) {
+            skipped.store(true, std::memory_order_relaxed);
+            return;
+        }
+        if (c.which != nullptr && !c.which->test(i)) {
+            continue;
+        }
+
+        {
+            const auto timer = metrics::scoped_timer{latency};
+            const auto readable = hash_piece(c, i, files, hasher);
+            if (hasher.finish() == c.hashes[i] && readable) {
+                pieces.set(i);
+            }
+        }
+
+        if (progress != nullptr) {
+            progress->pieces.fetch_add(1, std::memory_order_relaxed);
+            progress->bytes.fetch_add(c.layout.piece_size(i),
+                                      std::memory_order_relaxed);
+        }
+    }
+}
+
+verify_result verify_content(const content& c, concurrency::thread_pool& pool,
+                             std::stop_token stop,
+                             verify_progress* progress) {
+    const auto piece_count = c.layout.piece_count();
+    auto result = verify_result{torrent::bitfield{piece_count}};
+    if (piece_count == 0) {
+        return result;
+    }
+
+    // Tasks cover whole bytes of the bitfield so that no two of them ever
+    // write the same byte.
+    auto pieces_per_task = std::max<std::uint64_t>(
+        bytes_per_task / c.layout.piece_length(), 1);
+    pieces_per_task = (pieces_per_task + 7) / 8 * 8;
+
+    const auto task_count =
+        (piece_count + pieces_per_task - 1) / pieces_per_task;
+    auto done = std::latch{static_cast<std::ptrdiff_t>(task_count)};
+    auto skipped = std::atomic<bool>{false};
+
+    for (std::size_t task = 0; task < task_count; task++) {
+        const auto first = task * pieces_per_task;
+        const auto last = std::min<std::size_t>(first + pieces_per_task,
+                                                piece_count);
+        pool.submit([&, first, last] {
+            check_pieces(c, first, last, result.pieces, stop, progress,
+                         skipped);
+            done.count_down();
+        });
+    }
+    done.wait();
+
+    result.cancelled = skipped.load();
+    return result;
+}
+
+// A torrent whose piece hashes do not cover its files verifies nothing.
+verify_result invalid_layout(std::span<const crypto::sha1_digest> hashes) {
+    return {torrent::bitfield{hashes.size()}};
+}
+
+template <typename Info>
+verify_result verify_info(const Info& info, const std::filesystem::path& root,
+                          const torrent::bitfield* which,
+                          concurrency::thread_pool& pool, std::stop_token stop,
+                          verify_progress* progress) {
+    auto layout = torrent::file_layout::build(info);
+    if (!layout.has_value()) {
+        return invalid_layout(torrent::piece_hashes(info));
+    }
+
+    const auto c = content{std::move(layout.value()), content_paths(info, root),
+                           torrent::piece_hashes(info), which};
+    return verify_content(c, pool, std::move(stop), progress);
+}
+}  // namespace
+
+verify_result verify(const torrent::single_file_info& info,
+                     const std::filesystem::path& root,
+                     concurrency::thread_pool& pool, std::stop_token stop,
+                     verify_progress* progress) {
+    return verify_info(info, root, nullptr, pool, std::move(stop), progress);
+}
+
+verify_result verify(const torrent::multi_file_info& info,
+                     const std::filesystem::path& root,
+                     concurrency::thread_pool& pool, std::stop_token stop,
+                     verify_progress* progress) {
+    return verify_info(info, root, nullptr, pool, std::move(stop), progress);
+}
+
+verify_result verify(const torrent::single_file_info& info,
+                     const std::filesystem::path& root,
+                     const torrent::bitfield& which,
+                     concurrency::thread_pool& pool, std::stop_token stop,
+                     verify_progress* progress) {
+    return verify_info(info, root, &which, pool, std::move(stop), progress);
+}
+
+verify_result verify(const torrent::multi_file_info& info,
+                     const std::filesystem::path& root,
+                     const torrent::bitfield& which,
+                     concurrency::thread_pool& pool, std::stop_token stop,
+                     verify_progress* progress) {
+    return verify_info(info, root, &which, pool, std::move(stop), progress);
+}
+
+}  // namespace storage
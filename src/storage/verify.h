@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stop_token>
+
+#include "bitfield.h"
+#include "thread_pool.h"
+#include "torrent.h"
+
+namespace storage {
+
+// Updated by the workers as pieces are hashed; safe to poll from any thread.
+struct verify_progress {
+    std::atomic<std::size_t> pieces{0};
+    std::atomic<std::uint64_t> bytes{0};
+};
+
+struct verify_result {
+    torrent::bitfield pieces;
+    bool cancelled = false;
+};
+
+// Hashes the content under root against the torrent's piece hashes on pool
+// and returns the pieces that match. Files are mapped and hashed where they
+// lie, so pieces spanning several files cost nothing extra. Each worker maps
+// only the files of the pieces it is on, so that a torrent of many files
+// stays under the limit on mappings. Padding files are hashed as the zeros
+// they stand for without being looked for. A piece touching a missing or
+// short file fails. Once stop is requested the remaining pieces are skipped and
+// left unset.
+//
+// Blocks until every piece is done, so it must not be called from one of
+// pool's own workers.
+verify_result verify(const torrent::single_file_info& info,
+                     const std::filesystem::path& root,
+                     concurrency::thread_pool& pool, std::stop_token stop = {},
+                     verify_progress* progress = nullptr);
+verify_result verify(const torrent::multi_file_info& info,
+                     const std::filesystem::path& root,
+                     concurrency::thread_pool& pool, std::stop_token stop = {},
+                     verify_progress* progress = nullptr);
+
+// As above, hashing only the pieces set in which, one bit per piece; the
+// others are left unset.
+verify_result verify(const torrent::single_file_info& info,
+                     const std::filesystem::path& root,
+                     const torrent::bitfield& which,
+                     concurrency::thread_pool& pool, std::stop_token stop = {},
+                     verify_progress* progress = nullptr);
+verify_result verify(const torrent::multi_file_info& info,
+                     const std::filesystem::path& root,
+                     const torrent::bitfield& which,
+                     concurrency::thread_pool& pool, std::stop_token stop = {},
+                     verify_progress* progress = nullptr);
+
+}  // namespace storage
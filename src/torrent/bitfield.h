@@ -0,0 +1,60 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace torrent {
+
+// One bit per piece, most significant bit of the first byte first, which is
+// the layout of the peer wire bitfield message. Bits of different bytes may
+// be set concurrently; bits sharing a byte may not.
+class bitfield {
+   public:
+    bitfield() = default;
+    explicit bitfield(std::size_t size) : bytes_((size + 7) / 8), size_{size} {}
+    // Takes the (size + 7) / 8 bytes of another bitfield's bytes(); the
+    // spare bits of the last byte are cleared.
+    bitfield(std::span<const std::uint8_t> bytes, std::size_t size)
+        : bytes_(bytes.begin(), bytes.end()), size_{size} {
+        if (size % 8 != 0) {
+            bytes_.back() &= static_cast<std::uint8_t>(0xff00u >> (size % 8));
+        }
+    }
+
+    std::size_t size() const { return size_; }
+
+    bool test(std::size_t i) const {
+        return (bytes_[i / 8] & mask(i)) != 0;
+    }
+    void set(std::size_t i) { bytes_[i / 8] |= mask(i); }
+    void reset(std::size_t i) {
+        bytes_[i / 8] &= static_cast<std::uint8_t>(~mask(i));
+    }
+
+    std::size_t count() const {
+        std::size_t result = 0;
+        for (const auto byte : bytes_) {
+            result += static_cast<std::size_t>(std::popcount(byte));
+        }
+        return result;
+    }
+    bool all() const { return count() == size_; }
+    bool none() const { return count() == 0; }
+
+    std::span<const std::uint8_t> bytes() const { return bytes_; }
+
+    bool operator==(const bitfield&) const = default;
+
+   private:
+    static std::uint8_t mask(std::size_t i) {
+        return static_cast<std::uint8_t>(0x80u >> (i % 8));
+    }
+
+    std::vector<std::uint8_t> bytes_;
+    std::size_t size_ = 0;
+};
+
+}  // namespace torrent
@@ -0,0 +1,251 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <latch>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "bencode.h"
+#include "sha.h"
+#include "tape.h"
+#include "thread_pool.h"
+
+namespace torrent {
+namespace {
+// Small enough to balance across workers, large enough that scheduling
+// stays cheap next to opening and parsing the files.
+constexpr std::size_t files_per_task = 64;
+// Deeper file trees are refused rather than walked on a worker's stack.
+constexpr std::size_t max_tree_depth = 256;
+
+std::pmr::memory_resource* thread_arena() {
+    thread_local auto arena = std::pmr::unsynchronized_pool_resource{};
+    return &arena;
+}
+
+struct batch {
+    std::vector<catalog_entry> entries;
+    std::vector<catalog_error> errors;
+};
+
+bool is_padding(bencode::dict_ref file) {
+    const auto attr = file.find("attr");
+    return attr.has_value() && attr->is_string() &&
+           attr->as_string().find('p') != std::string_view::npos;
+}
+
+std::optional<std::uint64_t> total_size(bencode::dict_ref info,
+                                        std::size_t& file_count) {
+    if (const auto files = info.find("files");
+        files.has_value() && files->is_list()) {
+        std::uint64_t total = 0;
+        file_count = 0;
+        for (const auto file : files->as_list()) {
+            if (!file.is_dictionary()) {
+                return {};
+            }
+            const auto length = file.as_dict().find("length");
+            if (!length.has_value() || !length->is_integer() ||
+                length->as_integer() < 0) {
+                return {};
+            }
+            if (is_padding(file.as_dict())) {
+                continue;
+            }
+            total += static_cast<std::uint64_t>(length->as_integer());
+            file_count++;
+        }
+        return total;
+    }
+
+    const auto length = info.find("length");
+    if (!length.has_value() || !length->is_integer() ||
+        length->as_integer() < 0) {
+        return {};
+    }
+    file_count = 1;
+    return static_cast<std::uint64_t>(length->as_integer());
+}
+
+struct tree_totals {
+    std::uint64_t size = 0;
+    std::size_t file_count = 0;
+    std::size_t piece_count = 0;
+};
+
+// Adds up a v2 file tree, where directories are dictionaries keyed by name
+// and a file's details sit under the empty key. Every file has pieces of
+// its own.
+bool add_file_tree(bencode::dict_ref directory, std::uint64_t piece_length,
+                   std::size_t depth, tree_totals& out) {
+    if (depth > max_tree_depth) {
+        return false;
+    }
+    for (const auto [name, node] : directory) {
+        if (!node.is_dictionary()) {
+            return false;
+        }
+        if (!name.empty()) {
+            if (!add_file_tree(node.as_dict(), piece_length, depth + 1,
+                               out)) {
+                return false;
+            }
+            continue;
+        }
+
+        const auto length = node.as_dict().find("length");
+        if (!length.has_value() || !length->is_integer() ||
+            length->as_integer() < 0) {
+            return false;
+        }
+        const auto bytes = static_cast<std::uint64_t>(length->as_integer());
+        out.size += bytes;
+        out.file_count++;
+        out.piece_count += (bytes + piece_length - 1) / piece_length;
+    }
+    return true;
+}
+
+void catalog_batch(std::span<const std::filesystem::path> paths,
+                   batch& out) {
+    auto error = catalog_error{};
+    for (const auto& path : paths) {
+        auto entry = catalog_file(path, error);
+        if (entry.has_value()) {
+            out.entries.push_back(std::move(entry.value()));
+        } else {
+            out.errors.push_back(std::move(error));
+        }
+    }
+}
+}  // namespace
+
+std::optional<catalog_entry> catalog_file(const std::filesystem::path& path,
+                                          catalog_error& error) {
+    const auto fail = [&](std::size_t offset, std::string_view message) {
+        error = catalog_error{path, offset, std::string{message}};
+        return std::nullopt;
+    };
+
+    auto parse_failure = bencode::parse_error{};
+    const auto tape = bencode::load_tape(path, &parse_failure, thread_arena());
+    if (!tape.has_value()) {
+        return fail(parse_failure.offset, parse_failure.message);
+    }
+    if (!tape->root().is_dictionary()) {
+        return fail(0, "not a dictionary");
+    }
+
+    const auto info = tape->root().as_dict().find("info");
+    if (!info.has_value() || !info->is_dictionary()) {
+        return fail(0, "missing info dictionary");
+    }
+
+    const auto fields = info->as_dict();
+    const auto name = fields.find("name");
+    const auto pieces = fields.find("pieces");
+    const auto version = fields.find("meta version");
+    const auto v2 = version.has_value() && version->is_integer() &&
+                    version->as_integer() == 2;
+    if (!name.has_value() || !name->is_string() ||
+        (!pieces.has_value() && !v2) ||
+        (pieces.has_value() &&
+         (!pieces->is_string() ||
+          pieces->as_string().size() % sizeof(crypto::sha1_digest) != 0))) {
+        return fail(0, "invalid info dictionary");
+    }
+
+    auto entry = catalog_entry{};
+    entry.path = path;
+    entry.name = std::string{name->as_string()};
+    entry.info_hash = crypto::sha1(info->raw());
+    entry.has_v1 = pieces.has_value();
+    if (v2) {
+        entry.info_hash_v2 = crypto::sha256(info->raw());
+    }
+
+    if (entry.has_v1) {
+        const auto size = total_size(fields, entry.file_count);
+        if (!size.has_value()) {
+            return fail(0, "invalid file lengths");
+        }
+        entry.total_size = size.value();
+        entry.piece_count =
+            pieces->as_string().size() / sizeof(crypto::sha1_digest);
+        return entry;
+    }
+
+    const auto piece_length = fields.find("piece length");
+    const auto tree = fields.find("file tree");
+    if (!piece_length.has_value() || !piece_length->is_integer() ||
+        piece_length->as_integer() <= 0 || !tree.has_value() ||
+        !tree->is_dictionary()) {
+        return fail(0, "invalid info dictionary");
+    }
+    auto totals = tree_totals{};
+    if (!add_file_tree(tree->as_dict(),
+                       static_cast<std::uint64_t>(piece_length->as_integer()),
+                       0, totals)) {
+        return fail(0, "invalid file lengths");
+    }
+    entry.total_size = totals.size;
+    entry.piece_count = totals.piece_count;
+    entry.file_count = totals.file_count;
+    return entry;
+}
+
+catalog scan(const std::filesystem::path& directory,
+             concurrency::thread_pool& pool) {
+    auto result = catalog{};
+    auto paths = std::vector<std::filesystem::path>{};
+
+    auto ec = std::error_code{};
+    auto it = std::filesystem::recursive_directory_iterator{
+        directory, std::filesystem::directory_options::skip_permission_denied,
+        ec};
+    for (; !ec && it != std::filesystem::recursive_directory_iterator{};
+         it.increment(ec)) {
+        if (it->path().extension() == ".torrent" && it->is_regular_file(ec)) {
+            paths.push_back(it->path());
+        }
+    }
+    if (ec) {
+        result.errors.push_back({directory, 0, ec.message()});
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    auto batches = std::vector<batch>((paths.size() + files_per_task - 1) /
+                                      files_per_task);
+    auto done = std::latch{static_cast<std::ptrdiff_t>(batches.size())};
+    for (std::size_t i = 0; i < batches.size(); i++) {
+        const auto first = i * files_per_task;
+        const auto count = std::min(files_per_task, paths.size() - first);
+        pool.submit([&, i, first, count] {
+            catalog_batch(std::span{paths}.subspan(first, count), batches[i]);
+            done.count_down();
+        });
+    }
+    done.wait();
+
+    result.entries.reserve(paths.size());
+    for (auto& b : batches) {
+        std::move(b.entries.begin(), b.entries.end(),
+                  std::back_inserter(result.entries));
+        std::move(b.errors.begin(), b.errors.end(),
+                  std::back_inserter(result.errors));
+    }
+    return result;
+}
+
+}  // namespace torrent
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "sha.h"
+#include "thread_pool.h"
+
+namespace torrent {
+
+struct catalog_entry {
+    std::filesystem::path path;
+    std::string name;
+    crypto::sha1_digest info_hash;
+    // Set for v2-only and hybrid torrents, those of meta version 2.
+    std::optional<crypto::sha256_digest> info_hash_v2;
+    // Whether there are v1 piece hashes; hybrid torrents have both.
+    bool has_v1;
+    // Padding files are left out of the size and the file count.
+    std::uint64_t total_size;
+    // The v1 pieces, or for a v2-only torrent those of every file.
+    std::size_t piece_count;
+    std::size_t file_count;
+};
+
+// Why a file could not be catalogued. offset is the byte position of a
+// bencode error, and zero for anything else.
+struct catalog_error {
+    std::filesystem::path path;
+    std::size_t offset;
+    std::string message;
+};
+
+struct catalog {
+    std::vector<catalog_entry> entries;
+    std::vector<catalog_error> errors;
+};
+
+// Reads the summary of a single torrent straight from its tape, without
+// decoding the metainfo into a torrent struct.
+std::optional<catalog_entry> catalog_file(const std::filesystem::path& path,
+                                          catalog_error& error);
+
+// Walks directory for .torrent files and catalogues them on pool, each
+// worker reusing its own arena for the parsed tapes. Nothing is printed:
+// failures are collected in errors. Entries come out in path order. Must not
+// be called from one of pool's workers.
+catalog scan(const std::filesystem::path& directory,
+             concurrency::thread_pool& pool);
+
+}  // namespace torrent
@@ -0,0 +1,113 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sha.h"
+#include "torrent.h"
+
+namespace torrent {
+namespace {
+std::span<const crypto::sha1_digest> view_hashes(std::string_view pieces) {
+    return {reinterpret_cast<const crypto::sha1_digest*>(pieces.data()),
+            pieces.size() / sizeof(crypto::sha1_digest)};
+}
+}  // namespace
+
+file_layout::file_layout(std::vector<std::uint64_t> offsets,
+                         std::vector<bool> padding,
+                         std::uint64_t piece_length, std::size_t piece_count)
+    : offsets_{std::move(offsets)},
+      padding_{std::move(padding)},
+      piece_length_{piece_length},
+      piece_count_{piece_count} {}
+
+std::optional<file_layout> file_layout::build(
+    std::vector<std::uint64_t> offsets, std::vector<bool> padding,
+    bencode::integer piece_length, std::size_t piece_count) {
+    if (piece_length <= 0) {
+        return {};
+    }
+
+    const auto length = static_cast<std::uint64_t>(piece_length);
+    const auto total = offsets.back();
+    if ((total + length - 1) / length != piece_count) {
+        return {};
+    }
+    return file_layout{std::move(offsets), std::move(padding), length,
+                       piece_count};
+}
+
+std::optional<file_layout> file_layout::build(const single_file_info& info) {
+    if (info.length < 0 || info.pieces.size() % sizeof(crypto::sha1_digest)) {
+        return {};
+    }
+    return build({0, static_cast<std::uint64_t>(info.length)}, {},
+                 info.piece_length, piece_hashes(info).size());
+}
+
+std::optional<file_layout> file_layout::build(const multi_file_info& info) {
+    if (info.pieces.size() % sizeof(crypto::sha1_digest)) {
+        return {};
+    }
+
+    auto offsets = std::vector<std::uint64_t>{};
+    offsets.reserve(info.files.size() + 1);
+    offsets.push_back(0);
+    auto padding = std::vector<bool>{};
+    for (const auto& file : info.files) {
+        if (file.length < 0) {
+            return {};
+        }
+        offsets.push_back(offsets.back() +
+                          static_cast<std::uint64_t>(file.length));
+        if (file.is_padding()) {
+            padding.resize(info.files.size());
+            padding[offsets.size() - 2] = true;
+        }
+    }
+    return build(std::move(offsets), std::move(padding), info.piece_length,
+                 piece_hashes(info).size());
+}
+
+std::uint64_t file_layout::piece_size(std::size_t piece) const {
+    const auto begin = piece_offset(piece);
+    return std::min(piece_length_, total_size() - begin);
+}
+
+std::size_t file_layout::file_at(std::uint64_t offset) const {
+    // The first file ending after offset; empty files end where they start
+    // and are skipped.
+    const auto end = std::upper_bound(offsets_.begin() + 1, offsets_.end(),
+                                      offset);
+    return static_cast<std::size_t>(end - offsets_.begin()) - 1;
+}
+
+slice_range file_layout::slices(std::uint64_t offset,
+                                std::uint64_t length) const {
+    const auto total = total_size();
+    const auto begin = std::min(offset, total);
+    const auto end = begin + std::min(length, total - begin);
+    if (begin == end) {
+        return {offsets_.data(), 0, 0, 0};
+    }
+    return {offsets_.data(), file_at(begin), begin, end};
+}
+
+std::span<const crypto::sha1_digest> piece_hashes(
+    const single_file_info& info) {
+    return view_hashes(info.pieces);
+}
+
+std::span<const crypto::sha1_digest> piece_hashes(
+    const multi_file_info& info) {
+    return view_hashes(info.pieces);
+}
+
+}  // namespace torrent
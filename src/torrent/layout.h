@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "sha.h"
+#include "torrent.h"
+
+namespace torrent {
+
+// A run of bytes inside one file.
+struct file_slice {
+    std::size_t file;
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// The file slices covering a byte range of the torrent, computed lazily and
+// in order. Empty files never appear.
+class slice_range {
+   public:
+    class iterator {
+       public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = file_slice;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = file_slice;
+
+        iterator() = default;
+        iterator(const std::uint64_t* offsets, std::size_t file,
+                 std::uint64_t position, std::uint64_t end)
+            : offsets_{offsets}, file_{file}, position_{position}, end_{end} {
+            skip_empty();
+        }
+
+        file_slice operator*() const {
+            const auto file_end = offsets_[file_ + 1];
+            return {file_, position_ - offsets_[file_],
+                    (end_ < file_end ? end_ : file_end) - position_};
+        }
+        iterator& operator++() {
+            position_ = offsets_[++file_];
+            skip_empty();
+            return *this;
+        }
+        iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const iterator& other) const {
+            const bool done = position_ >= end_;
+            const bool other_done = other.position_ >= other.end_;
+            if (done || other_done) {
+                return done == other_done;
+            }
+            return position_ == other.position_;
+        }
+
+       private:
+        void skip_empty() {
+            while (position_ < end_ && offsets_[file_ + 1] == position_) {
+                ++file_;
+            }
+        }
+
+        const std::uint64_t* offsets_ = nullptr;
+        std::size_t file_ = 0;
+        std::uint64_t position_ = 0;
+        std::uint64_t end_ = 0;
+    };
+
+    slice_range(const std::uint64_t* offsets, std::size_t file,
+                std::uint64_t begin, std::uint64_t end)
+        : begin_{offsets, file, begin, end} {}
+
+    iterator begin() const { return begin_; }
+    iterator end() const { return {}; }
+
+   private:
+    iterator begin_;
+};
+
+// Maps pieces and byte ranges of a torrent onto its files. Built once per
+// torrent: file start offsets are kept as a single prefix-sum array, so
+// finding the file under any offset is a binary search and no per-file
+// objects are allocated.
+class file_layout {
+   public:
+    static std::optional<file_layout> build(const single_file_info& info);
+    static std::optional<file_layout> build(const multi_file_info& info);
+
+    std::size_t file_count() const { return offsets_.size() - 1; }
+    std::uint64_t file_offset(std::size_t file) const {
+        return offsets_[file];
+    }
+    std::uint64_t file_size(std::size_t file) const {
+        return offsets_[file + 1] - offsets_[file];
+    }
+    std::uint64_t total_size() const { return offsets_.back(); }
+    // BEP 47 padding: zeros that are hashed with the pieces but never
+    // stored, so the file is not read or created.
+    bool is_padding(std::size_t file) const {
+        return !padding_.empty() && padding_[file];
+    }
+
+    std::size_t piece_count() const { return piece_count_; }
+    std::uint64_t piece_length() const { return piece_length_; }
+    std::uint64_t piece_size(std::size_t piece) const;
+    std::uint64_t piece_offset(std::size_t piece) const {
+        return piece * piece_length_;
+    }
+
+    // Index of the file holding the byte at offset; empty files are never
+    // returned. offset must be less than total_size().
+    std::size_t file_at(std::uint64_t offset) const;
+
+    // Slices for length bytes starting at offset, clamped to the content.
+    slice_range slices(std::uint64_t offset, std::uint64_t length) const;
+    slice_range piece_slices(std::size_t piece) const {
+        return slices(piece_offset(piece), piece_size(piece));
+    }
+    slice_range block_slices(std::size_t piece, std::uint64_t begin,
+                             std::uint64_t length) const {
+        return slices(piece_offset(piece) + begin, length);
+    }
+
+   private:
+    file_layout(std::vector<std::uint64_t> offsets,
+                std::vector<bool> padding, std::uint64_t piece_length,
+                std::size_t piece_count);
+    static std::optional<file_layout> build(std::vector<std::uint64_t> offsets,
+                                            std::vector<bool> padding,
+                                            bencode::integer piece_length,
+                                            std::size_t piece_count);
+
+    std::vector<std::uint64_t> offsets_;
+    // One per file, or empty when there is none.
+    std::vector<bool> padding_;
+    std::uint64_t piece_length_;
+    std::size_t piece_count_;
+};
+
+// The SHA-1 of every piece, viewed in place inside the info's pieces string.
+std::span<const crypto::sha1_digest> piece_hashes(const single_file_info& info);
+std::span<const crypto::sha1_digest> piece_hashes(const multi_file_info& info);
+
+}  // namespace torrent
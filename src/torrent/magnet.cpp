@@ -0,0 +1,163 @@
+#include "magnet.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sha.h"
+
+namespace torrent {
+namespace {
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool from_hex(std::string_view text, std::span<std::byte> out) {
+    if (text.size() != 2 * out.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < out.size(); i++) {
+        const auto high = hex_value(text[2 * i]);
+        const auto low = hex_value(text[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = static_cast<std::byte>(high << 4 | low);
+    }
+    return true;
+}
+
+// RFC 4648 base32, which older clients use for btih: 32 characters for
+// 20 bytes, with no padding.
+bool from_base32(std::string_view text, std::span<std::byte> out) {
+    if (text.size() * 5 != out.size() * 8) {
+        return false;
+    }
+    std::uint32_t bits = 0;
+    int count = 0;
+    std::size_t n = 0;
+    for (const auto c : text) {
+        int value = -1;
+        if (c >= 'A' && c <= 'Z') {
+            value = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            value = c - 'a';
+        } else if (c >= '2' && c <= '7') {
+            value = c - '2' + 26;
+        }
+        if (value < 0) {
+            return false;
+        }
+        bits = bits << 5 | static_cast<std::uint32_t>(value);
+        count += 5;
+        if (count >= 8) {
+            count -= 8;
+            out[n++] = static_cast<std::byte>(bits >> count);
+        }
+    }
+    return true;
+}
+
+std::optional<std::string> percent_decode(std::string_view text) {
+    auto out = std::string{};
+    out.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '+') {
+            out += ' ';
+        } else if (text[i] != '%') {
+            out += text[i];
+        } else {
+            if (i + 2 >= text.size()) {
+                return {};
+            }
+            const auto high = hex_value(text[i + 1]);
+            const auto low = hex_value(text[i + 2]);
+            if (high < 0 || low < 0) {
+                return {};
+            }
+            out += static_cast<char>(high << 4 | low);
+            i += 2;
+        }
+    }
+    return out;
+}
+
+// Multihash prefix of a SHA-256 digest: function 0x12, length 0x20.
+constexpr std::string_view sha256_multihash = "1220";
+}  // namespace
+
+std::optional<magnet> parse_magnet(std::string_view uri) {
+    constexpr std::string_view scheme = "magnet:?";
+    if (!uri.starts_with(scheme)) {
+        return {};
+    }
+    uri.remove_prefix(scheme.size());
+
+    auto result = magnet{};
+    bool have_v1 = false;
+    while (!uri.empty()) {
+        const auto end = uri.find('&');
+        const auto parameter = uri.substr(0, end);
+        uri.remove_prefix(end == std::string_view::npos ? uri.size()
+                                                        : end + 1);
+
+        const auto equals = parameter.find('=');
+        if (equals == std::string_view::npos) {
+            continue;
+        }
+        const auto full_key = parameter.substr(0, equals);
+        // Numbered forms such as tr.1 count the same as tr.
+        const auto key = full_key.substr(0, full_key.find('.'));
+        auto value = percent_decode(parameter.substr(equals + 1));
+        if (!value.has_value()) {
+            return {};
+        }
+
+        if (key == "xt") {
+            const std::string_view topic = value.value();
+            if (topic.starts_with("urn:btih:")) {
+                const auto hash = topic.substr(9);
+                if (!from_hex(hash, result.info_hash) &&
+                    !from_base32(hash, result.info_hash)) {
+                    return {};
+                }
+                have_v1 = true;
+            } else if (topic.starts_with("urn:btmh:")) {
+                const auto hash = topic.substr(9);
+                auto digest = crypto::sha256_digest{};
+                if (!hash.starts_with(sha256_multihash) ||
+                    !from_hex(hash.substr(sha256_multihash.size()), digest)) {
+                    return {};
+                }
+                result.info_hash_v2 = digest;
+            }
+        } else if (key == "dn") {
+            result.name = std::move(value.value());
+        } else if (key == "tr") {
+            result.trackers.push_back(std::move(value.value()));
+        } else if (full_key == "x.pe") {
+            result.peers.push_back(std::move(value.value()));
+        }
+    }
+
+    if (!have_v1) {
+        return {};
+    }
+    return result;
+}
+
+}  // namespace torrent
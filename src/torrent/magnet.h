@@ -0,0 +1,29 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "sha.h"
+
+namespace torrent {
+
+// What a magnet URI says about a torrent: enough to find peers and fetch
+// the info dictionary from them (BEP 9).
+struct magnet {
+    crypto::sha1_digest info_hash;
+    // From a btmh topic, for hybrid torrents.
+    std::optional<crypto::sha256_digest> info_hash_v2;
+    std::string name;
+    std::vector<std::string> trackers;
+    // x.pe peer addresses, as host:port.
+    std::vector<std::string> peers;
+};
+
+// Accepts magnet:? URIs with a btih topic in hex or base32. Values are
+// percent-decoded; unknown parameters are ignored. Magnets with only a v2
+// topic are rejected, since peers are found by the v1 info-hash.
+std::optional<magnet> parse_magnet(std::string_view uri);
+
+}  // namespace torrent
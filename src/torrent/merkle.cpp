@@ -0,0 +1,180 @@
+#include "merkle.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "sha.h"
+#include "torrent.h"
+
+namespace torrent {
+
+crypto::sha256_digest merkle_parent(const crypto::sha256_digest& left,
+                                    const crypto::sha256_digest& right) {
+    auto pair = std::array<std::byte, 2 * sizeof(crypto::sha256_digest)>{};
+    std::memcpy(pair.data(), left.data(), left.size());
+    std::memcpy(pair.data() + left.size(), right.data(), right.size());
+    return crypto::sha256(
+        {reinterpret_cast<const char*>(pair.data()), pair.size()});
+}
+
+crypto::sha256_digest merkle_pad(std::size_t height) {
+    auto pad = crypto::sha256_digest{};
+    for (std::size_t i = 0; i < height; i++) {
+        pad = merkle_parent(pad, pad);
+    }
+    return pad;
+}
+
+crypto::sha256_digest merkle_root(std::span<const crypto::sha256_digest> leaves,
+                                  std::size_t width,
+                                  std::size_t leaf_height) {
+    auto layer = std::vector<crypto::sha256_digest>(leaves.begin(),
+                                                    leaves.end());
+    auto pad = merkle_pad(leaf_height);
+    for (; width > 1; width /= 2) {
+        if (layer.size() % 2 != 0) {
+            layer.push_back(pad);
+        }
+        for (std::size_t i = 0; i < layer.size() / 2; i++) {
+            layer[i] = merkle_parent(layer[2 * i], layer[2 * i + 1]);
+        }
+        layer.resize(layer.size() / 2);
+        pad = merkle_parent(pad, pad);
+    }
+    return layer.empty() ? pad : layer.front();
+}
+
+merkle_verifier::merkle_verifier(
+    std::uint64_t length, std::size_t blocks_per_piece,
+    std::vector<crypto::sha256_digest> piece_hashes)
+    : length_{length},
+      blocks_per_piece_{blocks_per_piece},
+      piece_hashes_{std::move(piece_hashes)} {}
+
+std::optional<merkle_verifier> merkle_verifier::build(
+    const v2::file& file, bencode::integer piece_length,
+    std::string_view piece_layer) {
+    if (!file.pieces_root.has_value() || file.length <= 0 ||
+        piece_length < static_cast<bencode::integer>(merkle_block_size) ||
+        !std::has_single_bit(static_cast<std::uint64_t>(piece_length))) {
+        return {};
+    }
+
+    const auto length = static_cast<std::uint64_t>(file.length);
+    const auto piece = static_cast<std::uint64_t>(piece_length);
+    const auto blocks_per_piece =
+        static_cast<std::size_t>(piece / merkle_block_size);
+    const auto pieces = static_cast<std::size_t>((length + piece - 1) / piece);
+    if (pieces == 1) {
+        return merkle_verifier{length, blocks_per_piece,
+                               {file.pieces_root.value()}};
+    }
+
+    if (piece_layer.size() != pieces * sizeof(crypto::sha256_digest)) {
+        return {};
+    }
+    auto hashes = std::vector<crypto::sha256_digest>(pieces);
+    std::memcpy(hashes.data(), piece_layer.data(), piece_layer.size());
+    const auto piece_height =
+        static_cast<std::size_t>(std::countr_zero(blocks_per_piece));
+    const auto root = merkle_root(hashes, std::bit_ceil(pieces), piece_height);
+    if (root != file.pieces_root.value()) {
+        return {};
+    }
+    return merkle_verifier{length, blocks_per_piece, std::move(hashes)};
+}
+
+std::size_t merkle_verifier::piece_blocks(std::size_t piece) const {
+    const auto piece_length =
+        std::uint64_t{blocks_per_piece_} * merkle_block_size;
+    const auto left = length_ - piece * piece_length;
+    return static_cast<std::size_t>(
+        std::min<std::uint64_t>(blocks_per_piece_,
+                                (left + merkle_block_size - 1) /
+                                    merkle_block_size));
+}
+
+std::size_t merkle_verifier::width(std::size_t piece) const {
+    return piece_count() == 1 ? std::bit_ceil(piece_blocks(piece))
+                              : blocks_per_piece_;
+}
+
+merkle_verifier::piece_state& merkle_verifier::state(std::size_t piece) {
+    const auto [it, inserted] = pieces_.try_emplace(piece);
+    if (inserted) {
+        it->second.leaves.resize(piece_blocks(piece));
+        it->second.have.resize(piece_blocks(piece));
+    }
+    return it->second;
+}
+
+bool merkle_verifier::set_block_hashes(
+    std::size_t piece, std::span<const crypto::sha256_digest> hashes) {
+    if (piece >= piece_count() || hashes.size() != piece_blocks(piece) ||
+        merkle_root(hashes, width(piece)) != piece_hashes_[piece]) {
+        return false;
+    }
+
+    auto& s = state(piece);
+    if (s.leaves_known) {
+        return true;
+    }
+    // Blocks that came in before the hashes are held to them now.
+    for (std::size_t i = 0; i < hashes.size(); i++) {
+        if (s.have[i] && s.leaves[i] != hashes[i]) {
+            s.have[i] = false;
+            s.count--;
+        }
+    }
+    s.leaves.assign(hashes.begin(), hashes.end());
+    s.leaves_known = true;
+    return true;
+}
+
+merkle_verifier::verdict merkle_verifier::add_block(std::size_t piece,
+                                                    std::size_t block,
+                                                    std::string_view data) {
+    if (piece >= piece_count() || block >= piece_blocks(piece)) {
+        return verdict::block_failed;
+    }
+    const auto offset =
+        (std::uint64_t{piece} * blocks_per_piece_ + block) * merkle_block_size;
+    if (data.size() !=
+        std::min<std::uint64_t>(merkle_block_size, length_ - offset)) {
+        return verdict::block_failed;
+    }
+
+    auto& s = state(piece);
+    const auto hash = crypto::sha256(data);
+    if (s.leaves_known) {
+        if (hash != s.leaves[block]) {
+            return verdict::block_failed;
+        }
+    } else {
+        s.leaves[block] = hash;
+    }
+    if (!s.have[block]) {
+        s.have[block] = true;
+        s.count++;
+    }
+    if (s.count < s.leaves.size()) {
+        return verdict::incomplete;
+    }
+
+    const bool matches =
+        s.leaves_known ||
+        merkle_root(s.leaves, width(piece)) == piece_hashes_[piece];
+    pieces_.erase(piece);
+    return matches ? verdict::passed : verdict::piece_failed;
+}
+
+}  // namespace torrent
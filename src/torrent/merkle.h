@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "sha.h"
+#include "torrent.h"
+
+namespace torrent {
+
+// BEP 52 hashes every file in blocks of this size; the tree's leaves are
+// the SHA-256 of each block, the last one possibly short.
+constexpr std::size_t merkle_block_size = 16384;
+
+crypto::sha256_digest merkle_parent(const crypto::sha256_digest& left,
+                                    const crypto::sha256_digest& right);
+
+// Root of a subtree of the given height past the end of a file, where every
+// leaf is all zeros.
+crypto::sha256_digest merkle_pad(std::size_t height);
+
+// Root over leaves that are themselves roots of subtrees of leaf_height,
+// with width slots in all. width is a power of two no smaller than the
+// number of leaves; the slots past them hold padding.
+crypto::sha256_digest merkle_root(std::span<const crypto::sha256_digest> leaves,
+                                  std::size_t width,
+                                  std::size_t leaf_height = 0);
+
+// Checks the blocks of one v2 file against its Merkle tree as they come in.
+// Each piece is known by its piece layer hash, or by the pieces root for a
+// file of one piece. Once a peer has sent a piece's block hashes and they
+// hash up to it, every block is checked on arrival, so a corrupt block costs
+// only itself; otherwise the piece is checked when its last block arrives.
+// Not thread-safe.
+class merkle_verifier {
+   public:
+    enum class verdict {
+        // Accepted so far; the piece still misses blocks.
+        incomplete,
+        // The piece is complete and matches.
+        passed,
+        // The block does not match its hash and must be fetched again. The
+        // other blocks of the piece are kept.
+        block_failed,
+        // The piece is complete and does not match; all of it must be
+        // fetched again.
+        piece_failed,
+    };
+
+    // piece_layer is the file's entry in the torrent's piece layers, empty
+    // for files of one piece. Fails for an empty file, or a layer of the
+    // wrong size or one that does not hash up to the pieces root.
+    static std::optional<merkle_verifier> build(const v2::file& file,
+                                                bencode::integer piece_length,
+                                                std::string_view piece_layer);
+
+    std::size_t piece_count() const { return piece_hashes_.size(); }
+    std::size_t piece_blocks(std::size_t piece) const;
+
+    // Block hashes of piece, as a peer sends them in reply to a hash
+    // request. They are kept if they hash up to the piece's hash.
+    bool set_block_hashes(std::size_t piece,
+                          std::span<const crypto::sha256_digest> hashes);
+
+    verdict add_block(std::size_t piece, std::size_t block,
+                      std::string_view data);
+
+   private:
+    struct piece_state {
+        std::vector<crypto::sha256_digest> leaves;
+        std::vector<bool> have;
+        std::size_t count = 0;
+        bool leaves_known = false;
+    };
+
+    merkle_verifier(std::uint64_t length, std::size_t blocks_per_piece,
+                    std::vector<crypto::sha256_digest> piece_hashes);
+
+    piece_state& state(std::size_t piece);
+    // Slots in the subtree of piece: a whole piece, except for a file of
+    // one piece, whose tree is only as wide as it needs to be.
+    std::size_t width(std::size_t piece) const;
+
+    std::uint64_t length_;
+    std::size_t blocks_per_piece_;
+    std::vector<crypto::sha256_digest> piece_hashes_;
+    // Only the pieces in flight, or with block hashes received.
+    std::unordered_map<std::size_t, piece_state> pieces_;
+};
+
+}  // namespace torrent
@@ -1,94 +1,377 @@
 #include "torrent.h"
 
+#include <fmt/base.h>
+
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
-#include <ios>
+#include <functional>
+#include <map>
 #include <optional>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "bencode.h"
+#include "decoder.h"
+#include "mapped_file.h"
+#include "sha.h"
 
 namespace torrent {
-std::optional<std::variant<single_file_info, multi_file_info>> process_info(
-    const bencode::dictionary& info) {
-    return {};
+namespace {
+// Names end up as directory entries under the download directory, so
+// anything that could step outside of it is rejected.
+bool is_valid_component(std::string_view name) {
+    return !name.empty() && name != "." && name != ".." &&
+           name.find_first_of(std::string_view{"/\\\0", 3}) ==
+               std::string_view::npos;
 }
 
-std::optional<torrent> torrent_from_dictionary(
-    const bencode::dictionary& contents) {
-    torrent new_torrent{};
-    if (contents.contains("info")) {
-        const auto element = contents.find("info");
-        if (std::holds_alternative<bencode::dictionary>(element->second)) {
-            const auto info =
-                process_info(std::get<bencode::dictionary>(element->second));
-            if (info.has_value()) {
-                new_torrent.info = info.value();
-            }
-        }
+bool decode_name(bencode::decoder& d, bencode::string& out) {
+    const char* const start = d.position();
+    auto name = std::string_view{};
+    if (!d.read(name)) {
+        return false;
     }
+    if (!is_valid_component(name)) {
+        return d.fail_at(start, "invalid name");
+    }
+    out.assign(name);
+    return true;
+}
 
-    if (contents.contains("announce")) {
-        const auto element = contents.find("announce");
-        if (std::holds_alternative<bencode::string>(element->second)) {
-            new_torrent.announce = std::get<bencode::string>(element->second);
+// Path components are joined with '/', in a buffer kept across calls so
+// that each path is allocated once, at its final size.
+bool decode_path(bencode::decoder& d, bencode::string& result) {
+    thread_local auto out = bencode::string{};
+    const char* const start = d.position();
+    out.clear();
+    const auto ok = d.read_list([&](bencode::decoder& element) {
+        const char* const at = element.position();
+        auto name = std::string_view{};
+        if (!element.read(name)) {
+            return false;
         }
+        if (!is_valid_component(name)) {
+            return element.fail_at(at, "invalid path component");
+        }
+        if (!out.empty()) {
+            out += '/';
+        }
+        out += name;
+        return true;
+    });
+    if (ok && out.empty()) {
+        return d.fail_at(start, "empty path");
     }
+    result.assign(out);
+    return ok;
+}
 
-    if (contents.contains("announce-list")) {
-        const auto element = contents.find("announce-list");
-        if (std::holds_alternative<bencode::list>(element->second)) {
-            new_torrent.announce_list =
-                std::get<bencode::list>(element->second);
-        }
+bool decode_digest(bencode::decoder& d,
+                   std::optional<crypto::sha256_digest>& out) {
+    const char* const start = d.position();
+    auto bytes = std::string_view{};
+    if (!d.read(bytes)) {
+        return false;
+    }
+    if (bytes.size() != sizeof(crypto::sha256_digest)) {
+        return d.fail_at(start, "expected a SHA-256 hash");
+    }
+    out.emplace();
+    std::memcpy(out->data(), bytes.data(), bytes.size());
+    return true;
+}
+
+bool decode_file_tree(bencode::decoder& d,
+                      std::optional<std::vector<v2::file>>& out);
+bool decode_piece_layers(
+    bencode::decoder& d,
+    std::map<crypto::sha256_digest, bencode::string>& out);
+
+// Everything an info dictionary may hold. Whether it describes one file or
+// many only shows once every key is in, so the keys the two share go to
+// single and are moved over for multi-file torrents.
+struct info_fields {
+    single_file_info single;
+    std::optional<bencode::integer> length;
+    std::optional<bencode::string> pieces;
+    std::optional<std::vector<multifile::file>> files;
+    std::optional<bencode::integer> meta_version;
+    std::optional<std::vector<v2::file>> file_tree;
+};
+
+bool decode_info(bencode::decoder& d, torrent& out);
+}  // namespace
+}  // namespace torrent
+
+// Keys in the order canonical bencode sorts them, which is the order they
+// arrive in.
+template <>
+struct bencode::schema<torrent::multifile::file> {
+    using file = torrent::multifile::file;
+    static constexpr auto fields = std::tuple{
+        bencode::field("attr", &file::attr),
+        bencode::required("length", &file::length),
+        bencode::field("md5sum", &file::md5sum),
+        bencode::required("path", &file::path, torrent::decode_path),
+    };
+};
+
+template <>
+struct bencode::schema<torrent::v2::file> {
+    using file = torrent::v2::file;
+    static constexpr auto fields = std::tuple{
+        bencode::required("length", &file::length),
+        bencode::field("pieces root", &file::pieces_root,
+                       torrent::decode_digest),
+    };
+};
+
+template <>
+struct bencode::schema<torrent::info_fields> {
+    using info = torrent::info_fields;
+    static constexpr auto fields = std::tuple{
+        bencode::field("file tree", &info::file_tree,
+                       torrent::decode_file_tree),
+        bencode::field("files", &info::files),
+        bencode::field("length", &info::length),
+        bencode::field("md5sum",
+                       [](info& i) -> auto& { return i.single.md5sum; }),
+        bencode::field("meta version", &info::meta_version),
+        bencode::required(
+            "name", [](info& i) -> auto& { return i.single.name; },
+            torrent::decode_name),
+        bencode::required("piece length", [](info& i) -> auto& {
+            return i.single.piece_length;
+        }),
+        bencode::field("pieces", &info::pieces),
+        bencode::field("private",
+                       [](info& i) -> auto& { return i.single.private_; }),
+    };
+};
+
+template <>
+struct bencode::schema<torrent::torrent> {
+    using metainfo = torrent::torrent;
+    static constexpr auto fields = std::tuple{
+        bencode::field("announce", &metainfo::announce),
+        bencode::field("announce-list", &metainfo::announce_list),
+        bencode::field("comment", &metainfo::comment),
+        bencode::field("created by", &metainfo::created_by),
+        bencode::field("creation date", &metainfo::creation_date),
+        bencode::field("encoding", &metainfo::encoding),
+        bencode::required("info", std::identity{}, torrent::decode_info),
+        bencode::field("piece layers", &metainfo::piece_layers,
+                       torrent::decode_piece_layers),
+    };
+};
+
+namespace torrent {
+namespace {
+bool decode_v2_file(bencode::decoder& d, const bencode::string& path,
+                    std::vector<v2::file>& files) {
+    const char* const start = d.position();
+    auto file = v2::file{};
+    if (!bencode::decode(d, file)) {
+        return false;
+    }
+    if (file.length < 0) {
+        return d.fail_at(start, "negative length");
+    }
+    if (file.length == 0) {
+        file.pieces_root.reset();
+    } else if (!file.pieces_root.has_value()) {
+        return d.fail_at(start, "missing pieces root");
     }
+    file.path = path;
+    files.push_back(std::move(file));
+    return true;
+}
+
+// Directories are dictionaries keyed by name; a file is a dictionary with
+// its details under the empty key, which sorts first.
+bool walk_file_tree(bencode::decoder& d, bencode::string& path,
+                    std::vector<v2::file>& files, bool root) {
+    const char* const start = d.position();
+    auto entries = std::size_t{0};
+    auto is_file = false;
+    const auto ok = d.read_dict([&](bencode::decoder& child,
+                                    std::string_view name) {
+        if (entries++ == 0 && name.empty() && !root) {
+            is_file = true;
+            return decode_v2_file(child, path, files);
+        }
+        if (is_file) {
+            return child.skip();
+        }
+        if (!is_valid_component(name)) {
+            return child.fail_at(name.data(), "invalid path component");
+        }
 
-    if (contents.contains("creation date")) {
-        const auto element = contents.find("creation date");
-        if (std::holds_alternative<bencode::integer>(element->second)) {
-            new_torrent.creation_date =
-                std::get<bencode::integer>(element->second);
+        const auto parent = path.size();
+        if (!path.empty()) {
+            path += '/';
         }
+        path += name;
+        const auto walked = walk_file_tree(child, path, files, false);
+        path.resize(parent);
+        return walked;
+    });
+    if (ok && entries == 0) {
+        return d.fail_at(start, "empty directory");
     }
+    return ok;
+}
 
-    if (contents.contains("comment")) {
-        const auto element = contents.find("comment");
-        if (std::holds_alternative<bencode::string>(element->second)) {
-            new_torrent.comment = std::get<bencode::string>(element->second);
+bool decode_file_tree(bencode::decoder& d,
+                      std::optional<std::vector<v2::file>>& out) {
+    auto path = bencode::string{};
+    return walk_file_tree(d, path, out.emplace(), true);
+}
+
+// Layers that are not a whole number of hashes, or keyed by anything but a
+// pieces root, are left out.
+bool decode_piece_layers(
+    bencode::decoder& d,
+    std::map<crypto::sha256_digest, bencode::string>& out) {
+    return d.read_dict([&](bencode::decoder& member, std::string_view root) {
+        if (root.size() != sizeof(crypto::sha256_digest) ||
+            member.next() != bencode::decoder::kind::string) {
+            return member.skip();
+        }
+        auto layer = std::string_view{};
+        if (!member.read(layer)) {
+            return false;
+        }
+        if (layer.size() % sizeof(crypto::sha256_digest) == 0) {
+            auto key = crypto::sha256_digest{};
+            std::memcpy(key.data(), root.data(), key.size());
+            out.emplace(key, bencode::string{layer});
         }
+        return true;
+    });
+}
+
+// The v1 view of a v2-only torrent: the same files, without piece hashes.
+std::variant<single_file_info, multi_file_info> files_of(
+    const v2_info& v2, single_file_info& fields) {
+    if (v2.files.size() == 1 && v2.files.front().path == fields.name) {
+        fields.length = v2.files.front().length;
+        return std::move(fields);
+    }
+
+    auto result = multi_file_info{};
+    result.piece_length = fields.piece_length;
+    result.private_ = fields.private_;
+    result.name = std::move(fields.name);
+    result.files.reserve(v2.files.size());
+    for (const auto& file : v2.files) {
+        result.files.push_back({file.length, {}, file.path, {}});
+    }
+    return result;
+}
+
+bool decode_info(bencode::decoder& d, torrent& out) {
+    const char* const start = d.position();
+    auto fields = info_fields{};
+    if (!bencode::decode(d, fields)) {
+        return false;
     }
+    const auto raw = std::string_view{start, d.position()};
+    out.info_hash = crypto::sha1(raw);
 
-    if (contents.contains("created by")) {
-        const auto element = contents.find("created by");
-        if (std::holds_alternative<bencode::string>(element->second)) {
-            new_torrent.created_by = std::get<bencode::string>(element->second);
+    if (fields.meta_version == 2) {
+        // A power of two of at least one 16 KiB block, so that every piece
+        // is a whole subtree.
+        const auto length = fields.single.piece_length;
+        if (length < 16384 ||
+            !std::has_single_bit(static_cast<std::uint64_t>(length))) {
+            return d.fail_at(start, "invalid v2 piece length");
+        }
+        if (!fields.file_tree.has_value() || fields.file_tree->empty()) {
+            return d.fail_at(start, "missing file tree");
         }
+        out.info_v2 = v2_info{length, std::move(fields.file_tree.value())};
+        out.info_hash_v2 = crypto::sha256(raw);
     }
 
-    if (contents.contains("encoding")) {
-        const auto element = contents.find("encoding");
-        if (std::holds_alternative<bencode::string>(element->second)) {
-            new_torrent.encoding = std::get<bencode::string>(element->second);
+    if (!fields.pieces.has_value()) {
+        if (!out.info_v2.has_value()) {
+            return d.fail_at(start, "missing pieces");
         }
+        out.info = files_of(out.info_v2.value(), fields.single);
+        return true;
+    }
+
+    if (fields.files.has_value()) {
+        auto result = multi_file_info{};
+        result.piece_length = fields.single.piece_length;
+        result.pieces = std::move(fields.pieces.value());
+        result.private_ = fields.single.private_;
+        result.name = std::move(fields.single.name);
+        result.files = std::move(fields.files.value());
+        out.info = std::move(result);
+        return true;
     }
 
-    return new_torrent;
+    if (!fields.length.has_value()) {
+        return d.fail_at(start, "missing length");
+    }
+    fields.single.pieces = std::move(fields.pieces.value());
+    fields.single.length = fields.length.value();
+    out.info = std::move(fields.single);
+    return true;
 }
+}  // namespace
 
-std::optional<torrent> from_file(const std::filesystem::path& path) {
-    const auto result = bencode::parse(path);
-    if (!result.has_value()) {
+std::optional<torrent> from_bytes(std::string_view contents,
+                                  bencode::parse_error* error) {
+    auto d = bencode::decoder{contents};
+    auto result = torrent{};
+    if (!bencode::decode(d, result)) {
+        d.report(error);
         return {};
     }
+    if (!result.info_v2.has_value()) {
+        result.piece_layers.clear();
+    }
+    return result;
+}
 
-    if (!std::holds_alternative<bencode::dictionary>(result.value())) {
+std::optional<torrent> from_info(std::string_view info,
+                                 bencode::parse_error* error) {
+    auto d = bencode::decoder{info};
+    auto result = torrent{};
+    if (!decode_info(d, result)) {
+        d.report(error);
         return {};
     }
+    if (!d.at_end()) {
+        d.fail("trailing data after info dictionary");
+        d.report(error);
+        return {};
+    }
+    return result;
+}
 
-    return torrent_from_dictionary(
-        std::get<bencode::dictionary>(result.value()));
+std::optional<torrent> from_file(const std::filesystem::path& path,
+                                 bencode::parse_error* error) {
+    const auto file = bencode::mapped_file::open(path);
+    if (!file.has_value()) {
+        if (error != nullptr) {
+            *error = bencode::parse_error{0, "could not open file"};
+        } else {
+            fmt::println(stderr, "Could not open file: {}",
+                         std::filesystem::absolute(path).string());
+        }
+        return {};
+    }
+    return from_bytes(file->bytes(), error);
 }
 }  // namespace torrent
@@ -5,12 +5,14 @@
 #include <fmt/std.h>
 
 #include <filesystem>
+#include <map>
 #include <optional>
-#include <sstream>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 #include "bencode.h"
+#include "sha.h"
 
 namespace torrent {
 
@@ -29,6 +31,13 @@ struct file {
     bencode::integer length;
     bencode::string md5sum;
     bencode::string path;
+    // BEP 47 attributes; "p" marks the padding files hybrid torrents use to
+    // start every file on a piece boundary.
+    bencode::string attr;
+
+    bool is_padding() const {
+        return attr.find('p') != bencode::string::npos;
+    }
 };
 }  // namespace multifile
 
@@ -41,67 +50,110 @@ struct multi_file_info {
     std::vector<multifile::file> files;
 };
 
+// BitTorrent v2 (BEP 52): every file is hashed on its own as a SHA-256
+// Merkle tree over 16 KiB blocks.
+namespace v2 {
+struct file {
+    bencode::integer length;
+    // Root of the file's tree; empty files have none.
+    std::optional<crypto::sha256_digest> pieces_root;
+    bencode::string path;
+};
+}  // namespace v2
+
+struct v2_info {
+    bencode::integer piece_length;
+    // In file tree order, which is sorted by path.
+    std::vector<v2::file> files;
+};
+
 struct torrent {
+    // For a v2-only torrent, the files of the file tree with no v1 piece
+    // hashes.
     std::variant<single_file_info, multi_file_info> info;
+    // Set for v2-only and hybrid torrents.
+    std::optional<v2_info> info_v2;
+    // Outside the info dictionary: the piece hashes of every file larger
+    // than a piece, concatenated and keyed by the file's pieces root.
+    std::map<crypto::sha256_digest, bencode::string> piece_layers;
     bencode::string announce;
     std::optional<bencode::list> announce_list;
     std::optional<bencode::integer> creation_date;
     std::optional<bencode::string> comment;
     std::optional<bencode::string> created_by;
     std::optional<bencode::string> encoding;
+
+    crypto::sha1_digest info_hash;
+    std::optional<crypto::sha256_digest> info_hash_v2;
 };
 
-std::optional<torrent> from_file(const std::filesystem::path& path);
+// Decodes the metainfo in a single pass over its bytes, straight into the
+// structs above. Keys nobody reads are skipped; errors, such as a value of
+// the wrong type or a missing key, are stored in error with the byte offset
+// they were found at when it is given and printed otherwise.
+std::optional<torrent> from_file(const std::filesystem::path& path,
+                                 bencode::parse_error* error = nullptr);
+std::optional<torrent> from_bytes(std::string_view contents,
+                                  bencode::parse_error* error = nullptr);
+// A torrent from a bare info dictionary, as fetched from peers for a magnet
+// link. Only info and the info-hashes are set; the caller checks the
+// info-hash against the one it asked for.
+std::optional<torrent> from_info(std::string_view info,
+                                 bencode::parse_error* error = nullptr);
 }  // namespace torrent
 
 template <>
-struct fmt::formatter<torrent::single_file_info> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        const torrent::single_file_info& t, fmt::format_context& ctx) const {
-        std::string result = fmt::format(
+struct fmt::formatter<torrent::single_file_info> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const torrent::single_file_info& t,
+                                         fmt::format_context& ctx) const {
+        return fmt::format_to(
+            ctx.out(),
             "[piece_length: {}, pieces: {}, private: {}, name: {}, "
             "length: {}, "
             "md5sum: {}]",
             t.piece_length, t.pieces, t.private_, t.name, t.length, t.md5sum);
-
-        return fmt::formatter<std::string>::format(result, ctx);
     }
 };
 
 template <>
-struct fmt::formatter<torrent::multifile::file> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        const torrent::multifile::file& t, fmt::format_context& ctx) const {
-        std::string result = fmt::format("[length: {}, md5sum: {}, path: {}]",
-                                         t.length, t.md5sum, t.path);
+struct fmt::formatter<torrent::multifile::file> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
 
-        return fmt::formatter<std::string>::format(result, ctx);
+    fmt::format_context::iterator format(const torrent::multifile::file& t,
+                                         fmt::format_context& ctx) const {
+        return fmt::format_to(ctx.out(), "[length: {}, md5sum: {}, path: {}]",
+                              t.length, t.md5sum, t.path);
     }
 };
 
 template <>
-struct fmt::formatter<torrent::multi_file_info> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        const torrent::multi_file_info& t, fmt::format_context& ctx) const {
-        std::string result = fmt::format(
+struct fmt::formatter<torrent::multi_file_info> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const torrent::multi_file_info& t,
+                                         fmt::format_context& ctx) const {
+        return fmt::format_to(
+            ctx.out(),
             "[piece_length: {}, pieces: {}, private: {}, name: {}, "
             "files: {}] ",
             t.piece_length, t.pieces, t.private_, t.name, t.files);
-
-        return fmt::formatter<std::string>::format(result, ctx);
     }
 };
 
 template <>
-struct fmt::formatter<torrent::torrent> : fmt::formatter<std::string> {
-    constexpr fmt::format_context::iterator format(
-        torrent::torrent t, fmt::format_context& ctx) const {
-        std::string result = fmt::format(
+struct fmt::formatter<torrent::torrent> {
+    constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+    fmt::format_context::iterator format(const torrent::torrent& t,
+                                         fmt::format_context& ctx) const {
+        return fmt::format_to(
+            ctx.out(),
             "[info: {}, announce: {}, announce_list: {}, creation_date: {}, "
             "comment: {}, "
-            "created_by: {}, encoding: {}]",
+            "created_by: {}, encoding: {}, info_hash: {}]",
             t.info, t.announce, t.announce_list, t.creation_date, t.comment,
-            t.created_by, t.encoding);
-        return fmt::formatter<std::string>::format(result, ctx);
+            t.created_by, t.encoding, crypto::to_hex(t.info_hash));
     }
 };
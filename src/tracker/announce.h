@@ -0,0 +1,54 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "message.h"
+#include "sha.h"
+
+namespace tracker {
+
+// Numbered as in BEP 15; HTTP trackers take the names.
+enum class event : std::uint32_t {
+    none = 0,
+    completed = 1,
+    started = 2,
+    stopped = 3,
+};
+
+struct announce_request {
+    crypto::sha1_digest info_hash{};
+    wire::peer_id peer_id{};
+    std::uint16_t port = 0;
+    std::uint64_t uploaded = 0;
+    std::uint64_t downloaded = 0;
+    std::uint64_t left = 0;
+    tracker::event event = event::none;
+    std::uint32_t numwant = 50;
+    // Lets a tracker recognise this client across address changes.
+    std::uint32_t key = 0;
+};
+
+struct announce_response {
+    std::chrono::seconds interval{};
+    std::uint32_t seeders = 0;
+    std::uint32_t leechers = 0;
+    // Decoding clears this but keeps its capacity, so a response reused
+    // across announces stops allocating once it has seen the largest swarm.
+    std::vector<boost::asio::ip::tcp::endpoint> peers;
+    // Set when the tracker answered with an error of its own.
+    std::string failure;
+};
+
+struct scrape_entry {
+    crypto::sha1_digest info_hash{};
+    std::uint32_t seeders = 0;
+    std::uint32_t completed = 0;
+    std::uint32_t leechers = 0;
+};
+
+}  // namespace tracker
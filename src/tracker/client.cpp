@@ -0,0 +1,104 @@
+#include "client.h"
+
+#include <algorithm>
+#include <random>
+#include <span>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "announce.h"
+#include "bencode.h"
+#include "sha.h"
+#include "torrent.h"
+#include "url.h"
+
+namespace tracker {
+namespace {
+std::vector<std::string> tier_urls(const bencode::value& tier) {
+    auto urls = std::vector<std::string>{};
+    if (const auto* list = std::get_if<bencode::list>(&tier)) {
+        for (const auto& element : *list) {
+            if (const auto* s = std::get_if<bencode::string>(&element);
+                s != nullptr && !s->empty()) {
+                urls.push_back(*s);
+            }
+        }
+    }
+    return urls;
+}
+}  // namespace
+
+tracker_list::tracker_list(std::vector<std::vector<std::string>> tiers)
+    : tiers_{std::move(tiers)} {
+    std::erase_if(tiers_, [](const auto& tier) { return tier.empty(); });
+    auto random = std::minstd_rand{std::random_device{}()};
+    for (auto& tier : tiers_) {
+        std::shuffle(tier.begin(), tier.end(), random);
+    }
+}
+
+tracker_list tracker_list::from(const torrent::torrent& t) {
+    auto tiers = std::vector<std::vector<std::string>>{};
+    if (t.announce_list.has_value()) {
+        for (const auto& tier : t.announce_list.value()) {
+            tiers.push_back(tier_urls(tier));
+        }
+    }
+    auto result = tracker_list{std::move(tiers)};
+    if (result.empty() && !t.announce.empty()) {
+        result.tiers_.push_back({t.announce});
+    }
+    return result;
+}
+
+void tracker_list::promote(std::size_t tier, std::size_t index) {
+    auto& urls = tiers_[tier];
+    std::rotate(urls.begin(), urls.begin() + index, urls.begin() + index + 1);
+}
+
+client::client(boost::asio::any_io_executor executor,
+               const client_options& options)
+    : http_{executor, options.http_timeout}, udp_{executor, options.udp} {}
+
+boost::asio::awaitable<bool> client::announce(const std::string& tracker_url,
+                                              const announce_request& request,
+                                              announce_response& response) {
+    const auto parsed = parse_url(tracker_url);
+    if (!parsed.has_value()) {
+        co_return false;
+    }
+    if (parsed->scheme == "udp") {
+        co_return co_await udp_.announce(*parsed, request, response);
+    }
+    co_return co_await http_.announce(*parsed, request, response);
+}
+
+boost::asio::awaitable<bool> client::announce(tracker_list& trackers,
+                                              const announce_request& request,
+                                              announce_response& response) {
+    for (std::size_t tier = 0; tier < trackers.tiers().size(); tier++) {
+        for (std::size_t i = 0; i < trackers.tiers()[tier].size(); i++) {
+            if (co_await announce(trackers.tiers()[tier][i], request,
+                                  response)) {
+                trackers.promote(tier, i);
+                co_return true;
+            }
+        }
+    }
+    co_return false;
+}
+
+boost::asio::awaitable<bool> client::scrape(
+    const std::string& tracker_url,
+    std::span<const crypto::sha1_digest> info_hashes,
+    std::vector<scrape_entry>& out) {
+    const auto parsed = parse_url(tracker_url);
+    if (!parsed.has_value() || parsed->scheme != "udp") {
+        co_return false;
+    }
+    co_return co_await udp_.scrape(*parsed, info_hashes, out);
+}
+
+}  // namespace tracker
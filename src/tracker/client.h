@@ -0,0 +1,77 @@
+#pragma once
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "announce.h"
+#include "http_tracker.h"
+#include "sha.h"
+#include "torrent.h"
+#include "udp_tracker.h"
+
+namespace tracker {
+
+// The trackers of one torrent in BEP 12 order: tiers are tried first to
+// last, trackers within a tier in a random order, and a tracker that
+// answers moves to the front of its tier.
+class tracker_list {
+   public:
+    tracker_list() = default;
+    explicit tracker_list(std::vector<std::vector<std::string>> tiers);
+
+    // announce-list when present and usable, announce otherwise.
+    static tracker_list from(const torrent::torrent& t);
+
+    const std::vector<std::vector<std::string>>& tiers() const {
+        return tiers_;
+    }
+    bool empty() const { return tiers_.empty(); }
+
+    void promote(std::size_t tier, std::size_t index);
+
+   private:
+    std::vector<std::vector<std::string>> tiers_;
+};
+
+struct client_options {
+    std::chrono::milliseconds http_timeout{15000};
+    udp_options udp;
+};
+
+// Announces and scrapes by URL scheme, sharing the HTTP connection pool
+// and the UDP sockets across every torrent. Use from a single thread.
+class client {
+   public:
+    client(boost::asio::any_io_executor executor,
+           const client_options& options = {});
+
+    boost::asio::awaitable<bool> announce(const std::string& tracker_url,
+                                          const announce_request& request,
+                                          announce_response& response);
+
+    // Fails over through the tiers and promotes the tracker that answered.
+    boost::asio::awaitable<bool> announce(tracker_list& trackers,
+                                          const announce_request& request,
+                                          announce_response& response);
+
+    // UDP trackers only, which scrape many torrents per packet.
+    boost::asio::awaitable<bool> scrape(
+        const std::string& tracker_url,
+        std::span<const crypto::sha1_digest> info_hashes,
+        std::vector<scrape_entry>& out);
+
+    const http_tracker& http() const { return http_; }
+    const udp_tracker& udp() const { return udp_; }
+
+   private:
+    http_tracker http_;
+    udp_tracker udp_;
+};
+
+}  // namespace tracker
@@ -0,0 +1,42 @@
+#include "compact.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace tracker {
+namespace {
+using boost::asio::ip::tcp;
+
+std::uint16_t load16(const unsigned char* p) {
+    return static_cast<std::uint16_t>(p[0] << 8 | p[1]);
+}
+
+template <std::size_t AddressSize, typename Address>
+bool decode(std::string_view bytes, std::vector<tcp::endpoint>& out) {
+    constexpr auto entry = AddressSize + 2;
+    if (bytes.size() % entry != 0) {
+        return false;
+    }
+
+    out.reserve(out.size() + bytes.size() / entry);
+    const auto* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    for (std::size_t i = 0; i < bytes.size(); i += entry) {
+        auto address = typename Address::bytes_type{};
+        std::copy_n(p + i, AddressSize, address.begin());
+        out.emplace_back(Address{address}, load16(p + i + AddressSize));
+    }
+    return true;
+}
+}  // namespace
+
+bool decode_peers(std::string_view bytes, std::vector<tcp::endpoint>& out) {
+    return decode<4, boost::asio::ip::address_v4>(bytes, out);
+}
+
+bool decode_peers6(std::string_view bytes, std::vector<tcp::endpoint>& out) {
+    return decode<16, boost::asio::ip::address_v6>(bytes, out);
+}
+}  // namespace tracker
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <string_view>
+#include <vector>
+
+namespace tracker {
+
+// Appends the peers of a compact peer list (BEP 23): 4 address bytes and a
+// 2-byte port each, in network order. Returns false, appending nothing, if
+// bytes is not a whole number of entries.
+bool decode_peers(std::string_view bytes,
+                  std::vector<boost::asio::ip::tcp::endpoint>& out);
+
+// The IPv6 form from BEP 7, 18 bytes per peer.
+bool decode_peers6(std::string_view bytes,
+                   std::vector<boost::asio::ip::tcp::endpoint>& out);
+
+}  // namespace tracker
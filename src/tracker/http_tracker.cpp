@@ -0,0 +1,271 @@
+#include "http_tracker.h"
+
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/http.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "announce.h"
+#include "bencode.h"
+#include "compact.h"
+#include "tape.h"
+
+namespace tracker {
+namespace {
+namespace http = boost::beast::http;
+using boost::asio::redirect_error;
+using boost::asio::use_awaitable;
+
+// Announce responses are small; anything larger is not a tracker.
+constexpr std::uint64_t max_body = 4 << 20;
+
+void append_escaped(std::string& out, std::string_view bytes) {
+    constexpr std::string_view hex = "0123456789ABCDEF";
+    for (const auto c : bytes) {
+        const auto u = static_cast<unsigned char>(c);
+        if ((u >= 'A' && u <= 'Z') || (u >= 'a' && u <= 'z') ||
+            (u >= '0' && u <= '9') || u == '-' || u == '.' || u == '_' ||
+            u == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[u >> 4];
+            out += hex[u & 0xf];
+        }
+    }
+}
+
+template <typename Bytes>
+std::string_view as_chars(const Bytes& bytes) {
+    return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+void append_parameter(std::string& out, std::string_view name,
+                      std::uint64_t value) {
+    char digits[24];
+    const auto end = std::to_chars(std::begin(digits), std::end(digits), value);
+    out += '&';
+    out += name;
+    out += '=';
+    out.append(digits, end.ptr);
+}
+
+std::string_view event_name(event e) {
+    switch (e) {
+        case event::completed:
+            return "completed";
+        case event::started:
+            return "started";
+        case event::stopped:
+            return "stopped";
+        case event::none:
+            break;
+    }
+    return {};
+}
+
+std::uint32_t to_count(bencode::integer i) {
+    return i < 0 ? 0 : static_cast<std::uint32_t>(i);
+}
+
+// Peers in the original form: a list of dictionaries with "ip" and "port".
+bool decode_peer_list(bencode::list_ref peers, announce_response& out) {
+    for (const auto peer : peers) {
+        if (!peer.is_dictionary()) {
+            return false;
+        }
+        const auto ip = peer.as_dict().find("ip");
+        const auto port = peer.as_dict().find("port");
+        if (!ip.has_value() || !ip->is_string() || !port.has_value() ||
+            !port->is_integer()) {
+            return false;
+        }
+
+        auto ec = boost::system::error_code{};
+        const auto address =
+            boost::asio::ip::make_address(std::string{ip->as_string()}, ec);
+        if (ec || port->as_integer() < 0 || port->as_integer() > 65535) {
+            continue;
+        }
+        out.peers.emplace_back(address,
+                               static_cast<std::uint16_t>(port->as_integer()));
+    }
+    return true;
+}
+}  // namespace
+
+std::string announce_target(std::string_view target,
+                            const announce_request& request) {
+    auto out = std::string{target};
+    out.reserve(out.size() + 256);
+    out += target.find('?') == std::string_view::npos ? '?' : '&';
+    out += "info_hash=";
+    append_escaped(out, as_chars(request.info_hash));
+    out += "&peer_id=";
+    append_escaped(out, as_chars(request.peer_id));
+    append_parameter(out, "port", request.port);
+    append_parameter(out, "uploaded", request.uploaded);
+    append_parameter(out, "downloaded", request.downloaded);
+    append_parameter(out, "left", request.left);
+    append_parameter(out, "compact", 1);
+    append_parameter(out, "numwant", request.numwant);
+    append_parameter(out, "key", request.key);
+    if (const auto name = event_name(request.event); !name.empty()) {
+        out += "&event=";
+        out += name;
+    }
+    return out;
+}
+
+bool parse_announce_response(std::string_view body, announce_response& out) {
+    out.peers.clear();
+    out.failure.clear();
+
+    thread_local auto arena = std::pmr::unsynchronized_pool_resource{};
+    auto error = bencode::parse_error{};
+    const auto tape = bencode::parse_tape(body, &error, &arena);
+    if (!tape.has_value() || !tape->root().is_dictionary()) {
+        return false;
+    }
+    const auto root = tape->root().as_dict();
+
+    if (const auto failure = root.find("failure reason");
+        failure.has_value() && failure->is_string()) {
+        out.failure = std::string{failure->as_string()};
+        return false;
+    }
+
+    const auto interval = root.find("interval");
+    if (!interval.has_value() || !interval->is_integer()) {
+        return false;
+    }
+    out.interval = std::chrono::seconds{interval->as_integer()};
+    if (const auto complete = root.find("complete");
+        complete.has_value() && complete->is_integer()) {
+        out.seeders = to_count(complete->as_integer());
+    }
+    if (const auto incomplete = root.find("incomplete");
+        incomplete.has_value() && incomplete->is_integer()) {
+        out.leechers = to_count(incomplete->as_integer());
+    }
+
+    if (const auto peers = root.find("peers"); peers.has_value()) {
+        const bool ok = peers->is_string()
+                            ? decode_peers(peers->as_string(), out.peers)
+                        : peers->is_list()
+                            ? decode_peer_list(peers->as_list(), out)
+                            : false;
+        if (!ok) {
+            return false;
+        }
+    }
+    if (const auto peers6 = root.find("peers6");
+        peers6.has_value() && peers6->is_string()) {
+        decode_peers6(peers6->as_string(), out.peers);
+    }
+    return true;
+}
+
+http_tracker::http_tracker(boost::asio::any_io_executor executor,
+                           std::chrono::milliseconds timeout)
+    : executor_{executor}, timeout_{timeout}, resolver_{executor} {}
+
+std::size_t http_tracker::idle_connections() const {
+    std::size_t count = 0;
+    for (const auto& [key, connections] : idle_) {
+        count += connections.size();
+    }
+    return count;
+}
+
+boost::asio::awaitable<bool> http_tracker::announce(
+    const url& tracker, const announce_request& request,
+    announce_response& response) {
+    const auto key = tracker.host + ':' + tracker.port;
+    const auto target = announce_target(tracker.target, request);
+    auto& pool = idle_[key];
+
+    // A kept connection may have been closed by the tracker since; that is
+    // retried once on a fresh one.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const bool reused = !pool.empty();
+        auto c = std::unique_ptr<connection>{};
+        if (reused) {
+            c = std::move(pool.back());
+            pool.pop_back();
+        } else {
+            c = std::make_unique<connection>(
+                boost::beast::tcp_stream{executor_});
+            auto ec = boost::system::error_code{};
+            const auto endpoints = co_await resolver_.async_resolve(
+                tracker.host, tracker.port, redirect_error(use_awaitable, ec));
+            if (ec) {
+                co_return false;
+            }
+            c->stream.expires_after(timeout_);
+            co_await c->stream.async_connect(endpoints,
+                                            redirect_error(use_awaitable, ec));
+            if (ec) {
+                co_return false;
+            }
+        }
+
+        bool keep_alive = false;
+        if (co_await exchange(*c, tracker, target, keep_alive)) {
+            const bool ok = parse_announce_response(c->body, response);
+            if (keep_alive) {
+                c->stream.expires_never();
+                pool.push_back(std::move(c));
+            }
+            co_return ok;
+        }
+        if (!reused) {
+            break;
+        }
+    }
+    co_return false;
+}
+
+boost::asio::awaitable<bool> http_tracker::exchange(connection& c,
+                                                    const url& tracker,
+                                                    const std::string& target,
+                                                    bool& keep_alive) {
+    auto request = http::request<http::empty_body>{http::verb::get, target, 11};
+    request.set(http::field::host, tracker.host);
+    request.set(http::field::user_agent, "rush");
+    request.keep_alive(true);
+
+    auto ec = boost::system::error_code{};
+    c.stream.expires_after(timeout_);
+    co_await http::async_write(c.stream, request,
+                               redirect_error(use_awaitable, ec));
+    if (ec) {
+        co_return false;
+    }
+
+    auto parser = http::response_parser<http::string_body>{};
+    parser.body_limit(max_body);
+    c.body.clear();
+    parser.get().body().swap(c.body);
+    co_await http::async_read(c.stream, c.buffer, parser,
+                              redirect_error(use_awaitable, ec));
+    parser.get().body().swap(c.body);
+    if (ec) {
+        co_return false;
+    }
+
+    keep_alive = parser.get().keep_alive();
+    co_return parser.get().result() == http::status::ok;
+}
+
+}  // namespace tracker
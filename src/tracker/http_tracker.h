@@ -0,0 +1,65 @@
+#pragma once
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "announce.h"
+#include "url.h"
+
+namespace tracker {
+
+// The request target for an announce: the URL's own path and query with the
+// announce parameters appended.
+std::string announce_target(std::string_view target,
+                            const announce_request& request);
+
+// Decodes a bencoded announce response. Compact peer lists are decoded
+// from body in place into out.peers.
+bool parse_announce_response(std::string_view body, announce_response& out);
+
+// HTTP announces over keep-alive connections. Connections that the tracker
+// leaves open are kept per host and port and reused by later announces, so
+// a client announcing thousands of torrents to one tracker pays for the TCP
+// handshake once. Use from a single thread.
+class http_tracker {
+   public:
+    http_tracker(boost::asio::any_io_executor executor,
+                 std::chrono::milliseconds timeout);
+
+    boost::asio::awaitable<bool> announce(const url& tracker,
+                                          const announce_request& request,
+                                          announce_response& response);
+
+    std::size_t idle_connections() const;
+
+   private:
+    struct connection {
+        boost::beast::tcp_stream stream;
+        boost::beast::flat_buffer buffer;
+        // Response bodies are read into the same string every time.
+        std::string body;
+    };
+
+    boost::asio::awaitable<bool> exchange(connection& c, const url& tracker,
+                                          const std::string& target,
+                                          bool& keep_alive);
+
+    boost::asio::any_io_executor executor_;
+    std::chrono::milliseconds timeout_;
+    boost::asio::ip::tcp::resolver resolver_;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<connection>>>
+        idle_;
+};
+
+}  // namespace tracker
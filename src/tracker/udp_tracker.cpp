@@ -0,0 +1,345 @@
+#include "udp_tracker.h"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "announce.h"
+#include "compact.h"
+#include "sha.h"
+#include "url.h"
+
+namespace tracker {
+namespace {
+using boost::asio::redirect_error;
+using boost::asio::use_awaitable;
+using boost::asio::ip::udp;
+
+constexpr std::uint64_t protocol_id = 0x41727101980;
+
+enum action : std::uint32_t {
+    connect_action = 0,
+    announce_action = 1,
+    scrape_action = 2,
+    error_action = 3,
+};
+
+constexpr std::size_t connect_size = 16;
+constexpr std::size_t announce_size = 98;
+constexpr std::size_t announce_reply_size = 20;
+constexpr std::size_t scrape_entry_size = 12;
+constexpr std::size_t reply_header_size = 8;
+
+// A connection id may be used for a minute after it was handed out.
+constexpr auto connection_lifetime = std::chrono::minutes{1};
+
+std::uint32_t load32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint32_t>(u[0]) << 24 |
+           static_cast<std::uint32_t>(u[1]) << 16 |
+           static_cast<std::uint32_t>(u[2]) << 8 |
+           static_cast<std::uint32_t>(u[3]);
+}
+
+std::uint64_t load64(const char* p) {
+    return static_cast<std::uint64_t>(load32(p)) << 32 | load32(p + 4);
+}
+
+char* store16(char* p, std::uint16_t v) {
+    p[0] = static_cast<char>(v >> 8);
+    p[1] = static_cast<char>(v);
+    return p + 2;
+}
+
+char* store32(char* p, std::uint32_t v) {
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+    return p + 4;
+}
+
+char* store64(char* p, std::uint64_t v) {
+    return store32(store32(p, static_cast<std::uint32_t>(v >> 32)),
+                   static_cast<std::uint32_t>(v));
+}
+
+template <std::size_t N>
+char* store(char* p, const std::array<std::byte, N>& bytes) {
+    std::memcpy(p, bytes.data(), N);
+    return p + N;
+}
+
+// Every request starts with the connection id, the action and the
+// transaction id; transact fills in the last.
+char* store_header(char* p, std::uint64_t connection_id, action a) {
+    return store32(store32(store64(p, connection_id), a), 0);
+}
+
+// The error reply carries a message after the header.
+std::string error_message(std::string_view reply) {
+    return std::string{reply.substr(reply_header_size)};
+}
+}  // namespace
+
+struct udp_tracker::channel {
+    struct pending {
+        udp::endpoint endpoint;
+        boost::asio::steady_timer* timer;
+        std::function<bool(std::string_view)>* on_reply;
+        bool answered = false;
+        bool ok = false;
+    };
+
+    channel(boost::asio::any_io_executor executor, udp protocol)
+        : socket{executor, protocol} {}
+
+    udp::socket socket;
+    std::unordered_map<std::uint32_t, pending*> pending_replies;
+    bool receiving = false;
+    // Large enough for any datagram.
+    std::array<char, 65536> buffer;
+};
+
+// Runs while transactions are outstanding; transact starts it again when
+// the next one begins.
+boost::asio::awaitable<void> udp_tracker::receive(std::shared_ptr<channel> c) {
+    while (c->socket.is_open() && !c->pending_replies.empty()) {
+        auto ec = boost::system::error_code{};
+        auto from = udp::endpoint{};
+        const auto n = co_await c->socket.async_receive_from(
+            boost::asio::buffer(c->buffer), from,
+            redirect_error(use_awaitable, ec));
+        if (ec || n < reply_header_size) {
+            continue;
+        }
+
+        const auto it = c->pending_replies.find(load32(c->buffer.data() + 4));
+        if (it == c->pending_replies.end() || it->second->endpoint != from) {
+            continue;
+        }
+        auto& p = *it->second;
+        c->pending_replies.erase(it);
+        p.answered = true;
+        p.ok = (*p.on_reply)({c->buffer.data(), n});
+        p.timer->cancel();
+    }
+    c->receiving = false;
+}
+
+udp_tracker::udp_tracker(boost::asio::any_io_executor executor,
+                         const udp_options& options)
+    : executor_{executor},
+      options_{options},
+      resolver_{executor},
+      random_{std::random_device{}()} {}
+
+udp_tracker::~udp_tracker() {
+    for (const auto& c : channels_) {
+        if (c) {
+            auto ec = boost::system::error_code{};
+            c->socket.close(ec);
+        }
+    }
+}
+
+std::shared_ptr<udp_tracker::channel> udp_tracker::channel_for(
+    const udp::endpoint& endpoint) {
+    auto& c = channels_[endpoint.address().is_v6() ? 1 : 0];
+    if (!c) {
+        c = std::make_shared<channel>(executor_, endpoint.protocol());
+    }
+    return c;
+}
+
+boost::asio::awaitable<bool> udp_tracker::transact(
+    const udp::endpoint& endpoint, std::span<char> packet,
+    std::function<bool(std::string_view)> on_reply) {
+    const auto c = channel_for(endpoint);
+    auto id = static_cast<std::uint32_t>(random_());
+    while (c->pending_replies.contains(id)) {
+        id++;
+    }
+    store32(packet.data() + 12, id);
+
+    auto timer = boost::asio::steady_timer{executor_};
+    auto p = channel::pending{endpoint, &timer, &on_reply};
+    c->pending_replies.emplace(id, &p);
+    if (!c->receiving) {
+        c->receiving = true;
+        boost::asio::co_spawn(executor_, receive(c), boost::asio::detached);
+    }
+
+    for (int attempt = 0; attempt <= options_.retries; attempt++) {
+        auto ec = boost::system::error_code{};
+        co_await c->socket.async_send_to(
+            boost::asio::buffer(packet.data(), packet.size()), endpoint,
+            redirect_error(use_awaitable, ec));
+        packets_sent_++;
+        if (ec || p.answered) {
+            break;
+        }
+        timer.expires_after(options_.timeout * (1 << attempt));
+        co_await timer.async_wait(redirect_error(use_awaitable, ec));
+        if (p.answered) {
+            break;
+        }
+    }
+
+    if (!p.answered) {
+        c->pending_replies.erase(id);
+        if (c->pending_replies.empty()) {
+            // Lets the receive loop finish instead of holding the
+            // io_context open.
+            auto ec = boost::system::error_code{};
+            c->socket.cancel(ec);
+        }
+    }
+    co_return p.ok;
+}
+
+boost::asio::awaitable<udp_tracker::known_tracker*> udp_tracker::find(
+    const url& tracker) {
+    const auto key = tracker.host + ':' + tracker.port;
+    if (const auto it = known_.find(key); it != known_.end()) {
+        co_return &it->second;
+    }
+
+    auto ec = boost::system::error_code{};
+    const auto endpoints = co_await resolver_.async_resolve(
+        tracker.host, tracker.port, redirect_error(use_awaitable, ec));
+    if (ec || endpoints.empty()) {
+        co_return nullptr;
+    }
+    auto& known = known_[key];
+    known.endpoint = endpoints.begin()->endpoint();
+    co_return &known;
+}
+
+boost::asio::awaitable<bool> udp_tracker::connect(known_tracker& t) {
+    if (std::chrono::steady_clock::now() < t.expires) {
+        co_return true;
+    }
+
+    auto packet = std::array<char, connect_size>{};
+    store_header(packet.data(), protocol_id, connect_action);
+    co_return co_await transact(
+        t.endpoint, packet, [&t](std::string_view reply) {
+            if (reply.size() < connect_size ||
+                load32(reply.data()) != connect_action) {
+                return false;
+            }
+            t.connection_id = load64(reply.data() + 8);
+            t.expires = std::chrono::steady_clock::now() + connection_lifetime;
+            return true;
+        });
+}
+
+boost::asio::awaitable<bool> udp_tracker::announce(
+    const url& tracker, const announce_request& request,
+    announce_response& response) {
+    response.peers.clear();
+    response.failure.clear();
+
+    auto* t = co_await find(tracker);
+    if (t == nullptr || !co_await connect(*t)) {
+        co_return false;
+    }
+
+    auto packet = std::array<char, announce_size>{};
+    auto* p = store_header(packet.data(), t->connection_id, announce_action);
+    p = store(p, request.info_hash);
+    p = store(p, request.peer_id);
+    p = store64(p, request.downloaded);
+    p = store64(p, request.left);
+    p = store64(p, request.uploaded);
+    p = store32(p, static_cast<std::uint32_t>(request.event));
+    p = store32(p, 0);  // Address: the one the packet came from.
+    p = store32(p, request.key);
+    p = store32(p, request.numwant);
+    store16(p, request.port);
+
+    // Over IPv6 the tracker answers with IPv6 peers (BEP 15).
+    const bool v6 = t->endpoint.address().is_v6();
+    co_return co_await transact(
+        t->endpoint, packet, [&response, v6](std::string_view reply) {
+            const auto a = load32(reply.data());
+            if (a == error_action) {
+                response.failure = error_message(reply);
+                return false;
+            }
+            if (a != announce_action || reply.size() < announce_reply_size) {
+                return false;
+            }
+            response.interval = std::chrono::seconds{load32(reply.data() + 8)};
+            response.leechers = load32(reply.data() + 12);
+            response.seeders = load32(reply.data() + 16);
+            const auto peers = reply.substr(announce_reply_size);
+            return v6 ? decode_peers6(peers, response.peers)
+                      : decode_peers(peers, response.peers);
+        });
+}
+
+boost::asio::awaitable<bool> udp_tracker::scrape(
+    const url& tracker, std::span<const crypto::sha1_digest> info_hashes,
+    std::vector<scrape_entry>& out) {
+    auto* t = co_await find(tracker);
+    if (t == nullptr) {
+        co_return false;
+    }
+
+    auto packet = std::vector<char>{};
+    for (std::size_t first = 0; first < info_hashes.size();
+         first += max_scrape) {
+        if (!co_await connect(*t)) {
+            co_return false;
+        }
+
+        const auto batch = info_hashes.subspan(
+            first, std::min(max_scrape, info_hashes.size() - first));
+        packet.resize(connect_size + batch.size() * sizeof(batch[0]));
+        auto* p = store_header(packet.data(), t->connection_id, scrape_action);
+        for (const auto& info_hash : batch) {
+            p = store(p, info_hash);
+        }
+
+        const bool ok = co_await transact(
+            t->endpoint, packet, [&out, batch](std::string_view reply) {
+                if (load32(reply.data()) != scrape_action ||
+                    reply.size() < reply_header_size +
+                                       batch.size() * scrape_entry_size) {
+                    return false;
+                }
+                const auto* q = reply.data() + reply_header_size;
+                for (const auto& info_hash : batch) {
+                    out.push_back({info_hash, load32(q), load32(q + 4),
+                                   load32(q + 8)});
+                    q += scrape_entry_size;
+                }
+                return true;
+            });
+        if (!ok) {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+}  // namespace tracker
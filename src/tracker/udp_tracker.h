@@ -0,0 +1,95 @@
+#pragma once
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "announce.h"
+#include "sha.h"
+#include "url.h"
+
+namespace tracker {
+
+struct udp_options {
+    // Doubled on every retransmission, as BEP 15 asks.
+    std::chrono::milliseconds timeout{15000};
+    int retries = 3;
+};
+
+// BEP 15 announces and scrapes. All trackers share one socket per address
+// family, and responses are matched to requests by transaction id and
+// decoded straight out of the receive buffer. Connection ids are kept for
+// the minute the protocol allows, so most announces are a single round
+// trip. Use from a single thread.
+class udp_tracker {
+   public:
+    // Info-hashes that fit in one scrape packet.
+    static constexpr std::size_t max_scrape = 74;
+
+    udp_tracker(boost::asio::any_io_executor executor,
+                const udp_options& options = {});
+    ~udp_tracker();
+
+    udp_tracker(const udp_tracker&) = delete;
+    udp_tracker& operator=(const udp_tracker&) = delete;
+
+    boost::asio::awaitable<bool> announce(const url& tracker,
+                                          const announce_request& request,
+                                          announce_response& response);
+
+    // Appends one entry per info-hash in order, max_scrape to a packet.
+    boost::asio::awaitable<bool> scrape(
+        const url& tracker, std::span<const crypto::sha1_digest> info_hashes,
+        std::vector<scrape_entry>& out);
+
+    // Packets sent, retransmissions included.
+    std::size_t packets_sent() const { return packets_sent_; }
+
+   private:
+    // The receive side is shared with the loop reading the socket, which
+    // may outlive the tracker by one completion.
+    struct channel;
+
+    struct known_tracker {
+        boost::asio::ip::udp::endpoint endpoint;
+        std::uint64_t connection_id = 0;
+        std::chrono::steady_clock::time_point expires{};
+    };
+
+    boost::asio::awaitable<known_tracker*> find(const url& tracker);
+    boost::asio::awaitable<bool> connect(known_tracker& t);
+
+    // Sends packet, whose transaction id is filled in here, until a reply
+    // arrives or the retries run out. on_reply sees the datagram in place.
+    boost::asio::awaitable<bool> transact(
+        const boost::asio::ip::udp::endpoint& endpoint, std::span<char> packet,
+        std::function<bool(std::string_view)> on_reply);
+
+    std::shared_ptr<channel> channel_for(
+        const boost::asio::ip::udp::endpoint& endpoint);
+    static boost::asio::awaitable<void> receive(std::shared_ptr<channel> c);
+
+    boost::asio::any_io_executor executor_;
+    udp_options options_;
+    boost::asio::ip::udp::resolver resolver_;
+    std::array<std::shared_ptr<channel>, 2> channels_;
+    std::unordered_map<std::string, known_tracker> known_;
+    std::mt19937 random_;
+    std::size_t packets_sent_ = 0;
+};
+
+}  // namespace tracker
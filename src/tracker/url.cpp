@@ -0,0 +1,71 @@
+#include "url.h"
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace tracker {
+std::optional<url> parse_url(std::string_view text) {
+    const auto scheme_end = text.find("://");
+    if (scheme_end == std::string_view::npos) {
+        return {};
+    }
+
+    auto result = url{};
+    result.scheme = std::string{text.substr(0, scheme_end)};
+    std::transform(result.scheme.begin(), result.scheme.end(),
+                   result.scheme.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (result.scheme != "http" && result.scheme != "udp") {
+        return {};
+    }
+
+    auto rest = text.substr(scheme_end + 3);
+    const auto authority_end = rest.find_first_of("/?");
+    auto authority = rest.substr(0, authority_end);
+    result.target = authority_end == std::string_view::npos
+                        ? "/"
+                        : std::string{rest.substr(authority_end)};
+    if (result.target.front() == '?') {
+        result.target.insert(0, "/");
+    }
+
+    auto port = std::string_view{};
+    if (authority.starts_with('[')) {
+        const auto close = authority.find(']');
+        if (close == std::string_view::npos) {
+            return {};
+        }
+        result.host = std::string{authority.substr(1, close - 1)};
+        const auto after = authority.substr(close + 1);
+        if (!after.empty()) {
+            if (!after.starts_with(':')) {
+                return {};
+            }
+            port = after.substr(1);
+        }
+    } else {
+        const auto colon = authority.rfind(':');
+        result.host = std::string{authority.substr(0, colon)};
+        if (colon != std::string_view::npos) {
+            port = authority.substr(colon + 1);
+        }
+    }
+
+    if (port.empty()) {
+        if (result.scheme == "udp") {
+            return {};
+        }
+        port = "80";
+    }
+    if (result.host.empty() ||
+        !std::all_of(port.begin(), port.end(),
+                     [](char c) { return c >= '0' && c <= '9'; })) {
+        return {};
+    }
+    result.port = std::string{port};
+    return result;
+}
+}  // namespace tracker
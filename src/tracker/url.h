@@ -0,0 +1,22 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace tracker {
+
+// The parts of an announce URL a tracker client needs. target is the path
+// and query, "/" when the URL has neither.
+struct url {
+    std::string scheme;
+    std::string host;
+    std::string port;
+    std::string target;
+};
+
+// Accepts http and udp URLs. http defaults to port 80; udp needs a port.
+// IPv6 hosts are written in brackets and returned without them.
+std::optional<url> parse_url(std::string_view text);
+
+}  // namespace tracker
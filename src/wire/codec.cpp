@@ -0,0 +1,227 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "message.h"
+
+namespace wire {
+namespace {
+std::uint32_t load32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint32_t>(u[0]) << 24 |
+           static_cast<std::uint32_t>(u[1]) << 16 |
+           static_cast<std::uint32_t>(u[2]) << 8 |
+           static_cast<std::uint32_t>(u[3]);
+}
+
+char* store32(char* p, std::uint32_t v) {
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+    return p + 4;
+}
+
+template <std::size_t N>
+const char* load(const char* p, std::array<std::byte, N>& out) {
+    std::memcpy(out.data(), p, N);
+    return p + N;
+}
+
+template <std::size_t N>
+char* store(char* p, const std::array<std::byte, N>& in) {
+    std::memcpy(p, in.data(), N);
+    return p + N;
+}
+
+// Decodes the payload of a message whose length is fixed by its id.
+std::optional<message> decode_fixed(message_id id, std::string_view payload) {
+    const auto* p = payload.data();
+    switch (id) {
+        case message_id::choke:
+            return payload.empty() ? std::optional<message>{choke{}}
+                                   : std::nullopt;
+        case message_id::unchoke:
+            return payload.empty() ? std::optional<message>{unchoke{}}
+                                   : std::nullopt;
+        case message_id::interested:
+            return payload.empty() ? std::optional<message>{interested{}}
+                                   : std::nullopt;
+        case message_id::not_interested:
+            return payload.empty() ? std::optional<message>{not_interested{}}
+                                   : std::nullopt;
+        case message_id::have:
+            if (payload.size() != 4) {
+                return {};
+            }
+            return have{load32(p)};
+        case message_id::request:
+            if (payload.size() != 12) {
+                return {};
+            }
+            return request{load32(p), load32(p + 4), load32(p + 8)};
+        case message_id::cancel:
+            if (payload.size() != 12) {
+                return {};
+            }
+            return cancel{load32(p), load32(p + 4), load32(p + 8)};
+        default:
+            return {};
+    }
+}
+}  // namespace
+
+frame decode(std::string_view input, std::uint32_t max_length) {
+    if (input.size() < 4) {
+        return {status::incomplete, 0, keep_alive{}};
+    }
+
+    const auto length = load32(input.data());
+    if (length > max_length) {
+        return {status::invalid, 0, keep_alive{}};
+    }
+    if (input.size() - 4 < length) {
+        return {status::incomplete, 0, keep_alive{}};
+    }
+
+    const auto size = std::size_t{4} + length;
+    if (length == 0) {
+        return {status::complete, size, keep_alive{}};
+    }
+
+    const auto id = static_cast<std::uint8_t>(input[4]);
+    const auto payload = input.substr(5, length - 1);
+    switch (static_cast<message_id>(id)) {
+        case message_id::bitfield:
+            return {status::complete, size, bitfield{payload}};
+        case message_id::piece:
+            if (payload.size() < 8) {
+                return {status::invalid, 0, keep_alive{}};
+            }
+            return {status::complete, size,
+                    piece{load32(payload.data()), load32(payload.data() + 4),
+                          payload.substr(8)}};
+        case message_id::choke:
+        case message_id::unchoke:
+        case message_id::interested:
+        case message_id::not_interested:
+        case message_id::have:
+        case message_id::request:
+        case message_id::cancel: {
+            auto m = decode_fixed(static_cast<message_id>(id), payload);
+            if (!m.has_value()) {
+                return {status::invalid, 0, keep_alive{}};
+            }
+            return {status::complete, size, std::move(m.value())};
+        }
+    }
+    return {status::complete, size, unknown{id, payload}};
+}
+
+std::optional<piece_header> decode_piece_header(std::string_view input) {
+    if (input.size() < piece_header_size ||
+        static_cast<message_id>(input[4]) != message_id::piece) {
+        return {};
+    }
+    const auto length = load32(input.data());
+    if (length < piece_header_size - 4) {
+        return {};
+    }
+    return piece_header{load32(input.data() + 5), load32(input.data() + 9),
+                        length - static_cast<std::uint32_t>(
+                                     piece_header_size - 4)};
+}
+
+std::optional<handshake> decode_handshake(std::string_view input) {
+    if (input.size() < handshake_size ||
+        static_cast<unsigned char>(input[0]) != protocol.size() ||
+        input.substr(1, protocol.size()) != protocol) {
+        return {};
+    }
+
+    auto h = handshake{};
+    const auto* p = input.data() + 1 + protocol.size();
+    p = load(p, h.reserved);
+    p = load(p, h.info_hash);
+    load(p, h.id);
+    return h;
+}
+
+std::array<char, handshake_size> encode(const handshake& h) {
+    auto out = std::array<char, handshake_size>{};
+    out[0] = static_cast<char>(protocol.size());
+    auto* p = std::copy(protocol.begin(), protocol.end(), out.data() + 1);
+    p = store(p, h.reserved);
+    p = store(p, h.info_hash);
+    store(p, h.id);
+    return out;
+}
+
+outgoing::outgoing(const message& m) {
+    std::visit(
+        [this](const auto& value) {
+            using T = std::decay_t<decltype(value)>;
+            auto* p = header_.data() + 4;
+            const auto id = [&](message_id i) {
+                *p++ = static_cast<char>(i);
+            };
+
+            if constexpr (std::is_same_v<T, choke>) {
+                id(message_id::choke);
+            } else if constexpr (std::is_same_v<T, unchoke>) {
+                id(message_id::unchoke);
+            } else if constexpr (std::is_same_v<T, interested>) {
+                id(message_id::interested);
+            } else if constexpr (std::is_same_v<T, not_interested>) {
+                id(message_id::not_interested);
+            } else if constexpr (std::is_same_v<T, have>) {
+                id(message_id::have);
+                p = store32(p, value.index);
+            } else if constexpr (std::is_same_v<T, bitfield>) {
+                id(message_id::bitfield);
+                payload_ = value.bits;
+            } else if constexpr (std::is_same_v<T, request> ||
+                                 std::is_same_v<T, cancel>) {
+                id(std::is_same_v<T, request> ? message_id::request
+                                              : message_id::cancel);
+                p = store32(p, value.index);
+                p = store32(p, value.begin);
+                p = store32(p, value.length);
+            } else if constexpr (std::is_same_v<T, piece>) {
+                id(message_id::piece);
+                p = store32(p, value.index);
+                p = store32(p, value.begin);
+                payload_ = value.block;
+            } else if constexpr (std::is_same_v<T, unknown>) {
+                *p++ = static_cast<char>(value.id);
+                payload_ = value.payload;
+            }
+
+            header_size_ = static_cast<std::size_t>(p - header_.data());
+            store32(header_.data(),
+                    static_cast<std::uint32_t>(header_size_ - 4 +
+                                               payload_.size()));
+        },
+        m);
+}
+
+outgoing::outgoing(const piece_header& h) {
+    auto* p = header_.data() + 4;
+    *p++ = static_cast<char>(message_id::piece);
+    p = store32(p, h.index);
+    p = store32(p, h.begin);
+    header_size_ = static_cast<std::size_t>(p - header_.data());
+    store32(header_.data(),
+            static_cast<std::uint32_t>(header_size_ - 4 + h.length));
+}
+
+}  // namespace wire
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "message.h"
+
+namespace wire {
+
+// Longest message accepted from a peer: room for a bitfield of a million
+// pieces, and far more than a 16 KiB block. The receive buffer should be at
+// least this large.
+constexpr std::uint32_t max_message_length = 1 << 20;
+
+enum class status { complete, incomplete, invalid };
+
+// A decoded message and the number of bytes it took up on the wire.
+struct frame {
+    status state;
+    std::size_t size;
+    message value;
+};
+
+// Decodes the message at the front of input without copying its payload.
+// When state is incomplete, nothing is decoded until more bytes arrive;
+// invalid means the peer broke the protocol and should be dropped.
+frame decode(std::string_view input,
+             std::uint32_t max_length = max_message_length);
+
+// The fixed fields of a piece message, which come before its block.
+struct piece_header {
+    std::uint32_t index;
+    std::uint32_t begin;
+    // Of the block.
+    std::uint32_t length;
+};
+constexpr std::size_t piece_header_size = 4 + 1 + 8;
+
+// Decodes the fixed fields of a piece message at the front of input, so
+// that its block can be received into a buffer of its own. Returns nothing
+// for any other message, or while fewer than piece_header_size bytes are
+// in.
+std::optional<piece_header> decode_piece_header(std::string_view input);
+
+// Decodes a handshake from the first handshake_size bytes of input. Returns
+// nothing if there are fewer bytes or they are not a BitTorrent handshake.
+std::optional<handshake> decode_handshake(std::string_view input);
+
+std::array<char, handshake_size> encode(const handshake& h);
+
+// An outgoing message as a scatter/gather sequence: the length prefix and
+// fixed fields are serialized into a small inline header, and the payload
+// of piece, bitfield and unknown messages is referenced where it lies, so a
+// block goes from the cache to the socket without being copied. Both the
+// message and the payload it refers to must outlive the write.
+class outgoing {
+   public:
+    explicit outgoing(const message& m);
+    // A piece message whose block of h.length bytes is written after it by
+    // other means, such as sendfile.
+    explicit outgoing(const piece_header& h);
+
+    std::array<boost::asio::const_buffer, 2> buffers() const {
+        return {boost::asio::buffer(header_.data(), header_size_),
+                boost::asio::buffer(payload_.data(), payload_.size())};
+    }
+
+    std::size_t size() const { return header_size_ + payload_.size(); }
+
+   private:
+    // Length, id and three integers, as in request and cancel.
+    std::array<char, 4 + 1 + 12> header_{};
+    std::size_t header_size_ = 0;
+    std::string_view payload_;
+};
+
+}  // namespace wire
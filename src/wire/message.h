@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <variant>
+
+#include "sha.h"
+
+// Messages of the peer wire protocol (BEP 3). Payloads are views into the
+// receive buffer they were decoded from, valid until those bytes are
+// consumed.
+namespace wire {
+
+using peer_id = std::array<std::byte, 20>;
+
+constexpr std::string_view protocol = "BitTorrent protocol";
+constexpr std::size_t handshake_size = 1 + protocol.size() + 8 + 20 + 20;
+
+struct handshake {
+    std::array<std::byte, 8> reserved;
+    crypto::sha1_digest info_hash;
+    peer_id id;
+};
+
+enum class message_id : std::uint8_t {
+    choke = 0,
+    unchoke = 1,
+    interested = 2,
+    not_interested = 3,
+    have = 4,
+    bitfield = 5,
+    request = 6,
+    piece = 7,
+    cancel = 8,
+};
+
+struct keep_alive {};
+struct choke {};
+struct unchoke {};
+struct interested {};
+struct not_interested {};
+
+struct have {
+    std::uint32_t index;
+};
+
+struct bitfield {
+    std::string_view bits;
+};
+
+struct request {
+    std::uint32_t index;
+    std::uint32_t begin;
+    std::uint32_t length;
+};
+
+struct piece {
+    std::uint32_t index;
+    std::uint32_t begin;
+    std::string_view block;
+};
+
+struct cancel {
+    std::uint32_t index;
+    std::uint32_t begin;
+    std::uint32_t length;
+};
+
+// Anything with an id this codec does not handle, such as extension
+// messages. These are passed through rather than treated as errors.
+struct unknown {
+    std::uint8_t id;
+    std::string_view payload;
+};
+
+using message = std::variant<keep_alive, choke, unchoke, interested,
+                             not_interested, have, bitfield, request, piece,
+                             cancel, unknown>;
+
+}  // namespace wire
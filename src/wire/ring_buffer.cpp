@@ -0,0 +1,88 @@
+#include "ring_buffer.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace wire {
+std::optional<ring_buffer> ring_buffer::create(std::size_t capacity) {
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    capacity = (std::max<std::size_t>(capacity, 1) + page - 1) / page * page;
+
+    const int fd = ::memfd_create("rush-ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        return {};
+    }
+    if (::ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+        ::close(fd);
+        return {};
+    }
+
+    // Reserve twice the size, then map the file over both halves.
+    void* base = ::mmap(nullptr, 2 * capacity, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return {};
+    }
+
+    auto* data = static_cast<char*>(base);
+    const bool mapped =
+        ::mmap(data, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+               fd, 0) != MAP_FAILED &&
+        ::mmap(data + capacity, capacity, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+    ::close(fd);
+    if (!mapped) {
+        ::munmap(base, 2 * capacity);
+        return {};
+    }
+    return ring_buffer{data, capacity};
+}
+
+ring_buffer::ring_buffer(char* data, std::size_t capacity)
+    : data_{data}, capacity_{capacity} {}
+
+ring_buffer::ring_buffer(ring_buffer&& other) noexcept
+    : data_{std::exchange(other.data_, nullptr)},
+      capacity_{std::exchange(other.capacity_, 0)},
+      read_{std::exchange(other.read_, 0)},
+      write_{std::exchange(other.write_, 0)} {}
+
+ring_buffer& ring_buffer::operator=(ring_buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        capacity_ = std::exchange(other.capacity_, 0);
+        read_ = std::exchange(other.read_, 0);
+        write_ = std::exchange(other.write_, 0);
+    }
+    return *this;
+}
+
+ring_buffer::~ring_buffer() { reset(); }
+
+void ring_buffer::consume(std::size_t n) {
+    read_ += n;
+    // Keep the read position in the first copy; the write position may run
+    // into the second.
+    if (read_ >= capacity_) {
+        read_ -= capacity_;
+        write_ -= capacity_;
+    }
+}
+
+void ring_buffer::reset() {
+    if (data_ != nullptr) {
+        ::munmap(data_, 2 * capacity_);
+        data_ = nullptr;
+        capacity_ = 0;
+        read_ = 0;
+        write_ = 0;
+    }
+}
+}  // namespace wire
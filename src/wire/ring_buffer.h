@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace wire {
+
+// Receive buffer for a peer connection. The same pages are mapped twice, back
+// to back, so both the readable and the writable region are always one
+// contiguous range: a message that wraps around the end of the buffer can
+// still be decoded, and its payload handed out, in place.
+class ring_buffer {
+   public:
+    // capacity is rounded up to a whole number of pages.
+    static std::optional<ring_buffer> create(std::size_t capacity);
+
+    ring_buffer(ring_buffer&& other) noexcept;
+    ring_buffer& operator=(ring_buffer&& other) noexcept;
+    ring_buffer(const ring_buffer&) = delete;
+    ring_buffer& operator=(const ring_buffer&) = delete;
+    ~ring_buffer();
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t size() const { return write_ - read_; }
+
+    // Bytes received and not yet consumed. Views stay valid until the bytes
+    // are consumed.
+    std::string_view readable() const {
+        return {data_ + read_, write_ - read_};
+    }
+
+    // Free space to receive into; commit() what was filled.
+    std::span<char> writable() {
+        return {data_ + write_, capacity_ - size()};
+    }
+
+    void commit(std::size_t n) { write_ += n; }
+    void consume(std::size_t n);
+
+   private:
+    ring_buffer(char* data, std::size_t capacity);
+    void reset();
+
+    char* data_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t read_ = 0;
+    std::size_t write_ = 0;
+};
+
+}  // namespace wire
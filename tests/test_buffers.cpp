@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "block_pool.h"
+
+TEST(BlockPool, ReferencesShareOneBlock) {
+    auto pool = buffers::block_pool{1 << 20, 1};
+    auto a = pool.allocate();
+    ASSERT_TRUE(a);
+    std::memset(a.data(), 'x', buffers::block_size);
+
+    auto b = a;
+    ASSERT_EQ(b.data(), a.data());
+    ASSERT_EQ(a.use_count(), 2);
+    ASSERT_EQ(pool.stats().in_use, 1);
+
+    a.reset();
+    ASSERT_EQ(b.use_count(), 1);
+    ASSERT_EQ(b.bytes()[buffers::block_size - 1], 'x');
+    auto c = std::move(b);
+    ASSERT_FALSE(b);
+    ASSERT_EQ(pool.stats().in_use, 1);
+    c.reset();
+    ASSERT_EQ(pool.stats().in_use, 0);
+    ASSERT_EQ(pool.stats().high_water, 1);
+}
+
+TEST(BlockPool, DistinctAlignedBlocks) {
+    auto pool = buffers::block_pool{4 << 20, 1};
+    auto blocks = std::vector<buffers::block_ref>{};
+    auto addresses = std::set<const char*>{};
+    for (std::size_t i = 0; i < 200; i++) {
+        blocks.push_back(pool.allocate());
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(blocks.back().data()) %
+                      4096,
+                  0);
+        addresses.insert(blocks.back().data());
+    }
+    ASSERT_EQ(addresses.size(), 200);
+    ASSERT_EQ(pool.stats().reserved, 256);
+}
+
+TEST(BlockPool, RefusesPastLimit) {
+    auto pool = buffers::block_pool{3 * buffers::block_size, 2};
+    auto a = pool.allocate();
+    auto b = pool.allocate();
+    auto c = pool.allocate();
+    ASSERT_TRUE(a && b && c);
+    ASSERT_FALSE(pool.allocate());
+
+    auto stats = pool.stats();
+    ASSERT_EQ(stats.failures, 1);
+    ASSERT_EQ(stats.reserved, 3);
+    ASSERT_EQ(stats.limit, 3);
+
+    b.reset();
+    ASSERT_TRUE(pool.allocate());
+}
+
+TEST(BlockPool, AtLimitTakesBlocksHeldByOtherShards) {
+    auto pool = buffers::block_pool{3 * buffers::block_size, 64};
+    auto blocks = std::vector<buffers::block_ref>{};
+    for (std::size_t i = 0; i < 3; i++) {
+        blocks.push_back(pool.allocate());
+    }
+    // Freed into the shard of another thread.
+    std::jthread{[blocks = std::move(blocks)] {}};
+
+    for (std::size_t i = 0; i < 3; i++) {
+        blocks.push_back(pool.allocate());
+        ASSERT_TRUE(blocks.back());
+    }
+    ASSERT_EQ(pool.stats().failures, 0);
+}
+
+TEST(BlockPool, FreedOnOtherThreads) {
+    constexpr std::size_t rounds = 500;
+    auto pool = buffers::block_pool{1 << 20, 4};
+
+    // Blocks allocated on one thread and released on another, as when the
+    // network receives them and the disk writes them.
+    auto threads = std::vector<std::jthread>{};
+    for (std::size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&pool] {
+            for (std::size_t i = 0; i < rounds; i++) {
+                auto block = pool.allocate();
+                if (!block) {
+                    continue;
+                }
+                block.data()[0] = 1;
+                std::jthread{[block = std::move(block)] {}};
+            }
+        });
+    }
+    threads.clear();
+
+    const auto stats = pool.stats();
+    ASSERT_EQ(stats.in_use, 0);
+    ASSERT_LE(stats.reserved, stats.limit);
+}
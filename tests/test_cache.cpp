@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "format.h"
+#include "metadata_cache.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace {
+class MetadataCache : public testing::Test {
+   protected:
+    void SetUp() override {
+        std::filesystem::remove_all(root_);
+        std::filesystem::create_directories(root_);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root_); }
+
+    std::filesystem::path add_torrent(const std::string& name) {
+        const auto path = root_ / name;
+        std::filesystem::copy_file(RUSH_TEST_RESOURCES "/alice.torrent", path);
+        torrents_.push_back(path);
+        return path;
+    }
+
+    std::filesystem::path cache_path() const { return root_ / "meta.cache"; }
+
+    std::filesystem::path root_ =
+        std::filesystem::temp_directory_path() / "rush_cache";
+    std::vector<std::filesystem::path> torrents_;
+};
+}  // namespace
+
+TEST_F(MetadataCache, RoundTrip) {
+    const auto path = add_torrent("alice.torrent");
+    const auto stats = cache::refresh(cache_path(), torrents_);
+    ASSERT_EQ(stats.has_value(), true);
+    ASSERT_EQ(stats->parsed, 1);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    ASSERT_EQ(cache.has_value(), true);
+    ASSERT_EQ(cache->size(), 1);
+
+    const auto entry = cache->find(path.string());
+    ASSERT_EQ(entry.has_value(), true);
+    ASSERT_EQ(entry->name(), "alice.txt");
+    ASSERT_EQ(entry->total_size(), 163783);
+    ASSERT_EQ(entry->piece_length(), 16384);
+    ASSERT_EQ(entry->is_multi_file(), false);
+    ASSERT_EQ(crypto::to_hex(entry->info_hash()),
+              "722fe65b2aa26d14f35b4ad627d20236e481d924");
+
+    const auto expected = torrent::from_file(path);
+    ASSERT_EQ(expected.has_value(), true);
+    ASSERT_EQ(fmt::format("{}", entry->to_torrent()),
+              fmt::format("{}", expected.value()));
+}
+
+TEST_F(MetadataCache, MultiFile) {
+    auto t = torrent::torrent{};
+    auto info = torrent::multi_file_info{};
+    info.piece_length = 16;
+    info.pieces = std::string(40, 'x');
+    info.name = "album";
+    info.files = {{10, "", "disc 1/01.flac", ""},
+                  {20, "abc", "cover.jpg", ""}};
+    t.info = info;
+    t.announce = "http://tracker.example/announce";
+
+    auto writer = cache::cache_writer{};
+    writer.add({"b.torrent", 1, 2, {}}, t);
+    writer.add({"a.torrent", 1, 2, {}}, torrent::torrent{});
+    ASSERT_EQ(writer.write(cache_path()), true);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    ASSERT_EQ(cache.has_value(), true);
+    ASSERT_EQ(cache->size(), 2);
+    ASSERT_EQ((*cache)[0].path(), "a.torrent");
+    ASSERT_EQ(cache->find("c.torrent").has_value(), false);
+
+    const auto entry = cache->find("b.torrent");
+    ASSERT_EQ(entry.has_value(), true);
+    ASSERT_EQ(entry->total_size(), 30);
+    ASSERT_EQ(entry->file_count(), 2);
+    ASSERT_EQ(entry->file(1).path, "cover.jpg");
+    ASSERT_EQ(entry->file(1).md5sum, "abc");
+    ASSERT_EQ(fmt::format("{}", entry->to_torrent()), fmt::format("{}", t));
+}
+
+TEST_F(MetadataCache, HybridKeepsV2Metadata) {
+    auto root = crypto::sha256_digest{};
+    root.fill(std::byte{7});
+    auto t = torrent::torrent{};
+    auto info = torrent::multi_file_info{};
+    info.piece_length = 32768;
+    info.pieces = std::string(60, 'x');
+    info.name = "hybrid";
+    info.files = {{100, "", "a", ""},
+                  {32668, "", ".pad/32668", "p"},
+                  {40000, "", "b", ""}};
+    t.info = info;
+    t.info_v2 = torrent::v2_info{32768, {{100, {}, "a"}, {40000, root, "b"}}};
+    t.piece_layers[root] = std::string(64, 'y');
+    t.info_hash_v2 = root;
+
+    auto writer = cache::cache_writer{};
+    writer.add({"hybrid.torrent", 1, 2, {}}, t);
+    ASSERT_EQ(writer.write(cache_path()), true);
+
+    // Written again from the cache, as refresh does for unchanged files.
+    auto copied = cache::cache_writer{};
+    {
+        const auto cache = cache::metadata_cache::open(cache_path());
+        ASSERT_EQ(cache.has_value(), true);
+        copied.add({"hybrid.torrent", 3, 4, {}}, (*cache)[0]);
+    }
+    ASSERT_EQ(copied.write(cache_path()), true);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    const auto entry = cache->find("hybrid.torrent");
+    ASSERT_EQ(entry.has_value(), true);
+    ASSERT_EQ(entry->has_info_v2(), true);
+    // Padding is not content.
+    ASSERT_EQ(entry->total_size(), 40100);
+    ASSERT_EQ(entry->file(1).attr, "p");
+
+    const auto result = entry->to_torrent();
+    ASSERT_EQ(fmt::format("{}", result), fmt::format("{}", t));
+    const auto& files = std::get<torrent::multi_file_info>(result.info).files;
+    ASSERT_EQ(files[1].is_padding(), true);
+    ASSERT_EQ(files[2].is_padding(), false);
+    ASSERT_EQ(result.info_hash_v2, root);
+    ASSERT_EQ(result.info_v2.has_value(), true);
+    ASSERT_EQ(result.info_v2->piece_length, 32768);
+    ASSERT_EQ(result.info_v2->files.size(), 2);
+    ASSERT_EQ(result.info_v2->files[0].path, "a");
+    ASSERT_EQ(result.info_v2->files[0].pieces_root.has_value(), false);
+    ASSERT_EQ(result.info_v2->files[1].length, 40000);
+    ASSERT_EQ(result.info_v2->files[1].pieces_root, root);
+    ASSERT_EQ(result.piece_layers, t.piece_layers);
+}
+
+TEST_F(MetadataCache, V1OnlyHasNoV2Metadata) {
+    const auto path = add_torrent("alice.torrent");
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 1);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    const auto result = cache->find(path.string())->to_torrent();
+    ASSERT_EQ(result.info_v2.has_value(), false);
+    ASSERT_EQ(result.info_hash_v2.has_value(), false);
+    ASSERT_EQ(result.piece_layers.empty(), true);
+}
+
+TEST_F(MetadataCache, ReusesUnchangedFiles) {
+    const auto path = add_torrent("alice.torrent");
+    add_torrent("copy.torrent");
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 2);
+
+    auto stats = cache::refresh(cache_path(), torrents_);
+    ASSERT_EQ(stats->reused, 2);
+    ASSERT_EQ(stats->parsed, 0);
+
+    // Touched but identical: hashed, not parsed.
+    std::filesystem::last_write_time(
+        path, std::filesystem::last_write_time(path) + std::chrono::hours{1});
+    stats = cache::refresh(cache_path(), torrents_);
+    ASSERT_EQ(stats->reused, 1);
+    ASSERT_EQ(stats->rehashed, 1);
+    ASSERT_EQ(stats->parsed, 0);
+}
+
+TEST_F(MetadataCache, ReparsesChangedFiles) {
+    const auto path = add_torrent("alice.torrent");
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 1);
+
+    std::ofstream{path, std::ios::binary | std::ios::trunc}
+        << "d8:announce3:new4:infod6:lengthi5e4:name1:x12:piece lengthi16e"
+           "6:pieces20:xxxxxxxxxxxxxxxxxxxxee";
+    const auto stats = cache::refresh(cache_path(), torrents_);
+    ASSERT_EQ(stats->parsed, 1);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    ASSERT_EQ(cache->find(path.string())->announce(), "new");
+}
+
+TEST_F(MetadataCache, DropsRemovedFiles) {
+    add_torrent("alice.torrent");
+    const auto removed = add_torrent("removed.torrent");
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 2);
+
+    torrents_.pop_back();
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->reused, 1);
+
+    const auto cache = cache::metadata_cache::open(cache_path());
+    ASSERT_EQ(cache->size(), 1);
+    ASSERT_EQ(cache->find(removed.string()).has_value(), false);
+}
+
+TEST_F(MetadataCache, CountsFailures) {
+    add_torrent("alice.torrent");
+    std::ofstream{root_ / "broken.torrent"} << "d4:infod";
+    torrents_.push_back(root_ / "broken.torrent");
+    torrents_.push_back(root_ / "missing.torrent");
+
+    const auto stats = cache::refresh(cache_path(), torrents_);
+    ASSERT_EQ(stats->parsed, 1);
+    ASSERT_EQ(stats->failed, 2);
+}
+
+TEST_F(MetadataCache, RejectsInvalidFiles) {
+    ASSERT_EQ(cache::metadata_cache::open(cache_path()).has_value(), false);
+
+    std::ofstream{cache_path()} << "not a cache";
+    ASSERT_EQ(cache::metadata_cache::open(cache_path()).has_value(), false);
+
+    add_torrent("alice.torrent");
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 1);
+    ASSERT_EQ(cache::metadata_cache::open(cache_path()).has_value(), true);
+
+    // A different version is rebuilt, not read.
+    {
+        auto file = std::fstream{cache_path(), std::ios::binary |
+                                                   std::ios::in |
+                                                   std::ios::out};
+        file.seekp(offsetof(cache::format::header, version));
+        file.put(static_cast<char>(cache::format::version + 1));
+    }
+    ASSERT_EQ(cache::metadata_cache::open(cache_path()).has_value(), false);
+    ASSERT_EQ(cache::refresh(cache_path(), torrents_)->parsed, 1);
+
+    // Tables that run past the end of the file.
+    std::filesystem::resize_file(cache_path(),
+                                 sizeof(cache::format::header) + 8);
+    ASSERT_EQ(cache::metadata_cache::open(cache_path()).has_value(), false);
+}
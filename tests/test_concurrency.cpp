@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <latch>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "thread_pool.h"
+
+TEST(ThreadPool, RunsEveryTask) {
+    auto count = std::atomic<std::size_t>{0};
+    {
+        auto pool = concurrency::thread_pool{4};
+        for (int i = 0; i < 1000; i++) {
+            pool.submit([&count] { count++; });
+        }
+    }
+    ASSERT_EQ(count.load(), 1000);
+}
+
+TEST(ThreadPool, TasksCanSubmitTasks) {
+    auto done = std::latch{100};
+    auto pool = concurrency::thread_pool{2};
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&] {
+            for (int j = 0; j < 10; j++) {
+                pool.submit([&done] { done.count_down(); });
+            }
+        });
+    }
+    done.wait();
+}
+
+TEST(ThreadPool, IdleWorkersSteal) {
+    auto ready = std::latch{4};
+    auto threads = std::set<std::thread::id>{};
+    auto mutex = std::mutex{};
+    auto pool = concurrency::thread_pool{4};
+
+    // One task fans out from a single worker's queue; the blocking latch
+    // only opens once four different workers have each picked one up.
+    pool.submit([&] {
+        for (int i = 0; i < 4; i++) {
+            pool.submit([&] {
+                {
+                    const auto lock = std::scoped_lock{mutex};
+                    threads.insert(std::this_thread::get_id());
+                }
+                ready.arrive_and_wait();
+            });
+        }
+    });
+    ready.wait();
+    ASSERT_EQ(threads.size(), 4);
+}
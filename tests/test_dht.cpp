@@ -0,0 +1,323 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "krpc.h"
+#include "node.h"
+#include "node_id.h"
+#include "routing_table.h"
+
+namespace {
+using boost::asio::use_awaitable;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using namespace std::chrono_literals;
+
+const auto localhost = boost::asio::ip::make_address_v4("127.0.0.1");
+
+void run(boost::asio::io_context& ctx, boost::asio::awaitable<void> body) {
+    auto failure = std::exception_ptr{};
+    boost::asio::co_spawn(ctx, std::move(body), [&](std::exception_ptr e) {
+        failure = e;
+        ctx.stop();
+    });
+    ctx.run();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+dht::node_id id_with(std::byte first) {
+    auto id = dht::node_id{};
+    id[0] = first;
+    return id;
+}
+
+// Nodes on loopback, each bootstrapped from the ones before it.
+struct swarm {
+    swarm(boost::asio::io_context& ctx, std::size_t size,
+          const dht::node_options& options) {
+        auto random = std::mt19937_64{7};
+        for (std::size_t i = 0; i < size; i++) {
+            nodes.push_back(std::make_unique<dht::node>(
+                ctx.get_executor(), udp::endpoint{localhost, 0},
+                dht::random_id(random), options));
+        }
+    }
+
+    boost::asio::awaitable<void> bootstrap() {
+        const auto first = std::array{nodes[0]->local_endpoint()};
+        for (std::size_t i = 1; i < nodes.size(); i++) {
+            co_await nodes[i]->bootstrap(first);
+        }
+    }
+
+    std::vector<std::unique_ptr<dht::node>> nodes;
+};
+
+// Sends one raw datagram to a node and returns its answer.
+boost::asio::awaitable<dht::message> query(udp::socket& socket,
+                                           const udp::endpoint& to,
+                                           const dht::message& q,
+                                           std::string& storage) {
+    auto packet = std::string{};
+    dht::encode(q, packet);
+    co_await socket.async_send_to(boost::asio::buffer(packet), to,
+                                  use_awaitable);
+    storage.resize(1500);
+    auto from = udp::endpoint{};
+    const auto n = co_await socket.async_receive_from(
+        boost::asio::buffer(storage), from, use_awaitable);
+    storage.resize(n);
+    auto reply = dht::message{};
+    EXPECT_TRUE(dht::decode(storage, reply));
+    co_return reply;
+}
+}  // namespace
+
+TEST(Dht, MeasuresDistance) {
+    const auto a = id_with(std::byte{0x80});
+    const auto b = id_with(std::byte{0x81});
+    EXPECT_EQ(dht::common_prefix(a, a), 160u);
+    EXPECT_EQ(dht::common_prefix(a, b), 7u);
+    EXPECT_EQ(dht::common_prefix(a, dht::node_id{}), 0u);
+    EXPECT_EQ(dht::distance(a, b), id_with(std::byte{0x01}));
+
+    const auto target = id_with(std::byte{0x83});
+    EXPECT_TRUE(dht::closer(target, b, a));
+    EXPECT_FALSE(dht::closer(target, a, b));
+    EXPECT_FALSE(dht::closer(target, a, a));
+}
+
+TEST(Dht, RoutingTableSplitsTowardsSelf) {
+    auto random = std::mt19937_64{1};
+    const auto self = dht::random_id(random);
+    auto table = dht::routing_table{self, 8};
+
+    auto all = std::vector<dht::node_entry>{};
+    for (std::uint16_t i = 0; i < 2000; i++) {
+        const auto n =
+            dht::node_entry{dht::random_id(random),
+                            udp::endpoint{localhost, std::uint16_t(i + 1)}};
+        if (table.heard_from(n)) {
+            all.push_back(n);
+        }
+    }
+    EXPECT_GT(table.bucket_count(), 1u);
+    EXPECT_EQ(table.size(), all.size());
+    EXPECT_LE(table.size(), table.bucket_count() * 8);
+
+    // Half of all ids fall in the farthest bucket, which keeps only k.
+    const auto far = std::count_if(all.begin(), all.end(), [&](auto& n) {
+        return dht::common_prefix(self, n.id) == 0;
+    });
+    EXPECT_EQ(far, 8);
+
+    const auto target = dht::random_id(random);
+    auto closest = std::array<dht::node_entry, 8>{};
+    ASSERT_EQ(table.closest(target, closest), 8u);
+    std::sort(all.begin(), all.end(), [&](auto& a, auto& b) {
+        return dht::closer(target, a.id, b.id);
+    });
+    for (std::size_t i = 0; i < closest.size(); i++) {
+        EXPECT_EQ(closest[i].id, all[i].id);
+    }
+}
+
+TEST(Dht, RoutingTableDropsFailingNodes) {
+    auto table = dht::routing_table{id_with(std::byte{0x00}), 2};
+    const auto a = dht::node_entry{id_with(std::byte{0x80}),
+                                   udp::endpoint{localhost, 1}};
+    const auto b = dht::node_entry{id_with(std::byte{0x81}),
+                                   udp::endpoint{localhost, 2}};
+    const auto c = dht::node_entry{id_with(std::byte{0x82}),
+                                   udp::endpoint{localhost, 3}};
+    EXPECT_TRUE(table.heard_from(a));
+    EXPECT_TRUE(table.heard_from(b));
+    // The bucket is full of nodes that still answer.
+    EXPECT_FALSE(table.heard_from(c));
+
+    table.failed(a.id);
+    EXPECT_TRUE(table.heard_from(c));
+    EXPECT_EQ(table.size(), 2u);
+
+    for (int i = 0; i < 3; i++) {
+        table.failed(b.id);
+    }
+    EXPECT_EQ(table.size(), 1u);
+}
+
+TEST(Dht, KrpcRoundTrips) {
+    auto q = dht::message{};
+    q.transaction = "aa";
+    q.id = id_with(std::byte{1});
+    q.method = dht::method::announce_peer;
+    q.target = id_with(std::byte{2});
+    q.port = 6881;
+    q.token = "secret";
+
+    auto packet = std::string{};
+    dht::encode(q, packet);
+    auto decoded = dht::message{};
+    ASSERT_TRUE(dht::decode(packet, decoded));
+    EXPECT_EQ(decoded.type, dht::message::kind::query);
+    EXPECT_EQ(decoded.transaction, "aa");
+    EXPECT_EQ(decoded.method, dht::method::announce_peer);
+    EXPECT_EQ(decoded.id, q.id);
+    EXPECT_EQ(decoded.target, q.target);
+    EXPECT_EQ(decoded.port, 6881);
+    EXPECT_EQ(decoded.token, "secret");
+
+    auto nodes = std::string{};
+    dht::append_node(nodes, {id_with(std::byte{3}),
+                             udp::endpoint{localhost, 1234}});
+    auto r = dht::message{};
+    r.type = dht::message::kind::response;
+    r.transaction = "bb";
+    r.id = id_with(std::byte{4});
+    r.nodes = nodes;
+    r.token = "tok";
+    r.values.emplace_back(localhost, 6882);
+    dht::encode(r, packet);
+    ASSERT_TRUE(dht::decode(packet, decoded));
+    EXPECT_EQ(decoded.type, dht::message::kind::response);
+    EXPECT_EQ(decoded.token, "tok");
+    ASSERT_EQ(decoded.values.size(), 1u);
+    EXPECT_EQ(decoded.values[0], tcp::endpoint(localhost, 6882));
+    auto learned = std::vector<dht::node_entry>{};
+    ASSERT_TRUE(dht::decode_nodes(decoded.nodes, learned));
+    ASSERT_EQ(learned.size(), 1u);
+    EXPECT_EQ(learned[0].id, id_with(std::byte{3}));
+    EXPECT_EQ(learned[0].endpoint, udp::endpoint(localhost, 1234));
+
+    EXPECT_FALSE(dht::decode("d1:t2:aa1:y1:qe", decoded));
+    EXPECT_FALSE(dht::decode("not bencode", decoded));
+}
+
+TEST(Dht, AnnouncedPeersAreFound) {
+    auto ctx = boost::asio::io_context{};
+    auto s = swarm{ctx, 256, {.timeout = 500ms, .rate_limit = 0}};
+    const auto info_hash = id_with(std::byte{0x5a});
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        co_await s.bootstrap();
+
+        auto peers = std::vector<tcp::endpoint>{};
+        const auto announced =
+            co_await s.nodes[17]->announce(info_hash, 6881, peers);
+        EXPECT_TRUE(peers.empty());
+        EXPECT_EQ(announced.announced, 8u);
+
+        const auto found = co_await s.nodes[200]->get_peers(info_hash, peers);
+        EXPECT_EQ(peers, std::vector{tcp::endpoint(localhost, 6881)});
+        EXPECT_GE(found.hops, 1u);
+        EXPECT_LE(found.hops, 6u);
+        EXPECT_EQ(found.responses, found.queries);
+        // Far fewer than asking everyone.
+        EXPECT_LT(found.queries, 64u);
+    }());
+
+    for (const auto& n : s.nodes) {
+        EXPECT_GT(n->table().size(), 0u);
+    }
+}
+
+TEST(Dht, LookupsRouteAroundDeadNodes) {
+    auto ctx = boost::asio::io_context{};
+    auto s = swarm{ctx, 64, {.timeout = 100ms, .rate_limit = 0}};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        co_await s.bootstrap();
+        for (std::size_t i = 1; i < s.nodes.size(); i += 2) {
+            s.nodes[i]->close();
+        }
+        const auto result = co_await s.nodes[0]->find_node(s.nodes[2]->id());
+        EXPECT_LT(result.responses, result.queries);
+        EXPECT_GT(result.responses, 0u);
+    }());
+}
+
+TEST(Dht, RejectsBadTokens) {
+    auto ctx = boost::asio::io_context{};
+    auto n = dht::node{ctx.get_executor(), udp::endpoint{localhost, 0},
+                       id_with(std::byte{1})};
+    auto socket = udp::socket{ctx, udp::endpoint{localhost, 0}};
+    const auto info_hash = id_with(std::byte{2});
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        auto storage = std::string{};
+        auto q = dht::message{};
+        q.transaction = "t1";
+        q.id = id_with(std::byte{3});
+        q.method = dht::method::announce_peer;
+        q.target = info_hash;
+        q.port = 7000;
+        q.token = "forged!!";
+        auto reply = co_await query(socket, n.local_endpoint(), q, storage);
+        EXPECT_EQ(reply.type, dht::message::kind::error);
+        EXPECT_EQ(reply.error_code, dht::protocol_error);
+
+        q.method = dht::method::get_peers;
+        reply = co_await query(socket, n.local_endpoint(), q, storage);
+        EXPECT_EQ(reply.type, dht::message::kind::response);
+        EXPECT_TRUE(reply.values.empty());
+        const auto token = std::string{reply.token};
+
+        q.method = dht::method::announce_peer;
+        q.token = token;
+        reply = co_await query(socket, n.local_endpoint(), q, storage);
+        EXPECT_EQ(reply.type, dht::message::kind::response);
+
+        q.method = dht::method::get_peers;
+        reply = co_await query(socket, n.local_endpoint(), q, storage);
+        EXPECT_EQ(reply.values, std::vector{tcp::endpoint(localhost, 7000)});
+
+        q.method = dht::method::unknown;
+        reply = co_await query(socket, n.local_endpoint(), q, storage);
+        EXPECT_EQ(reply.type, dht::message::kind::error);
+        EXPECT_EQ(reply.error_code, dht::method_unknown);
+    }());
+}
+
+TEST(Dht, RateLimitsEachAddress) {
+    auto ctx = boost::asio::io_context{};
+    auto n = dht::node{ctx.get_executor(), udp::endpoint{localhost, 0},
+                       id_with(std::byte{1}), {.rate_limit = 5}};
+    auto socket = udp::socket{ctx, udp::endpoint{localhost, 0}};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        auto q = dht::message{};
+        q.transaction = "t1";
+        q.id = id_with(std::byte{3});
+        auto packet = std::string{};
+        dht::encode(q, packet);
+        for (int i = 0; i < 20; i++) {
+            co_await socket.async_send_to(boost::asio::buffer(packet),
+                                          n.local_endpoint(), use_awaitable);
+        }
+
+        auto timer = boost::asio::steady_timer{ctx, 200ms};
+        co_await timer.async_wait(use_awaitable);
+        EXPECT_EQ(n.packets_received(), 20u);
+        EXPECT_EQ(n.packets_sent(), 5u);
+    }());
+}
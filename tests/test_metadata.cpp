@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "encoder.h"
+#include "engine.h"
+#include "exchange.h"
+#include "extension.h"
+#include "fetcher.h"
+#include "message.h"
+#include "sha.h"
+#include "torrent.h"
+
+namespace {
+using boost::asio::ip::tcp;
+using namespace std::chrono_literals;
+
+const tcp::endpoint loopback{boost::asio::ip::make_address("127.0.0.1"), 0};
+
+template <typename Predicate>
+bool eventually(Predicate done, std::chrono::seconds timeout = 10s) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+// A multi-file info dictionary of several metadata pieces.
+std::string make_info(std::size_t files) {
+    auto info = std::string{};
+    auto e = bencode::encoder{std::back_inserter(info)};
+    e.begin_dict().string("files").begin_list();
+    for (std::size_t i = 0; i < files; i++) {
+        e.begin_dict()
+            .string("length")
+            .integer(static_cast<bencode::integer>(1000 + i))
+            .string("path")
+            .begin_list()
+            .string("directory")
+            .string("file" + std::to_string(i) + ".dat")
+            .end()
+            .end();
+    }
+    e.end();
+    e.string("name").string("content");
+    e.string("piece length").integer(262144);
+    e.string("pieces").string(std::string(20 * 8, 'x'));
+    e.end();
+    return info;
+}
+
+std::string_view piece_of(std::string_view info, std::uint32_t piece) {
+    return info.substr(piece * metadata::piece_size, metadata::piece_size);
+}
+}  // namespace
+
+TEST(Metadata, ExtensionMessagesRoundTrip) {
+    auto payload = std::string{};
+    metadata::encode(metadata::extension_handshake{3, 40000}, payload);
+    EXPECT_EQ(payload[0], 0);
+    const auto h = metadata::decode_extension_handshake(
+        std::string_view{payload}.substr(1));
+    ASSERT_TRUE(h.has_value());
+    EXPECT_EQ(h->ut_metadata, 3);
+    EXPECT_EQ(h->metadata_size, 40000u);
+
+    const auto data = std::string(1000, 'd');
+    metadata::encode(
+        7, {metadata::metadata_type::data, 2, 33768, std::string_view{data}},
+        payload);
+    EXPECT_EQ(payload[0], 7);
+    const auto m = metadata::decode_metadata_message(
+        std::string_view{payload}.substr(1));
+    ASSERT_TRUE(m.has_value());
+    EXPECT_EQ(m->type, metadata::metadata_type::data);
+    EXPECT_EQ(m->piece, 2u);
+    EXPECT_EQ(m->total_size, 33768u);
+    EXPECT_EQ(m->data, data);
+
+    EXPECT_FALSE(metadata::decode_metadata_message("d8:msg_typei9ee"));
+    EXPECT_FALSE(metadata::decode_metadata_message(
+        "d8:msg_typei1e5:piecei0ee"));
+
+    auto local = wire::handshake{};
+    EXPECT_FALSE(metadata::supports_extensions(local));
+    metadata::enable_extensions(local);
+    EXPECT_TRUE(metadata::supports_extensions(local));
+}
+
+TEST(Metadata, FetcherAssemblesPiecesInAnyOrder) {
+    const auto info = make_info(2000);
+    ASSERT_GT(info.size(), 4 * metadata::piece_size);
+
+    bool completed = false;
+    auto f = metadata::fetcher{crypto::sha1(info), [&] { completed = true; }};
+    EXPECT_FALSE(f.pick().has_value());
+    EXPECT_FALSE(f.set_size(metadata::max_metadata_size + 1));
+    ASSERT_TRUE(f.set_size(info.size()));
+    EXPECT_FALSE(f.set_size(info.size() + 1));
+    const auto count = static_cast<std::uint32_t>(f.piece_count());
+
+    for (auto i = count; i-- > 0;) {
+        EXPECT_FALSE(f.complete());
+        EXPECT_FALSE(f.received(i, piece_of(info, i).substr(1)));
+        EXPECT_TRUE(f.received(i, piece_of(info, i)));
+    }
+    EXPECT_TRUE(completed);
+    EXPECT_TRUE(f.complete());
+    EXPECT_TRUE(f.received(0, piece_of(info, 0)));
+    EXPECT_EQ(f.duplicates(), 1u);
+    EXPECT_FALSE(f.received(count, "x"));
+
+    EXPECT_EQ(f.info(), info);
+    const auto t = f.to_torrent();
+    ASSERT_TRUE(t.has_value());
+    EXPECT_EQ(t->info_hash, crypto::sha1(info));
+    const auto* multi = std::get_if<torrent::multi_file_info>(&t->info);
+    ASSERT_NE(multi, nullptr);
+    EXPECT_EQ(multi->files.size(), 2000u);
+}
+
+TEST(Metadata, FetcherStartsOverOnBadHash) {
+    const auto info = make_info(500);
+    auto f = metadata::fetcher{crypto::sha1(info)};
+    ASSERT_TRUE(f.set_size(info.size()));
+    const auto count = static_cast<std::uint32_t>(f.piece_count());
+
+    auto corrupt = std::string{piece_of(info, 1)};
+    corrupt[10] ^= 1;
+    for (std::uint32_t i = 0; i < count; i++) {
+        f.received(i, i == 1 ? std::string_view{corrupt} : piece_of(info, i));
+    }
+    EXPECT_FALSE(f.complete());
+    EXPECT_EQ(f.failures(), 1u);
+    EXPECT_FALSE(f.info().has_value());
+
+    for (std::uint32_t i = 0; i < count; i++) {
+        f.received(i, piece_of(info, i));
+    }
+    EXPECT_TRUE(f.complete());
+}
+
+TEST(Metadata, FetcherDoublesUpOnlyAtTheEnd) {
+    auto f = metadata::fetcher{crypto::sha1_digest{}};
+    ASSERT_TRUE(f.set_size(3 * metadata::piece_size));
+
+    EXPECT_EQ(f.pick(), 0u);
+    EXPECT_EQ(f.pick(), 1u);
+    EXPECT_EQ(f.pick(), 2u);
+    // Every piece asked for once: the oldest goes to a second peer.
+    EXPECT_EQ(f.pick(), 0u);
+    EXPECT_EQ(f.pick(), 1u);
+    EXPECT_EQ(f.pick(), 2u);
+    EXPECT_FALSE(f.pick().has_value());
+    // A peer with nothing in flight still gets work.
+    EXPECT_EQ(f.pick(true), 0u);
+
+    f.released(1);
+    f.released(1);
+    EXPECT_EQ(f.pick(), 1u);
+}
+
+TEST(Metadata, FetchesFromSeveralPeers) {
+    constexpr std::size_t seeders = 4;
+    const auto info = std::make_shared<const std::string>(make_info(5000));
+    const auto info_hash = crypto::sha1(*info);
+
+    auto local = wire::handshake{};
+    local.info_hash = info_hash;
+    metadata::enable_extensions(local);
+
+    auto server = session::engine{{.threads = 2}};
+    auto endpoints = std::vector<tcp::endpoint>{};
+    for (std::size_t i = 0; i < seeders; i++) {
+        endpoints.push_back(
+            server.listen(loopback, metadata::serve(info, local)));
+    }
+
+    std::atomic<bool> done{false};
+    const auto f = std::make_shared<metadata::fetcher>(
+        info_hash, [&] { done = true; });
+    auto client = session::engine{{.threads = 2}};
+    const auto handler = metadata::fetch(f, local);
+    for (const auto& endpoint : endpoints) {
+        client.connect(endpoint, local, handler);
+    }
+
+    ASSERT_TRUE(eventually([&] { return done.load(); }));
+    EXPECT_EQ(f->info(), *info);
+    EXPECT_EQ(f->failures(), 0u);
+    // Every connection closes once the metadata is in.
+    EXPECT_TRUE(eventually([&] { return client.connections() == 0; }));
+}
+
+TEST(Metadata, PeersWithoutExtensionsAreDropped) {
+    const auto info = std::make_shared<const std::string>(make_info(10));
+    auto local = wire::handshake{};
+    local.info_hash = crypto::sha1(*info);
+
+    auto server = session::engine{{.threads = 1}};
+    auto plain = local;
+    metadata::enable_extensions(local);
+    const auto endpoint =
+        server.listen(loopback, metadata::serve(info, local));
+
+    const auto f = std::make_shared<metadata::fetcher>(local.info_hash);
+    auto client = session::engine{{.threads = 1}};
+    client.connect(endpoint, plain, metadata::fetch(f, local));
+    EXPECT_TRUE(eventually([&] { return client.connections() == 0; }));
+    EXPECT_FALSE(f->complete());
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exporter.h"
+#include "metrics.h"
+
+namespace {
+std::string read_file(const std::filesystem::path& path) {
+    auto file = std::ifstream{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file},
+            std::istreambuf_iterator<char>{}};
+}
+
+class MetricsFile : public testing::Test {
+   protected:
+    void SetUp() override {
+        std::filesystem::remove_all(root_);
+        std::filesystem::create_directories(root_);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root_); }
+
+    std::filesystem::path write_config(const std::string& text) {
+        const auto path = root_ / "rush.toml";
+        std::ofstream{path} << text;
+        return path;
+    }
+
+    std::filesystem::path root_ =
+        std::filesystem::temp_directory_path() / "rush_metrics";
+};
+}  // namespace
+
+TEST(Histogram, Buckets) {
+    using metrics::histogram;
+    for (std::uint64_t v = 0; v < 16; v++) {
+        ASSERT_EQ(histogram::bucket_of(v), v);
+    }
+    ASSERT_EQ(histogram::bucket_of(16), 16);
+    ASSERT_EQ(histogram::bucket_of(31), 31);
+    ASSERT_EQ(histogram::bucket_of(32), 32);
+    ASSERT_EQ(histogram::bucket_of(33), 32);
+    ASSERT_EQ(histogram::bucket_of(~std::uint64_t{0}),
+              histogram::bucket_count - 1);
+
+    // Every bucket starts where the one before it ends.
+    for (std::size_t b = 1; b < histogram::bucket_count; b++) {
+        ASSERT_EQ(histogram::bucket_of(histogram::lowest(b)), b);
+        ASSERT_EQ(histogram::bucket_of(histogram::lowest(b) - 1), b - 1);
+    }
+}
+
+TEST(Histogram, Percentiles) {
+    auto h = metrics::histogram{};
+    ASSERT_EQ(h.read().percentile(0.5), 0);
+
+    for (std::uint64_t v = 1; v <= 1000; v++) {
+        h.record(v);
+    }
+    const auto s = h.read();
+    ASSERT_EQ(s.count, 1000);
+    ASSERT_EQ(s.sum, 500500);
+    ASSERT_EQ(s.max, 1000);
+    ASSERT_DOUBLE_EQ(s.mean(), 500.5);
+
+    // Within the 1/16 the buckets promise, and never below the truth.
+    for (const auto q : {0.5, 0.9, 0.99}) {
+        const auto exact = static_cast<double>(q * 1000);
+        const auto p = static_cast<double>(s.percentile(q));
+        ASSERT_GE(p, exact);
+        ASSERT_LE(p, exact * 17 / 16);
+    }
+    ASSERT_EQ(s.percentile(1.0), 1000);
+}
+
+TEST(Counter, ManyThreads) {
+    auto c = metrics::counter{};
+    auto h = metrics::histogram{};
+    {
+        auto threads = std::vector<std::jthread>{};
+        for (int t = 0; t < 32; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 10000; i++) {
+                    c.add();
+                    h.record(7);
+                }
+            });
+        }
+    }
+    ASSERT_EQ(c.value(), 320000);
+    ASSERT_EQ(h.read().count, 320000);
+    ASSERT_EQ(h.read().max, 7);
+}
+
+TEST(Registry, SameNameSameMetric) {
+    auto r = metrics::registry{};
+    auto& a = r.counter("a");
+    ASSERT_EQ(&a, &r.counter("a"));
+    a.add(3);
+    r.gauge("depth").set(5);
+    r.gauge("depth").add(-2);
+    r.histogram("latency").record(40);
+
+    const auto s = r.read();
+    ASSERT_EQ(s.counters.at("a"), 3);
+    ASSERT_EQ(s.gauges.at("depth"), 3);
+    ASSERT_EQ(s.histograms.at("latency").count, 1);
+}
+
+TEST(Timer, Disabled) {
+    auto h = metrics::histogram{};
+    metrics::set_enabled(false);
+    { const auto timer = metrics::scoped_timer{h}; }
+    metrics::set_enabled(true);
+    ASSERT_EQ(h.read().count, 0);
+    { const auto timer = metrics::scoped_timer{h}; }
+    ASSERT_EQ(h.read().count, 1);
+}
+
+TEST(Format, Snapshot) {
+    auto r = metrics::registry{};
+    r.counter("bytes").add(10);
+    r.gauge("depth").set(-1);
+    r.histogram("ns").record(3);
+
+    auto s = r.read();
+    s.time = std::chrono::system_clock::time_point{std::chrono::seconds{2}};
+    ASSERT_EQ(metrics::format_snapshot(s, metrics::format::json),
+              "{\"time\":2000,\"counters\":{\"bytes\":10},"
+              "\"gauges\":{\"depth\":-1},\"histograms\":{\"ns\":{"
+              "\"count\":1,\"mean\":3.0,\"p50\":3,\"p90\":3,\"p99\":3,"
+              "\"p999\":3,\"max\":3}}}\n");
+    ASSERT_EQ(metrics::format_snapshot(s, metrics::format::text),
+              "time 2000\nbytes 10\ndepth -1\nns.count 1\nns.mean 3.0\n"
+              "ns.p50 3\nns.p90 3\nns.p99 3\nns.p999 3\nns.max 3\n\n");
+}
+
+TEST_F(MetricsFile, LoadOptions) {
+    const auto options = metrics::load_options(
+        write_config("[metrics]\n"
+                     "file = \"out.txt\"\n"
+                     "format = \"text\"\n"
+                     "interval_ms = 250\n"));
+    ASSERT_EQ(options.has_value(), true);
+    ASSERT_EQ(options->path, "out.txt");
+    ASSERT_EQ(options->format, metrics::format::text);
+    ASSERT_EQ(options->interval, std::chrono::milliseconds{250});
+
+    const auto empty = metrics::load_options(write_config("\n"));
+    ASSERT_EQ(empty.has_value(), true);
+    ASSERT_EQ(empty->path.empty(), true);
+
+    auto error = metrics::config_error{};
+    ASSERT_EQ(metrics::load_options(
+                  write_config("[metrics]\nformat = \"xml\"\n"), &error)
+                  .has_value(),
+              false);
+    ASSERT_EQ(error.message.empty(), false);
+    ASSERT_EQ(
+        metrics::load_options(write_config("[metrics]\ninterval_ms = 0\n"))
+            .has_value(),
+        false);
+    ASSERT_EQ(metrics::load_options(root_ / "missing.toml").has_value(),
+              false);
+}
+
+TEST_F(MetricsFile, ExporterAppends) {
+    auto r = metrics::registry{};
+    r.counter("ticks").add(1);
+    const auto path = root_ / "metrics.jsonl";
+    {
+        auto exporter = metrics::exporter{
+            r, {path, metrics::format::json, std::chrono::milliseconds{1}}};
+        while (read_file(path).empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+
+    // A line per snapshot, the last one written on destruction.
+    const auto text = read_file(path);
+    ASSERT_GE(std::count(text.begin(), text.end(), '\n'), 2);
+    ASSERT_EQ(text.ends_with("\"counters\":{\"ticks\":1},\"gauges\":{},"
+                             "\"histograms\":{}}\n"),
+              true);
+}
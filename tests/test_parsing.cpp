@@ -1,11 +1,35 @@
 #include <gtest/gtest.h>
 
+#include <fmt/format.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <variant>
+#include <vector>
 
 #include "bencode.h"
+#include "decoder.h"
+#include "document.h"
+#include "encoder.h"
+#include "json.h"
+#include "push_parser.h"
+#include "tape.h"
 
-TEST(BencodeParsing, PositiveInteger) {
-    const auto result = bencode::parse_literal("i1234e");
+class BencodeParsing : public ::testing::TestWithParam<bencode::backend> {};
+
+INSTANTIATE_TEST_SUITE_P(Backends, BencodeParsing,
+                         ::testing::Values(bencode::backend::lexy,
+                                           bencode::backend::fast));
+
+TEST_P(BencodeParsing, PositiveInteger) {
+    const auto result = bencode::parse_literal("i1234e", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -19,8 +43,8 @@ TEST(BencodeParsing, PositiveInteger) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, NegativeInteger) {
-    const auto result = bencode::parse_literal("i-1234e");
+TEST_P(BencodeParsing, NegativeInteger) {
+    const auto result = bencode::parse_literal("i-1234e", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -34,15 +58,15 @@ TEST(BencodeParsing, NegativeInteger) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, NonBencodeInput) {
-    const auto result = bencode::parse_literal("random_text");
+TEST_P(BencodeParsing, NonBencodeInput) {
+    const auto result = bencode::parse_literal("random_text", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, false);
 }
 
-TEST(BencodeParsing, String) {
-    const auto result = bencode::parse_literal("5:abcde");
+TEST_P(BencodeParsing, String) {
+    const auto result = bencode::parse_literal("5:abcde", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -56,8 +80,20 @@ TEST(BencodeParsing, String) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, List) {
-    const auto result = bencode::parse_literal("li123e3:fooe");
+TEST_P(BencodeParsing, StringWithEmbeddedNul) {
+    const auto result =
+        bencode::parse_literal(std::string_view{"5:ab\0de", 7}, GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto actual = std::get<bencode::string>(result.value());
+    const bencode::string expected{"ab\0de", 5};
+    ASSERT_EQ(actual, expected);
+}
+
+TEST_P(BencodeParsing, List) {
+    const auto result = bencode::parse_literal("li123e3:fooe", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -73,8 +109,9 @@ TEST(BencodeParsing, List) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, NestedList) {
-    const auto result = bencode::parse_literal("li123e3:fooli456e3:baree");
+TEST_P(BencodeParsing, NestedList) {
+    const auto result =
+        bencode::parse_literal("li123e3:fooli456e3:baree", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -96,8 +133,8 @@ TEST(BencodeParsing, NestedList) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, Dictionary) {
-    const auto result = bencode::parse_literal("d3:fooi123ee");
+TEST_P(BencodeParsing, Dictionary) {
+    const auto result = bencode::parse_literal("d3:fooi123ee", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -113,8 +150,9 @@ TEST(BencodeParsing, Dictionary) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, NestedDictionary) {
-    const auto result = bencode::parse_literal("d3:fooi123e3:bard3:bazi456eee");
+TEST_P(BencodeParsing, NestedDictionary) {
+    const auto result =
+        bencode::parse_literal("d3:fooi123e3:bard3:bazi456eee", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -135,8 +173,9 @@ TEST(BencodeParsing, NestedDictionary) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, ListInNestedDictionary) {
-    const auto result = bencode::parse_literal("d3:food3:barl3:bari42eeee");
+TEST_P(BencodeParsing, ListInNestedDictionary) {
+    const auto result =
+        bencode::parse_literal("d3:food3:barl3:bari42eeee", GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -159,10 +198,11 @@ TEST(BencodeParsing, ListInNestedDictionary) {
     ASSERT_EQ(actual, expected);
 }
 
-TEST(BencodeParsing, Foo) {
+TEST_P(BencodeParsing, Foo) {
     const auto result = bencode::parse_literal(
         "d13:creation "
-        "datei1458348895130e8:encoding5:UTF-84:infod5:filesli42eeee");
+        "datei1458348895130e8:encoding5:UTF-84:infod5:filesli42eeee",
+        GetParam());
 
     const auto is_successful = result.has_value();
     ASSERT_EQ(is_successful, true);
@@ -171,3 +211,547 @@ TEST(BencodeParsing, Foo) {
         std::holds_alternative<bencode::dictionary>(result.value());
     ASSERT_EQ(is_dictionary, true);
 }
+
+TEST_P(BencodeParsing, EmptyContainers) {
+    const auto result = bencode::parse_literal("ld0:lee0:e", GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    auto expected_nested = bencode::dictionary{};
+    expected_nested.insert({"", bencode::list{}});
+
+    auto expected = bencode::list{};
+    expected.push_back(expected_nested);
+    expected.push_back("");
+
+    ASSERT_EQ(std::get<bencode::list>(result.value()), expected);
+}
+
+TEST_P(BencodeParsing, LongIntegers) {
+    const auto result = bencode::parse_literal(
+        "li9223372036854775807ei-9223372036854775808ei000123456789012ee",
+        GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    auto expected = bencode::list{};
+    expected.push_back(INT64_MAX);
+    expected.push_back(INT64_MIN);
+    expected.push_back(123456789012);
+
+    ASSERT_EQ(std::get<bencode::list>(result.value()), expected);
+}
+
+TEST_P(BencodeParsing, IntegerOverflow) {
+    const auto result =
+        bencode::parse_literal("i9223372036854775808e", GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, false);
+}
+
+TEST_P(BencodeParsing, TruncatedString) {
+    const auto result = bencode::parse_literal("l10:abcdee", GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, false);
+}
+
+TEST_P(BencodeParsing, File) {
+    const auto result =
+        bencode::parse(RUSH_TEST_RESOURCES "/alice.torrent", GetParam());
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto reference = bencode::parse(RUSH_TEST_RESOURCES "/alice.torrent",
+                                          bencode::backend::lexy);
+    ASSERT_EQ(result, reference);
+}
+
+TEST(BencodeDocument, StringsAreViewsIntoInput) {
+    const std::string_view input = "l5:abcdei42ee";
+    const auto result = bencode::parse_document(input);
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto& root = result->root();
+    ASSERT_EQ(root.is_list(), true);
+    ASSERT_EQ(root.as_list().size(), 2);
+
+    const auto actual = root.as_list()[0].as_string();
+    ASSERT_EQ(actual, "abcde");
+    ASSERT_EQ(actual.data(), input.data() + 3);
+    ASSERT_EQ(root.as_list()[1].as_integer(), 42);
+}
+
+TEST(BencodeDocument, DictionaryLookup) {
+    const auto result =
+        bencode::parse_document("d3:bari-7e3:food3:bazli1eleeee");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto* bar = result->root().find("bar");
+    ASSERT_NE(bar, nullptr);
+    ASSERT_EQ(bar->as_integer(), -7);
+
+    const auto* foo = result->root().find("foo");
+    ASSERT_NE(foo, nullptr);
+    ASSERT_EQ(foo->is_dictionary(), true);
+
+    const auto* baz = foo->find("baz");
+    ASSERT_NE(baz, nullptr);
+    ASSERT_EQ(baz->as_list().size(), 2);
+    ASSERT_EQ(baz->as_list()[1].as_list().empty(), true);
+
+    ASSERT_EQ(result->root().find("missing"), nullptr);
+}
+
+TEST(BencodeDocument, ToValue) {
+    const auto result = bencode::parse_document("d3:food3:barl3:bari42eeee");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    auto expected_nested_list = bencode::list{};
+    expected_nested_list.push_back("bar");
+    expected_nested_list.push_back(42);
+
+    auto expected_nested = bencode::dictionary{};
+    expected_nested.insert({"bar", expected_nested_list});
+
+    auto expected = bencode::dictionary{};
+    expected.insert({"foo", expected_nested});
+
+    const auto actual = bencode::to_value(result->root());
+    ASSERT_EQ(actual, bencode::value{expected});
+}
+
+TEST(BencodeDocument, TruncatedInput) {
+    ASSERT_EQ(bencode::parse_document("l5:abce").has_value(), false);
+    ASSERT_EQ(bencode::parse_document("d3:fooe").has_value(), false);
+    ASSERT_EQ(bencode::parse_document("i12").has_value(), false);
+    ASSERT_EQ(bencode::parse_document("").has_value(), false);
+}
+
+TEST(BencodeDocument, LoadFile) {
+    const auto result =
+        bencode::load_document(RUSH_TEST_RESOURCES "/alice.torrent");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto* info = result->root().find("info");
+    ASSERT_NE(info, nullptr);
+
+    const auto* pieces = info->find("pieces");
+    ASSERT_NE(pieces, nullptr);
+    ASSERT_EQ(pieces->as_string().size(), 200);
+
+    const auto* name = info->find("name");
+    ASSERT_NE(name, nullptr);
+    ASSERT_EQ(name->as_string(), "alice.txt");
+}
+
+namespace {
+struct event_recorder {
+    void begin_list() { events += "[l"; }
+    void begin_dict() { events += "[d"; }
+    void end() { events += "]"; }
+    void integer(bencode::integer i) {
+        events += "(" + std::to_string(i) + ")";
+    }
+    void key(std::size_t length) { events += "k" + std::to_string(length); }
+    void string(std::size_t length) { events += "s" + std::to_string(length); }
+    void string_chunk(std::string_view data, bool last) {
+        text += data;
+        if (last) {
+            events += "'" + text + "'";
+            text.clear();
+        }
+    }
+
+    std::string events;
+    std::string text;
+};
+}  // namespace
+
+TEST(BencodePushParser, WholeInput) {
+    const std::string_view input = "d3:fooli-12e3:bare3:bazdee";
+    auto recorder = event_recorder{};
+    auto parser = bencode::push_parser{recorder};
+
+    ASSERT_EQ(parser.feed(input), input.size());
+    ASSERT_EQ(parser.finish(), true);
+    ASSERT_EQ(recorder.events, "[dk3'foo'[l(-12)s3'bar']k3'baz'[d]]");
+}
+
+TEST(BencodePushParser, ByteAtATime) {
+    const std::string_view input = "d4:infod6:lengthi163783e4:name0:ee";
+
+    auto whole = event_recorder{};
+    auto whole_parser = bencode::push_parser{whole};
+    whole_parser.feed(input);
+    ASSERT_EQ(whole_parser.finish(), true);
+
+    auto split = event_recorder{};
+    auto split_parser = bencode::push_parser{split};
+    for (std::size_t i = 0; i < input.size(); i++) {
+        ASSERT_EQ(split_parser.feed(input.substr(i, 1)), 1);
+    }
+    ASSERT_EQ(split_parser.finish(), true);
+
+    ASSERT_EQ(split.events, whole.events);
+}
+
+TEST(BencodePushParser, BinaryStringSplitAcrossChunks) {
+    const std::string_view input{"l6:a\0b\0cde", 11};
+    auto recorder = event_recorder{};
+    auto parser = bencode::push_parser{recorder};
+
+    parser.feed(input.substr(0, 5));
+    parser.feed(input.substr(5));
+    ASSERT_EQ(parser.finish(), true);
+    const auto expected = "[ls6'" + std::string{"a\0b\0cd", 6} + "']";
+    ASSERT_EQ(recorder.events, expected);
+}
+
+TEST(BencodePushParser, StopsAtEndOfValue) {
+    const std::string_view input = "d1:ai1ee<raw piece data>";
+    auto recorder = event_recorder{};
+    auto parser = bencode::push_parser{recorder};
+
+    ASSERT_EQ(parser.feed(input), 8);
+    ASSERT_EQ(parser.state(), decltype(parser)::status::complete);
+}
+
+TEST(BencodePushParser, ReportsErrorOffset) {
+    auto recorder = event_recorder{};
+    auto parser = bencode::push_parser{recorder};
+
+    parser.feed("li12");
+    parser.feed("xe");
+    ASSERT_EQ(parser.state(), decltype(parser)::status::error);
+    ASSERT_EQ(parser.error()->offset, 4);
+}
+
+TEST(BencodePushParser, IncompleteInput) {
+    auto recorder = event_recorder{};
+    auto parser = bencode::push_parser{recorder};
+
+    parser.feed("l3:ab");
+    ASSERT_EQ(parser.finish(), false);
+    ASSERT_EQ(parser.error().has_value(), true);
+}
+
+TEST(BencodeEncoder, SortsDictionaryKeys) {
+    auto nested = bencode::list{};
+    nested.push_back(-3);
+    nested.push_back("x");
+
+    auto input = bencode::dictionary{};
+    input.insert({"zeta", 1});
+    input.insert({"alpha", nested});
+    input.insert({"mid", bencode::dictionary{}});
+
+    auto actual = std::string{};
+    bencode::encode(bencode::value{input}, std::back_inserter(actual));
+    ASSERT_EQ(actual, "d5:alphali-3e1:xe3:midde4:zetai1ee");
+    ASSERT_EQ(bencode::encoded_size(bencode::value{input}), actual.size());
+}
+
+TEST(BencodeEncoder, IntoCallerBuffer) {
+    char buffer[16];
+    auto out = bencode::encoder{std::begin(buffer)};
+    out.begin_list().integer(0).string("ab").end();
+
+    const auto actual = std::string_view{buffer, out.out()};
+    ASSERT_EQ(actual, "li0e2:abe");
+}
+
+TEST(BencodeEncoder, DocumentRoundTrip) {
+    const std::string_view input = "d3:food3:barl3:bari42eee4:infod1:ai1eee";
+    const auto document = bencode::parse_document(input);
+    ASSERT_EQ(document.has_value(), true);
+
+    auto actual = std::string{};
+    bencode::encode(document->root(), std::back_inserter(actual));
+    ASSERT_EQ(actual, input);
+}
+
+TEST(BencodeDocument, RawMember) {
+    const std::string_view input = "d8:announce3:url4:infod1:ali1ei2eee1:zi0ee";
+    const auto document = bencode::parse_document(input);
+    ASSERT_EQ(document.has_value(), true);
+
+    ASSERT_EQ(document->raw_member("info"), "d1:ali1ei2eee");
+    ASSERT_EQ(document->raw_member("announce"), "3:url");
+    ASSERT_EQ(document->raw_member("z"), "i0e");
+    ASSERT_EQ(document->raw_member("missing").has_value(), false);
+}
+
+TEST(BencodeTape, Scalars) {
+    const auto result = bencode::parse_tape(
+        "li42ei-9223372036854775808e3:abc0:i36028797018963968ee");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto list = result->root().as_list();
+    ASSERT_EQ(list.size(), 5);
+
+    auto it = list.begin();
+    ASSERT_EQ((*it++).as_integer(), 42);
+    ASSERT_EQ((*it++).as_integer(), INT64_MIN);
+    ASSERT_EQ((*it++).as_string(), "abc");
+    ASSERT_EQ((*it++).as_string(), "");
+    ASSERT_EQ((*it++).as_integer(), 36028797018963968);
+    ASSERT_EQ(it == list.end(), true);
+}
+
+TEST(BencodeTape, DictionaryLookup) {
+    const auto result =
+        bencode::parse_tape("d3:bari-7e3:food3:bazli1eleee3:quxi0ee");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto root = result->root().as_dict();
+    ASSERT_EQ(root.size(), 3);
+    ASSERT_EQ(root.find("bar")->as_integer(), -7);
+    ASSERT_EQ(root.find("qux")->as_integer(), 0);
+    ASSERT_EQ(root.contains("missing"), false);
+
+    const auto foo = root.find("foo");
+    ASSERT_EQ(foo.has_value(), true);
+    ASSERT_EQ(foo->raw(), "d3:bazli1eleee");
+
+    const auto baz = foo->as_dict().find("baz");
+    ASSERT_EQ(baz->as_list().size(), 2);
+}
+
+TEST(BencodeTape, SortsUnsortedKeys) {
+    const std::string_view input = "d1:cd1:zi1e1:ai2ee1:bi3e1:ali4eee";
+    const auto result = bencode::parse_tape(input);
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    auto keys = std::string{};
+    for (const auto& [key, value] : result->root().as_dict()) {
+        keys += key;
+    }
+    ASSERT_EQ(keys, "abc");
+
+    const auto c = result->root().as_dict().find("c");
+    ASSERT_EQ(c->as_dict().find("a")->as_integer(), 2);
+    ASSERT_EQ(c->as_dict().find("z")->as_integer(), 1);
+    ASSERT_EQ(c->raw(), "d1:zi1e1:ai2ee");
+    ASSERT_EQ(result->root().as_dict().find("a")->as_list().size(), 1);
+
+    const auto actual = bencode::to_value(result->root());
+    ASSERT_EQ(actual, bencode::parse_literal(input, bencode::backend::fast));
+}
+
+TEST(BencodeTape, LoadFile) {
+    const auto result =
+        bencode::load_tape(RUSH_TEST_RESOURCES "/alice.torrent");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto info = result->root().as_dict().find("info");
+    ASSERT_EQ(info.has_value(), true);
+    ASSERT_EQ(info->as_dict().find("pieces")->as_string().size(), 200);
+    ASSERT_EQ(info->as_dict().find("name")->as_string(), "alice.txt");
+    ASSERT_LT(result->size_in_bytes(), result->source().size());
+}
+
+TEST(BencodeTape, ReportsErrors) {
+    auto error = bencode::parse_error{};
+    const auto result = bencode::parse_tape("d3:fooi12x", &error);
+
+    ASSERT_EQ(result.has_value(), false);
+    ASSERT_EQ(error.offset, 9);
+    ASSERT_EQ(error.message, "expected 'e'");
+
+    ASSERT_EQ(bencode::load_tape("/does/not/exist", &error).has_value(), false);
+    ASSERT_EQ(error.message, "could not open file");
+}
+
+TEST(BencodeTape, Arena) {
+    auto arena = std::pmr::monotonic_buffer_resource{};
+    const auto result = bencode::parse_tape("li1ei2ee", nullptr, &arena);
+
+    ASSERT_EQ(result.has_value(), true);
+    ASSERT_EQ(result->root().as_list().size(), 2);
+}
+
+TEST(BencodePrinter, Format) {
+    const auto value =
+        bencode::parse_literal("li-3e3:fooli1ei2eeleee", bencode::backend::fast)
+            .value();
+
+    ASSERT_EQ(fmt::format("{}", value), "[-3, foo, [1, 2], []]");
+    ASSERT_EQ(fmt::format("{}", std::get<bencode::list>(value)),
+              "[-3, foo, [1, 2], []]");
+}
+
+TEST(BencodePrinter, Dictionary) {
+    const auto value =
+        bencode::parse_literal("d3:keyi7ee", bencode::backend::fast).value();
+
+    ASSERT_EQ(fmt::format("{}", value), "{key: 7}");
+    ASSERT_EQ(fmt::format("{}", std::get<bencode::dictionary>(value)),
+              "{key: 7}");
+}
+
+namespace {
+std::string to_json(std::string_view input, bencode::binary_format binary =
+                                                bencode::binary_format::hex) {
+    auto stream = std::istringstream{std::string{input}};
+    auto result = std::string{};
+    if (!bencode::write_json(stream, std::back_inserter(result), binary)) {
+        return "<error>";
+    }
+    return result;
+}
+}  // namespace
+
+TEST(BencodeJson, Structure) {
+    ASSERT_EQ(to_json("d1:ali1ei-2ee1:bde1:c0:e"),
+              R"({"a":[1,-2],"b":{},"c":""})");
+    ASSERT_EQ(to_json("le"), "[]");
+}
+
+TEST(BencodeJson, EscapesText) {
+    ASSERT_EQ(to_json("7:a\"b\\\nc\x01"), R"("a\"b\\\nc\u0001")");
+    ASSERT_EQ(to_json("4:\xc3\xa9t\xc3"), R"({"hex":"c3a974c3"})");
+    ASSERT_EQ(to_json("2:\xc3\xa9"), "\"\xc3\xa9\"");
+}
+
+TEST(BencodeJson, BinaryStrings) {
+    const auto hex = std::string{"5:\x00\xff\x10zz", 7};
+    ASSERT_EQ(to_json(hex), R"({"hex":"00ff107a7a"})");
+    ASSERT_EQ(to_json(hex, bencode::binary_format::base64),
+              R"({"base64":"AP8Qeno="})");
+
+    const auto key = std::string{"d2:\xff\xfei1ee", 10};
+    ASSERT_EQ(to_json(key), R"({"fffe":1})");
+}
+
+TEST(BencodeJson, LongStringsStreamAsBinary) {
+    const auto length = bencode::json_writer<char*>::inline_limit + 1;
+    const auto input = std::to_string(length) + ":" + std::string(length, 'a');
+
+    auto expected = std::string{R"({"base64":")"};
+    for (std::size_t i = 0; i < length / 3; i++) {
+        expected += "YWFh";
+    }
+    expected += "YWE=\"}";
+    ASSERT_EQ(to_json(input, bencode::binary_format::base64), expected);
+}
+
+TEST(BencodeJson, InvalidInput) {
+    ASSERT_EQ(to_json("d1:a"), "<error>");
+    ASSERT_EQ(to_json("x"), "<error>");
+}
+
+TEST(BencodeJson, File) {
+    auto file = std::ifstream{RUSH_TEST_RESOURCES "/alice.torrent",
+                              std::ios::binary};
+    auto result = std::string{};
+    ASSERT_EQ(bencode::write_json(file, std::back_inserter(result)).has_value(),
+              true);
+    const auto expected_start = R"({"creation date":1452468725091,)";
+    ASSERT_EQ(result.starts_with(expected_start), true);
+    ASSERT_NE(result.find(R"("pieces":{"hex":")"), std::string::npos);
+}
+
+namespace {
+struct endpoint {
+    bencode::string host;
+    bencode::integer port = 0;
+    std::optional<bencode::integer> weight;
+};
+
+struct service {
+    bencode::string name;
+    std::vector<endpoint> endpoints;
+};
+}  // namespace
+
+template <>
+struct bencode::schema<endpoint> {
+    static constexpr auto fields = std::tuple{
+        bencode::required("host", &endpoint::host),
+        bencode::required("port", &endpoint::port),
+        bencode::field("weight", &endpoint::weight),
+    };
+};
+
+template <>
+struct bencode::schema<service> {
+    static constexpr auto fields = std::tuple{
+        bencode::field("endpoints", &service::endpoints),
+        bencode::required("name", &service::name),
+    };
+};
+
+TEST(BencodeDecoder, FillsStructs) {
+    auto d = bencode::decoder{
+        "d9:endpointsld4:host1:a4:porti80eed4:host1:b4:porti81e"
+        "6:weighti3eee4:name3:webe"};
+    auto result = service{};
+    ASSERT_TRUE(bencode::decode(d, result));
+    EXPECT_TRUE(d.at_end());
+    EXPECT_EQ(result.name, "web");
+    ASSERT_EQ(result.endpoints.size(), 2u);
+    EXPECT_EQ(result.endpoints[0].host, "a");
+    EXPECT_EQ(result.endpoints[0].port, 80);
+    EXPECT_FALSE(result.endpoints[0].weight.has_value());
+    EXPECT_EQ(result.endpoints[1].weight, 3);
+}
+
+TEST(BencodeDecoder, SkipsUnknownKeys) {
+    auto d = bencode::decoder{
+        "d5:extrald1:xli1eee3:abce4:name3:web5:zzzzzi-4ee"};
+    auto result = service{};
+    ASSERT_TRUE(bencode::decode(d, result));
+    EXPECT_EQ(result.name, "web");
+    EXPECT_TRUE(result.endpoints.empty());
+}
+
+TEST(BencodeDecoder, ReportsOffsets) {
+    const auto input = std::string_view{"d9:endpointsld4:host1:a4:port2:80eee"};
+    auto d = bencode::decoder{input};
+    auto result = service{};
+    ASSERT_FALSE(bencode::decode(d, result));
+    EXPECT_EQ(d.error().offset, input.find("2:80"));
+    EXPECT_EQ(d.error().message, "expected integer");
+
+    // Later failures keep the first error.
+    EXPECT_FALSE(d.fail("another"));
+    EXPECT_EQ(d.error().message, "expected integer");
+
+    auto missing = bencode::decoder{"d9:endpointsld4:host1:aeee"};
+    ASSERT_FALSE(bencode::decode(missing, result));
+    EXPECT_EQ(missing.error().offset, 13);
+    EXPECT_EQ(missing.error().message, "missing required key");
+
+    auto truncated = bencode::decoder{"d4:name3:web5:extral"};
+    ASSERT_FALSE(bencode::decode(truncated, result));
+    EXPECT_EQ(truncated.error().offset, 20);
+}
+
+TEST(BencodeDecoder, Values) {
+    auto d = bencode::decoder{"ld1:ai1eeli2e1:bee"};
+    auto result = bencode::list{};
+    ASSERT_TRUE(bencode::decode(d, result));
+    ASSERT_EQ(result.size(), 2u);
+    EXPECT_EQ(fmt::format("{}", result), "[{a: 1}, [2, b]]");
+}
@@ -0,0 +1,269 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bitfield.h"
+#include "layout.h"
+#include "piece_picker.h"
+#include "piece_set.h"
+#include "torrent.h"
+
+namespace {
+picker::piece_set make_set(std::size_t size,
+                           std::initializer_list<std::size_t> pieces) {
+    auto result = picker::piece_set{size};
+    for (const auto piece : pieces) {
+        result.set(piece);
+    }
+    return result;
+}
+
+picker::piece_set full_set(std::size_t size) {
+    auto result = picker::piece_set{size};
+    result.fill();
+    return result;
+}
+
+// Downloads every block handed out, so the next pick starts a new piece.
+void complete_blocks(picker::piece_picker& p,
+                     std::span<const picker::block> blocks) {
+    for (const auto b : blocks) {
+        if (p.finished(b)) {
+            p.passed(b.piece);
+        }
+    }
+}
+}  // namespace
+
+TEST(PieceSet, ReadsWireBitfields) {
+    const auto set =
+        picker::piece_set::from_bytes(std::string{"\x80\x01\xc0", 3}, 18);
+    ASSERT_TRUE(set.has_value());
+    EXPECT_EQ(set->count(), 4);
+    EXPECT_TRUE(set->test(0));
+    EXPECT_TRUE(set->test(15));
+    EXPECT_TRUE(set->test(16));
+    EXPECT_TRUE(set->test(17));
+    EXPECT_EQ(set->find_next(1), 15);
+    EXPECT_EQ(set->find_next(18), 18);
+
+    EXPECT_FALSE(picker::piece_set::from_bytes("\xff\xff\xe0", 18));
+    EXPECT_FALSE(picker::piece_set::from_bytes("\xff", 18));
+
+    auto bits = torrent::bitfield{18};
+    bits.set(0);
+    bits.set(15);
+    bits.set(16);
+    bits.set(17);
+    EXPECT_EQ(picker::piece_set{bits}, *set);
+}
+
+TEST(PieceSet, BulkOperations) {
+    // Large enough for the vector loops and their scalar tails.
+    constexpr std::size_t size = 5000;
+    auto a = picker::piece_set{size};
+    auto b = picker::piece_set{size};
+    EXPECT_FALSE(intersects(a, b));
+    EXPECT_FALSE(any_missing(a, b));
+
+    a.set(4999);
+    EXPECT_TRUE(any_missing(a, b));
+    EXPECT_FALSE(intersects(a, b));
+    b.set(4999);
+    EXPECT_TRUE(intersects(a, b));
+    EXPECT_FALSE(any_missing(a, b));
+
+    for (std::size_t i = 0; i < size; i += 3) {
+        a.set(i);
+    }
+    for (std::size_t i = 0; i < size; i += 5) {
+        b.set(i);
+    }
+    // Multiples of 15 below 5000, and 4999.
+    EXPECT_EQ(count_common(a, b), 335);
+    auto seen = std::vector<std::size_t>{};
+    for_each_common(a, b, [&](std::size_t i) { seen.push_back(i); });
+    ASSERT_EQ(seen.size(), 335);
+    EXPECT_EQ(seen[1], 15);
+    EXPECT_EQ(seen.back(), 4999);
+
+    EXPECT_EQ(full_set(size).count(), size);
+}
+
+TEST(PiecePicker, TracksAvailability) {
+    auto p = picker::piece_picker{8, 4, 2};
+    p.add_peer(make_set(8, {0, 1, 2}));
+    p.add_peer(make_set(8, {1, 2}));
+    p.add_have(2);
+    EXPECT_EQ(p.availability(0), 1);
+    EXPECT_EQ(p.availability(1), 2);
+    EXPECT_EQ(p.availability(2), 3);
+
+    p.remove_peer(make_set(8, {1, 2}));
+    EXPECT_EQ(p.availability(1), 1);
+    EXPECT_EQ(p.availability(2), 2);
+    EXPECT_EQ(p.blocks_in(6), 4);
+    EXPECT_EQ(p.blocks_in(7), 2);
+}
+
+TEST(PiecePicker, PicksRarestFirst) {
+    auto p = picker::piece_picker{8, 2, 2};
+    const auto seed = full_set(8);
+    p.add_peer(seed);
+    p.add_peer(make_set(8, {0, 1, 2, 3, 4, 6, 7}));
+    p.add_peer(make_set(8, {0, 1, 2, 3, 4, 6}));
+    p.add_peer(make_set(8, {0, 1, 2, 3, 6}));
+
+    auto out = std::array<picker::block, 2>{};
+    auto order = std::vector<std::uint32_t>{};
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(p.pick(seed, out), 2);
+        EXPECT_EQ(out[0].piece, out[1].piece);
+        order.push_back(out[0].piece);
+        complete_blocks(p, out);
+    }
+    EXPECT_EQ(order[0], 5);
+    EXPECT_EQ(order[1], 7);
+    EXPECT_EQ(order[2], 4);
+    EXPECT_TRUE(p.complete());
+    EXPECT_FALSE(p.interesting(seed));
+    EXPECT_EQ(p.pick(seed, out), 0);
+}
+
+TEST(PiecePicker, PrefersPartialPieces) {
+    auto p = picker::piece_picker{4, 4, 4};
+    const auto seed = full_set(4);
+    p.add_peer(seed);
+    p.add_peer(make_set(4, {0}));
+
+    auto first = std::array<picker::block, 2>{};
+    ASSERT_EQ(p.pick(seed, first), 2);
+    const auto started = first[0].piece;
+    EXPECT_NE(started, 0);
+
+    // Another peer finishes the piece before starting one of its own.
+    auto second = std::array<picker::block, 3>{};
+    ASSERT_EQ(p.pick(seed, second), 3);
+    EXPECT_EQ(second[0], (picker::block{started, 2}));
+    EXPECT_EQ(second[1], (picker::block{started, 3}));
+    EXPECT_NE(second[2].piece, started);
+
+    // An aborted block goes to the next peer first.
+    p.aborted(first[1]);
+    auto third = std::array<picker::block, 1>{};
+    ASSERT_EQ(p.pick(seed, third), 1);
+    EXPECT_EQ(third[0], first[1]);
+}
+
+TEST(PiecePicker, EndgameDuplicatesRequests) {
+    auto p = picker::piece_picker{2, 2, 1};
+    const auto seed = full_set(2);
+    p.add_peer(seed);
+    p.add_peer(seed);
+
+    auto first = std::array<picker::block, 8>{};
+    ASSERT_EQ(p.pick(seed, first), 3);
+    EXPECT_TRUE(p.endgame());
+
+    // Everything is requested once; a second peer may ask again, but never
+    // for what it already has outstanding.
+    auto pending = std::array{first[0]};
+    auto second = std::array<picker::block, 8>{};
+    ASSERT_EQ(p.pick(seed, second, pending), 2);
+    EXPECT_EQ(std::count(second.begin(), second.begin() + 2, first[0]), 0);
+
+    // Each block allows max_requests outstanding requests.
+    auto third = std::array<picker::block, 8>{};
+    EXPECT_EQ(p.pick(seed, third), 3);
+    EXPECT_EQ(p.pick(seed, third), 1);
+
+    // The first copy of a block counts; later copies do not.
+    const auto b = first[1];
+    const auto blocks = p.blocks_in(b.piece);
+    EXPECT_EQ(p.finished(b), blocks == 1);
+    EXPECT_FALSE(p.finished(b));
+}
+
+TEST(PiecePicker, FailedPiecesAreRequestedAgain) {
+    auto p = picker::piece_picker{1, 2, 2};
+    const auto seed = full_set(1);
+    p.add_peer(seed);
+
+    auto out = std::array<picker::block, 2>{};
+    ASSERT_EQ(p.pick(seed, out), 2);
+    EXPECT_FALSE(p.finished(out[0]));
+    EXPECT_TRUE(p.finished(out[1]));
+    p.failed(0);
+    EXPECT_FALSE(p.endgame());
+
+    ASSERT_EQ(p.pick(seed, out), 2);
+    EXPECT_FALSE(p.finished(out[0]));
+    EXPECT_TRUE(p.finished(out[1]));
+    p.passed(0);
+    EXPECT_TRUE(p.complete());
+    EXPECT_FALSE(p.endgame());
+}
+
+// Both the dense walk and the sparse scan must agree with a brute-force
+// search for the rarest piece the peer has.
+TEST(PiecePicker, MatchesBruteForce) {
+    constexpr std::size_t pieces = 3000;
+    auto random = std::mt19937{42};
+    auto p = picker::piece_picker{pieces, 1, 1};
+
+    auto peers = std::vector<picker::piece_set>{};
+    for (int i = 0; i < 40; i++) {
+        auto peer = picker::piece_set{pieces};
+        const auto density = random() % 100;
+        for (std::size_t piece = 0; piece < pieces; piece++) {
+            if (random() % 1000 < density) {
+                peer.set(piece);
+            }
+        }
+        p.add_peer(peer);
+        peers.push_back(std::move(peer));
+    }
+    // Leave and rejoin, to move pieces both ways between buckets.
+    for (int i = 0; i < 10; i++) {
+        p.remove_peer(peers[i]);
+        p.add_peer(peers[i]);
+    }
+
+    for (int round = 0; round < 500 && !p.complete(); round++) {
+        const auto& peer = peers[random() % peers.size()];
+        auto best = UINT32_MAX;
+        for (std::size_t piece = 0; piece < pieces; piece++) {
+            if (peer.test(piece) && !p.have().test(piece)) {
+                best = std::min(best, p.availability(piece));
+            }
+        }
+
+        auto out = std::array<picker::block, 1>{};
+        if (p.pick(peer, out) == 0) {
+            EXPECT_EQ(best, UINT32_MAX);
+            continue;
+        }
+        EXPECT_EQ(p.availability(out[0].piece), best);
+        complete_blocks(p, out);
+    }
+}
+
+TEST(PiecePicker, FromLayout) {
+    auto info = torrent::single_file_info{};
+    info.piece_length = 65536;
+    info.length = 3 * 65536 + 20000;
+    info.pieces = std::string(4 * 20, '\0');
+    const auto layout = torrent::file_layout::build(info);
+    ASSERT_TRUE(layout.has_value());
+
+    const auto p = picker::piece_picker{*layout};
+    EXPECT_EQ(p.piece_count(), 4);
+    EXPECT_EQ(p.blocks_in(0), 4);
+    EXPECT_EQ(p.blocks_in(3), 2);
+}
@@ -0,0 +1,310 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "block_pool.h"
+#include "engine.h"
+#include "message.h"
+#include "peer_connection.h"
+
+namespace {
+using boost::asio::ip::tcp;
+using namespace std::chrono_literals;
+
+constexpr std::uint32_t block_size = 16384;
+
+const tcp::endpoint loopback{boost::asio::ip::make_address("127.0.0.1"), 0};
+
+template <typename Predicate>
+bool eventually(Predicate done, std::chrono::seconds timeout = 10s) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+wire::handshake make_handshake(std::byte fill) {
+    auto h = wire::handshake{};
+    h.info_hash.fill(fill);
+    return h;
+}
+
+// A fake peer that serves every request from content.
+session::peer_handler seeder(std::string_view content) {
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [](session::peer_connection&,
+                              const wire::handshake& remote) {
+        return std::optional{remote};
+    };
+    handler.on_message = [content](session::peer_connection& peer,
+                                   const wire::message& m) {
+        if (const auto* r = std::get_if<wire::request>(&m)) {
+            peer.send(wire::piece{
+                r->index, r->begin,
+                content.substr(r->index * block_size, r->length)});
+        }
+    };
+    return handler;
+}
+}  // namespace
+
+TEST(SessionEngine, LoopbackTransfer) {
+    constexpr std::uint32_t blocks = 64;
+    constexpr std::size_t peers = 100;
+
+    auto content = std::string(blocks * block_size, '\0');
+    for (std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+
+    auto server = session::engine{{.threads = 2}};
+    const auto endpoint = server.listen(loopback, seeder(content));
+
+    std::atomic<std::size_t> closed{0};
+    std::atomic<std::size_t> received{0};
+    std::atomic<std::size_t> corrupt{0};
+    auto client = session::engine{{.threads = 3}};
+    for (std::size_t i = 0; i < peers; i++) {
+        auto handler = session::peer_handler{};
+        handler.on_handshake = [](session::peer_connection& peer,
+                                  const wire::handshake& remote) {
+            peer.send(wire::interested{});
+            for (std::uint32_t b = 0; b < blocks; b++) {
+                peer.send(wire::request{b, 0, block_size});
+            }
+            return std::optional{remote};
+        };
+        handler.on_message = [&, count = std::uint32_t{0}](
+                                 session::peer_connection& peer,
+                                 const wire::message& m) mutable {
+            const auto* p = std::get_if<wire::piece>(&m);
+            if (p == nullptr) {
+                return;
+            }
+            if (p->block != std::string_view{content}.substr(
+                                p->index * block_size, block_size)) {
+                corrupt++;
+            }
+            received++;
+            if (++count == blocks) {
+                peer.close();
+            }
+        };
+        handler.on_close = [&](session::peer_connection&) { closed++; };
+        client.connect(endpoint, make_handshake(std::byte{1}),
+                       std::move(handler));
+    }
+
+    ASSERT_EQ(eventually([&] { return closed == peers; }), true);
+    ASSERT_EQ(received, peers * blocks);
+    ASSERT_EQ(corrupt, 0);
+}
+
+TEST(SessionEngine, BlocksReceivedIntoPool) {
+    constexpr std::uint32_t blocks = 64;
+    auto content = std::string(blocks * block_size, '\0');
+    for (std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i * 13 + i / 1000);
+    }
+
+    auto pool = buffers::block_pool{1 << 20, 2};
+    auto server = session::engine{{.threads = 1}};
+    const auto endpoint = server.listen(loopback, seeder(content));
+
+    std::atomic<bool> closed{false};
+    std::atomic<std::size_t> received{0};
+    std::atomic<std::size_t> corrupt{0};
+    auto client = session::engine{{.threads = 1, .blocks = &pool}};
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [](session::peer_connection& peer,
+                              const wire::handshake& remote) {
+        for (std::uint32_t b = 0; b < blocks; b++) {
+            peer.send(wire::request{b, 0, block_size});
+        }
+        return std::optional{remote};
+    };
+    handler.on_block = [&](session::peer_connection& peer,
+                           std::uint32_t index, std::uint32_t,
+                           buffers::block_ref block, std::uint32_t length) {
+        if (std::string_view{block.data(), length} !=
+            std::string_view{content}.substr(index * block_size,
+                                             block_size)) {
+            corrupt++;
+        }
+        if (++received == blocks) {
+            peer.close();
+        }
+    };
+    handler.on_close = [&](session::peer_connection&) { closed = true; };
+    client.connect(endpoint, make_handshake(std::byte{1}), std::move(handler));
+
+    ASSERT_EQ(eventually([&] { return closed.load(); }), true);
+    ASSERT_EQ(received, blocks);
+    ASSERT_EQ(corrupt, 0);
+    const auto stats = pool.stats();
+    ASSERT_EQ(stats.in_use, 0);
+    ASSERT_GE(stats.high_water, 1);
+    ASSERT_EQ(stats.failures, 0);
+}
+
+TEST(SessionEngine, BlocksSentFromFiles) {
+    constexpr std::uint32_t blocks = 64;
+    auto content = std::string(blocks * block_size, '\0');
+    for (std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i * 11 + i / 3000);
+    }
+    const auto path =
+        std::filesystem::temp_directory_path() / "rush_test_sendfile";
+    std::ofstream{path, std::ios::binary} << content;
+    const auto fd = std::shared_ptr<int>{
+        new int{::open(path.c_str(), O_RDONLY)}, [](const int* p) {
+            ::close(*p);
+            delete p;
+        }};
+    ASSERT_GE(*fd, 0);
+
+    // Odd blocks come from the file in two slices, even ones from memory,
+    // so that both share batches.
+    auto seeding = seeder(content);
+    seeding.on_message = [&content, fd](session::peer_connection& peer,
+                                        const wire::message& m) {
+        const auto* r = std::get_if<wire::request>(&m);
+        if (r == nullptr) {
+            return;
+        }
+        if (r->index % 2 == 0) {
+            peer.send(wire::piece{
+                r->index, r->begin,
+                std::string_view{content}.substr(r->index * block_size,
+                                                 r->length)});
+            return;
+        }
+        const auto offset = std::uint64_t{r->index} * block_size;
+        peer.send(wire::piece_header{r->index, r->begin, r->length},
+                  {{*fd, offset, 1000}, {*fd, offset + 1000, r->length - 1000}},
+                  fd);
+    };
+    auto server = session::engine{{.threads = 1}};
+    const auto endpoint = server.listen(loopback, std::move(seeding));
+
+    std::atomic<bool> closed{false};
+    std::atomic<std::size_t> received{0};
+    std::atomic<std::size_t> corrupt{0};
+    auto client = session::engine{{.threads = 1}};
+    auto handler = session::peer_handler{};
+    handler.on_handshake = [](session::peer_connection& peer,
+                              const wire::handshake& remote) {
+        for (std::uint32_t b = 0; b < blocks; b++) {
+            peer.send(wire::request{b, 0, block_size});
+        }
+        return std::optional{remote};
+    };
+    handler.on_message = [&](session::peer_connection& peer,
+                             const wire::message& m) {
+        const auto* p = std::get_if<wire::piece>(&m);
+        if (p == nullptr) {
+            return;
+        }
+        if (p->block != std::string_view{content}.substr(
+                            p->index * block_size, block_size)) {
+            corrupt++;
+        }
+        if (++received == blocks) {
+            peer.close();
+        }
+    };
+    handler.on_close = [&](session::peer_connection&) { closed = true; };
+    client.connect(endpoint, make_handshake(std::byte{1}), std::move(handler));
+
+    ASSERT_EQ(eventually([&] { return closed.load(); }), true);
+    ASSERT_EQ(received, blocks);
+    ASSERT_EQ(corrupt, 0);
+    std::filesystem::remove(path);
+}
+
+TEST(SessionEngine, ConnectionLimit) {
+    auto server = session::engine{{.threads = 2, .max_connections = 2}};
+    const auto endpoint = server.listen(loopback, seeder(""));
+
+    // Connections over the limit are accepted and closed straight away.
+    std::atomic<int> refused{0};
+    auto client = session::engine{{.threads = 1}};
+    for (int i = 0; i < 4; i++) {
+        auto handler = seeder("");
+        handler.on_close = [&](session::peer_connection&) { refused++; };
+        client.connect(endpoint, make_handshake(std::byte{1}),
+                       std::move(handler));
+    }
+
+    ASSERT_EQ(eventually([&] { return refused == 2; }), true);
+    ASSERT_EQ(server.connections(), 2);
+}
+
+TEST(SessionEngine, HandshakeTimeout) {
+    auto server =
+        session::engine{{.threads = 1, .handshake_timeout = 50ms}};
+    const auto endpoint = server.listen(loopback, seeder(""));
+
+    // Connect and stay silent; the engine should hang up.
+    auto context = boost::asio::io_context{};
+    auto socket = tcp::socket{context};
+    socket.connect(endpoint);
+
+    const auto start = std::chrono::steady_clock::now();
+    char byte = 0;
+    auto ec = boost::system::error_code{};
+    boost::asio::read(socket, boost::asio::buffer(&byte, 1), ec);
+    ASSERT_EQ(ec, boost::asio::error::eof);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, 5s);
+}
+
+TEST(SessionEngine, RejectsOtherTorrents) {
+    auto server = session::engine{{.threads = 1}};
+    auto handler = seeder("");
+    handler.on_handshake = [](session::peer_connection&,
+                              const wire::handshake&) {
+        return std::optional{make_handshake(std::byte{2})};
+    };
+    const auto endpoint = server.listen(loopback, std::move(handler));
+
+    std::atomic<bool> closed{false};
+    std::atomic<bool> handshaken{false};
+    auto client_handler = seeder("");
+    client_handler.on_handshake = [&](session::peer_connection&,
+                                      const wire::handshake& remote) {
+        handshaken = true;
+        return std::optional{remote};
+    };
+    client_handler.on_close = [&](session::peer_connection&) {
+        closed = true;
+    };
+
+    auto client = session::engine{{.threads = 1}};
+    client.connect(endpoint, make_handshake(std::byte{1}),
+                   std::move(client_handler));
+    ASSERT_EQ(eventually([&] { return closed.load(); }), true);
+    ASSERT_EQ(handshaken, false);
+}
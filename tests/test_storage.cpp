@@ -0,0 +1,1062 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "bencode.h"
+#include "block_pool.h"
+#include "create.h"
+#include "disk_io.h"
+#include "encoder.h"
+#include "file_pool.h"
+#include "layout.h"
+#include "merkle.h"
+#include "read_cache.h"
+#include "resume.h"
+#include "sha.h"
+#include "thread_pool.h"
+#include "torrent.h"
+#include "verify.h"
+
+namespace {
+std::string piece_hashes(std::string_view content, std::size_t piece_length) {
+    auto result = std::string{};
+    for (std::size_t i = 0; i < content.size(); i += piece_length) {
+        const auto digest = crypto::sha1(content.substr(i, piece_length));
+        result.append(reinterpret_cast<const char*>(digest.data()),
+                      digest.size());
+    }
+    return result;
+}
+
+void write_file(const std::filesystem::path& path, std::string_view data) {
+    std::filesystem::create_directories(path.parent_path());
+    auto file = std::ofstream{path, std::ios::binary};
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+std::string read_file(const std::filesystem::path& path) {
+    auto file = std::ifstream{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, {}};
+}
+
+// Three 16-byte pieces over four files: the first spans a and b, the last
+// spans b and c/d, and the empty file sits in between.
+class VerifyMultiFile : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        root_ = std::filesystem::temp_directory_path() / "rush_verify";
+        std::filesystem::remove_all(root_);
+
+        const std::string a = "0123456789";
+        const std::string b = "abcdefghijklmnopqrstuvwxy";
+        const std::string d = "ABCDEFG";
+        write_file(root_ / "content" / "a", a);
+        write_file(root_ / "content" / "empty", "");
+        write_file(root_ / "content" / "b", b);
+        write_file(root_ / "content" / "c" / "d", d);
+
+        info_.piece_length = 16;
+        info_.pieces = piece_hashes(a + b + d, 16);
+        info_.name = "content";
+        info_.files = {{10, "", "a"}, {0, "", "empty"}, {25, "", "b"},
+                       {7, "", "c/d"}};
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root_); }
+
+    std::filesystem::path root_;
+    torrent::multi_file_info info_{};
+    concurrency::thread_pool pool_{2};
+};
+}  // namespace
+
+TEST_F(VerifyMultiFile, AllPiecesMatch) {
+    auto progress = storage::verify_progress{};
+    const auto result = storage::verify(info_, root_, pool_, {}, &progress);
+
+    ASSERT_EQ(result.pieces.size(), 3);
+    ASSERT_EQ(result.pieces.all(), true);
+    ASSERT_EQ(result.cancelled, false);
+    ASSERT_EQ(progress.pieces.load(), 3);
+    ASSERT_EQ(progress.bytes.load(), 42);
+}
+
+TEST_F(VerifyMultiFile, CorruptFileFailsItsPieces) {
+    write_file(root_ / "content" / "c" / "d", "ABCDEFX");
+    const auto result = storage::verify(info_, root_, pool_);
+
+    ASSERT_EQ(result.pieces.test(0), true);
+    ASSERT_EQ(result.pieces.test(1), true);
+    ASSERT_EQ(result.pieces.test(2), false);
+}
+
+TEST_F(VerifyMultiFile, MissingFileFailsSpanningPieces) {
+    std::filesystem::remove(root_ / "content" / "a");
+    std::filesystem::remove(root_ / "content" / "empty");
+    const auto result = storage::verify(info_, root_, pool_);
+
+    ASSERT_EQ(result.pieces.test(0), false);
+    ASSERT_EQ(result.pieces.test(1), true);
+    ASSERT_EQ(result.pieces.test(2), true);
+}
+
+TEST_F(VerifyMultiFile, ShortFileFailsItsPieces) {
+    write_file(root_ / "content" / "c" / "d", "ABC");
+    const auto result = storage::verify(info_, root_, pool_);
+
+    ASSERT_EQ(result.pieces.count(), 2);
+    ASSERT_EQ(result.pieces.test(2), false);
+}
+
+TEST_F(VerifyMultiFile, Cancelled) {
+    auto stop = std::stop_source{};
+    stop.request_stop();
+    const auto result = storage::verify(info_, root_, pool_, stop.get_token());
+
+    ASSERT_EQ(result.cancelled, true);
+    ASSERT_EQ(result.pieces.none(), true);
+}
+
+TEST_F(VerifyMultiFile, OnlyWhichPieces) {
+    auto which = torrent::bitfield{3};
+    which.set(0);
+    which.set(2);
+    auto progress = storage::verify_progress{};
+    const auto result =
+        storage::verify(info_, root_, which, pool_, {}, &progress);
+
+    ASSERT_EQ(result.pieces, which);
+    ASSERT_EQ(progress.pieces.load(), 2);
+}
+
+TEST(VerifySingleFile, PartialLastPiece) {
+    const auto root = std::filesystem::temp_directory_path() / "rush_single";
+    const std::string data(100000, 'x');
+    write_file(root / "file.bin", data);
+
+    auto info = torrent::single_file_info{};
+    info.piece_length = 16384;
+    info.pieces = piece_hashes(data, 16384);
+    info.name = "file.bin";
+    info.length = 100000;
+
+    auto pool = concurrency::thread_pool{3};
+    const auto result = storage::verify(info, root, pool);
+    std::filesystem::remove_all(root);
+
+    ASSERT_EQ(result.pieces.size(), 7);
+    ASSERT_EQ(result.pieces.all(), true);
+    ASSERT_EQ(result.pieces.bytes().size(), 1);
+    ASSERT_EQ(result.pieces.bytes()[0], 0xfe);
+}
+
+TEST(VerifyPadded, PaddingIsHashedAsZeros) {
+    const auto root = std::filesystem::temp_directory_path() / "rush_padded";
+    std::filesystem::remove_all(root);
+    const std::string a = "0123456789";
+    const std::string b = "abcdefghijklmnopqrstuvwxy";
+    write_file(root / "content" / "a", a);
+    write_file(root / "content" / "b", b);
+
+    // a is padded to the end of the first piece; the padding is never
+    // written out.
+    auto info = torrent::multi_file_info{};
+    info.piece_length = 16;
+    info.pieces = piece_hashes(a + std::string(6, '\0') + b, 16);
+    info.name = "content";
+    info.files = {{10, "", "a", ""}, {6, "", ".pad/6", "p"}, {25, "", "b", ""}};
+
+    auto pool = concurrency::thread_pool{2};
+    const auto result = storage::verify(info, root, pool);
+    std::filesystem::remove_all(root);
+
+    ASSERT_EQ(result.pieces.size(), 3);
+    ASSERT_EQ(result.pieces.all(), true);
+}
+
+namespace {
+class Resume : public VerifyMultiFile {
+   protected:
+    std::vector<std::filesystem::path> paths() const {
+        return storage::content_paths(info_, root_);
+    }
+
+    // Moves the mtime of a content file on, as a write would.
+    void touch(const std::filesystem::path& path) const {
+        const auto file = root_ / "content" / path;
+        std::filesystem::last_write_time(
+            file,
+            std::filesystem::last_write_time(file) + std::chrono::seconds{1});
+    }
+
+    storage::resume_data saved(std::initializer_list<std::size_t> pieces) {
+        auto data = storage::resume_data{hash_};
+        data.pieces = torrent::bitfield{3};
+        for (const auto piece : pieces) {
+            data.pieces.set(piece);
+        }
+        data.files = storage::file_states(paths());
+        return data;
+    }
+
+    std::filesystem::path file() const { return root_ / "resume"; }
+
+    std::optional<storage::resume_data> load(
+        const crypto::sha1_digest& info_hash) const {
+        return storage::load_resume(file(), info_hash, 3, 4);
+    }
+
+    crypto::sha1_digest hash_ = crypto::sha1("info");
+};
+}  // namespace
+
+TEST_F(Resume, SaveAndLoad) {
+    auto data = saved({0, 2});
+    data.partial.push_back({1, torrent::bitfield{5}});
+    data.partial.back().blocks.set(3);
+    ASSERT_TRUE(storage::save_resume(file(), data));
+    ASSERT_EQ(load(hash_), data);
+    ASSERT_FALSE(std::filesystem::exists(root_ / "resume.tmp"));
+
+    // Every piece, which leaves out the bits.
+    auto complete = saved({0, 1, 2});
+    ASSERT_TRUE(storage::save_resume(file(), complete));
+    ASSERT_EQ(load(hash_), complete);
+
+    ASSERT_FALSE(load(crypto::sha1("other")));
+    ASSERT_FALSE(storage::load_resume(root_ / "missing", hash_, 3, 4));
+    const auto bytes = read_file(file());
+    write_file(file(), bytes.substr(0, bytes.size() - 1));
+    ASSERT_FALSE(load(hash_));
+    auto flipped = bytes;
+    flipped.back() ^= 1;
+    write_file(file(), flipped);
+    ASSERT_FALSE(load(hash_));
+
+    // The header is covered too: here its piece count, 64 bytes in.
+    auto header = bytes;
+    header[64] ^= 0x40;
+    write_file(file(), header);
+    ASSERT_FALSE(load(hash_));
+    write_file(file(), bytes);
+    ASSERT_FALSE(storage::load_resume(file(), hash_, 4, 4));
+    ASSERT_FALSE(storage::load_resume(file(), hash_, 3, 3));
+    ASSERT_EQ(load(hash_), complete);
+}
+
+TEST_F(Resume, UnchangedFilesAreTrusted) {
+    // Piece 1 is on disk but was not saved as done, so nothing looked.
+    auto data = saved({0, 2});
+    data.partial.push_back({1, torrent::bitfield{1}});
+    const auto result = storage::restore(info_, root_, data, pool_);
+
+    ASSERT_EQ(result.pieces, data.pieces);
+    ASSERT_EQ(result.partial, data.partial);
+    ASSERT_EQ(result.changed_files, 0);
+    ASSERT_EQ(result.rechecked_pieces, 0);
+
+    // Pieces of 16 bytes are one block, not three.
+    data.partial.back().blocks = torrent::bitfield{3};
+    ASSERT_TRUE(storage::restore(info_, root_, data, pool_).partial.empty());
+}
+
+TEST_F(Resume, ChangedFilesAreRechecked) {
+    auto data = saved({0, 2});
+    data.partial.push_back({1, torrent::bitfield{1}});
+    write_file(root_ / "content" / "c" / "d", "ABCDEFX");
+    touch("c/d");
+    touch("a");
+    const auto result = storage::restore(info_, root_, data, pool_);
+
+    // a holds piece 0, which still matches; d's piece 2 no longer does.
+    ASSERT_EQ(result.changed_files, 2);
+    ASSERT_EQ(result.rechecked_pieces, 2);
+    ASSERT_TRUE(result.pieces.test(0));
+    ASSERT_FALSE(result.pieces.test(1));
+    ASSERT_FALSE(result.pieces.test(2));
+    ASSERT_EQ(result.partial, data.partial);
+}
+
+TEST_F(Resume, NothingSavedChecksEverything) {
+    const auto result = storage::restore(info_, root_, std::nullopt, pool_);
+    ASSERT_TRUE(result.pieces.all());
+    ASSERT_EQ(result.changed_files, 4);
+    ASSERT_EQ(result.rechecked_pieces, 3);
+
+    // Saved for another layout.
+    auto data = saved({});
+    data.files.pop_back();
+    ASSERT_EQ(storage::restore(info_, root_, data, pool_).rechecked_pieces,
+              3);
+}
+
+TEST_F(Resume, FileFollowsProgress) {
+    auto data = saved({});
+    auto resume = storage::resume_file{file(), paths(), data,
+                                       std::chrono::hours{1}};
+    auto blocks = torrent::bitfield{2};
+    blocks.set(1);
+    resume.blocks_written(0, blocks);
+    resume.blocks_written(1, blocks);
+    resume.piece_passed(0);
+    resume.piece_failed(2);
+    // The first save is due, being the first.
+    ASSERT_TRUE(resume.save_if_due());
+
+    auto expected = saved({0});
+    expected.partial.push_back({1, blocks});
+    ASSERT_EQ(load(hash_), expected);
+
+    // Saved again only when asked, before the interval is up.
+    resume.piece_passed(1);
+    ASSERT_TRUE(resume.save_if_due());
+    ASSERT_EQ(load(hash_), expected);
+    ASSERT_TRUE(resume.save());
+    expected = saved({0, 1});
+    ASSERT_EQ(load(hash_), expected);
+    ASSERT_EQ(resume.data(), expected);
+}
+
+namespace {
+// 200 KiB in 32 KiB pieces of two blocks each, over files whose boundaries
+// fall inside blocks, with an empty file and a nested one.
+class DiskIO : public ::testing::TestWithParam<bool> {
+   protected:
+    void SetUp() override {
+        root_ = std::filesystem::temp_directory_path() / "rush_disk_io";
+        std::filesystem::remove_all(root_);
+
+        data_.resize(200 << 10);
+        auto random = std::mt19937{7};
+        for (auto& c : data_) {
+            c = static_cast<char>(random());
+        }
+        info_.piece_length = 32768;
+        info_.pieces = piece_hashes(data_, 32768);
+        info_.name = "content";
+        info_.files = {{5000, "", "a"},
+                       {0, "", "empty"},
+                       {100000, "", "b"},
+                       {static_cast<bencode::integer>(data_.size()) - 105000,
+                        "", "c/d"}};
+        layout_ = torrent::file_layout::build(info_);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root_); }
+
+    storage::disk_options options() const {
+        auto o = storage::disk_options{};
+        o.io_uring = GetParam();
+        return o;
+    }
+
+    // Every block as (piece, begin), in a shuffled order.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> blocks() const {
+        auto result = std::vector<std::pair<std::uint32_t, std::uint32_t>>{};
+        for (std::uint32_t p = 0; p < layout_->piece_count(); p++) {
+            for (std::uint32_t b = 0; b < layout_->piece_size(p);
+                 b += storage::block_size) {
+                result.emplace_back(p, b);
+            }
+        }
+        std::shuffle(result.begin(), result.end(), std::mt19937{11});
+        return result;
+    }
+
+    std::uint32_t length(std::uint32_t piece, std::uint32_t begin) const {
+        return static_cast<std::uint32_t>(std::min<std::uint64_t>(
+            storage::block_size, layout_->piece_size(piece) - begin));
+    }
+
+    // The block as received into a pooled buffer.
+    buffers::block_ref block(std::uint32_t piece, std::uint32_t begin) {
+        const auto offset = layout_->piece_offset(piece) + begin;
+        auto result = pool_.allocate();
+        std::memcpy(result.data(), data_.data() + offset,
+                    length(piece, begin));
+        return result;
+    }
+
+    bool write(storage::disk_io& disk, std::uint32_t piece,
+               std::uint32_t begin) {
+        return disk.write(piece, begin, block(piece, begin),
+                          length(piece, begin));
+    }
+
+    std::filesystem::path root_;
+    std::string data_;
+    torrent::multi_file_info info_{};
+    std::optional<torrent::file_layout> layout_;
+    buffers::block_pool pool_{4 << 20, 2};
+};
+}  // namespace
+
+TEST_P(DiskIO, BlocksInAnyOrderLandInTheirFiles) {
+    {
+        auto disk = storage::disk_io{
+            *layout_, storage::content_paths(info_, root_), pool_, options()};
+        for (const auto& [piece, begin] : blocks()) {
+            write(disk, piece, begin);
+        }
+        disk.flush();
+        ASSERT_EQ(disk.cached_bytes(), 0);
+    }
+
+    const auto content = root_ / "content";
+    ASSERT_EQ(read_file(content / "a") + read_file(content / "empty") +
+                  read_file(content / "b") + read_file(content / "c" / "d"),
+              data_);
+    auto pool = concurrency::thread_pool{2};
+    ASSERT_EQ(storage::verify(info_, root_, pool).pieces.all(), true);
+}
+
+TEST_P(DiskIO, PaddingIsNeverStored) {
+    // a padded to the end of the first piece.
+    std::fill(data_.begin() + 5000, data_.begin() + 32768, '\0');
+    info_.pieces = piece_hashes(data_, 32768);
+    info_.files = {{5000, "", "a", ""},
+                   {27768, "", ".pad/27768", "p"},
+                   {static_cast<bencode::integer>(data_.size()) - 32768, "",
+                    "b", ""}};
+    layout_ = torrent::file_layout::build(info_);
+
+    auto sent = std::string{};
+    {
+        auto disk = storage::disk_io{
+            *layout_, storage::content_paths(info_, root_), pool_, options()};
+        for (const auto& [piece, begin] : blocks()) {
+            write(disk, piece, begin);
+        }
+        disk.flush();
+
+        // Uploads of padding come from memory, not from a file.
+        disk.upload(0, 0, storage::block_size,
+                    [&](storage::upload_data data, std::error_code ec) {
+                        ASSERT_FALSE(ec);
+                        ASSERT_TRUE(data.ranges.empty());
+                        sent.assign(data.bytes.begin(), data.bytes.end());
+                    });
+        disk.flush();
+    }
+
+    ASSERT_EQ(sent, data_.substr(0, storage::block_size));
+    const auto content = root_ / "content";
+    ASSERT_EQ(std::filesystem::exists(content / ".pad"), false);
+    ASSERT_EQ(read_file(content / "a") + std::string(27768, '\0') +
+                  read_file(content / "b"),
+              data_);
+    auto pool = concurrency::thread_pool{2};
+    ASSERT_EQ(storage::verify(info_, root_, pool).pieces.all(), true);
+}
+
+TEST_P(DiskIO, BlocksOfTheWrongLengthAreIgnored) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    disk.write(1, 0, block(1, 0), 100);
+    // The last piece is shorter than a block.
+    const auto last = static_cast<std::uint32_t>(layout_->piece_count() - 1);
+    disk.write(last, 0, block(last, 0), storage::block_size);
+    ASSERT_EQ(disk.cached_bytes(), 0);
+
+    write(disk, last, 0);
+    disk.flush();
+    auto pool = concurrency::thread_pool{1};
+    ASSERT_EQ(storage::verify(info_, root_, pool).pieces.test(last), true);
+}
+
+TEST_P(DiskIO, ReadSeesCachedBlocks) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    // Only the second block of piece 0: the piece stays in the cache.
+    write(disk, 0, storage::block_size);
+
+    auto result = std::string{};
+    auto error = std::error_code{};
+    disk.read(0, storage::block_size - 100, 200,
+              [&](buffers::block_ref, std::span<const char> data,
+                  std::error_code ec) {
+                  result.assign(data.begin(), data.end());
+                  error = ec;
+              });
+    disk.flush();
+
+    ASSERT_FALSE(error);
+    ASSERT_EQ(result.size(), 200);
+    ASSERT_EQ(result.substr(0, 100), std::string(100, '\0'));
+    ASSERT_EQ(result.substr(100),
+              data_.substr(storage::block_size, 100));
+}
+
+TEST_P(DiskIO, ReadFromCacheSharesTheBlock) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    auto written = block(2, storage::block_size);
+    disk.write(2, storage::block_size, written, storage::block_size);
+
+    auto read = buffers::block_ref{};
+    auto data = std::span<const char>{};
+    disk.read(2, storage::block_size + 10, 100,
+              [&](buffers::block_ref b, std::span<const char> d,
+                  std::error_code) {
+                  read = std::move(b);
+                  data = d;
+              });
+    disk.flush();
+
+    ASSERT_EQ(read.data(), written.data());
+    ASSERT_EQ(data.data(), written.data() + 10);
+    ASSERT_EQ(data.size(), 100);
+}
+
+TEST_P(DiskIO, RangesPastTheCachedPieceAreRefused) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    write(disk, 0, storage::block_size);
+
+    auto read_error = std::error_code{};
+    disk.read(0, 4 * storage::block_size, 100,
+              [&](buffers::block_ref, std::span<const char>,
+                  std::error_code ec) { read_error = ec; });
+    auto upload_error = std::error_code{};
+    disk.upload(0, 4 * storage::block_size, 100,
+                [&](storage::upload_data, std::error_code ec) {
+                    upload_error = ec;
+                });
+    disk.flush();
+
+    ASSERT_EQ(read_error, std::errc::invalid_argument);
+    ASSERT_EQ(upload_error, std::errc::invalid_argument);
+}
+
+TEST_P(DiskIO, BackpressureUntilDrained) {
+    auto o = options();
+    o.cache_size = 4 * storage::block_size;
+    auto drains = std::atomic<int>{0};
+    auto disk =
+        storage::disk_io{*layout_, storage::content_paths(info_, root_),
+                         pool_, o, {[&] { drains++; }, {}}};
+
+    bool refused = false;
+    for (const auto& [piece, begin] : blocks()) {
+        refused |= !write(disk, piece, begin);
+    }
+    disk.flush();
+
+    ASSERT_EQ(refused, true);
+    ASSERT_GE(drains.load(), 1);
+    ASSERT_EQ(pool_.stats().in_use, 0);
+    ASSERT_EQ(disk.congested(), false);
+    auto pool = concurrency::thread_pool{2};
+    ASSERT_EQ(storage::verify(info_, root_, pool).pieces.all(), true);
+}
+
+TEST_P(DiskIO, WriteErrorIsReported) {
+    // A regular file where the content directory should be.
+    write_file(root_ / "content", "");
+    auto failed = std::vector<std::uint32_t>{};
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options(),
+        {{}, [&](std::uint32_t piece, std::error_code) {
+             failed.push_back(piece);
+         }}};
+
+    write(disk, 1, 0);
+    write(disk, 1, storage::block_size);
+    disk.flush();
+
+    ASSERT_EQ(failed, std::vector<std::uint32_t>{1});
+}
+
+TEST_P(DiskIO, WrittenBlocksAreReported) {
+    auto written = std::vector<std::pair<std::uint32_t, torrent::bitfield>>{};
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options(),
+        {{}, {}, [&](std::uint32_t piece, const torrent::bitfield& blocks) {
+             written.emplace_back(piece, blocks);
+         }}};
+
+    write(disk, 2, storage::block_size);
+    write(disk, 3, 0);
+    disk.flush();
+
+    auto second = torrent::bitfield{2};
+    second.set(1);
+    auto first = torrent::bitfield{2};
+    first.set(0);
+    std::sort(written.begin(), written.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    ASSERT_EQ(written.size(), 2);
+    ASSERT_EQ(written[0], std::pair(std::uint32_t{2}, second));
+    ASSERT_EQ(written[1], std::pair(std::uint32_t{3}, first));
+}
+
+TEST_P(DiskIO, RestOfAnEvictedPieceIsWrittenOnArrival) {
+    auto o = options();
+    o.cache_size = 2 * storage::block_size;
+    auto mutex = std::mutex{};
+    auto reported = std::condition_variable{};
+    auto written = std::vector<std::pair<std::uint32_t, torrent::bitfield>>{};
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, o,
+        {{}, {}, [&](std::uint32_t piece, const torrent::bitfield& blocks) {
+             const auto lock = std::lock_guard{mutex};
+             written.emplace_back(piece, blocks);
+             reported.notify_all();
+         }}};
+
+    // The third block is over the cache size and evicts the first halves
+    // of pieces 0 and 1.
+    write(disk, 0, 0);
+    write(disk, 1, 0);
+    write(disk, 2, 0);
+    write(disk, 0, storage::block_size);
+
+    auto second = torrent::bitfield{2};
+    second.set(1);
+    auto lock = std::unique_lock{mutex};
+    ASSERT_TRUE(reported.wait_for(lock, std::chrono::seconds{10}, [&] {
+        return std::find(written.begin(), written.end(),
+                         std::pair(std::uint32_t{0}, second)) !=
+               written.end();
+    }));
+    lock.unlock();
+    disk.flush();
+}
+
+TEST_P(DiskIO, SequentialUploadsReadAhead) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    for (const auto& [piece, begin] : blocks()) {
+        write(disk, piece, begin);
+    }
+    disk.flush();
+
+    auto results = std::vector<storage::upload_data>{};
+    const auto upload = [&](std::uint32_t piece, std::uint32_t begin,
+                            std::uint32_t length) {
+        disk.upload(piece, begin, length,
+                    [&](storage::upload_data data, std::error_code ec) {
+                        ASSERT_FALSE(ec);
+                        results.push_back(std::move(data));
+                    });
+        disk.flush();
+        return results.back();
+    };
+    const auto expected = [&](std::uint32_t piece, std::uint32_t begin,
+                              std::uint32_t length) {
+        return data_.substr(layout_->piece_offset(piece) + begin, length);
+    };
+
+    // The first request of piece 1 is sent from its files: the end of a
+    // and the start of b.
+    auto first = upload(1, 0, storage::block_size);
+    ASSERT_EQ(first.bytes.size(), 0);
+    auto sent = std::string{};
+    for (const auto& range : first.ranges) {
+        auto bytes = std::string(range.length, '\0');
+        ASSERT_EQ(::pread(range.file->fd(), bytes.data(), bytes.size(),
+                          static_cast<off_t>(range.offset)),
+                  static_cast<ssize_t>(range.length));
+        sent += bytes;
+    }
+    ASSERT_EQ(sent, expected(1, 0, storage::block_size));
+
+    // The next one reads the whole piece ahead.
+    auto second = upload(1, storage::block_size, storage::block_size);
+    ASSERT_TRUE(second.ranges.empty());
+    ASSERT_EQ(std::string(second.bytes.begin(), second.bytes.end()),
+              expected(1, storage::block_size, storage::block_size));
+    ASSERT_EQ(disk.read_stats().pieces, 1);
+
+    // Another peer asking for the start of it is served from memory.
+    auto third = upload(1, 100, 1000);
+    ASSERT_TRUE(third.ranges.empty());
+    ASSERT_EQ(std::string(third.bytes.begin(), third.bytes.end()),
+              expected(1, 100, 1000));
+    ASSERT_EQ(disk.read_stats().hits, 1);
+}
+
+TEST_P(DiskIO, WriteDropsPieceFromReadCache) {
+    auto disk = storage::disk_io{
+        *layout_, storage::content_paths(info_, root_), pool_, options()};
+    for (const auto& [piece, begin] : blocks()) {
+        write(disk, piece, begin);
+    }
+    disk.flush();
+    const auto ignore = [](storage::upload_data, std::error_code) {};
+    disk.upload(2, 0, 100, ignore);
+    disk.upload(2, 100, 100, ignore);
+    disk.flush();
+    ASSERT_EQ(disk.read_stats().pieces, 1);
+
+    auto changed = pool_.allocate();
+    std::memset(changed.data(), 'x', storage::block_size);
+    disk.write(2, 0, changed, storage::block_size);
+    write(disk, 2, storage::block_size);
+    disk.flush();
+    ASSERT_EQ(disk.read_stats().pieces, 0);
+
+    // Read ahead again, as the requests go on from where they were.
+    auto bytes = std::string{};
+    disk.upload(2, 200, 100,
+                [&](storage::upload_data data, std::error_code) {
+                    bytes.assign(data.bytes.begin(), data.bytes.end());
+                });
+    disk.flush();
+    ASSERT_EQ(bytes, std::string(100, 'x'));
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, DiskIO, ::testing::Bool(),
+                         [](const auto& info) {
+                             return info.param ? "io_uring" : "fallback";
+                         });
+
+TEST(FilePool, ClosesLeastRecentlyUsed) {
+    const auto root = std::filesystem::temp_directory_path() / "rush_pool";
+    std::filesystem::remove_all(root);
+    auto pool = storage::file_pool{{root / "a", root / "b", root / "c"},
+                                   {10, 20, 1 << 20},
+                                   2,
+                                   storage::allocation::sparse};
+
+    auto error = std::error_code{};
+    const auto a = pool.open(0, true, error);
+    pool.open(1, true, error);
+    pool.open(0, false, error);
+    pool.open(2, true, error);
+    ASSERT_FALSE(error);
+    ASSERT_EQ(pool.open_count(), 2);
+    // b went, and a still works for whoever holds it.
+    ASSERT_EQ(pool.open(0, false, error), a);
+
+    ASSERT_EQ(std::filesystem::file_size(root / "c"), 1 << 20);
+    std::filesystem::remove_all(root);
+}
+
+TEST(FilePool, MissingFileForReading) {
+    auto pool = storage::file_pool{{"/nonexistent/rush"}, {1}, 4,
+                                   storage::allocation::sparse};
+    auto error = std::error_code{};
+    ASSERT_EQ(pool.open(0, false, error), nullptr);
+    ASSERT_EQ(error, std::errc::no_such_file_or_directory);
+}
+
+namespace {
+// Pieces of one block each, of which the cache holds four.
+class ReadCache : public ::testing::Test {
+   protected:
+    void insert(std::uint32_t piece) {
+        auto b = pool_.allocate();
+        std::memset(b.data(), static_cast<int>(piece), storage::block_size);
+        cache_.insert(piece, {std::move(b)});
+    }
+
+    bool cached(std::uint32_t piece) {
+        return cache_.find(piece, 0, 1).has_value();
+    }
+
+    buffers::block_pool pool_{1 << 20, 2};
+    storage::read_cache cache_{4 * storage::block_size + 1,
+                               storage::block_size};
+};
+}  // namespace
+
+TEST_F(ReadCache, FindsRangesWithinBlocks) {
+    insert(3);
+    const auto hit = cache_.find(3, 10, 100);
+    ASSERT_TRUE(hit.has_value());
+    ASSERT_EQ(hit->bytes.size(), 100);
+    ASSERT_EQ(hit->bytes.data(), hit->block.data() + 10);
+    ASSERT_EQ(hit->bytes[0], 3);
+    ASSERT_FALSE(cache_.find(4, 0, 100).has_value());
+    ASSERT_FALSE(cache_.find(3, storage::block_size - 10, 100).has_value());
+
+    const auto stats = cache_.stats();
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 2);
+    ASSERT_EQ(stats.pieces, 1);
+    ASSERT_EQ(stats.bytes, storage::block_size);
+}
+
+TEST_F(ReadCache, KeepsToItsBudget) {
+    for (std::uint32_t piece = 0; piece < 10; piece++) {
+        insert(piece);
+    }
+    ASSERT_EQ(cache_.stats().pieces, 4);
+    ASSERT_EQ(cache_.stats().bytes, 4 * storage::block_size);
+    ASSERT_TRUE(cached(9));
+    ASSERT_FALSE(cached(0));
+    // Only the cache holds blocks.
+    ASSERT_EQ(pool_.stats().in_use, 4);
+}
+
+TEST_F(ReadCache, ScanDoesNotEvictFrequentPieces) {
+    // Pieces of four blocks, as disk_io hands them over: read ahead for one
+    // block, then found for the rest of the peer's requests.
+    auto cache = storage::read_cache{4 * 4 * storage::block_size,
+                                     4 * storage::block_size};
+    const auto read_through = [&](std::uint32_t piece) {
+        if (!cache.find(piece, 0, storage::block_size)) {
+            auto blocks = std::vector<buffers::block_ref>{};
+            for (std::size_t b = 0; b < 4; b++) {
+                blocks.push_back(pool_.allocate());
+            }
+            cache.insert(piece, std::move(blocks), 0);
+        }
+        for (std::uint32_t b = 1; b < 4; b++) {
+            ASSERT_TRUE(cache.find(piece, b * storage::block_size,
+                                   storage::block_size));
+        }
+    };
+
+    // Two peers reading pieces 0 and 1.
+    for (std::uint32_t piece = 0; piece < 2; piece++) {
+        read_through(piece);
+        read_through(piece);
+    }
+
+    // A peer reading everything once.
+    for (std::uint32_t piece = 100; piece < 200; piece++) {
+        read_through(piece);
+    }
+    ASSERT_EQ(cache.stats().pieces, 4);
+    ASSERT_EQ(cache.stats().misses, 102);
+    ASSERT_TRUE(cache.find(0, 0, 1));
+    ASSERT_TRUE(cache.find(1, 0, 1));
+}
+
+TEST_F(ReadCache, EvictedPieceComesBackAsFrequent) {
+    insert(0);
+    insert(1);
+    // Read twice, so kept as frequent.
+    for (const auto piece : {0, 0, 1, 1}) {
+        ASSERT_TRUE(cached(piece));
+    }
+    // Four pieces fill the cache, and 2 is the oldest of those seen once.
+    for (std::uint32_t piece = 2; piece < 5; piece++) {
+        insert(piece);
+    }
+    ASSERT_FALSE(cached(2));
+
+    // Asked for again soon after, it is kept like the pieces hit twice.
+    insert(2);
+    for (std::uint32_t piece = 10; piece < 20; piece++) {
+        insert(piece);
+    }
+    ASSERT_TRUE(cached(2));
+    ASSERT_TRUE(cached(19));
+}
+
+TEST_F(ReadCache, EraseAndDisabled) {
+    insert(1);
+    cache_.erase(1);
+    cache_.erase(2);
+    ASSERT_FALSE(cached(1));
+    ASSERT_EQ(cache_.stats().bytes, 0);
+
+    auto off = storage::read_cache{0, storage::block_size};
+    ASSERT_FALSE(off.enabled());
+    off.insert(1, {pool_.allocate()});
+    ASSERT_EQ(off.stats().pieces, 0);
+    ASSERT_EQ(pool_.stats().in_use, 0);
+}
+
+namespace {
+// Random content over files that end mid-piece, one of a single block, an
+// empty one and one spanning several pieces, in 16 KiB pieces.
+class CreateTorrent : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        std::filesystem::remove_all(root_);
+        auto random = std::mt19937{13};
+        for (const auto& [path, size] : files_) {
+            auto data = std::string(size, '\0');
+            for (auto& c : data) {
+                c = static_cast<char>(random());
+            }
+            write_file(root_ / "content" / path, data);
+            contents_.push_back(std::move(data));
+        }
+        std::filesystem::create_directories(root_ / "content" / "a");
+        write_file(root_ / "content" / "a" / "empty", "");
+        options_.piece_length = 16384;
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root_); }
+
+    torrent::torrent create() {
+        auto error = storage::create_error{};
+        const auto created =
+            storage::create_torrent(root_ / "content", options_, pool_, &error);
+        EXPECT_EQ(error.message, "");
+        EXPECT_EQ(created.has_value(), true);
+
+        // Written the way it would be encoded again.
+        auto encoded = std::string{};
+        bencode::encode(bencode::parse_literal(created->metainfo).value(),
+                        std::back_inserter(encoded));
+        EXPECT_EQ(encoded, created->metainfo);
+
+        auto result = torrent::from_bytes(created->metainfo);
+        EXPECT_EQ(result.has_value(), true);
+        EXPECT_EQ(result->info_hash, created->info_hash);
+        EXPECT_EQ(result->info_hash_v2, created->info_hash_v2);
+        return std::move(result.value());
+    }
+
+    std::filesystem::path root_ =
+        std::filesystem::temp_directory_path() / "rush_create";
+    // In path order, after a/empty.
+    std::vector<std::pair<std::string, std::size_t>> files_ = {
+        {"a/x", 100}, {"b", 40000}, {"c", 70000}};
+    std::vector<std::string> contents_;
+    storage::create_options options_;
+    concurrency::thread_pool pool_{3};
+};
+}  // namespace
+
+TEST(PickPieceLength, AboutTwoThousandPieces) {
+    ASSERT_EQ(storage::pick_piece_length(0), 16384);
+    ASSERT_EQ(storage::pick_piece_length(10 << 20), 16384);
+    ASSERT_EQ(storage::pick_piece_length(std::uint64_t{1} << 30), 512 << 10);
+    ASSERT_EQ(storage::pick_piece_length(std::uint64_t{1} << 40), 16 << 20);
+}
+
+TEST_F(CreateTorrent, FilesInPathOrderVerify) {
+    options_.trackers = {"http://a/announce", "udp://b:80"};
+    options_.private_ = true;
+    const auto t = create();
+
+    ASSERT_EQ(t.announce, "http://a/announce");
+    ASSERT_EQ(t.announce_list->size(), 2);
+    ASSERT_EQ(t.info_v2.has_value(), false);
+    const auto& info = std::get<torrent::multi_file_info>(t.info);
+    ASSERT_EQ(info.name, "content");
+    ASSERT_EQ(info.piece_length, 16384);
+    ASSERT_EQ(info.private_, 1);
+    ASSERT_EQ(info.files.size(), 4);
+    ASSERT_EQ(info.files[0].path, "a/empty");
+    ASSERT_EQ(info.files[1].path, "a/x");
+    ASSERT_EQ(info.files[3].path, "c");
+    ASSERT_EQ(info.pieces,
+              piece_hashes(contents_[0] + contents_[1] + contents_[2], 16384));
+
+    const auto result = storage::verify(info, root_, pool_);
+    ASSERT_EQ(result.pieces.size(), 7);
+    ASSERT_EQ(result.pieces.all(), true);
+}
+
+TEST_F(CreateTorrent, HybridPadsFilesAndBuildsTrees) {
+    // Two blocks a piece, so that the trees have levels within pieces.
+    options_.hybrid = true;
+    options_.piece_length = 32768;
+    const auto t = create();
+
+    // Every file with data after it is padded to a piece boundary.
+    const auto& info = std::get<torrent::multi_file_info>(t.info);
+    ASSERT_EQ(info.files.size(), 6);
+    ASSERT_EQ(info.files[2].is_padding(), true);
+    ASSERT_EQ(info.files[2].length, 32668);
+    ASSERT_EQ(info.files[2].path, ".pad/32668");
+    ASSERT_EQ(info.files[4].length, 25536);
+    const auto padded = contents_[0] + std::string(32668, '\0') +
+                        contents_[1] + std::string(25536, '\0') + contents_[2];
+    ASSERT_EQ(info.pieces, piece_hashes(padded, 32768));
+    // The content checks out as it is, with no pad files on disk.
+    ASSERT_EQ(storage::verify(info, root_, pool_).pieces.all(), true);
+
+    ASSERT_EQ(t.info_v2.has_value(), true);
+    const auto& files = t.info_v2->files;
+    ASSERT_EQ(files.size(), 4);
+    ASSERT_EQ(files[0].pieces_root.has_value(), false);
+    // Files of more than one piece have a layer.
+    ASSERT_EQ(t.piece_layers.size(), 2);
+
+    for (std::size_t i = 1; i < files.size(); i++) {
+        const auto& data = contents_[i - 1];
+        const auto layer = t.piece_layers.find(files[i].pieces_root.value());
+        auto verifier = torrent::merkle_verifier::build(
+            files[i], 32768,
+            layer == t.piece_layers.end() ? "" : layer->second);
+        ASSERT_EQ(verifier.has_value(), true) << files[i].path;
+
+        for (std::size_t p = 0; p < verifier->piece_count(); p++) {
+            auto verdict = torrent::merkle_verifier::verdict::incomplete;
+            for (std::size_t b = 0; b < verifier->piece_blocks(p); b++) {
+                const auto offset = p * 32768 + b * 16384;
+                verdict = verifier->add_block(
+                    p, b, std::string_view{data}.substr(offset, 16384));
+            }
+            ASSERT_EQ(verdict, torrent::merkle_verifier::verdict::passed);
+        }
+    }
+}
+
+TEST_F(CreateTorrent, SingleFile) {
+    options_.hybrid = true;
+    options_.piece_length = 0;
+    options_.comment = "hello";
+    options_.creation_date = 1700000000;
+
+    auto error = storage::create_error{};
+    const auto created = storage::create_torrent(root_ / "content" / "c",
+                                                 options_, pool_, &error);
+    ASSERT_EQ(created.has_value(), true);
+    const auto t = torrent::from_bytes(created->metainfo);
+    ASSERT_EQ(t.has_value(), true);
+    ASSERT_EQ(t->comment, "hello");
+    ASSERT_EQ(t->creation_date, 1700000000);
+
+    const auto& info = std::get<torrent::single_file_info>(t->info);
+    ASSERT_EQ(info.name, "c");
+    ASSERT_EQ(info.length, 70000);
+    ASSERT_EQ(storage::verify(info, root_ / "content", pool_).pieces.all(),
+              true);
+    ASSERT_EQ(t->info_v2->files.size(), 1);
+    ASSERT_EQ(t->info_v2->files[0].path, "c");
+}
+
+TEST_F(CreateTorrent, Errors) {
+    auto error = storage::create_error{};
+    options_.piece_length = 20000;
+    ASSERT_EQ(storage::create_torrent(root_ / "content", options_, pool_,
+                                      &error)
+                  .has_value(),
+              false);
+    ASSERT_EQ(error.message,
+              "piece length must be a power of two of at least 16 KiB");
+
+    options_.piece_length = 0;
+    ASSERT_EQ(storage::create_torrent(root_ / "content" / "a" / "empty",
+                                      options_, pool_, &error)
+                  .has_value(),
+              false);
+    ASSERT_EQ(error.message, "no data to hash");
+
+    ASSERT_EQ(storage::create_torrent(root_ / "missing", options_, pool_,
+                                      &error)
+                  .has_value(),
+              false);
+    ASSERT_EQ(error.path, root_ / "missing");
+}
@@ -0,0 +1,709 @@
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "bencode.h"
+#include "catalog.h"
+#include "encoder.h"
+#include "layout.h"
+#include "magnet.h"
+#include "merkle.h"
+#include "sha.h"
+#include "tape.h"
+#include "thread_pool.h"
+#include "torrent.h"
+
+TEST(TorrentFromFile, InfoHash) {
+    const auto result =
+        torrent::from_file(RUSH_TEST_RESOURCES "/alice.torrent");
+
+    const auto is_successful = result.has_value();
+    ASSERT_EQ(is_successful, true);
+
+    const auto actual = crypto::to_hex(result->info_hash);
+    ASSERT_EQ(actual, "722fe65b2aa26d14f35b4ad627d20236e481d924");
+    ASSERT_EQ(result->info_hash_v2.has_value(), false);
+}
+
+TEST(TorrentFromFile, MissingFile) {
+    const auto result =
+        torrent::from_file(RUSH_TEST_RESOURCES "/does-not-exist.torrent");
+
+    ASSERT_EQ(result.has_value(), false);
+}
+
+TEST(TorrentFromFile, SingleFileInfo) {
+    const auto result =
+        torrent::from_file(RUSH_TEST_RESOURCES "/alice.torrent");
+    ASSERT_EQ(result.has_value(), true);
+
+    const auto* info = std::get_if<torrent::single_file_info>(&result->info);
+    ASSERT_NE(info, nullptr);
+    ASSERT_EQ(info->name, "alice.txt");
+    ASSERT_EQ(info->length, 163783);
+    ASSERT_EQ(info->piece_length, 16384);
+    ASSERT_EQ(info->pieces.size(), 200);
+    ASSERT_EQ(torrent::piece_hashes(*info).size(), 10);
+}
+
+TEST(TorrentFromInfo, MatchesTheTorrentFile) {
+    const auto tape = bencode::load_tape(RUSH_TEST_RESOURCES "/alice.torrent");
+    ASSERT_TRUE(tape.has_value());
+    const auto info = tape->root().as_dict().find("info");
+    ASSERT_TRUE(info.has_value());
+
+    const auto result = torrent::from_info(info->raw());
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(crypto::to_hex(result->info_hash),
+              "722fe65b2aa26d14f35b4ad627d20236e481d924");
+    const auto* single = std::get_if<torrent::single_file_info>(&result->info);
+    ASSERT_NE(single, nullptr);
+    EXPECT_EQ(single->name, "alice.txt");
+
+    // Trailing bytes would change the info-hash.
+    auto padded = std::string{info->raw()} + "x";
+    EXPECT_FALSE(torrent::from_info(padded).has_value());
+    EXPECT_FALSE(torrent::from_info("d4:name1:ae").has_value());
+}
+
+TEST(Magnet, ParsesHexTopic) {
+    const auto m = torrent::parse_magnet(
+        "magnet:?xt=urn:btih:722FE65B2AA26D14F35B4AD627D20236E481D924"
+        "&dn=alice+in%20wonderland&tr=udp%3A%2F%2Ftracker.example%3A6969"
+        "&tr.1=http%3A%2F%2Fother.example%2Fannounce&x.pe=10.0.0.1:6881"
+        "&ws=http%3A%2F%2Fignored.example");
+    ASSERT_TRUE(m.has_value());
+    EXPECT_EQ(crypto::to_hex(m->info_hash),
+              "722fe65b2aa26d14f35b4ad627d20236e481d924");
+    EXPECT_FALSE(m->info_hash_v2.has_value());
+    EXPECT_EQ(m->name, "alice in wonderland");
+    ASSERT_EQ(m->trackers.size(), 2);
+    EXPECT_EQ(m->trackers[0], "udp://tracker.example:6969");
+    EXPECT_EQ(m->trackers[1], "http://other.example/announce");
+    ASSERT_EQ(m->peers.size(), 1);
+    EXPECT_EQ(m->peers[0], "10.0.0.1:6881");
+}
+
+TEST(Magnet, ParsesBase32AndV2Topics) {
+    const auto v2 = std::string{
+        "caf1e1c30e81cb361b9ee167c4aa64228a7fa4fa9f6105232b28ad099f3a302e"};
+    const auto m = torrent::parse_magnet(
+        "magnet:?xt=urn:btih:OIX6MWZKUJWRJ423JLLCPUQCG3SIDWJE"
+        "&xt=urn:btmh:1220" +
+        v2);
+    ASSERT_TRUE(m.has_value());
+    EXPECT_EQ(crypto::to_hex(m->info_hash),
+              "722fe65b2aa26d14f35b4ad627d20236e481d924");
+    ASSERT_TRUE(m->info_hash_v2.has_value());
+    EXPECT_EQ(crypto::to_hex(m->info_hash_v2.value()), v2);
+}
+
+TEST(Magnet, RejectsMalformed) {
+    EXPECT_FALSE(torrent::parse_magnet("http://example.com").has_value());
+    EXPECT_FALSE(torrent::parse_magnet("magnet:?dn=x").has_value());
+    EXPECT_FALSE(
+        torrent::parse_magnet("magnet:?xt=urn:btih:1234").has_value());
+    EXPECT_FALSE(torrent::parse_magnet(
+                     "magnet:?xt=urn:btih:"
+                     "722fe65b2aa26d14f35b4ad627d20236e481d924&dn=%zz")
+                     .has_value());
+}
+
+namespace {
+std::filesystem::path write_torrent(std::string_view name,
+                                    const bencode::value& contents) {
+    const auto path = std::filesystem::temp_directory_path() / name;
+    auto encoded = std::string{};
+    bencode::encode(contents, std::back_inserter(encoded));
+    auto file = std::ofstream{path, std::ios::binary};
+    file << encoded;
+    return path;
+}
+
+bencode::value file_entry(bencode::integer length,
+                          std::initializer_list<const char*> path) {
+    auto components = bencode::list{};
+    for (const auto* component : path) {
+        components.push_back(bencode::string{component});
+    }
+    auto entry = bencode::dictionary{};
+    entry["length"] = length;
+    entry["path"] = components;
+    return entry;
+}
+
+bencode::value multi_file_torrent(bencode::list files) {
+    auto info = bencode::dictionary{};
+    info["name"] = bencode::string{"album"};
+    info["piece length"] = bencode::integer{16};
+    info["pieces"] = bencode::string(40, 'x');
+    info["files"] = std::move(files);
+
+    auto contents = bencode::dictionary{};
+    contents["announce"] = bencode::string{"http://tracker.example/announce"};
+    contents["info"] = std::move(info);
+    return contents;
+}
+}  // namespace
+
+TEST(TorrentFromFile, MultiFileInfo) {
+    auto files = bencode::list{};
+    files.push_back(file_entry(10, {"disc 1", "01.flac"}));
+    files.push_back(file_entry(20, {"cover.jpg"}));
+    const auto path =
+        write_torrent("rush_multi.torrent", multi_file_torrent(files));
+
+    const auto result = torrent::from_file(path);
+    std::filesystem::remove(path);
+    ASSERT_EQ(result.has_value(), true);
+
+    const auto* info = std::get_if<torrent::multi_file_info>(&result->info);
+    ASSERT_NE(info, nullptr);
+    ASSERT_EQ(info->name, "album");
+    ASSERT_EQ(info->files.size(), 2);
+    ASSERT_EQ(info->files[0].path, "disc 1/01.flac");
+    ASSERT_EQ(info->files[0].length, 10);
+    ASSERT_EQ(info->files[1].path, "cover.jpg");
+    ASSERT_EQ(torrent::file_layout::build(*info).has_value(), true);
+}
+
+TEST(TorrentFromFile, RejectsPathTraversal) {
+    auto files = bencode::list{};
+    files.push_back(file_entry(10, {"..", "etc", "passwd"}));
+    const auto path =
+        write_torrent("rush_traversal.torrent", multi_file_torrent(files));
+
+    auto error = bencode::parse_error{};
+    const auto result = torrent::from_file(path, &error);
+    std::filesystem::remove(path);
+    ASSERT_EQ(result.has_value(), false);
+    ASSERT_EQ(error.message, "invalid path component");
+
+    auto encoded = std::string{};
+    bencode::encode(multi_file_torrent(files), std::back_inserter(encoded));
+    ASSERT_EQ(error.offset, encoded.find("2:.."));
+}
+
+TEST(TorrentFromBytes, ReportsTypeMismatches) {
+    auto contents = multi_file_torrent({});
+    auto& info = std::get<bencode::dictionary>(
+        std::get<bencode::dictionary>(contents)["info"]);
+    info["piece length"] = bencode::string{"16"};
+    auto encoded = std::string{};
+    bencode::encode(contents, std::back_inserter(encoded));
+
+    auto error = bencode::parse_error{};
+    ASSERT_FALSE(torrent::from_bytes(encoded, &error).has_value());
+    EXPECT_EQ(error.message, "expected integer");
+    EXPECT_EQ(error.offset, encoded.find("12:piece length") + 15);
+
+    info["piece length"] = bencode::integer{16};
+    info.erase("name");
+    encoded.clear();
+    bencode::encode(contents, std::back_inserter(encoded));
+    ASSERT_FALSE(torrent::from_bytes(encoded, &error).has_value());
+    EXPECT_EQ(error.message, "missing required key");
+    EXPECT_EQ(error.offset, encoded.find("4:info") + 6);
+}
+
+TEST(TorrentFromBytes, SkipsUnknownKeys) {
+    auto files = bencode::list{};
+    files.push_back(file_entry(10, {"a"}));
+    auto contents = multi_file_torrent(files);
+    auto& root = std::get<bencode::dictionary>(contents);
+    auto nested = bencode::list{};
+    nested.push_back(bencode::dictionary{});
+    nested.push_back(bencode::list{});
+    root["url-list"] = nested;
+    auto& info = std::get<bencode::dictionary>(root["info"]);
+    info["source"] = bencode::string{"elsewhere"};
+    std::get<bencode::dictionary>(
+        std::get<bencode::list>(info["files"]).front())["sha1"] =
+        bencode::integer{7};
+    auto encoded = std::string{};
+    bencode::encode(contents, std::back_inserter(encoded));
+
+    const auto result = torrent::from_bytes(encoded);
+    ASSERT_TRUE(result.has_value());
+    const auto* multi = std::get_if<torrent::multi_file_info>(&result->info);
+    ASSERT_NE(multi, nullptr);
+    ASSERT_EQ(multi->files.size(), 1u);
+    EXPECT_EQ(multi->files[0].path, "a");
+    EXPECT_EQ(result->announce, "http://tracker.example/announce");
+
+    // The info-hash covers the info dictionary exactly as written.
+    const auto start = encoded.find("4:info") + 6;
+    const auto end = encoded.find("8:url-list");
+    EXPECT_EQ(result->info_hash,
+              crypto::sha1(std::string_view{encoded}.substr(start,
+                                                            end - start)));
+}
+
+namespace {
+// Pieces of 16 bytes over files of 10, 0, 25, 0 and 7 bytes.
+torrent::multi_file_info sample_info() {
+    auto info = torrent::multi_file_info{};
+    info.piece_length = 16;
+    info.pieces = std::string(3 * 20, '\0');
+    info.name = "content";
+    info.files = {{10, "", "a"},
+                  {0, "", "empty"},
+                  {25, "", "b"},
+                  {0, "", "also-empty"},
+                  {7, "", "c"}};
+    return info;
+}
+
+std::string describe(torrent::slice_range slices) {
+    auto result = std::string{};
+    for (const auto slice : slices) {
+        result += fmt::format("[{} {} {}]", slice.file, slice.offset,
+                              slice.length);
+    }
+    return result;
+}
+}  // namespace
+
+TEST(FileLayout, Offsets) {
+    const auto layout = torrent::file_layout::build(sample_info());
+    ASSERT_EQ(layout.has_value(), true);
+
+    ASSERT_EQ(layout->file_count(), 5);
+    ASSERT_EQ(layout->total_size(), 42);
+    ASSERT_EQ(layout->piece_count(), 3);
+    ASSERT_EQ(layout->piece_size(0), 16);
+    ASSERT_EQ(layout->piece_size(2), 10);
+    ASSERT_EQ(layout->file_offset(4), 35);
+    ASSERT_EQ(layout->file_size(2), 25);
+}
+
+TEST(FileLayout, FileAt) {
+    const auto layout = torrent::file_layout::build(sample_info()).value();
+
+    ASSERT_EQ(layout.file_at(0), 0);
+    ASSERT_EQ(layout.file_at(9), 0);
+    ASSERT_EQ(layout.file_at(10), 2);
+    ASSERT_EQ(layout.file_at(34), 2);
+    ASSERT_EQ(layout.file_at(35), 4);
+    ASSERT_EQ(layout.file_at(41), 4);
+}
+
+TEST(FileLayout, PieceSlices) {
+    const auto layout = torrent::file_layout::build(sample_info()).value();
+
+    ASSERT_EQ(describe(layout.piece_slices(0)), "[0 0 10][2 0 6]");
+    ASSERT_EQ(describe(layout.piece_slices(1)), "[2 6 16]");
+    ASSERT_EQ(describe(layout.piece_slices(2)), "[2 22 3][4 0 7]");
+}
+
+TEST(FileLayout, BlockSlices) {
+    const auto layout = torrent::file_layout::build(sample_info()).value();
+
+    ASSERT_EQ(describe(layout.block_slices(0, 8, 4)), "[0 8 2][2 0 2]");
+    ASSERT_EQ(describe(layout.block_slices(2, 8, 100)), "[4 5 2]");
+    ASSERT_EQ(describe(layout.slices(42, 1)), "");
+}
+
+TEST(FileLayout, RejectsMismatchedPieceCount) {
+    auto info = sample_info();
+    info.pieces = std::string(2 * 20, '\0');
+    ASSERT_EQ(torrent::file_layout::build(info).has_value(), false);
+
+    info = sample_info();
+    info.piece_length = 0;
+    ASSERT_EQ(torrent::file_layout::build(info).has_value(), false);
+}
+
+TEST(FileLayout, PieceHashesAreViews) {
+    auto info = sample_info();
+    info.pieces[20] = '\x7f';
+    const auto hashes = torrent::piece_hashes(info);
+
+    ASSERT_EQ(hashes.size(), 3);
+    ASSERT_EQ(hashes[1][0], std::byte{0x7f});
+    ASSERT_EQ(static_cast<const void*>(hashes.data()),
+              static_cast<const void*>(info.pieces.data()));
+}
+
+namespace {
+std::string_view as_chars(const crypto::sha256_digest& digest) {
+    return {reinterpret_cast<const char*>(digest.data()), digest.size()};
+}
+
+// The tree of BEP 52 spelled out: every block hashed, zero leaves up to
+// width, then halved layer by layer. Returns the layers, leaves first.
+std::vector<std::vector<crypto::sha256_digest>> reference_tree(
+    std::string_view content, std::size_t width) {
+    auto layer = std::vector<crypto::sha256_digest>(width);
+    for (std::size_t i = 0; i * 16384 < content.size(); i++) {
+        layer[i] = crypto::sha256(content.substr(i * 16384, 16384));
+    }
+    auto layers = std::vector<std::vector<crypto::sha256_digest>>{layer};
+    while (layer.size() > 1) {
+        auto next = std::vector<crypto::sha256_digest>{};
+        for (std::size_t i = 0; i < layer.size(); i += 2) {
+            next.push_back(crypto::sha256(std::string{as_chars(layer[i])} +
+                                          std::string{as_chars(layer[i + 1])}));
+        }
+        layer = next;
+        layers.push_back(layer);
+    }
+    return layers;
+}
+
+std::string content_of(std::size_t size, char seed) {
+    auto content = std::string(size, '\0');
+    for (std::size_t i = 0; i < size; i++) {
+        content[i] = static_cast<char>(seed + i * 7 + i / 997);
+    }
+    return content;
+}
+
+// Files of 100 KiB in pieces of 32 KiB: four pieces, the last one short.
+constexpr std::size_t v2_piece_length = 32768;
+
+struct v2_file {
+    std::string content = content_of(100 * 1024, 'a');
+    // 7 blocks, padded to a tree of 8 leaves.
+    std::vector<std::vector<crypto::sha256_digest>> tree =
+        reference_tree(content, 8);
+
+    crypto::sha256_digest root() const { return tree.back().front(); }
+    std::string piece_layer() const {
+        auto layer = std::string{};
+        for (const auto& hash : tree[1]) {
+            layer += as_chars(hash);
+        }
+        return layer;
+    }
+    torrent::v2::file file() const {
+        return {static_cast<bencode::integer>(content.size()), root(), "f"};
+    }
+};
+
+bencode::value v2_entry(bencode::integer length,
+                        std::optional<crypto::sha256_digest> root) {
+    auto details = bencode::dictionary{};
+    details["length"] = length;
+    if (root.has_value()) {
+        details["pieces root"] = bencode::string{as_chars(root.value())};
+    }
+    auto entry = bencode::dictionary{};
+    entry[""] = details;
+    return entry;
+}
+}  // namespace
+
+TEST(TorrentFromBytes, V2FileTree) {
+    const auto big = v2_file{};
+    const auto small = content_of(1000, 'z');
+
+    auto directory = bencode::dictionary{};
+    directory["big.bin"] = v2_entry(static_cast<bencode::integer>(
+                                        big.content.size()),
+                                    big.root());
+    auto tree = bencode::dictionary{};
+    tree["directory"] = directory;
+    tree["empty"] = v2_entry(0, std::nullopt);
+    tree["small.txt"] = v2_entry(1000, crypto::sha256(small));
+
+    auto info = bencode::dictionary{};
+    info["file tree"] = tree;
+    info["meta version"] = bencode::integer{2};
+    info["name"] = bencode::string{"content"};
+    info["piece length"] = bencode::integer{v2_piece_length};
+    auto layers = bencode::dictionary{};
+    layers[bencode::string{as_chars(big.root())}] = big.piece_layer();
+    auto contents = bencode::dictionary{};
+    contents["info"] = info;
+    contents["piece layers"] = layers;
+
+    auto encoded = std::string{};
+    bencode::encode(bencode::value{contents}, std::back_inserter(encoded));
+    const auto result = torrent::from_bytes(encoded);
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->info_v2.has_value());
+    EXPECT_TRUE(result->info_hash_v2.has_value());
+
+    const auto& files = result->info_v2->files;
+    ASSERT_EQ(files.size(), 3u);
+    EXPECT_EQ(files[0].path, "directory/big.bin");
+    EXPECT_EQ(files[0].pieces_root, big.root());
+    EXPECT_EQ(files[1].path, "empty");
+    EXPECT_FALSE(files[1].pieces_root.has_value());
+    EXPECT_EQ(files[2].path, "small.txt");
+    EXPECT_EQ(files[2].length, 1000);
+    ASSERT_EQ(result->piece_layers.count(big.root()), 1u);
+    EXPECT_EQ(result->piece_layers.at(big.root()), big.piece_layer());
+
+    // Without v1 hashes the files still show up in the v1 view.
+    const auto* multi = std::get_if<torrent::multi_file_info>(&result->info);
+    ASSERT_NE(multi, nullptr);
+    EXPECT_EQ(multi->name, "content");
+    ASSERT_EQ(multi->files.size(), 3u);
+    EXPECT_EQ(multi->files[2].path, "small.txt");
+    EXPECT_TRUE(multi->pieces.empty());
+}
+
+TEST(TorrentFromBytes, HybridKeepsBothVersions) {
+    auto files = bencode::list{};
+    files.push_back(file_entry(10, {"a"}));
+    auto pad = file_entry(16374, {".pad", "16374"});
+    std::get<bencode::dictionary>(pad)["attr"] = bencode::string{"p"};
+    files.push_back(pad);
+    files.push_back(file_entry(20, {"b"}));
+    auto contents = multi_file_torrent(files);
+
+    auto tree = bencode::dictionary{};
+    tree["a"] = v2_entry(10, crypto::sha256_digest{});
+    tree["b"] = v2_entry(20, crypto::sha256_digest{});
+    auto& info = std::get<bencode::dictionary>(
+        std::get<bencode::dictionary>(contents)["info"]);
+    info["file tree"] = tree;
+    info["meta version"] = bencode::integer{2};
+    info["piece length"] = bencode::integer{16384};
+
+    auto encoded = std::string{};
+    bencode::encode(contents, std::back_inserter(encoded));
+    const auto result = torrent::from_bytes(encoded);
+    ASSERT_TRUE(result.has_value());
+    const auto* multi = std::get_if<torrent::multi_file_info>(&result->info);
+    ASSERT_NE(multi, nullptr);
+    ASSERT_EQ(multi->files.size(), 3u);
+    EXPECT_FALSE(multi->files[0].is_padding());
+    EXPECT_TRUE(multi->files[1].is_padding());
+    EXPECT_EQ(multi->pieces.size(), 40u);
+    ASSERT_TRUE(result->info_v2.has_value());
+    EXPECT_EQ(result->info_v2->files.size(), 2u);
+}
+
+TEST(Merkle, RootMatchesTheReferenceTree) {
+    const auto big = v2_file{};
+    auto leaves = std::vector<crypto::sha256_digest>{};
+    for (std::size_t i = 0; i * 16384 < big.content.size(); i++) {
+        leaves.push_back(crypto::sha256(big.content.substr(i * 16384, 16384)));
+    }
+    EXPECT_EQ(torrent::merkle_root(leaves, 8), big.root());
+    // From the piece layer, whose entries stand for subtrees of height 1.
+    EXPECT_EQ(torrent::merkle_root(big.tree[1], 4, 1), big.root());
+    // Three of them in eight slots: padding fills the rest.
+    const auto left = torrent::merkle_parent(
+        big.tree[2][0],
+        torrent::merkle_parent(big.tree[1][2], torrent::merkle_pad(1)));
+    EXPECT_EQ(torrent::merkle_root(std::span{big.tree[1]}.first(3), 8, 1),
+              torrent::merkle_parent(left, torrent::merkle_pad(3)));
+    EXPECT_EQ(torrent::merkle_pad(1), crypto::sha256(std::string(64, '\0')));
+}
+
+TEST(Merkle, RejectsABadPieceLayer) {
+    const auto big = v2_file{};
+    auto layer = big.piece_layer();
+    EXPECT_TRUE(torrent::merkle_verifier::build(big.file(), v2_piece_length,
+                                                layer)
+                    .has_value());
+    layer[40] ^= 1;
+    EXPECT_FALSE(torrent::merkle_verifier::build(big.file(), v2_piece_length,
+                                                 layer)
+                     .has_value());
+    EXPECT_FALSE(torrent::merkle_verifier::build(big.file(), v2_piece_length,
+                                                 layer.substr(32))
+                     .has_value());
+}
+
+TEST(Merkle, ChecksPiecesAsTheirLastBlockArrives) {
+    using verdict = torrent::merkle_verifier::verdict;
+    const auto big = v2_file{};
+    auto v = torrent::merkle_verifier::build(big.file(), v2_piece_length,
+                                             big.piece_layer());
+    ASSERT_TRUE(v.has_value());
+    ASSERT_EQ(v->piece_count(), 4u);
+    EXPECT_EQ(v->piece_blocks(0), 2u);
+    EXPECT_EQ(v->piece_blocks(3), 1u);
+
+    const auto block = [&](std::size_t piece, std::size_t b) {
+        return std::string_view{big.content}.substr(
+            piece * v2_piece_length + b * 16384, 16384);
+    };
+    EXPECT_EQ(v->add_block(0, 1, block(0, 1)), verdict::incomplete);
+    EXPECT_EQ(v->add_block(0, 0, block(0, 0)), verdict::passed);
+    EXPECT_EQ(v->add_block(3, 0, block(3, 0)), verdict::passed);
+
+    // Without block hashes a bad block shows only once the piece is done.
+    auto corrupt = std::string{block(1, 0)};
+    corrupt[100] ^= 1;
+    EXPECT_EQ(v->add_block(1, 0, corrupt), verdict::incomplete);
+    EXPECT_EQ(v->add_block(1, 1, block(1, 1)), verdict::piece_failed);
+    EXPECT_EQ(v->add_block(1, 0, block(1, 0)), verdict::incomplete);
+    EXPECT_EQ(v->add_block(1, 1, block(1, 1)), verdict::passed);
+
+    EXPECT_EQ(v->add_block(2, 0, block(2, 0).substr(1)),
+              verdict::block_failed);
+    EXPECT_EQ(v->add_block(4, 0, block(2, 0)), verdict::block_failed);
+}
+
+TEST(Merkle, ChecksEveryBlockOnceItsHashesAreKnown) {
+    using verdict = torrent::merkle_verifier::verdict;
+    const auto big = v2_file{};
+    auto v = torrent::merkle_verifier::build(big.file(), v2_piece_length,
+                                             big.piece_layer());
+    ASSERT_TRUE(v.has_value());
+    const auto leaves = std::span{big.tree[0]};
+
+    auto corrupt = std::string{big.content.substr(2 * 16384, 16384)};
+    corrupt[0] ^= 1;
+    // A block from before the hashes came is checked against them.
+    EXPECT_EQ(v->add_block(1, 0, corrupt), verdict::incomplete);
+    EXPECT_FALSE(v->set_block_hashes(1, leaves.subspan(0, 2)));
+    EXPECT_TRUE(v->set_block_hashes(1, leaves.subspan(2, 2)));
+    EXPECT_EQ(v->add_block(1, 1, big.content.substr(3 * 16384, 16384)),
+              verdict::incomplete);
+    EXPECT_EQ(v->add_block(1, 0, corrupt), verdict::block_failed);
+    EXPECT_EQ(v->add_block(1, 0, big.content.substr(2 * 16384, 16384)),
+              verdict::passed);
+}
+
+TEST(Merkle, FileOfOnePiece) {
+    using verdict = torrent::merkle_verifier::verdict;
+    // Three blocks, the last one short, under a tree four leaves wide.
+    const auto content = content_of(40000, 'q');
+    const auto root = reference_tree(content, 4).back().front();
+    const auto file = torrent::v2::file{40000, root, "one"};
+    auto v = torrent::merkle_verifier::build(file, 65536, {});
+    ASSERT_TRUE(v.has_value());
+    ASSERT_EQ(v->piece_count(), 1u);
+    EXPECT_EQ(v->piece_blocks(0), 3u);
+
+    EXPECT_EQ(v->add_block(0, 2, content.substr(32768)), verdict::incomplete);
+    EXPECT_EQ(v->add_block(0, 0, content.substr(0, 16384)),
+              verdict::incomplete);
+    EXPECT_EQ(v->add_block(0, 1, content.substr(16384, 16384)),
+              verdict::passed);
+}
+
+TEST(Catalog, File) {
+    auto error = torrent::catalog_error{};
+    const auto entry =
+        torrent::catalog_file(RUSH_TEST_RESOURCES "/alice.torrent", error);
+    ASSERT_EQ(entry.has_value(), true);
+
+    ASSERT_EQ(entry->name, "alice.txt");
+    ASSERT_EQ(crypto::to_hex(entry->info_hash),
+              "722fe65b2aa26d14f35b4ad627d20236e481d924");
+    ASSERT_EQ(entry->total_size, 163783);
+    ASSERT_EQ(entry->piece_count, 10);
+    ASSERT_EQ(entry->file_count, 1);
+    ASSERT_EQ(entry->has_v1, true);
+    ASSERT_EQ(entry->info_hash_v2.has_value(), false);
+}
+
+TEST(Catalog, ScanDirectory) {
+    const auto root = std::filesystem::temp_directory_path() / "rush_scan";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "nested");
+    for (int i = 0; i < 150; i++) {
+        std::filesystem::copy_file(
+            RUSH_TEST_RESOURCES "/alice.torrent",
+            root / "nested" / fmt::format("{:03}.torrent", i));
+    }
+    std::ofstream{root / "broken.torrent"} << "d4:infod";
+    std::ofstream{root / "list.torrent"} << "le";
+    std::ofstream{root / "notes.txt"} << "not a torrent";
+
+    auto pool = concurrency::thread_pool{3};
+    const auto result = torrent::scan(root, pool);
+    std::filesystem::remove_all(root);
+
+    ASSERT_EQ(result.entries.size(), 150);
+    ASSERT_EQ(result.entries.front().path.filename(), "000.torrent");
+    ASSERT_EQ(result.entries.back().path.filename(), "149.torrent");
+
+    ASSERT_EQ(result.errors.size(), 2);
+    ASSERT_EQ(result.errors[0].path.filename(), "broken.torrent");
+    ASSERT_EQ(result.errors[0].offset, 8);
+    ASSERT_EQ(result.errors[1].message, "not a dictionary");
+}
+
+TEST(Catalog, ScanV2OnlyAndHybrid) {
+    const auto root = std::filesystem::temp_directory_path() / "rush_scan_v2";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+
+    // Padded like create lays out a hybrid torrent.
+    auto files = bencode::list{};
+    files.push_back(file_entry(10, {"a"}));
+    auto pad = file_entry(6, {".pad", "6"});
+    std::get<bencode::dictionary>(pad)["attr"] = bencode::string{"p"};
+    files.push_back(pad);
+    files.push_back(file_entry(20, {"b"}));
+    auto hybrid = multi_file_torrent(files);
+    auto& hybrid_info = std::get<bencode::dictionary>(
+        std::get<bencode::dictionary>(hybrid)["info"]);
+    auto hybrid_tree = bencode::dictionary{};
+    hybrid_tree["a"] = v2_entry(10, crypto::sha256_digest{});
+    hybrid_tree["b"] = v2_entry(20, crypto::sha256_digest{});
+    hybrid_info["file tree"] = hybrid_tree;
+    hybrid_info["meta version"] = bencode::integer{2};
+    write_torrent("rush_scan_v2/hybrid.torrent", hybrid);
+
+    // Pieces are per file: three for big.bin, one for small.txt.
+    auto directory = bencode::dictionary{};
+    directory["big.bin"] = v2_entry(40000, crypto::sha256_digest{});
+    auto tree = bencode::dictionary{};
+    tree["directory"] = directory;
+    tree["empty"] = v2_entry(0, std::nullopt);
+    tree["small.txt"] = v2_entry(1000, crypto::sha256_digest{});
+    auto info = bencode::dictionary{};
+    info["file tree"] = tree;
+    info["meta version"] = bencode::integer{2};
+    info["name"] = bencode::string{"content"};
+    info["piece length"] = bencode::integer{16384};
+    auto v2_only = bencode::dictionary{};
+    v2_only["info"] = info;
+    const auto v2_path = write_torrent("rush_scan_v2/v2.torrent", v2_only);
+    const auto parsed = torrent::from_file(v2_path);
+
+    auto pool = concurrency::thread_pool{2};
+    const auto result = torrent::scan(root, pool);
+    std::filesystem::remove_all(root);
+
+    ASSERT_EQ(result.errors.size(), 0);
+    ASSERT_EQ(result.entries.size(), 2);
+
+    const auto& padded = result.entries[0];
+    ASSERT_EQ(padded.has_v1, true);
+    ASSERT_EQ(padded.info_hash_v2.has_value(), true);
+    ASSERT_EQ(padded.total_size, 30);
+    ASSERT_EQ(padded.file_count, 2);
+    ASSERT_EQ(padded.piece_count, 2);
+
+    const auto& v2 = result.entries[1];
+    ASSERT_EQ(v2.name, "content");
+    ASSERT_EQ(v2.has_v1, false);
+    ASSERT_EQ(parsed.has_value(), true);
+    ASSERT_EQ(v2.info_hash, parsed->info_hash);
+    ASSERT_EQ(v2.info_hash_v2, parsed->info_hash_v2);
+    ASSERT_EQ(v2.total_size, 41000);
+    ASSERT_EQ(v2.file_count, 3);
+    ASSERT_EQ(v2.piece_count, 4);
+}
+
+TEST(Catalog, MissingDirectory) {
+    auto pool = concurrency::thread_pool{1};
+    const auto result = torrent::scan("/does/not/exist", pool);
+
+    ASSERT_EQ(result.entries.empty(), true);
+    ASSERT_EQ(result.errors.size(), 1);
+}
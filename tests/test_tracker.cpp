@@ -0,0 +1,426 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "announce.h"
+#include "client.h"
+#include "compact.h"
+#include "encoder.h"
+#include "http_tracker.h"
+#include "udp_tracker.h"
+#include "url.h"
+
+namespace {
+namespace http = boost::beast::http;
+using boost::asio::redirect_error;
+using boost::asio::use_awaitable;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using namespace std::chrono_literals;
+
+const auto localhost = boost::asio::ip::make_address("127.0.0.1");
+
+// Two peers, 10.0.0.1:6881 and 10.0.0.2:6882, in compact form.
+const std::string compact_peers{"\x0a\x00\x00\x01\x1a\xe1"
+                                "\x0a\x00\x00\x02\x1a\xe2",
+                                12};
+
+// Runs body on ctx until it finishes, stopping the stand-in trackers with it.
+void run(boost::asio::io_context& ctx, boost::asio::awaitable<void> body) {
+    auto failure = std::exception_ptr{};
+    boost::asio::co_spawn(ctx, std::move(body), [&](std::exception_ptr e) {
+        failure = e;
+        ctx.stop();
+    });
+    ctx.run();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+tracker::announce_request make_request(std::byte fill) {
+    auto request = tracker::announce_request{};
+    request.info_hash.fill(fill);
+    request.peer_id.fill(std::byte{'-'});
+    request.port = 6881;
+    request.left = 1000;
+    request.event = tracker::event::started;
+    return request;
+}
+
+std::uint32_t load32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint32_t>(u[0]) << 24 | u[1] << 16 | u[2] << 8 |
+           u[3];
+}
+
+void store32(std::string& out, std::uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>(v >> shift);
+    }
+}
+
+// Answers announces on keep-alive connections, counting both.
+struct http_stand_in {
+    explicit http_stand_in(boost::asio::io_context& ctx)
+        : acceptor{ctx, {localhost, 0}} {
+        boost::asio::co_spawn(ctx, accept(), boost::asio::detached);
+    }
+
+    std::string url() const {
+        return "http://127.0.0.1:" +
+               std::to_string(acceptor.local_endpoint().port()) + "/announce";
+    }
+
+    boost::asio::awaitable<void> accept() {
+        for (;;) {
+            auto socket = co_await acceptor.async_accept(use_awaitable);
+            connections++;
+            boost::asio::co_spawn(acceptor.get_executor(),
+                                  serve(std::move(socket)),
+                                  boost::asio::detached);
+        }
+    }
+
+    boost::asio::awaitable<void> serve(tcp::socket socket) {
+        auto buffer = boost::beast::flat_buffer{};
+        for (;;) {
+            auto ec = boost::system::error_code{};
+            auto request = http::request<http::empty_body>{};
+            co_await http::async_read(socket, buffer, request,
+                                      redirect_error(use_awaitable, ec));
+            if (ec) {
+                co_return;
+            }
+            requests++;
+            last_target = std::string{request.target()};
+
+            auto body = std::string{};
+            bencode::encoder{std::back_inserter(body)}
+                .begin_dict()
+                .string("complete")
+                .integer(5)
+                .string("incomplete")
+                .integer(3)
+                .string("interval")
+                .integer(1800)
+                .string("peers")
+                .string(compact_peers)
+                .end();
+            auto response =
+                http::response<http::string_body>{http::status::ok, 11};
+            response.body() = std::move(body);
+            response.keep_alive(true);
+            response.prepare_payload();
+            co_await http::async_write(socket, response,
+                                       redirect_error(use_awaitable, ec));
+            if (ec) {
+                co_return;
+            }
+        }
+    }
+
+    tcp::acceptor acceptor;
+    std::size_t connections = 0;
+    std::size_t requests = 0;
+    std::string last_target;
+};
+
+// A BEP 15 tracker that knows every torrent, except those whose info-hash
+// starts with 0xff. It can be told to ignore the first few packets.
+struct udp_stand_in {
+    static constexpr std::uint64_t connection_id = 0x0123456789abcdef;
+
+    explicit udp_stand_in(boost::asio::io_context& ctx)
+        : socket{ctx, {localhost, 0}} {
+        boost::asio::co_spawn(ctx, serve(), boost::asio::detached);
+    }
+
+    std::string url() const {
+        return "udp://127.0.0.1:" +
+               std::to_string(socket.local_endpoint().port()) + "/announce";
+    }
+
+    boost::asio::awaitable<void> serve() {
+        auto buffer = std::array<char, 2048>{};
+        for (;;) {
+            auto from = udp::endpoint{};
+            const auto n = co_await socket.async_receive_from(
+                boost::asio::buffer(buffer), from, use_awaitable);
+            packets++;
+            if (drop > 0) {
+                drop--;
+                continue;
+            }
+
+            const auto request = std::string_view{buffer.data(), n};
+            const auto action = load32(request.data() + 8);
+            auto reply = std::string{};
+            store32(reply, action);
+            reply.append(request.substr(12, 4));
+            if (action == 0) {
+                store32(reply, connection_id >> 32);
+                store32(reply, static_cast<std::uint32_t>(connection_id));
+            } else if (request.substr(0, 8) !=
+                       std::string_view{"\x01\x23\x45\x67\x89\xab\xcd\xef",
+                                        8}) {
+                continue;
+            } else if (action == 1 && request[16] == '\xff') {
+                reply.replace(0, 4, std::string_view{"\0\0\0\3", 4});
+                reply += "unknown torrent";
+            } else if (action == 1) {
+                store32(reply, 1800);
+                store32(reply, 3);
+                store32(reply, 5);
+                reply += compact_peers;
+            } else if (action == 2) {
+                const auto hashes = (n - 16) / 20;
+                largest_scrape = std::max(largest_scrape, hashes);
+                for (std::size_t i = 0; i < hashes; i++) {
+                    const auto first =
+                        static_cast<unsigned char>(request[16 + i * 20]);
+                    store32(reply, first);
+                    store32(reply, first * 2);
+                    store32(reply, first * 3);
+                }
+            }
+            co_await socket.async_send_to(boost::asio::buffer(reply), from,
+                                          use_awaitable);
+        }
+    }
+
+    udp::socket socket;
+    std::size_t packets = 0;
+    std::size_t drop = 0;
+    std::size_t largest_scrape = 0;
+};
+
+// A UDP port nothing listens on.
+std::string dead_udp_url(boost::asio::io_context& ctx) {
+    auto socket = udp::socket{ctx, {localhost, 0}};
+    return "udp://127.0.0.1:" + std::to_string(socket.local_endpoint().port());
+}
+
+void expect_stand_in_peers(const tracker::announce_response& response) {
+    EXPECT_EQ(response.interval, 1800s);
+    EXPECT_EQ(response.seeders, 5);
+    EXPECT_EQ(response.leechers, 3);
+    ASSERT_EQ(response.peers.size(), 2);
+    EXPECT_EQ(response.peers[0],
+              tcp::endpoint(boost::asio::ip::make_address("10.0.0.1"), 6881));
+    EXPECT_EQ(response.peers[1],
+              tcp::endpoint(boost::asio::ip::make_address("10.0.0.2"), 6882));
+}
+}  // namespace
+
+TEST(Tracker, ParsesUrls) {
+    const auto http = tracker::parse_url("http://tracker.example/announce?x=1");
+    ASSERT_TRUE(http.has_value());
+    EXPECT_EQ(http->host, "tracker.example");
+    EXPECT_EQ(http->port, "80");
+    EXPECT_EQ(http->target, "/announce?x=1");
+
+    const auto udp = tracker::parse_url("UDP://[::1]:6969");
+    ASSERT_TRUE(udp.has_value());
+    EXPECT_EQ(udp->scheme, "udp");
+    EXPECT_EQ(udp->host, "::1");
+    EXPECT_EQ(udp->port, "6969");
+    EXPECT_EQ(udp->target, "/");
+
+    EXPECT_FALSE(tracker::parse_url("udp://tracker.example").has_value());
+    EXPECT_FALSE(tracker::parse_url("wss://tracker.example").has_value());
+    EXPECT_FALSE(tracker::parse_url("http://:80/").has_value());
+}
+
+TEST(Tracker, DecodesCompactPeers) {
+    auto peers = std::vector<tcp::endpoint>{};
+    ASSERT_TRUE(tracker::decode_peers(compact_peers, peers));
+    ASSERT_EQ(peers.size(), 2);
+    EXPECT_EQ(peers[1].port(), 6882);
+    EXPECT_FALSE(tracker::decode_peers(compact_peers.substr(1), peers));
+    EXPECT_EQ(peers.size(), 2);
+
+    auto v6 = std::string(18, '\0');
+    v6[15] = 1;
+    v6[17] = 80;
+    ASSERT_TRUE(tracker::decode_peers6(v6, peers));
+    EXPECT_EQ(peers[2],
+              tcp::endpoint(boost::asio::ip::make_address("::1"), 80));
+}
+
+TEST(Tracker, ParsesAnnounceResponses) {
+    auto response = tracker::announce_response{};
+    EXPECT_TRUE(tracker::parse_announce_response(
+        "d8:intervali900e5:peersld2:ip9:127.0.0.14:porti80eeee", response));
+    EXPECT_EQ(response.interval, 900s);
+    ASSERT_EQ(response.peers.size(), 1);
+    EXPECT_EQ(response.peers[0].port(), 80);
+
+    EXPECT_FALSE(tracker::parse_announce_response(
+        "d14:failure reason9:not founde", response));
+    EXPECT_EQ(response.failure, "not found");
+    EXPECT_TRUE(response.peers.empty());
+    EXPECT_FALSE(tracker::parse_announce_response("i3e", response));
+}
+
+TEST(Tracker, EncodesAnnounceTargets) {
+    auto request = make_request(std::byte{0x12});
+    request.info_hash[0] = std::byte{'a'};
+    const auto target = tracker::announce_target("/announce?k=v", request);
+    EXPECT_TRUE(target.starts_with("/announce?k=v&info_hash=a%12%12"));
+    EXPECT_NE(target.find("&port=6881&uploaded=0&downloaded=0&left=1000"
+                          "&compact=1&numwant=50&key=0&event=started"),
+              std::string::npos);
+}
+
+TEST(Tracker, HttpReusesConnections) {
+    auto ctx = boost::asio::io_context{};
+    auto stand_in = http_stand_in{ctx};
+    auto http = tracker::http_tracker{ctx.get_executor(), 5s};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        const auto url = tracker::parse_url(stand_in.url()).value();
+        auto response = tracker::announce_response{};
+        for (int i = 0; i < 20; i++) {
+            EXPECT_TRUE(co_await http.announce(
+                url, make_request(std::byte(i)), response));
+        }
+        expect_stand_in_peers(response);
+    }());
+
+    EXPECT_EQ(stand_in.requests, 20);
+    EXPECT_EQ(stand_in.connections, 1);
+    EXPECT_EQ(http.idle_connections(), 1);
+    EXPECT_NE(stand_in.last_target.find("info_hash=%13%13"),
+              std::string::npos);
+}
+
+TEST(Tracker, UdpAnnounce) {
+    auto ctx = boost::asio::io_context{};
+    auto stand_in = udp_stand_in{ctx};
+    auto udp = tracker::udp_tracker{ctx.get_executor(), {.timeout = 50ms}};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        const auto url = tracker::parse_url(stand_in.url()).value();
+        auto response = tracker::announce_response{};
+        EXPECT_TRUE(co_await udp.announce(url, make_request(std::byte{1}),
+                                          response));
+        expect_stand_in_peers(response);
+
+        // The connection id is reused, so this is one round trip.
+        EXPECT_TRUE(co_await udp.announce(url, make_request(std::byte{2}),
+                                          response));
+        EXPECT_EQ(udp.packets_sent(), 3);
+
+        EXPECT_FALSE(co_await udp.announce(url, make_request(std::byte{0xff}),
+                                           response));
+        EXPECT_EQ(response.failure, "unknown torrent");
+    }());
+}
+
+TEST(Tracker, UdpRetransmits) {
+    auto ctx = boost::asio::io_context{};
+    auto stand_in = udp_stand_in{ctx};
+    stand_in.drop = 2;
+    auto udp = tracker::udp_tracker{ctx.get_executor(),
+                                    {.timeout = 20ms, .retries = 3}};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        const auto url = tracker::parse_url(stand_in.url()).value();
+        auto response = tracker::announce_response{};
+        EXPECT_TRUE(co_await udp.announce(url, make_request(std::byte{1}),
+                                          response));
+        expect_stand_in_peers(response);
+    }());
+    EXPECT_EQ(stand_in.packets, 4);
+}
+
+TEST(Tracker, UdpScrapesInBatches) {
+    auto ctx = boost::asio::io_context{};
+    auto stand_in = udp_stand_in{ctx};
+    auto udp = tracker::udp_tracker{ctx.get_executor(), {.timeout = 50ms}};
+
+    auto hashes = std::vector<crypto::sha1_digest>(200);
+    for (std::size_t i = 0; i < hashes.size(); i++) {
+        hashes[i].fill(std::byte(i));
+    }
+
+    auto entries = std::vector<tracker::scrape_entry>{};
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        const auto url = tracker::parse_url(stand_in.url()).value();
+        EXPECT_TRUE(co_await udp.scrape(url, hashes, entries));
+    }());
+
+    // A connect and three scrapes of 74, 74 and 52.
+    EXPECT_EQ(stand_in.packets, 4);
+    EXPECT_EQ(stand_in.largest_scrape, tracker::udp_tracker::max_scrape);
+    ASSERT_EQ(entries.size(), hashes.size());
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        EXPECT_EQ(entries[i].info_hash, hashes[i]);
+        EXPECT_EQ(entries[i].seeders, i);
+        EXPECT_EQ(entries[i].completed, i * 2);
+        EXPECT_EQ(entries[i].leechers, i * 3);
+    }
+}
+
+TEST(Tracker, FailsOverThroughTiers) {
+    auto ctx = boost::asio::io_context{};
+    auto http_tracker = http_stand_in{ctx};
+    auto udp_tracker = udp_stand_in{ctx};
+    auto client = tracker::client{ctx.get_executor(),
+                                  {.udp = {.timeout = 10ms, .retries = 1}}};
+
+    const auto dead = dead_udp_url(ctx);
+    auto trackers = tracker::tracker_list{{
+        {dead, "http://127.0.0.1:1/announce?"},
+        {dead + "/other", udp_tracker.url(), http_tracker.url()},
+    }};
+
+    run(ctx, [&]() -> boost::asio::awaitable<void> {
+        auto response = tracker::announce_response{};
+        EXPECT_TRUE(co_await client.announce(
+            trackers, make_request(std::byte{1}), response));
+        expect_stand_in_peers(response);
+    }());
+
+    // Whichever live tracker answered leads its tier now.
+    const auto& first = trackers.tiers()[1][0];
+    EXPECT_TRUE(first == udp_tracker.url() || first == http_tracker.url());
+    EXPECT_EQ(trackers.tiers()[0].size(), 2);
+}
+
+TEST(Tracker, ListsFromTorrent) {
+    auto t = torrent::torrent{};
+    t.announce = "http://a/announce";
+    EXPECT_EQ(tracker::tracker_list::from(t).tiers(),
+              (std::vector<std::vector<std::string>>{{"http://a/announce"}}));
+
+    t.announce_list = bencode::list{};
+    t.announce_list->push_back(bencode::list{});
+    auto tier = bencode::list{};
+    tier.push_back(bencode::string{"udp://b:1"});
+    tier.push_back(bencode::integer{3});
+    t.announce_list->push_back(std::move(tier));
+    EXPECT_EQ(tracker::tracker_list::from(t).tiers(),
+              (std::vector<std::vector<std::string>>{{"udp://b:1"}}));
+}
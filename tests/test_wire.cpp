@@ -0,0 +1,257 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/write.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+
+#include "codec.h"
+#include "message.h"
+#include "ring_buffer.h"
+
+namespace {
+std::string flatten(const wire::outgoing& out) {
+    auto bytes = std::string(out.size(), '\0');
+    boost::asio::buffer_copy(boost::asio::buffer(bytes), out.buffers());
+    return bytes;
+}
+
+wire::frame round_trip(const wire::message& m, std::string& storage) {
+    storage = flatten(wire::outgoing{m});
+    return wire::decode(storage);
+}
+}  // namespace
+
+TEST(WireRingBuffer, WrapsContiguously) {
+    auto ring = wire::ring_buffer::create(1);
+    ASSERT_EQ(ring.has_value(), true);
+    const auto capacity = ring->capacity();
+    ASSERT_GE(capacity, 1);
+
+    // Leave the read position just short of the end, then write across it.
+    ring->commit(capacity - 3);
+    ring->consume(capacity - 3);
+    const auto text = std::string_view{"wrapped around"};
+    auto space = ring->writable();
+    ASSERT_EQ(space.size(), capacity);
+    std::copy(text.begin(), text.end(), space.begin());
+    ring->commit(text.size());
+
+    ASSERT_EQ(ring->readable(), text);
+    ring->consume(4);
+    ASSERT_EQ(ring->readable(), "ped around");
+    ASSERT_EQ(ring->size(), 10);
+}
+
+TEST(WireCodec, FixedMessages) {
+    auto storage = std::string{};
+    auto f = round_trip(wire::choke{}, storage);
+    ASSERT_EQ(f.state, wire::status::complete);
+    ASSERT_EQ(f.size, 5);
+    ASSERT_EQ(std::holds_alternative<wire::choke>(f.value), true);
+
+    f = round_trip(wire::not_interested{}, storage);
+    ASSERT_EQ(std::holds_alternative<wire::not_interested>(f.value), true);
+
+    f = round_trip(wire::have{0x01020304}, storage);
+    ASSERT_EQ(storage, std::string_view("\0\0\0\5\4\1\2\3\4", 9));
+    ASSERT_EQ(std::get<wire::have>(f.value).index, 0x01020304);
+
+    f = round_trip(wire::request{1, 16384, 16384}, storage);
+    ASSERT_EQ(f.size, 17);
+    const auto r = std::get<wire::request>(f.value);
+    ASSERT_EQ(r.index, 1);
+    ASSERT_EQ(r.begin, 16384);
+    ASSERT_EQ(r.length, 16384);
+
+    f = round_trip(wire::cancel{2, 0, 100}, storage);
+    ASSERT_EQ(std::get<wire::cancel>(f.value).length, 100);
+
+    f = wire::decode(std::string_view("\0\0\0\0", 4));
+    ASSERT_EQ(f.state, wire::status::complete);
+    ASSERT_EQ(f.size, 4);
+    ASSERT_EQ(std::holds_alternative<wire::keep_alive>(f.value), true);
+}
+
+TEST(WireCodec, PayloadsAreNotCopied) {
+    const auto block = std::string(16384, 'b');
+    const auto out = wire::outgoing{wire::piece{7, 32768, block}};
+    ASSERT_EQ(out.size(), 13 + block.size());
+    ASSERT_EQ(out.buffers()[1].data(), block.data());
+
+    const auto bytes = flatten(out);
+    const auto f = wire::decode(bytes);
+    ASSERT_EQ(f.state, wire::status::complete);
+    const auto p = std::get<wire::piece>(f.value);
+    ASSERT_EQ(p.index, 7);
+    ASSERT_EQ(p.begin, 32768);
+    ASSERT_EQ(p.block.data(), bytes.data() + 13);
+    ASSERT_EQ(p.block, block);
+
+    auto storage = std::string{};
+    const auto b = round_trip(wire::bitfield{"\xff\x80"}, storage);
+    ASSERT_EQ(std::get<wire::bitfield>(b.value).bits, "\xff\x80");
+
+    const auto u = round_trip(wire::unknown{20, "d1:md"}, storage);
+    ASSERT_EQ(std::get<wire::unknown>(u.value).id, 20);
+    ASSERT_EQ(std::get<wire::unknown>(u.value).payload, "d1:md");
+}
+
+TEST(WireCodec, PieceHeader) {
+    const auto block = std::string(16384, 'b');
+    const auto bytes = flatten(wire::outgoing{wire::piece{7, 32768, block}});
+    const auto header = wire::decode_piece_header(
+        std::string_view{bytes}.substr(0, wire::piece_header_size));
+    ASSERT_TRUE(header.has_value());
+    ASSERT_EQ(header->index, 7);
+    ASSERT_EQ(header->begin, 32768);
+    ASSERT_EQ(header->length, 16384);
+
+    ASSERT_FALSE(wire::decode_piece_header(
+        std::string_view{bytes}.substr(0, wire::piece_header_size - 1)));
+    ASSERT_FALSE(wire::decode_piece_header(
+        flatten(wire::outgoing{wire::request{1, 2, 3}})));
+
+    // The header alone, for a block sent after it from a file.
+    const auto alone = wire::outgoing{wire::piece_header{7, 32768, 16384}};
+    ASSERT_EQ(alone.size(), wire::piece_header_size);
+    ASSERT_EQ(flatten(alone), bytes.substr(0, wire::piece_header_size));
+}
+
+TEST(WireCodec, Incomplete) {
+    const auto bytes = flatten(wire::outgoing{wire::request{1, 2, 3}});
+    for (std::size_t i = 0; i < bytes.size(); i++) {
+        ASSERT_EQ(wire::decode(std::string_view{bytes}.substr(0, i)).state,
+                  wire::status::incomplete);
+    }
+    ASSERT_EQ(wire::decode(bytes).state, wire::status::complete);
+}
+
+TEST(WireCodec, Invalid) {
+    // A have with a short payload, and a choke with one.
+    ASSERT_EQ(wire::decode(std::string_view("\0\0\0\3\4\1\2", 7)).state,
+              wire::status::invalid);
+    ASSERT_EQ(wire::decode(std::string_view("\0\0\0\2\0\0", 6)).state,
+              wire::status::invalid);
+    // A piece without room for its index and offset.
+    ASSERT_EQ(wire::decode(std::string_view("\0\0\0\5\7\0\0\0\0", 9)).state,
+              wire::status::invalid);
+    // Longer than allowed, rejected before the payload arrives.
+    ASSERT_EQ(wire::decode(std::string_view("\0\0\1\0", 4), 255).state,
+              wire::status::invalid);
+}
+
+TEST(WireCodec, Handshake) {
+    auto h = wire::handshake{};
+    h.reserved[5] = std::byte{0x10};
+    h.info_hash.fill(std::byte{0xab});
+    h.id.fill(std::byte{'-'});
+
+    const auto bytes = wire::encode(h);
+    ASSERT_EQ(bytes.size(), 68);
+    ASSERT_EQ(std::string_view(bytes.data(), 20), "\x13" "BitTorrent protocol");
+
+    const auto decoded =
+        wire::decode_handshake(std::string_view{bytes.data(), bytes.size()});
+    ASSERT_EQ(decoded.has_value(), true);
+    ASSERT_EQ(decoded->reserved, h.reserved);
+    ASSERT_EQ(decoded->info_hash, h.info_hash);
+    ASSERT_EQ(decoded->id, h.id);
+
+    auto other = bytes;
+    other[1] = 'b';
+    ASSERT_EQ(
+        wire::decode_handshake(std::string_view{other.data(), other.size()})
+            .has_value(),
+        false);
+}
+
+TEST(WireCodec, Loopback) {
+    using boost::asio::ip::tcp;
+    constexpr std::uint32_t block_size = 16384;
+    constexpr std::uint32_t block_count = 256;
+
+    auto context = boost::asio::io_context{};
+    auto acceptor =
+        tcp::acceptor{context, {boost::asio::ip::make_address("127.0.0.1"), 0}};
+    auto receiver = tcp::socket{context};
+    auto sender = tcp::socket{context};
+    sender.connect(acceptor.local_endpoint());
+    acceptor.accept(receiver);
+
+    auto content = std::string(block_size * block_count, '\0');
+    for (std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i * 31 + i / 7);
+    }
+
+    // Each block goes out as one gathered write next to some chatter.
+    auto writer = std::thread{[&] {
+        const auto hello = wire::encode(wire::handshake{});
+        boost::asio::write(sender, boost::asio::buffer(hello));
+        for (std::uint32_t i = 0; i < block_count; i++) {
+            const auto have = wire::outgoing{wire::have{i}};
+            const auto block = wire::outgoing{wire::piece{
+                i, 0, std::string_view{content}.substr(i * block_size,
+                                                       block_size)}};
+            const auto h = have.buffers();
+            const auto b = block.buffers();
+            boost::asio::write(sender, std::array{h[0], h[1], b[0], b[1]});
+        }
+        sender.shutdown(tcp::socket::shutdown_send);
+    }};
+
+    auto ring = wire::ring_buffer::create(64 * 1024);
+    ASSERT_EQ(ring.has_value(), true);
+
+    bool handshaken = false;
+    std::uint32_t haves = 0;
+    std::uint32_t blocks = 0;
+    auto error = boost::system::error_code{};
+    while (!error) {
+        const auto space = ring->writable();
+        ring->commit(receiver.read_some(
+            boost::asio::buffer(space.data(), space.size()), error));
+
+        if (!handshaken) {
+            if (ring->size() < wire::handshake_size) {
+                continue;
+            }
+            ASSERT_EQ(wire::decode_handshake(ring->readable()).has_value(),
+                      true);
+            ring->consume(wire::handshake_size);
+            handshaken = true;
+        }
+
+        for (;;) {
+            const auto f = wire::decode(ring->readable());
+            ASSERT_NE(f.state, wire::status::invalid);
+            if (f.state == wire::status::incomplete) {
+                break;
+            }
+            if (const auto* h = std::get_if<wire::have>(&f.value)) {
+                ASSERT_EQ(h->index, haves++);
+            } else {
+                const auto& p = std::get<wire::piece>(f.value);
+                ASSERT_EQ(p.index, blocks);
+                ASSERT_EQ(p.block, std::string_view{content}.substr(
+                                       blocks * block_size, block_size));
+                blocks++;
+            }
+            ring->consume(f.size);
+        }
+    }
+    writer.join();
+
+    ASSERT_EQ(error, boost::asio::error::eof);
+    ASSERT_EQ(haves, block_count);
+    ASSERT_EQ(blocks, block_count);
+    ASSERT_EQ(ring->size(), 0);
+}